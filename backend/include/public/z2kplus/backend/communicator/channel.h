@@ -74,6 +74,10 @@ public:
   ~Channel();
 
   bool trySend(std::string message, const FailFrame &ff);
+  // Queues an immutable message without copying it. Callers that need to hang on to the message
+  // (e.g. for retransmission) can share it with the channel rather than handing over a copy. The
+  // writer thread sends everything queued since its last wakeup with one writev.
+  bool trySend(std::shared_ptr<const std::string> message, const FailFrame &ff);
 
   /**
    * Request a shutdown. Does nothing if the shutdown has already been requested.
@@ -104,7 +108,7 @@ private:
 
   std::mutex mutex_;
   std::condition_variable condVar_;
-  std::string outgoing_;
+  std::vector<std::shared_ptr<const std::string>> outgoing_;
   bool shutdownRequested_ = false;
 };
 
@@ -15,6 +15,8 @@
 #pragma once
 
 #include <deque>
+#include <memory>
+#include <string>
 #include <vector>
 #include "kosak/coding/coding.h"
 #include "kosak/coding/failures.h"
@@ -51,7 +53,9 @@ public:
 private:
   uint64_t nextOutgoingId_ = 0;
   uint64_t nextExpectedIncomingId_ = 1000;
-  std::deque<std::pair<uint64_t, std::string>> unacknowledgedOutgoing_;
+  // Shared with the Channel's outgoing queue, so remembering a message for retransmission does
+  // not copy it.
+  std::deque<std::pair<uint64_t, std::shared_ptr<const std::string>>> unacknowledgedOutgoing_;
 };
 }  // namespace internal
 
@@ -16,10 +16,15 @@
 
 #include <cstddef>
 #include <functional>
+#include <memory>
+#include <tuple>
 #include <type_traits>
+#include <utility>
 #include <vector>
 #include "kosak/coding/coding.h"
 #include "kosak/coding/failures.h"
+#include "z2kplus/backend/coordinator/prefetcher.h"
+#include "z2kplus/backend/coordinator/query_cache.h"
 #include "z2kplus/backend/coordinator/subscription.h"
 #include "z2kplus/backend/files/path_master.h"
 #include "z2kplus/backend/reverse_index/index/consolidated_index.h"
@@ -82,6 +87,7 @@ public:
   typedef z2kplus::backend::files::FileKeyKind FileKeyKind;
   typedef z2kplus::backend::files::PathMaster PathMaster;
   typedef z2kplus::backend::reverse_index::index::ConsolidatedIndex ConsolidatedIndex;
+  typedef z2kplus::backend::reverse_index::index::MetadataBatch MetadataBatch;
   typedef z2kplus::backend::reverse_index::iterators::ZgramIterator ZgramIterator;
   typedef z2kplus::backend::reverse_index::zgramOff_t zgramOff_t;
   typedef z2kplus::backend::shared::protocol::message::drequests::CheckSyntax CheckSyntax;
@@ -150,6 +156,12 @@ public:
 
   void ping(Subscription *sub, Ping &&o, std::vector<response_t> *responses);
 
+  // Called between batches of requests. Extends the QueryCache's entries, and for each
+  // subscription side that has been paging sequentially, resolves the next few pages of results
+  // (each within a small time budget) and hands them to the Prefetcher to be warmed into the
+  // ZgramCache.
+  void prefetch();
+
   bool tryCheckpoint(std::chrono::system_clock::time_point now,
       FilePosition<FileKeyKind::Logged> *loggedPosition,
       FilePosition<FileKeyKind::Unlogged> *unloggedPosition,
@@ -176,6 +188,14 @@ private:
   std::shared_ptr<PathMaster> pathMaster_;
   ConsolidatedIndex index_;
   std::set<std::shared_ptr<Subscription>, internal::SubComparer> subscriptions_;
+  QueryCache queryCache_;
   std::map<std::string, internal::CachedFilters> filters_;
+  // Scratch space for getMoreZgrams, kept here so its buffers are reused from page to page.
+  MetadataBatch metadataBatch_;
+  // Subscription sides (true means the back side) that asked for a page since the last prefetch(),
+  // with how many results each should read ahead.
+  std::vector<std::tuple<std::weak_ptr<Subscription>, bool, size_t>> prefetchCandidates_;
+  // Created on first use.
+  std::unique_ptr<Prefetcher> prefetcher_;
 };
 }  // namespace z2kplus::backend::coordinator
@@ -0,0 +1,75 @@
+// Copyright 2023 The Z2K Plus+ Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "kosak/coding/coding.h"
+#include "z2kplus/backend/files/path_master.h"
+#include "z2kplus/backend/reverse_index/index/zgram_cache.h"
+#include "z2kplus/backend/shared/zephyrgram.h"
+#include "z2kplus/backend/shared/zgram_view.h"
+
+// When a client pages steadily through a subscription, the Coordinator asks the Prefetcher to warm
+// the zgrams it expects to be asked for next. The Prefetcher's background thread maps the log
+// files, advises the kernel to read ahead over the relevant ranges, and parses the records into
+// ZgramViews. The Coordinator thread later moves the finished views into its ZgramCache, so the
+// cache itself is only ever touched by the Coordinator thread.
+namespace z2kplus::backend::coordinator {
+class Prefetcher {
+  struct Private {};
+  typedef z2kplus::backend::files::LogLocation LogLocation;
+  typedef z2kplus::backend::files::PathMaster PathMaster;
+  typedef z2kplus::backend::reverse_index::index::ZgramCache ZgramCache;
+  typedef z2kplus::backend::shared::ZgramId ZgramId;
+  typedef z2kplus::backend::shared::ZgramView ZgramView;
+
+public:
+  typedef std::vector<std::pair<ZgramId, LogLocation>> locators_t;
+
+  static std::unique_ptr<Prefetcher> create(std::shared_ptr<PathMaster> pm);
+
+  Prefetcher(Private, std::shared_ptr<PathMaster> pm);
+  DISALLOW_COPY_AND_ASSIGN(Prefetcher);
+  DISALLOW_MOVE_COPY_AND_ASSIGN(Prefetcher);
+  // Stops and joins the background thread. Work in progress is abandoned.
+  ~Prefetcher();
+
+  // Queues 'locators' for warming. Any earlier request that the background thread has not yet
+  // started is superseded: the client has moved on, so it is no longer the best use of the I/O.
+  void request(locators_t locators);
+
+  // Moves the zgrams that have been warmed so far into 'cache'.
+  void drainInto(ZgramCache *cache);
+
+private:
+  void threadMain();
+  void warm(locators_t *locators);
+
+  std::shared_ptr<PathMaster> pm_;
+
+  std::mutex mutex_;
+  std::condition_variable condVar_;
+  bool stopRequested_ = false;
+  locators_t pending_;
+  std::vector<std::shared_ptr<const ZgramView>> finished_;
+
+  std::thread thread_;
+};
+}  // namespace z2kplus::backend::coordinator
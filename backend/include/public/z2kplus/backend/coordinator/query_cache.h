@@ -0,0 +1,173 @@
+// Copyright 2023 The Z2K Plus+ Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "kosak/coding/coding.h"
+#include "z2kplus/backend/reverse_index/iterators/iterator_common.h"
+#include "z2kplus/backend/reverse_index/types.h"
+
+// Many users have the same handful of subscriptions open. Rather than have each Subscription
+// evaluate its own iterator tree from scratch, the QueryCache keeps one shared entry per distinct
+// query (keyed by the canonical text of the planned iterator). The entry materializes the matching
+// zgrams as runs of consecutive zgramOffs and extends them incrementally as new zgrams arrive.
+// Subscriptions get a CachedQuery iterator, which serves from those runs and evaluates the query
+// live over whatever the entry hasn't reached yet. The entries are extended between requests, on a
+// budget of their own, so no subscriber pays for bringing them up to date. An entry lives only as
+// long as some CachedQuery refers to it.
+namespace z2kplus::backend::coordinator {
+namespace internal {
+// The runs of a CachedQueryEntry, delta-encoded: each run is a varint gap (from the end of the
+// previous run) followed by a varint length. Every 'runsPerBlock' runs we start a new block whose
+// first run is relative to the block's own 'begin_', so a lookup is a binary search over the blocks
+// followed by decoding one block. The last run is kept unencoded because 'append' keeps growing it.
+class RunList {
+public:
+  // A half-open range [first, second) of raw zgramOffs.
+  typedef std::pair<uint32_t, uint32_t> run_t;
+
+  static constexpr size_t runsPerBlock = 32;
+
+  RunList();
+  DISALLOW_COPY_AND_ASSIGN(RunList);
+  DECLARE_MOVE_COPY_AND_ASSIGN(RunList);
+  ~RunList();
+
+  // 'zgramOff' must be greater than everything appended so far.
+  void append(uint32_t zgramOff);
+
+  size_t numBlocks() const { return blocks_.size(); }
+  // The number of blocks whose first run starts at or before 'zgramOff'.
+  size_t countBlocksStartingAtOrBefore(uint32_t zgramOff) const;
+  // Decodes the runs of block 'index' into 'result', which has room for 'runsPerBlock' runs, and
+  // returns how many there are.
+  size_t decodeBlock(size_t index, run_t *result) const;
+
+private:
+  struct Block {
+    // Where the block's first run starts.
+    uint32_t begin_ = 0;
+    // Where the block's encoded runs start in 'bytes_'.
+    uint32_t offset_ = 0;
+  };
+
+  std::vector<Block> blocks_;
+  std::vector<uint8_t> bytes_;
+  // The end of the last encoded run in the last block (or that block's 'begin_', if it has none).
+  uint32_t encodedEnd_ = 0;
+  // The number of runs in the last block, including 'last_'.
+  uint32_t runsInLastBlock_ = 0;
+  // The last run, which is not in 'bytes_' yet. Meaningless if there are no blocks.
+  run_t last_;
+};
+
+class CachedQueryEntry {
+  typedef z2kplus::backend::reverse_index::iterators::IteratorContext IteratorContext;
+  typedef z2kplus::backend::reverse_index::iterators::ZgramIterator ZgramIterator;
+  typedef z2kplus::backend::reverse_index::iterators::ZgramIteratorState ZgramIteratorState;
+
+public:
+  explicit CachedQueryEntry(std::unique_ptr<ZgramIterator> query);
+  DISALLOW_COPY_AND_ASSIGN(CachedQueryEntry);
+  DISALLOW_MOVE_COPY_AND_ASSIGN(CachedQueryEntry);
+  ~CachedQueryEntry();
+
+  // Evaluate the query over any zgrams that have arrived since the last call. If the budget in 'ctx'
+  // runs out, we keep what we found so far and pick up next time from as far as the scan got.
+  void extend(const IteratorContext &ctx);
+
+  // Called at index swap, when all zgramOffs change meaning. Frees the runs.
+  void invalidate();
+
+  const ZgramIterator *query() const { return query_.get(); }
+  // All of the zgrams in the runs match the query.
+  const RunList &runs() const { return runs_; }
+  // All matching zgrams with raw zgramOff < evaluatedEnd() are in 'runs'.
+  uint32_t evaluatedEnd() const { return evaluatedEnd_; }
+
+private:
+  std::unique_ptr<ZgramIterator> query_;
+  // Forward iteration state used by 'extend'.
+  std::unique_ptr<ZgramIteratorState> state_;
+  RunList runs_;
+  uint32_t evaluatedEnd_ = 0;
+};
+}  // namespace internal
+
+class CachedQuery final : public z2kplus::backend::reverse_index::iterators::ZgramIterator {
+  struct Private {};
+  typedef z2kplus::backend::reverse_index::iterators::IteratorContext IteratorContext;
+  typedef z2kplus::backend::reverse_index::iterators::PlanEstimate PlanEstimate;
+  typedef z2kplus::backend::reverse_index::iterators::ZgramIteratorState ZgramIteratorState;
+  typedef z2kplus::backend::reverse_index::iterators::zgramRel_t zgramRel_t;
+
+public:
+  static std::unique_ptr<CachedQuery> create(std::shared_ptr<internal::CachedQueryEntry> entry);
+  CachedQuery(Private, std::shared_ptr<internal::CachedQueryEntry> entry);
+  ~CachedQuery() final;
+
+  std::unique_ptr<ZgramIteratorState> createState(const IteratorContext &ctx) const final;
+  size_t getMore(const IteratorContext &ctx, ZgramIteratorState *state, zgramRel_t lowerBound,
+      zgramRel_t *result, size_t capacity) const final;
+
+  PlanEstimate estimate(const ConsolidatedIndex &ci) const final {
+    return entry_->query()->estimate(ci);
+  }
+
+private:
+  void dump(std::ostream &s) const final;
+
+  std::shared_ptr<internal::CachedQueryEntry> entry_;
+};
+
+class QueryCache {
+  typedef z2kplus::backend::reverse_index::index::ConsolidatedIndex ConsolidatedIndex;
+  typedef z2kplus::backend::reverse_index::iterators::ZgramIterator ZgramIterator;
+
+public:
+  QueryCache();
+  DISALLOW_COPY_AND_ASSIGN(QueryCache);
+  DECLARE_MOVE_COPY_AND_ASSIGN(QueryCache);
+  ~QueryCache();
+
+  // Consumes 'query' and returns an iterator that serves its results from the shared cache entry.
+  // Queries whose results depend on metadata are returned unchanged.
+  std::unique_ptr<ZgramIterator> lookupOrInsert(std::unique_ptr<ZgramIterator> &&query);
+
+  // Brings the entries up to date with 'ci', for as long as magicConstants::queryCacheTimeBudget
+  // allows. Called between requests.
+  void extend(const ConsolidatedIndex &ci);
+
+  // Called at index swap.
+  void resetIndex();
+
+  // The number of entries still in use by some CachedQuery.
+  size_t size() const;
+
+private:
+  void purgeUnused();
+
+  // We don't keep the entries alive ourselves: each one goes away with the last CachedQuery that
+  // uses it.
+  std::map<std::string, std::weak_ptr<internal::CachedQueryEntry>> entries_;
+  // The key of the last entry 'extend' worked on. The next call starts after it, so that one
+  // expensive query can't keep the others from ever being extended.
+  std::string lastExtended_;
+};
+}  // namespace z2kplus::backend::coordinator
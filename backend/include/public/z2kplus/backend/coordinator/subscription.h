@@ -14,6 +14,7 @@
 
 #pragma once
 
+#include <chrono>
 #include <deque>
 #include <memory>
 #include <vector>
@@ -56,11 +57,36 @@ struct PerSideStatus {
   bool topUp(const ConsolidatedIndex &index, const ZgramIterator *query, zgramRel_t lowerBound,
       size_t minItems);
 
+  // Records a GetMoreZgrams on this side and returns how many results we should read ahead (0 if
+  // the client doesn't seem to be paging sequentially).
+  size_t notePageRequest(std::chrono::steady_clock::time_point now, size_t pageSize);
+
+  // Tops up the residual to 'minItems' for read-ahead purposes, within the (small) prefetch time
+  // budget. Unlike topUp, a shortfall does not feed into the adaptive budget of the foreground
+  // requests. Does nothing if the foreground is already struggling with this query.
+  void readAhead(const ConsolidatedIndex &index, const ZgramIterator *query, size_t minItems);
+
   bool isExhausted(const ConsolidatedIndex &index) const;
   void setExhausted(const ConsolidatedIndex &index);
 
   bool forward_ = false;
   std::unique_ptr<ZgramIteratorState> iteratorState_;
+  // If a topUp runs out of budget, we throw away the iterator state and the next topUp starts over
+  // from here (just past the last item we received).
+  zgramRel_t resumeFrom_;
+  // True if the last topUp ran out of budget before it was satisfied.
+  bool morePending_ = false;
+  // The time budget for the next topUp. It doubles (up to magicConstants::maxQueryTimeBudget) every
+  // time a topUp runs out of budget without making any progress, so that even a very expensive
+  // query eventually moves forward.
+  std::chrono::milliseconds timeBudget_;
+  // For detecting sequential paging: when the last GetMoreZgrams for this side arrived, and how many
+  // requests in a row have each arrived within magicConstants::prefetchWindow of the previous one.
+  std::chrono::steady_clock::time_point lastPageTime_;
+  size_t sequentialPages_ = 0;
+  // Work counters, accumulated over the life of this side of the subscription.
+  size_t postingsTouched_ = 0;
+  size_t trieNodesMatched_ = 0;
   // These are zgrams that I've looked up, beyond the limit of the user's search, in order to estimate how many
   // more zgrams there are beyond the user's search. It is a unique_ptr because I want to have a noexcept move
   // constructor.
@@ -72,6 +98,11 @@ struct PerSideStatus {
   exhaustVersion_t exhaustVersion_;
 
   friend std::ostream &operator<<(std::ostream &s, const PerSideStatus &o);
+
+private:
+  bool topUpWithin(const ConsolidatedIndex &index, const ZgramIterator *query,
+      zgramRel_t lowerBound, size_t minItems, std::chrono::milliseconds timeBudget,
+      bool adaptBudget);
 };
 
 namespace internal {
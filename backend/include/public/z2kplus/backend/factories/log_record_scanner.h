@@ -0,0 +1,123 @@
+// Copyright 2023 The Z2K Plus+ Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "kosak/coding/coding.h"
+#include "kosak/coding/failures.h"
+#include "z2kplus/backend/files/keys.h"
+#include "z2kplus/backend/shared/zephyrgram.h"
+
+namespace z2kplus::backend::factories {
+// A JSON string from a log record: a view of the text between the quotes, still escaped. Most
+// strings in the logs have no escapes, and for those the view already is the value.
+class RawJsonString {
+  typedef kosak::coding::FailFrame FailFrame;
+public:
+  RawJsonString() = default;
+  RawJsonString(std::string_view contents, bool hasEscapes) : contents_(contents),
+      hasEscapes_(hasEscapes) {}
+
+  std::string_view contents() const { return contents_; }
+  bool hasEscapes() const { return hasEscapes_; }
+
+  // Appends the unescaped value to 'result'.
+  bool tryDecode(std::string *result, const FailFrame &ff) const;
+
+private:
+  std::string_view contents_;
+  bool hasEscapes_ = false;
+};
+
+// The records of a region of a log file, in columnar form. The zgram columns are views over the
+// text that was scanned, so that text must outlive the batch. Metadata records are comparatively
+// rare and are decoded in full.
+class LogRecordBatch {
+  typedef kosak::coding::FailFrame FailFrame;
+  typedef z2kplus::backend::files::LogLocation LogLocation;
+  typedef z2kplus::backend::shared::MetadataRecord MetadataRecord;
+  typedef z2kplus::backend::shared::RenderStyle RenderStyle;
+  typedef z2kplus::backend::shared::Zephyrgram Zephyrgram;
+  typedef z2kplus::backend::shared::ZgramId ZgramId;
+
+public:
+  struct ZgramColumns {
+    std::vector<ZgramId> zgramIds_;
+    std::vector<uint64_t> timesecs_;
+    std::vector<RawJsonString> senders_;
+    std::vector<RawJsonString> signatures_;
+    std::vector<bool> isLogged_;
+    std::vector<RawJsonString> instances_;
+    std::vector<RawJsonString> bodies_;
+    std::vector<RenderStyle> renderStyles_;
+    std::vector<LogLocation> locations_;
+  };
+
+  LogRecordBatch();
+  DISALLOW_COPY_AND_ASSIGN(LogRecordBatch);
+  DECLARE_MOVE_COPY_AND_ASSIGN(LogRecordBatch);
+  ~LogRecordBatch();
+
+  void clear();
+
+  // Every record, in file order: (true, index into zgrams()) or (false, index into metadata()).
+  const std::vector<std::pair<bool, uint32_t>> &order() const { return order_; }
+
+  const ZgramColumns &zgrams() const { return zgrams_; }
+
+  std::vector<std::pair<MetadataRecord, LogLocation>> &metadata() { return metadata_; }
+  const std::vector<std::pair<MetadataRecord, LogLocation>> &metadata() const { return metadata_; }
+
+  bool tryDecodeZgram(size_t index, Zephyrgram *result, const FailFrame &ff) const;
+
+private:
+  std::vector<std::pair<bool, uint32_t>> order_;
+  ZgramColumns zgrams_;
+  std::vector<std::pair<MetadataRecord, LogLocation>> metadata_;
+  // Backing store for the zgrams that had to go through the generic parser.
+  std::deque<std::string> ownedText_;
+
+  friend struct LogRecordScanner;
+};
+
+// A LogRecord parser specialized for the exact shapes of the records we write. It walks the text
+// once, finding string boundaries with JsonScanner, and only unescapes strings that contain
+// escapes. A record it does not recognize (e.g. one with extra whitespace, a number with leading
+// zeros, or a raw control character in a string) goes through the generic JSON parser instead, so
+// the results are always the same as that parser's. test/test_misc.cc checks that against every
+// test log.
+struct LogRecordScanner {
+  typedef kosak::coding::FailFrame FailFrame;
+  typedef z2kplus::backend::files::FileKeyKind FileKeyKind;
+  typedef z2kplus::backend::shared::LogRecord LogRecord;
+
+  template<FileKeyKind Kind>
+  using FileKey = z2kplus::backend::files::FileKey<Kind>;
+
+  LogRecordScanner() = delete;
+
+  static bool tryParse(std::string_view text, LogRecord *result, const FailFrame &ff);
+
+  // Scans the newline-separated records in 'text' (which starts at 'startingOffset' in the file
+  // named by 'fileKey') and appends them to 'batch'.
+  static bool tryScanRegion(std::string_view text, FileKey<FileKeyKind::Either> fileKey,
+      size_t startingOffset, LogRecordBatch *batch, const FailFrame &ff);
+};
+}  // namespace z2kplus::backend::factories
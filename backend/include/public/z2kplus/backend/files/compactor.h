@@ -0,0 +1,93 @@
+// Copyright 2023 The Z2K Plus+ Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "kosak/coding/coding.h"
+#include "kosak/coding/failures.h"
+#include "kosak/coding/unix.h"
+
+namespace z2kplus::backend::files {
+// What the compactor knows about a file it has written.
+struct CompactedFile {
+  uint64_t size_ = 0;
+  std::string checksum_;
+  uint64_t numRecords_ = 0;
+  // Fingerprints the legacy parts it was made from (their names, sizes and mtimes).
+  std::string sourceKey_;
+
+  friend bool operator==(const CompactedFile &lhs, const CompactedFile &rhs) {
+    return lhs.size_ == rhs.size_ && lhs.checksum_ == rhs.checksum_ &&
+        lhs.numRecords_ == rhs.numRecords_ && lhs.sourceKey_ == rhs.sourceKey_;
+  }
+  friend bool operator!=(const CompactedFile &lhs, const CompactedFile &rhs) {
+    return !(lhs == rhs);
+  }
+};
+
+// One line per compacted file, appended (and synced) as each file is finished, so that an
+// interrupted run can pick up where it left off. The format is
+//   <size> <checksum> <numRecords> <sourceKey> <filename>
+class CompactorManifest {
+  typedef kosak::coding::FailFrame FailFrame;
+
+public:
+  CompactorManifest() = default;
+  DISALLOW_MOVE_COPY_AND_ASSIGN(CompactorManifest);
+  ~CompactorManifest() = default;
+
+  // Reads what an earlier run recorded, if anything, and opens the manifest for appending.
+  bool tryOpen(std::string fileName, const FailFrame &ff);
+
+  const CompactedFile *find(const std::string &fileName) const;
+  bool tryAppend(const std::string &fileName, const CompactedFile &file, const FailFrame &ff);
+
+private:
+  std::mutex mutex_;
+  std::map<std::string, CompactedFile> files_;
+  kosak::coding::nsunix::FileCloser fc_;
+};
+
+struct CompactorStats {
+  std::atomic<size_t> numResumed_ = 0;
+  std::atomic<size_t> numRecords_ = 0;
+};
+
+class Compactor {
+  typedef kosak::coding::FailFrame FailFrame;
+
+public:
+  // Suffix of the file a day is written to before it has been verified and renamed into place.
+  static constexpr std::string_view compactingSuffix = ".compacting";
+
+  Compactor() = delete;
+
+  // Concatenates the parts of a day into 'destFilename', unless the manifest says that was already
+  // done and the file still checks out.
+  static bool tryCompactDay(const std::vector<std::string> &srcFilenames,
+      const std::string &destFilename, bool isLogged, CompactorManifest *manifest,
+      CompactorStats *stats, const FailFrame &ff);
+
+  // Checks that every record parses, that the zgramIds increase and that the zgrams are logged or
+  // unlogged as expected. Fills in everything but the sourceKey.
+  static bool tryVerify(const std::string &fileName, bool expectLogged, CompactedFile *result,
+      const FailFrame &ff);
+};
+}  // namespace z2kplus::backend::files
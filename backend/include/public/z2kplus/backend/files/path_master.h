@@ -36,7 +36,7 @@ public:
   static bool tryCreate(std::string root, std::shared_ptr<PathMaster> *result, const FailFrame &ff);
 
   PathMaster(Private, std::string loggedRoot, std::string unloggedRoot, std::string indexRoot,
-      std::string scratchRoot, std::string mediaRoot);
+      std::string scratchRoot, std::string mediaRoot, std::string digestCacheRoot);
   DISALLOW_COPY_AND_ASSIGN(PathMaster);
   DISALLOW_MOVE_COPY_AND_ASSIGN(PathMaster);
   ~PathMaster();
@@ -55,6 +55,8 @@ public:
   const std::string &scratchRoot() const { return scratchRoot_; }
   const std::string &loggedRoot() const { return loggedRoot_; }
   const std::string &unloggedRoot() const { return unloggedRoot_; }
+  // Unlike scratch, survives from one build to the next.
+  const std::string &digestCacheRoot() const { return digestCacheRoot_; }
 
 private:
   std::string loggedRoot_;
@@ -62,5 +64,6 @@ private:
   std::string indexRoot_;
   std::string scratchRoot_;
   std::string mediaRoot_;
+  std::string digestCacheRoot_;
 };
 }  // namespace z2kplus::backend::files
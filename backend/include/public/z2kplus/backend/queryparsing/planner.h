@@ -0,0 +1,51 @@
+// Copyright 2023 The Z2K Plus+ Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+#include <memory>
+#include <string>
+#include "kosak/coding/coding.h"
+#include "z2kplus/backend/reverse_index/index/consolidated_index.h"
+#include "z2kplus/backend/reverse_index/iterators/iterator_common.h"
+
+namespace z2kplus::backend::queryparsing {
+
+// The planner sits between the parser and the subscription. It rewrites the iterator tree that the
+// parser built (in written order) using cardinality estimates taken from the index:
+// * And children are ordered rarest-first, so the leapfrog in And starts from the cheapest operand.
+// * Duplicate And/Or children are removed.
+// * "x and not x" becomes "nothing"; "x or not x" becomes "everything".
+// * Double negations are removed.
+//
+// Because subscriptions are long-lived and new zgrams keep arriving in the dynamic index, the
+// planner never drops a child merely because its current estimate is zero.
+class QueryPlanner {
+  typedef z2kplus::backend::reverse_index::index::ConsolidatedIndex ConsolidatedIndex;
+  typedef z2kplus::backend::reverse_index::iterators::ZgramIterator ZgramIterator;
+
+public:
+  explicit QueryPlanner(const ConsolidatedIndex &ci) : ci_(ci) {}
+  DISALLOW_COPY_AND_ASSIGN(QueryPlanner);
+  DISALLOW_MOVE_COPY_AND_ASSIGN(QueryPlanner);
+  ~QueryPlanner() = default;
+
+  // Consumes 'query' and returns the planned equivalent. If 'explanation' is not null, it is set to
+  // a human-readable, indented rendering of the chosen plan and its estimated sizes and costs.
+  std::unique_ptr<ZgramIterator> plan(std::unique_ptr<ZgramIterator> &&query,
+      std::string *explanation) const;
+
+private:
+  const ConsolidatedIndex &ci_;
+};
+}  // namespace z2kplus::backend::queryparsing
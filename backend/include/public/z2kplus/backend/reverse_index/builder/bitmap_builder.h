@@ -0,0 +1,34 @@
+// Copyright 2023 The Z2K Plus+ Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include "kosak/coding/coding.h"
+#include "kosak/coding/failures.h"
+#include "z2kplus/backend/reverse_index/builder/common.h"
+#include "z2kplus/backend/util/frozen/frozen_bitmap.h"
+
+namespace z2kplus::backend::reverse_index::builder {
+struct BitmapBuilder {
+  typedef kosak::coding::FailFrame FailFrame;
+  typedef z2kplus::backend::util::frozen::FrozenBitmap FrozenBitmap;
+
+  BitmapBuilder() = delete;
+
+  // 'values' must be strictly increasing. Lays the bitmap's storage out in 'alloc'.
+  static bool tryMake(const uint32_t *values, size_t size, SimpleAllocator *alloc,
+      FrozenBitmap *result, const FailFrame &ff);
+};
+}  // namespace z2kplus::backend::reverse_index::builder
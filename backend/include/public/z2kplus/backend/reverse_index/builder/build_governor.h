@@ -0,0 +1,104 @@
+// Copyright 2023 The Z2K Plus+ Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <limits>
+#include <mutex>
+#include <ostream>
+#include "kosak/coding/coding.h"
+#include "kosak/coding/failures.h"
+#include "kosak/coding/memory/buffered_writer.h"
+
+namespace z2kplus::backend::reverse_index::builder {
+// Keeps a background index build from starving the server. It
+// 1. lowers the CPU and I/O priority of the build thread (the builder's worker threads and forked
+//    sorts inherit it),
+// 2. paces the build's writes (scratch files and the index itself) with a token bucket, and
+// 3. pauses those writes while the server reports that it is under pressure.
+// Install it on the build thread with WriteThrottle::Scope. Thread-safe.
+class BuildGovernor final : public kosak::coding::memory::WriteThrottle {
+  typedef kosak::coding::FailFrame FailFrame;
+
+public:
+  typedef std::chrono::steady_clock clock_t;
+
+  struct Options {
+    // Added to the build thread's nice value.
+    int niceness_ = 0;
+    // Put the build thread in the idle I/O scheduling class.
+    bool idleIoPriority_ = false;
+    // 0 means unlimited.
+    size_t writeBytesPerSecond_ = 0;
+    // The server is under pressure when a batch of requests takes longer than this...
+    std::chrono::microseconds latencyThreshold_ = std::chrono::microseconds::max();
+    // ...or when more than this many requests are waiting.
+    size_t queueDepthThreshold_ = std::numeric_limits<size_t>::max();
+    // How long to stay paused after the last report of pressure.
+    std::chrono::microseconds pressureHold_ = std::chrono::microseconds::zero();
+    // The longest a single write waits for the pressure to clear.
+    std::chrono::microseconds maxPause_ = std::chrono::microseconds::zero();
+  };
+
+  struct Metrics {
+    size_t bytesWritten_ = 0;
+    // Time spent waiting on the token bucket.
+    std::chrono::microseconds rateLimited_ = std::chrono::microseconds::zero();
+    // Time spent paused for the server, and how many times that happened.
+    std::chrono::microseconds paused_ = std::chrono::microseconds::zero();
+    size_t numPauses_ = 0;
+
+    friend std::ostream &operator<<(std::ostream &s, const Metrics &o);
+  };
+
+  // The settings in magic_constants.
+  static Options defaultOptions();
+
+  explicit BuildGovernor(const Options &options);
+  DISALLOW_MOVE_COPY_AND_ASSIGN(BuildGovernor);
+  ~BuildGovernor() final;
+
+  // Lowers the calling thread's priorities according to the options.
+  bool tryLowerCurrentThreadPriority(const FailFrame &ff) const;
+
+  void beforeWrite(size_t bytes) final;
+
+  // Called by the server after each batch of requests.
+  void reportServerLoad(std::chrono::microseconds batchLatency, size_t queueDepth);
+
+  Metrics metrics() const;
+
+private:
+  void waitForServer();
+  void waitForTokens(size_t bytes);
+
+  Options options_;
+
+  // Token bucket. Holds at most a second's worth of tokens; may go negative, meaning we owe.
+  std::mutex mutex_;
+  double tokens_ = 0;
+  clock_t::time_point lastRefill_;
+
+  // Nanoseconds since clock_t's epoch.
+  std::atomic<int64_t> pressureUntil_ = 0;
+
+  std::atomic<size_t> bytesWritten_ = 0;
+  std::atomic<int64_t> rateLimitedMicros_ = 0;
+  std::atomic<int64_t> pausedMicros_ = 0;
+  std::atomic<size_t> numPauses_ = 0;
+};
+}  // namespace z2kplus::backend::reverse_index::builder
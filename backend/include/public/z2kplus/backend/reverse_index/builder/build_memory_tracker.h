@@ -0,0 +1,93 @@
+// Copyright 2023 The Z2K Plus+ Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <string_view>
+#include "kosak/coding/coding.h"
+#include "kosak/coding/failures.h"
+#include "kosak/coding/memory/memory_tracker.h"
+
+namespace z2kplus::backend::reverse_index::builder {
+// The memory budget for an index build, shared by all of its stages and threads. Stages that can
+// adapt (by spilling earlier, or by running fewer threads or smaller sorts) ask before growing and
+// back off when the answer is no. Stages that can't still report what they hold, so that the
+// others see less room. Each stage's peak is logged when it ends.
+class BuildMemoryTracker final : public kosak::coding::memory::MemoryTracker {
+  typedef kosak::coding::FailFrame FailFrame;
+
+public:
+  // A budget of 0 means unlimited.
+  explicit BuildMemoryTracker(size_t budget);
+  DISALLOW_MOVE_COPY_AND_ASSIGN(BuildMemoryTracker);
+  ~BuildMemoryTracker() final;
+
+  // Fails if the reservation would exceed the budget.
+  bool tryReserve(size_t bytes, const FailFrame &ff) final;
+  void release(size_t bytes) final;
+  size_t estimateMemoryUsed() const final;
+  // True once forced reservations have pushed us over the budget.
+  bool resourcesExceeded() final;
+
+  // Like tryReserve, but running out of room is an answer, not an error.
+  bool reserveIfAvailable(size_t bytes);
+  // For memory that is needed regardless. Always succeeds.
+  void forceReserve(size_t bytes);
+
+  // How many of 'requested' threads (0 means one per core) fit in the remaining budget, if each
+  // needs about 'bytesPerThread'. Always at least one.
+  size_t threadsFor(size_t requested, size_t bytesPerThread) const;
+  // The --buffer-size to give each of 'numSorts' concurrent external sorts (0 means sort's own
+  // default).
+  size_t sortBufferSize(size_t numSorts) const;
+
+  // Logs the peak reservation since the previous call (or since construction) and returns it.
+  size_t endStage(std::string_view stageName);
+
+  size_t budget() const { return budget_; }
+
+private:
+  size_t available() const;
+  void notePeak(size_t used);
+
+  size_t budget_ = 0;
+  std::atomic<size_t> used_ = 0;
+  std::atomic<size_t> stagePeak_ = 0;
+};
+
+// A resizable reservation against a BuildMemoryTracker, released when it is destroyed.
+class MemoryReservation {
+  typedef kosak::coding::FailFrame FailFrame;
+
+public:
+  MemoryReservation();
+  explicit MemoryReservation(BuildMemoryTracker *tracker);
+  DISALLOW_COPY_AND_ASSIGN(MemoryReservation);
+  DECLARE_MOVE_COPY_AND_ASSIGN(MemoryReservation);
+  ~MemoryReservation();
+
+  // Shrinking always succeeds; growing succeeds only if it fits in the budget.
+  bool tryResizeIfAvailable(size_t bytes);
+  // Always succeeds.
+  void forceResize(size_t bytes);
+
+  size_t size() const { return size_; }
+
+private:
+  BuildMemoryTracker *tracker_ = nullptr;
+  size_t size_ = 0;
+};
+}  // namespace z2kplus::backend::reverse_index::builder
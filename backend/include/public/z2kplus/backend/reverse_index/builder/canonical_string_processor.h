@@ -19,6 +19,7 @@
 #include "kosak/coding/failures.h"
 #include "kosak/coding/memory/buffered_writer.h"
 #include "z2kplus/backend/files/path_master.h"
+#include "z2kplus/backend/reverse_index/builder/build_memory_tracker.h"
 #include "z2kplus/backend/reverse_index/builder/common.h"
 #include "z2kplus/backend/reverse_index/builder/log_splitter.h"
 #include "z2kplus/backend/reverse_index/builder/zgram_digestor.h"
@@ -32,8 +33,9 @@ struct CanonicalStringProcessor {
 
   CanonicalStringProcessor() = delete;
 
+  // The external sort that dedups the strings gets its buffer from 'memory'.
   static bool tryMakeCanonicalStringPool(const PathMaster &pm, const LogSplitterResult &lsr,
-      const ZgramDigestorResult &zgdr, SimpleAllocator *alloc, FrozenStringPool *stringPool,
-      const FailFrame &ff);
+      const ZgramDigestorResult &zgdr, BuildMemoryTracker *memory, SimpleAllocator *alloc,
+      FrozenStringPool *stringPool, const FailFrame &ff);
 };
 }   // namespace z2kplus::backend::reverse_index::builder
@@ -21,6 +21,8 @@
 #include "kosak/coding/memory/mapped_file.h"
 #include "z2kplus/backend/files/path_master.h"
 #include "z2kplus/backend/files/keys.h"
+#include "z2kplus/backend/reverse_index/builder/index_file_writer.h"
+#include "z2kplus/backend/reverse_index/index/index_layout.h"
 #include "z2kplus/backend/util/frozen/frozen_string_pool.h"
 
 namespace z2kplus::backend::reverse_index::builder {
@@ -28,9 +30,9 @@ constexpr const char defaultRecordSeparator = 0;
 constexpr const char defaultFieldSeparator = (char) 255;
 constexpr const char wordOffSeparator = ';';
 
-// Used with mmap. Is going to be a sparse file allocated on demand, so it doesn't matter if this
-// number is kind of big.
- constexpr const size_t outputFileMaxSize = 100'000'000'000UL;
+// Only address space is reserved for this much. The file itself grows as the index is laid out
+// (see IndexFileWriter), so it doesn't matter if this number is kind of big.
+constexpr const size_t outputFileMaxSize = 100'000'000'000UL;
 
 class RecordIterator {
   using FailFrame = kosak::coding::FailFrame;
@@ -52,8 +54,12 @@ private:
 
 class SimpleAllocator {
   using FailFrame = kosak::coding::FailFrame;
+  using IndexSection = z2kplus::backend::reverse_index::index::IndexSection;
+  using IndexSectionTable = z2kplus::backend::reverse_index::index::IndexSectionTable;
 public:
   SimpleAllocator(char *start, size_t capacity, size_t initialAlignment);
+  // Allocates out of 'writer', telling it how far the allocations have got.
+  SimpleAllocator(IndexFileWriter *writer, size_t initialAlignment);
   DISALLOW_COPY_AND_ASSIGN(SimpleAllocator);
   DISALLOW_MOVE_COPY_AND_ASSIGN(SimpleAllocator);
   ~SimpleAllocator() = default;
@@ -80,7 +86,16 @@ public:
     return offset_;
   }
 
+  // Ends the current section (if any) and starts 'section' at the next multiple of 'alignment',
+  // which is measured from the start of the file and may be wider than initialAlignment. Sections
+  // must be started in IndexSection order.
+  bool tryBeginSection(IndexSection section, size_t alignment, const FailFrame &ff);
+  // Ends the current section.
+  void endSections();
+  const IndexSectionTable &sections() const { return sections_; }
+
 private:
+  bool tryPad(size_t alignment, const FailFrame &ff);
   bool tryAdvance(size_t size, const FailFrame &ff);
   char *data() const { return start_ + offset_; }
 
@@ -88,5 +103,12 @@ private:
   size_t capacity_ = 0;
   size_t initialAlignment_ = 0;
   size_t offset_ = 0;
+  IndexSectionTable sections_;
+  // If not null, the file behind [start_, start_ + capacity_).
+  IndexFileWriter *writer_ = nullptr;
+  IndexSection currentSection_ = IndexSection::numSections;
+  size_t currentSectionBegin_ = 0;
+  // Bytes allocated since we last told the thread's WriteThrottle.
+  size_t unthrottledBytes_ = 0;
 };
 }  // namespace z2kplus::backend::reverse_index::builder
@@ -0,0 +1,110 @@
+// Copyright 2023 The Z2K Plus+ Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "kosak/coding/coding.h"
+#include "kosak/coding/failures.h"
+
+namespace z2kplus::backend::reverse_index::builder {
+// A 128-bit fingerprint of everything that went into some build output: the version, the input
+// ranges and their bytes, and so on. It is a fast, non-cryptographic hash: two 64-bit lanes, each
+// folding in its words through the MurmurHash3 finalizer. Nobody has analysed it, so it promises
+// no particular collision rate, and inputs chosen to collide would defeat it. What it is meant to
+// do is make different inputs very unlikely to look the same by accident. A collision would
+// silently put the wrong postings in the index, so the cache relies on its inputs being the
+// operator's own logs.
+class DigestKey {
+public:
+  DigestKey();
+  DEFINE_COPY_AND_ASSIGN(DigestKey);
+  DEFINE_MOVE_COPY_AND_ASSIGN(DigestKey);
+  ~DigestKey();
+
+  // Strings are length-prefixed, so ("ab", "c") and ("a", "bc") are different keys.
+  void add(std::string_view bytes);
+  void add(uint64_t value);
+
+  // 32 hex digits.
+  std::string toString() const;
+
+private:
+  void mix(uint64_t word);
+
+  uint64_t lane0_ = 0;
+  uint64_t lane1_ = 0;
+};
+
+// Sets *size to the size of 'fileName' and *checksum to the DigestKey of its contents.
+bool tryChecksumFile(const std::string &fileName, uint64_t *size, std::string *checksum,
+    const kosak::coding::FailFrame &ff);
+
+// A persistent cache of per-chunk build outputs (the split records of a chunk of the logs, and
+// the zgramInfos, wordInfos, plusplus rows and trie runs they digest to), so that a rebuild only
+// re-parses and re-tokenizes the days that are new or changed. An entry is a list of files plus a
+// few numbers, stored under a key that fingerprints its inputs. The files are hard links to the
+// scratch outputs that were stored, so storing copies nothing, and on a hit the cached files are
+// handed straight to the later stages, which only ever read them. Each file's size, inode, mtime
+// and checksum are stored with the entry. A lookup checks the first three, which is enough to
+// catch a file that was replaced or rewritten, and now and then the checksum as well, so a damaged
+// entry is a miss rather than bad input. The cache is safe to use from several threads at once.
+class DigestCache {
+  typedef kosak::coding::FailFrame FailFrame;
+
+public:
+  struct Entry {
+    std::vector<std::string> files_;
+    std::vector<uint64_t> values_;
+  };
+
+  explicit DigestCache(std::string root);
+  DISALLOW_COPY_AND_ASSIGN(DigestCache);
+  DISALLOW_MOVE_COPY_AND_ASSIGN(DigestCache);
+  ~DigestCache();
+
+  // Sets *found, and on a hit fills in *result. Either way the key counts as used.
+  bool tryLookup(const std::string &key, bool *found, Entry *result, const FailFrame &ff);
+  // The files must be on the same filesystem as the cache and must not change afterwards.
+  bool tryStore(const std::string &key, const Entry &entry, const FailFrame &ff);
+  // Removes every entry that was neither looked up nor stored since construction. A build calls
+  // this once it is done, so the cache holds exactly what the next build is likely to want.
+  bool tryRemoveUnused(const FailFrame &ff);
+
+  size_t hits() const;
+  size_t misses() const;
+
+private:
+  // Reads the entry's manifest and checks its files against it, checksumming them too if
+  // 'checksum' is set.
+  bool tryCheckEntry(const std::string &key, bool checksum, Entry *result,
+      const FailFrame &ff) const;
+  std::string manifestName(const std::string &key) const;
+  std::string fileName(const std::string &key, size_t index) const;
+
+  std::string root_;
+  mutable std::mutex mutex_;
+  // Protected by mutex_.
+  std::set<std::string, std::less<>> used_;
+  size_t hits_ = 0;
+  size_t misses_ = 0;
+  // Counts lookups, to choose the ones that checksum.
+  size_t lookups_ = 0;
+};
+}  // namespace z2kplus::backend::reverse_index::builder
@@ -18,6 +18,7 @@
 #include "kosak/coding/coding.h"
 #include "kosak/coding/failures.h"
 #include "z2kplus/backend/files/path_master.h"
+#include "z2kplus/backend/shared/magic_constants.h"
 
 namespace z2kplus::backend::reverse_index::builder {
 class IndexBuilder {
@@ -28,12 +29,33 @@ class IndexBuilder {
   using InterFileRange = z2kplus::backend::files::InterFileRange<Kind>;
 
 public:
+  struct Options {
+    // Approximate size of the chunks the logs are split into for parallel processing.
+    size_t chunkSize_ = z2kplus::backend::shared::magicConstants::indexBuilderChunkSize;
+    // Number of worker threads (0 means one per core).
+    size_t numThreads_ = z2kplus::backend::shared::magicConstants::indexBuilderNumThreads;
+    // Bytes of trie postings each digester holds in memory before spilling a sorted run.
+    size_t trieEntriesBudget_ = z2kplus::backend::shared::magicConstants::trieEntriesBudget;
+    // Bytes of memory the whole build may use (0 means unlimited).
+    size_t memoryBudget_ = z2kplus::backend::shared::magicConstants::indexBuilderMemoryBudget;
+    // Whether to reuse (and then update) the split and digested chunks cached by earlier builds.
+    bool useDigestCache_ = true;
+  };
+
   IndexBuilder() = delete;
 
   static bool tryClearScratchDirectory(const PathMaster &pm, const FailFrame &ff);
+  // Stages that an earlier, unfinished build in the same scratch directory completed with the same
+  // inputs aren't run again (see StageManifest). Anything else in the scratch directory is removed.
+  static bool tryBuild(const PathMaster &pm,
+      const InterFileRange<FileKeyKind::Logged> &loggedRange,
+      const InterFileRange<FileKeyKind::Unlogged> &unloggedRange,
+      const FailFrame &ff) {
+    return tryBuild(pm, loggedRange, unloggedRange, Options(), ff);
+  }
   static bool tryBuild(const PathMaster &pm,
       const InterFileRange<FileKeyKind::Logged> &loggedRange,
       const InterFileRange<FileKeyKind::Unlogged> &unloggedRange,
-      const FailFrame &ff);
+      const Options &options, const FailFrame &ff);
 };
 }   // namespace z2kplus::backend::reverse_index::builder
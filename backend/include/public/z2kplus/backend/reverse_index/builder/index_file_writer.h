@@ -0,0 +1,83 @@
+// Copyright 2023 The Z2K Plus+ Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include "kosak/coding/coding.h"
+#include "kosak/coding/failures.h"
+#include "kosak/coding/unix.h"
+#include "z2kplus/backend/shared/magic_constants.h"
+
+namespace z2kplus::backend::reverse_index::builder {
+// The index file under construction. The builders lay the frozen structures out in place, in one
+// forward pass (through SimpleAllocator), and fix up relative pointers as they go, so they need a
+// fixed range of addresses. That range is only reserved: the file behind it grows with real blocks
+// as the allocator advances, and the pages far enough behind the allocator are written back in
+// file order (and, optionally, dropped from the page cache) while the build goes on. So the build
+// doesn't depend on sparse files, runs out of disk with an error rather than a SIGBUS, and leaves
+// neither a burst of random writeback nor a second copy of the index in the cache at the end.
+class IndexFileWriter {
+  typedef kosak::coding::FailFrame FailFrame;
+  typedef kosak::coding::nsunix::FileCloser FileCloser;
+
+public:
+  struct Options {
+    // How much the file grows at a time. A multiple of the page size.
+    size_t growStep_ = z2kplus::backend::shared::magicConstants::indexWriterGrowStep;
+    // How far behind the allocator a page has to be before it is written back.
+    size_t writeBehind_ = z2kplus::backend::shared::magicConstants::indexWriterWriteBehind;
+    // Whether pages are dropped from the page cache once they have been written back. Anything
+    // that is read again later is simply read back from the file.
+    bool dropWrittenPages_ = z2kplus::backend::shared::magicConstants::indexWriterDropWrittenPages;
+  };
+
+  explicit IndexFileWriter(const Options &options);
+  DISALLOW_COPY_AND_ASSIGN(IndexFileWriter);
+  DISALLOW_MOVE_COPY_AND_ASSIGN(IndexFileWriter);
+  ~IndexFileWriter();
+
+  // Creates (or truncates) the file and reserves 'capacity' bytes of address space for it.
+  bool tryOpen(const std::string &fileName, size_t capacity, const FailFrame &ff);
+
+  // Makes [0, end) writable, growing the file as needed, and starts writing back what lies more
+  // than writeBehind_ behind 'end'.
+  bool tryAdvanceTo(size_t end, const FailFrame &ff);
+
+  // Unmaps the file, cuts it down to 'size', and makes it durable (fdatasync). The caller can
+  // then rename it into place.
+  bool tryFinish(size_t size, const FailFrame &ff);
+
+  char *start() const { return start_; }
+  size_t capacity() const { return capacity_; }
+  // The file's current size. Never more than one grow step past the allocator.
+  size_t fileSize() const { return fileSize_; }
+
+private:
+  bool tryGrow(size_t end, const FailFrame &ff);
+  bool tryWriteBehind(size_t end, const FailFrame &ff);
+  void unmap();
+
+  Options options_;
+  std::string fileName_;
+  FileCloser fc_;
+  char *start_ = nullptr;
+  size_t capacity_ = 0;
+  size_t fileSize_ = 0;
+  // [0, written_) has been written back; [written_, writing_) is being written back.
+  size_t written_ = 0;
+  size_t writing_ = 0;
+};
+}  // namespace z2kplus::backend::reverse_index::builder
@@ -14,13 +14,28 @@
 
 #pragma once
 
+#include <optional>
 #include <ostream>
 #include "kosak/coding/coding.h"
 #include "kosak/coding/failures.h"
 #include "z2kplus/backend/files/path_master.h"
+#include "z2kplus/backend/reverse_index/builder/build_memory_tracker.h"
 #include "z2kplus/backend/reverse_index/builder/common.h"
+#include "z2kplus/backend/reverse_index/builder/digest_cache.h"
+#include "z2kplus/backend/shared/zephyrgram.h"
 
 namespace z2kplus::backend::reverse_index::builder {
+// What the ZgramDigestor needs to know to look up a chunk in the digest cache.
+struct LogSplitterChunkInfo {
+  typedef z2kplus::backend::shared::ZgramId ZgramId;
+
+  // Fingerprints the chunk's input. Empty if the build isn't using a digest cache.
+  std::string cacheKey_;
+  // The chunk's lowest and highest zgramIds, logged and unlogged together. Unset if it has none.
+  std::optional<ZgramId> firstZgramId_;
+  std::optional<ZgramId> lastZgramId_;
+};
+
 struct LogSplitterResult {
   LogSplitterResult();
   LogSplitterResult(std::vector<std::string> loggedZgrams, std::vector<std::string> unloggedZgrams,
@@ -37,6 +52,8 @@ struct LogSplitterResult {
   std::string zgramRevisions_;
   std::string zgramRefersTo_;
   std::string zmojis_;
+  // One per chunk, in chunk order.
+  std::vector<LogSplitterChunkInfo> chunkInfos_;
 };
 
 class LogSplitter {
@@ -47,9 +64,15 @@ class LogSplitter {
   using IntraFileRange = z2kplus::backend::files::IntraFileRange<Kind>;
 
 public:
+  // Splits the logs into chunks of about 'chunkSize' bytes and processes them on 'numThreads'
+  // threads (0 means one per core). There is one output file per chunk for the zgrams, in chunk
+  // (and therefore zgramId) order. Each chunk in flight counts its size against 'memory', which
+  // may mean fewer threads. If 'cache' is not null, chunks whose input hasn't changed since they
+  // were cached aren't parsed again.
   static bool split(const PathMaster &pm,
       const std::vector<IntraFileRange<FileKeyKind::Logged>> &loggedRanges,
       const std::vector<IntraFileRange<FileKeyKind::Unlogged>> &unloggedRanges,
-      size_t numShards, LogSplitterResult *result, const FailFrame &ff);
+      size_t chunkSize, size_t numThreads, BuildMemoryTracker *memory, DigestCache *cache,
+      LogSplitterResult *result, const FailFrame &ff);
 };
 }  // namespace z2kplus::backend::reverse_index::builder
@@ -16,6 +16,7 @@
 
 #include "kosak/coding/coding.h"
 #include "kosak/coding/failures.h"
+#include "z2kplus/backend/reverse_index/builder/build_memory_tracker.h"
 #include "z2kplus/backend/reverse_index/builder/canonical_string_processor.h"
 #include "z2kplus/backend/reverse_index/builder/common.h"
 #include "z2kplus/backend/reverse_index/builder/log_splitter.h"
@@ -32,8 +33,13 @@ struct MetadataBuilder {
 
   MetadataBuilder() = delete;
 
+  // The tables are independent of each other, so they are built at the same time, on 'numThreads'
+  // threads (0 means one per core), and then copied into 'alloc' in order. Their scratch files are
+  // named after 'tempFile'. The in-memory staging (reaction counts, revision and refers-to edges)
+  // is reported to 'memory'.
   static bool tryMakeMetadata(const LogSplitterResult &lsr, const ZgramDigestorResult &iitr,
-      const std::string &tempFile, const FrozenStringPool &stringPool, SimpleAllocator *alloc,
-      FrozenMetadata *result, const FailFrame &ff);
+      const std::string &tempFile, const FrozenStringPool &stringPool, size_t numThreads,
+      BuildMemoryTracker *memory, SimpleAllocator *alloc, FrozenMetadata *result,
+      const FailFrame &ff);
 };
 }  // namespace z2kplus::backend::reverse_index::builder
@@ -0,0 +1,94 @@
+// Copyright 2023 The Z2K Plus+ Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "kosak/coding/coding.h"
+#include "kosak/coding/failures.h"
+#include "z2kplus/backend/files/path_master.h"
+
+namespace z2kplus::backend::reverse_index::builder {
+// What a finished stage left behind, and the key that fingerprints what it was given.
+struct StageRecord {
+  std::string stage_;
+  std::string inputKey_;
+  // Output files. They are checksummed, and may be outside the scratch directory.
+  std::vector<std::string> files_;
+  // Everything else the next stage needs. Strings can't contain newlines.
+  std::vector<std::string> strings_;
+  std::vector<uint64_t> values_;
+};
+
+// Remembers, in the scratch directory, which stages of the build have finished: what they were
+// given, which files they produced, and checksums of those files. Before running a stage the
+// build asks whether it already finished with the same inputs; if so, and its files are intact,
+// the build picks up the recorded outputs instead. The manifest and the files it lists survive a
+// failed build or a restart of the process, so a rebuild resumes after the last good stage.
+//
+// Stages are recorded in the order they run, and each stage's input key should cover the key of
+// the stage before it, so that redoing a stage redoes everything after it.
+class StageManifest {
+  typedef kosak::coding::FailFrame FailFrame;
+  typedef z2kplus::backend::files::PathMaster PathMaster;
+
+public:
+  // A missing or unreadable manifest is an empty one.
+  static bool tryLoad(const PathMaster &pm, StageManifest *result, const FailFrame &ff);
+
+  StageManifest();
+  DISALLOW_COPY_AND_ASSIGN(StageManifest);
+  DECLARE_MOVE_COPY_AND_ASSIGN(StageManifest);
+  ~StageManifest();
+
+  // If 'stage' finished with 'inputKey' and its files are intact, sets *found and fills in
+  // *result. Otherwise forgets 'stage' and every stage recorded after it, and clears out the
+  // scratch files that the remaining stages don't need, so that the stage can start afresh.
+  bool tryResume(std::string_view stage, const std::string &inputKey, bool *found,
+      StageRecord *result, const FailFrame &ff);
+  // Checksums the record's files, then writes out the manifest.
+  bool tryRecord(StageRecord record, const FailFrame &ff);
+  // Deletes the scratch files that no recorded stage needs: the leftovers of a build that died,
+  // and the intermediate files of stages that aren't checkpointed.
+  bool tryRemoveUnrecordedFiles(const FailFrame &ff);
+
+  size_t numStages() const { return stages_.size(); }
+
+private:
+  struct Checksum {
+    uint64_t size_ = 0;
+    std::string digest_;
+  };
+
+  struct Stage {
+    StageRecord record_;
+    // Parallel to record_.files_.
+    std::vector<Checksum> checksums_;
+  };
+
+  StageManifest(std::string scratchRoot, std::string manifestName, std::vector<Stage> stages);
+
+  static bool tryChecksum(const std::string &fileName, bool *exists, Checksum *result,
+      const FailFrame &ff);
+  bool tryIntact(const Stage &stage, bool *result, const FailFrame &ff) const;
+  bool tryWrite(const FailFrame &ff) const;
+
+  std::string scratchRoot_;
+  std::string manifestName_;
+  std::vector<Stage> stages_;
+};
+}  // namespace z2kplus::backend::reverse_index::builder
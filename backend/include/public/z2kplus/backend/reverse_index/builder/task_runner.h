@@ -0,0 +1,43 @@
+// Copyright 2023 The Z2K Plus+ Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+#include "kosak/coding/delegate.h"
+#include "kosak/coding/failures.h"
+
+namespace z2kplus::backend::reverse_index::builder {
+// Runs a batch of independent tasks on a pool of threads. The threads claim tasks in index order
+// from a shared counter, so a thread that finishes early takes the next task instead of sitting
+// idle while another works through a long one. Callers that write their outputs per task index
+// (rather than per thread) get the same results no matter how many threads there are.
+class TaskRunner {
+  typedef kosak::coding::FailFrame FailFrame;
+
+public:
+  // callback signature:
+  // bool task(size_t taskIndex, const FailFrame &ff)
+  typedef kosak::coding::Delegate<bool, size_t, const FailFrame &> task_t;
+
+  TaskRunner() = delete;
+
+  // Runs task(i) for every i in [0, numTasks) on at most 'numThreads' threads (0 means one per
+  // core). Once a task fails no new ones are started, but the running ones are allowed to finish.
+  // The workers inherit the caller's WriteThrottle. 'name' is for the log.
+  static bool tryRun(std::string_view name, size_t numTasks, size_t numThreads, const task_t &task,
+      const FailFrame &ff);
+};
+}  // namespace z2kplus::backend::reverse_index::builder
@@ -17,11 +17,34 @@
 #include <ostream>
 #include "kosak/coding/coding.h"
 #include "kosak/coding/failures.h"
+#include "kosak/coding/memory/buffered_writer.h"
 #include "z2kplus/backend/files/path_master.h"
 #include "z2kplus/backend/reverse_index/trie/frozen_node.h"
 #include "z2kplus/backend/reverse_index/builder/common.h"
 
 namespace z2kplus::backend::reverse_index::builder {
+// Collects the words of the nodes as they are frozen, in a scratch file that later becomes the
+// index's postings section (see ZgramDigestor::tryFinishPostings).
+class PostingsWriter {
+  typedef kosak::coding::FailFrame FailFrame;
+  typedef kosak::coding::memory::BufferedWriter BufferedWriter;
+
+public:
+  PostingsWriter();
+  DISALLOW_COPY_AND_ASSIGN(PostingsWriter);
+  DISALLOW_MOVE_COPY_AND_ASSIGN(PostingsWriter);
+  ~PostingsWriter();
+
+  bool tryOpen(const std::string &fileName, const FailFrame &ff);
+  // Sets *offset to the index of the first of 'words' in the postings.
+  bool tryAppend(const std::vector<wordOff_t> &words, uint32_t *offset, const FailFrame &ff);
+  bool tryClose(const FailFrame &ff);
+
+private:
+  BufferedWriter writer_;
+  size_t size_ = 0;
+};
+
 class TrieBuilderNode {
   typedef kosak::coding::FailFrame FailFrame;
   typedef z2kplus::backend::reverse_index::trie::FrozenNode FrozenNode;
@@ -36,13 +59,14 @@ public:
   ~TrieBuilderNode();
 
   bool tryInsert(const std::u32string_view &probe, const wordOff_t *begin, size_t size,
-      SimpleAllocator *alloc, const FailFrame &ff);
+      SimpleAllocator *alloc, PostingsWriter *postings, const FailFrame &ff);
 
-  bool tryFreeze(SimpleAllocator *alloc, FrozenNode **result, const FailFrame &ff);
+  bool tryFreeze(SimpleAllocator *alloc, PostingsWriter *postings, FrozenNode **result,
+      const FailFrame &ff);
 
 private:
   bool tryInsertHelper(std::u32string_view probe, const wordOff_t *begin, size_t size,
-      SimpleAllocator *alloc, const FailFrame &ff);
+      SimpleAllocator *alloc, PostingsWriter *postings, const FailFrame &ff);
 
   std::u32string prefix_;
   std::vector<wordOff_t> wordsHere_;
@@ -0,0 +1,105 @@
+// Copyright 2023 The Z2K Plus+ Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "kosak/coding/coding.h"
+#include "kosak/coding/failures.h"
+#include "kosak/coding/memory/mapped_file.h"
+#include "z2kplus/backend/reverse_index/builder/build_memory_tracker.h"
+
+namespace z2kplus::backend::reverse_index::builder {
+// The postings (word offsets) of the corpus, grouped by word. Each digester accumulates the
+// postings for its shard in memory and, whenever its budget fills, spills them to a binary "run"
+// sorted by word. The TrieFinalizer merges all the runs straight into the trie.
+//
+// A run is a sequence of records, each 4-byte aligned, made of native uint32_ts:
+//   keySize numWordOffs key (keySize bytes, zero-padded to a multiple of 4) wordOff...
+// Keys are UTF-8 and sorted bytewise, which is the same as sorting by code point. WordOffs are
+// relative to the start of the shard and increase within a record and across a shard's runs.
+class TrieEntriesWriter {
+  typedef kosak::coding::FailFrame FailFrame;
+
+public:
+  // Runs are named runPrefix.0, runPrefix.1, ... 'budget' is roughly how many bytes of postings to
+  // hold in memory before spilling. The postings are also reserved against 'memory' as they grow,
+  // and the writer spills early if the build as a whole is out of room.
+  TrieEntriesWriter(std::string runPrefix, size_t budget, BuildMemoryTracker *memory);
+  DISALLOW_COPY_AND_ASSIGN(TrieEntriesWriter);
+  DECLARE_MOVE_COPY_AND_ASSIGN(TrieEntriesWriter);
+  ~TrieEntriesWriter();
+
+  // 'key' must stay valid until the next spill (i.e. until tryAdd returns or tryClose is called).
+  bool tryAdd(std::string_view key, uint32_t wordOff, const FailFrame &ff);
+
+  bool tryClose(const FailFrame &ff);
+
+  const std::vector<std::string> &runNames() const { return runNames_; }
+
+private:
+  bool trySpill(const FailFrame &ff);
+
+  std::string runPrefix_;
+  size_t budget_ = 0;
+  std::unordered_map<std::string_view, std::vector<uint32_t>> postings_;
+  // Approximate memory held by postings_.
+  size_t bytesUsed_ = 0;
+  // Covers bytesUsed_.
+  MemoryReservation reservation_;
+  std::vector<std::string> runNames_;
+};
+
+struct TrieEntry {
+  std::string_view key_;
+  const uint32_t *wordOffs_ = nullptr;
+  size_t numWordOffs_ = 0;
+};
+
+// Reads a run written by TrieEntriesWriter. Has the shape kosak::coding::merger::Merger expects.
+class TrieEntriesReader {
+  typedef kosak::coding::FailFrame FailFrame;
+  template<typename T>
+  using MappedFile = kosak::coding::memory::MappedFile<T>;
+
+public:
+  typedef TrieEntry item_type;
+
+  // Maps the run and checks that it is well-formed and sorted, so that tryGetNext can't fail.
+  static bool tryCreate(const std::string &runName, TrieEntriesReader *result,
+      const FailFrame &ff);
+
+  TrieEntriesReader();
+  DISALLOW_COPY_AND_ASSIGN(TrieEntriesReader);
+  DECLARE_MOVE_COPY_AND_ASSIGN(TrieEntriesReader);
+  ~TrieEntriesReader();
+
+  bool tryGetNext(TrieEntry *result);
+
+private:
+  MappedFile<uint32_t> mf_;
+  const uint32_t *current_ = nullptr;
+  const uint32_t *end_ = nullptr;
+};
+
+struct TrieEntryLess {
+  bool operator()(const TrieEntry &lhs, const TrieEntry &rhs) const {
+    return lhs.key_ < rhs.key_;
+  }
+};
+}  // namespace z2kplus::backend::reverse_index::builder
@@ -15,8 +15,10 @@
 #pragma once
 
 #include <string>
+#include <vector>
 #include "kosak/coding/coding.h"
 #include "kosak/coding/failures.h"
+#include "z2kplus/backend/reverse_index/builder/build_memory_tracker.h"
 #include "z2kplus/backend/reverse_index/builder/common.h"
 #include "z2kplus/backend/reverse_index/trie/frozen_trie.h"
 
@@ -27,7 +29,12 @@ class TrieFinalizer {
   typedef z2kplus::backend::reverse_index::builder::SimpleAllocator SimpleAllocator;
 
 public:
-  static bool tryMakeTrie(const std::string &trieEntries, const std::vector<wordOff_t> &wordOffs,
-      SimpleAllocator *alloc, FrozenTrie *result, const FailFrame &ff);
+  // Merges the sorted runs written by each shard's TrieEntriesWriter into a trie. The wordOffs in
+  // shard i's runs are relative to wordOffs[i]. The merge has no way to spill, so it just reports
+  // its working memory to 'memory'. The nodes go into 'alloc', but the postings go to the file
+  // 'postingsName', and the caller points the trie at them once it has laid them out.
+  static bool tryMakeTrie(const std::vector<std::vector<std::string>> &runsPerShard,
+      const std::vector<wordOff_t> &wordOffs, const std::string &postingsName,
+      BuildMemoryTracker *memory, SimpleAllocator *alloc, FrozenTrie *result, const FailFrame &ff);
 };
 }  // namespace z2kplus::backend::reverse_index::builder
@@ -14,13 +14,34 @@
 
 #pragma once
 
+#include <string>
+#include <vector>
 #include "kosak/coding/failures.h"
 #include "z2kplus/backend/files/path_master.h"
+#include "z2kplus/backend/reverse_index/builder/build_memory_tracker.h"
+#include "z2kplus/backend/reverse_index/builder/digest_cache.h"
 #include "z2kplus/backend/reverse_index/builder/log_splitter.h"
 #include "z2kplus/backend/reverse_index/trie/frozen_trie.h"
 #include "z2kplus/backend/util/frozen/frozen_vector.h"
 
 namespace z2kplus::backend::reverse_index::builder {
+// The digested shards, in shard order, and the sorted plusplus rows.
+struct DigestedShards {
+  DigestedShards();
+  DISALLOW_COPY_AND_ASSIGN(DigestedShards);
+  DECLARE_MOVE_COPY_AND_ASSIGN(DigestedShards);
+  ~DigestedShards();
+
+  std::vector<std::string> zgramInfoNames_;
+  std::vector<std::string> wordInfoNames_;
+  std::vector<std::vector<std::string>> trieEntriesRuns_;
+  std::vector<size_t> numZgramsPerShard_;
+  std::vector<size_t> numWordsPerShard_;
+  std::string plusPlusEntriesName_;
+  std::string minusMinusEntriesName_;
+  std::string plusPlusKeysName_;
+};
+
 class ZgramDigestorResult {
   template<typename T>
   using FrozenVector = z2kplus::backend::util::frozen::FrozenVector<T>;
@@ -55,6 +76,15 @@ private:
   std::string plusPlusEntriesName_;
   std::string minusMinusEntriesName_;
   std::string plusPlusKeysName_;
+
+  // Inputs for ZgramDigestor::tryFinishWordInfos.
+  std::vector<std::string> wordInfoNames_;
+  std::vector<size_t> numZgramsPerShard_;
+  std::vector<size_t> numWordsPerShard_;
+  // Input for ZgramDigestor::tryFinishPostings.
+  std::string postingsName_;
+
+  friend class ZgramDigestor;
 };
 
 class ZgramDigestor {
@@ -62,7 +92,27 @@ class ZgramDigestor {
   typedef z2kplus::backend::files::PathMaster PathMaster;
 
 public:
-  static bool tryDigest(const PathMaster &pm, const LogSplitterResult &lsr, SimpleAllocator *alloc,
-      ZgramDigestorResult *result, const FailFrame &ff);
+  // Digests the LogSplitter's chunks (one shard each) on 'numThreads' threads (0 means one per
+  // core), and sorts the plusplus rows. Each digester holds about 'trieEntriesBudget' bytes of
+  // postings in memory before spilling them to disk, or less if 'memory' runs short. If 'memory'
+  // can't fit a full budget per thread, fewer threads are used. If 'cache' is not null, a shard
+  // whose chunk and whose zgram revisions are unchanged since it was cached isn't digested again.
+  // Everything this produces is in files, so a build can checkpoint it.
+  static bool tryDigestShards(const PathMaster &pm, const LogSplitterResult &lsr,
+      size_t numThreads, size_t trieEntriesBudget, BuildMemoryTracker *memory, DigestCache *cache,
+      DigestedShards *result, const FailFrame &ff);
+
+  // Lays out the ZgramInfos and the trie's nodes. The trie's postings go to the scratch file
+  // 'postingsName'.
+  static bool tryDigest(DigestedShards shards, const std::string &postingsName,
+      BuildMemoryTracker *memory, SimpleAllocator *alloc, ZgramDigestorResult *result,
+      const FailFrame &ff);
+
+  // tryDigest leaves the WordInfos and the trie's postings out of the index file, so that they can
+  // be placed after the hot sections. These calls append them at the allocator's current position.
+  static bool tryFinishWordInfos(SimpleAllocator *alloc, ZgramDigestorResult *result,
+      const FailFrame &ff);
+  static bool tryFinishPostings(SimpleAllocator *alloc, ZgramDigestorResult *result,
+      const FailFrame &ff);
 };
 }  // namespace z2kplus::backend::reverse_index::builder
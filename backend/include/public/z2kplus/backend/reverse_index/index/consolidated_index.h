@@ -31,8 +31,11 @@
 #include "z2kplus/backend/reverse_index/fields.h"
 #include "z2kplus/backend/reverse_index/index/dynamic_index.h"
 #include "z2kplus/backend/reverse_index/index/frozen_index.h"
+#include "z2kplus/backend/reverse_index/index/metadata_batch.h"
 #include "z2kplus/backend/reverse_index/index/zgram_cache.h"
 #include "z2kplus/backend/reverse_index/metadata/frozen_metadata.h"
+#include "z2kplus/backend/reverse_index/metadata/plusplus_counter.h"
+#include "z2kplus/backend/reverse_index/metadata/plusplus_key_dictionary.h"
 #include "z2kplus/backend/reverse_index/types.h"
 #include "z2kplus/backend/shared/magic_constants.h"
 #include "z2kplus/backend/shared/plusplus_scanner.h"
@@ -109,6 +112,14 @@ private:
 };
 }  // namespace internal
 
+// Where a walk of the tries by ConsolidatedIndex::tryFindMatching stopped.
+struct TrieWalkPosition {
+  // False while the walk is still in the frozen trie.
+  bool inDynamic_ = false;
+  // Within that trie, as described at FrozenNode::tryFindMatching.
+  std::vector<uint32_t> path_;
+};
+
 class ConsolidatedIndex {
   typedef kosak::coding::FailFrame FailFrame;
   typedef kosak::coding::nsunix::FileCloser FileCloser;
@@ -118,6 +129,8 @@ class ConsolidatedIndex {
   typedef z2kplus::backend::reverse_index::index::DynamicIndex DynamicIndex;
   typedef z2kplus::backend::reverse_index::index::FrozenIndex FrozenIndex;
   typedef z2kplus::backend::reverse_index::metadata::FrozenMetadata FrozenMetadata;
+  typedef z2kplus::backend::reverse_index::metadata::PlusPlusCounter PlusPlusCounter;
+  typedef z2kplus::backend::reverse_index::metadata::PlusPlusKeyDictionary PlusPlusKeyDictionary;
   typedef z2kplus::backend::reverse_index::WordInfo WordInfo;
   typedef z2kplus::backend::reverse_index::ZgramInfo ZgramInfo;
   typedef z2kplus::backend::shared::LogRecord LogRecord;
@@ -138,6 +151,7 @@ class ConsolidatedIndex {
   template<typename R, typename ...Args>
   using Delegate = kosak::coding::Delegate<R, Args...>;
 public:
+  typedef DynamicIndex::plusPlusKeyId_t plusPlusKeyId_t;
   typedef DynamicIndex::ppDeltaMap_t ppDeltaMap_t;
 
   static bool tryCreate(std::shared_ptr<PathMaster> pm,
@@ -163,8 +177,17 @@ public:
 
   bool tryAddForBootstrap(const std::vector<logRecordAndLocation_t> &records, const FailFrame &ff);
 
-  void findMatching(const FiniteAutomaton &dfa,
-      const kosak::coding::Delegate<void, const wordOff_t *, const wordOff_t *> &callback) const;
+  // Reports the posting lists of the words matching 'dfa', first those of the frozen trie and then
+  // those of the dynamic one. Polls 'outOfBudget' as it goes, and if that says to stop, returns
+  // false with '*position' saying where. Calling again with that position picks up from there
+  // without repeating any callbacks, provided no words were added to the dynamic index meanwhile.
+  bool tryFindMatching(const FiniteAutomaton &dfa, const Delegate<bool> &outOfBudget,
+      TrieWalkPosition *position,
+      const Delegate<void, const wordOff_t *, const wordOff_t *> &callback) const;
+  // Total number of word occurrences (in any field) matching 'dfa'. This is an upper bound on
+  // the number of zgrams containing a matching word. Gives up (returning false) if that takes more
+  // than 'maxNodes' trie nodes.
+  bool tryCountMatching(const FiniteAutomaton &dfa, size_t maxNodes, size_t *result) const;
 
   bool tryCheckpoint(std::chrono::system_clock::time_point now,
       FilePosition<FileKeyKind::Logged> *loggedPosition,
@@ -184,15 +207,37 @@ public:
   }
 
   void getMetadataFor(ZgramId zgramId, std::vector<MetadataRecord> *result) const;
+  // Batch form of getMetadataFor (and getPlusPlusKeys). 'zgramIds' must be sorted in ascending
+  // order. Resolves every category with one forward sweep over each frozen map, replacing the
+  // contents of 'result'.
+  void resolveMetadata(const ZgramId *zgramIds, size_t size, MetadataBatch *result) const;
   std::string_view getZmojis(std::string_view userId) const;
   int64_t getReactionCount(std::string_view reaction, ZgramId relativeTo) const;
+  const PlusPlusKeyDictionary &plusPlusKeys() const { return plusPlusKeys_; }
+  int64_t getPlusPlusCountAfter(ZgramId zgramId, plusPlusKeyId_t key) const;
+  // Convenience form, for keys that may never have been seen.
   int64_t getPlusPlusCountAfter(ZgramId zgramId, std::string_view key) const;
-  std::set<std::string> getPlusPlusKeys(ZgramId zgramId) const;
+  // Batch form of getPlusPlusCountAfter for a single key. 'zgramIds' must be sorted in ascending
+  // order. Writes 'size' counts to 'result'.
+  void getPlusPlusCountsAfter(plusPlusKeyId_t key, const ZgramId *zgramIds, size_t size,
+      int64_t *result) const;
+  void getPlusPlusCountsAfter(std::string_view key, const ZgramId *zgramIds, size_t size,
+      int64_t *result) const;
+  // The keys mentioned in 'zgramId', sorted and without duplicates. Overwrites 'result', which the
+  // caller can reuse from call to call.
+  void getPlusPlusKeys(ZgramId zgramId, std::vector<plusPlusKeyId_t> *result) const;
 
   void getReactionsFor(ZgramId zgramId, std::vector<shared::zgMetadata::Reaction> *result) const;
   void getZgramRevsFor(ZgramId zgramId, std::vector<shared::zgMetadata::ZgramRevision> *result) const;
   void getRefersToFor(ZgramId zgramId, std::vector<shared::zgMetadata::ZgramRefersTo> *result) const;
 
+  // The zgrams currently referring to 'zgramId', frozen and dynamic together. Sorted.
+  void getReferredBy(ZgramId zgramId, std::vector<ZgramId> *result) const;
+  // The zgrams reachable from 'zgramId' by following refers-to links in either direction,
+  // including 'zgramId' itself. The search is breadth-first and stops after 'maxSize' zgrams.
+  // Sorted.
+  void getThread(ZgramId zgramId, size_t maxSize, std::vector<ZgramId> *result) const;
+
   size_t zgramInfoSize() const {
     return frozenIndex_.get()->zgramInfos().size() + dynamicIndex_.zgramInfos().size();
   }
@@ -203,6 +248,10 @@ public:
 
   const PathMaster &pm() const { return *pm_; }
 
+  // Different for every index created by this process, so that anything derived from an index
+  // (and cached) can tell when it has been replaced.
+  uint64_t generation() const { return generation_; }
+
   const FrozenIndex &frozenIndex() const { return *frozenIndex_.get(); }
   const DynamicIndex &dynamicIndex() const { return dynamicIndex_; }
 
@@ -219,15 +268,25 @@ private:
   bool tryAddMetadataHelper(std::vector<MetadataRecord> &&records, std::vector<MetadataRecord> *movedRecords,
       const FailFrame &ff);
 
+  // Interns the keys of 'scanned' (which is what PlusPlusScanner produces, per zgram), applies
+  // the deltas, and writes them to 'deltaMap' in key id form.
+  void updatePlusPlusCounts(const std::map<ZgramId, PlusPlusScanner::ppDeltas_t> &scanned,
+      ppDeltaMap_t *deltaMap);
+
   bool tryDetermineLogged(const MetadataRecord &mr, bool *isLogged, const FailFrame &ff);
   bool tryAppendAndFlush(std::string_view logged, std::string_view unlogged, const FailFrame &ff);
 
   std::shared_ptr<PathMaster> pm_;
+  uint64_t generation_ = 0;
 
   // Zgrams and metadata that have been digested and stored in the on-disk format.
   MappedFile<FrozenIndex> frozenIndex_;
   // Freshly arrived zephyrgrams and metadata.
   DynamicIndex dynamicIndex_;
+  // Dense ids for the plusplus keys in both of the above.
+  PlusPlusKeyDictionary plusPlusKeys_;
+  // Net ++ counts over both of the above.
+  PlusPlusCounter plusPlusCounter_;
 
   // Log for the freshly-arrived logged zgrams and metadata
   internal::DynamicFileState<FileKeyKind::Logged> loggedState_;
@@ -41,15 +41,21 @@ class DynamicIndex {
   typedef z2kplus::backend::shared::ZgramId ZgramId;
   typedef z2kplus::backend::shared::Zephyrgram Zephyrgram;
   typedef z2kplus::backend::shared::ZgramCore ZgramCore;
+  typedef z2kplus::backend::util::frozen::FrozenStringPool FrozenStringPool;
 
   template<typename T>
   using Slice = kosak::coding::containers::Slice<T>;
 
 public:
   typedef std::pair<LogRecord, LogLocation> logRecordAndLocation_t;
-  typedef std::map<ZgramId, PlusPlusScanner::ppDeltas_t> ppDeltaMap_t;
+  typedef z2kplus::backend::reverse_index::metadata::PlusPlusKeyDictionary::keyId_t plusPlusKeyId_t;
+  // zgramId -> plusplus key id -> net delta
+  typedef std::map<ZgramId, std::map<plusPlusKeyId_t, int64_t>> ppDeltaMap_t;
 
   DynamicIndex();
+  // 'frozenPool' is the string pool of the frozen side. Metadata strings that are already in it
+  // are referred to rather than copied.
+  explicit DynamicIndex(const FrozenStringPool *frozenPool);
   DynamicIndex(DynamicTrie &&trie, std::vector<ZgramInfo> &&zgramInfos,
       std::vector<WordInfo> &&wordInfos, DynamicMetadata &&metadata);
   DISALLOW_COPY_AND_ASSIGN(DynamicIndex);
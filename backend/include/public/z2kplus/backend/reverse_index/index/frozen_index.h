@@ -19,6 +19,7 @@
 #include "kosak/coding/failures.h"
 #include "z2kplus/backend/files/keys.h"
 #include "z2kplus/backend/reverse_index/fields.h"
+#include "z2kplus/backend/reverse_index/index/index_layout.h"
 #include "z2kplus/backend/reverse_index/metadata/frozen_metadata.h"
 #include "z2kplus/backend/reverse_index/types.h"
 #include "z2kplus/backend/reverse_index/trie/frozen_trie.h"
@@ -65,7 +66,7 @@ public:
   FrozenIndex(const FilePosition<FileKeyKind::Logged> &loggedEnd,
       const FilePosition<FileKeyKind::Unlogged> &unloggedEnd,
       FrozenVector<ZgramInfo> zgramInfos, FrozenVector<WordInfo> wordInfos, FrozenTrie trie,
-      FrozenStringPool stringPool, FrozenMetadata metadata);
+      FrozenStringPool stringPool, FrozenMetadata metadata, const IndexSectionTable &sections);
   DISALLOW_COPY_AND_ASSIGN(FrozenIndex);
   DECLARE_MOVE_COPY_AND_ASSIGN(FrozenIndex);
   ~FrozenIndex();
@@ -85,6 +86,9 @@ public:
   FrozenMetadata &metadata() { return metadata_; }
   const FrozenMetadata &metadata() const { return metadata_; }
 
+  // Where each section lives in the file, so the loader can apply per-section access policies.
+  const IndexSectionTable &sections() const { return sections_; }
+
 private:
   FilePosition<FileKeyKind::Logged> loggedEnd_;
   FilePosition<FileKeyKind::Unlogged> unloggedEnd_;
@@ -93,6 +97,7 @@ private:
   FrozenTrie trie_;
   FrozenStringPool stringPool_;
   FrozenMetadata metadata_;
+  IndexSectionTable sections_;
 
   friend std::ostream &operator<<(std::ostream &s, const FrozenIndex &o);
 };
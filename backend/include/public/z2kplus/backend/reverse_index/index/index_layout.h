@@ -0,0 +1,97 @@
+// Copyright 2023 The Z2K Plus+ Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+#include "kosak/coding/coding.h"
+#include "kosak/coding/failures.h"
+
+namespace z2kplus::backend::reverse_index::index {
+// The sections of the frozen index file, in the order the builder lays them out. The hot sections
+// (everything a query or a page of results touches) come first and are contiguous; the hot group
+// ends on a hugepage boundary. Every section starts on a page boundary.
+enum class IndexSection {
+  header, zgramInfos, trie, stringPool, wordInfos, postings, metadata, revisions, numSections
+};
+const char *getName(IndexSection section);
+inline std::ostream &operator<<(std::ostream &s, IndexSection section) {
+  return s << getName(section);
+}
+
+// How the loader treats a section's pages.
+enum class SectionPolicy {
+  // Read it all in up front, optionally backed by hugepages and locked.
+  hot,
+  // Point lookups: turn off readahead.
+  random,
+  // Leave the kernel's default readahead alone.
+  normal
+};
+SectionPolicy getPolicy(IndexSection section);
+
+// Byte offsets (relative to the start of the file) of each section. Lives in the FrozenIndex
+// header, so it must stay trivially copyable.
+class IndexSectionTable {
+public:
+  struct Range {
+    uint64_t begin_ = 0;
+    uint64_t end_ = 0;
+  };
+
+  const Range &range(IndexSection section) const { return ranges_[(size_t)section]; }
+  void setRange(IndexSection section, uint64_t begin, uint64_t end) {
+    ranges_[(size_t)section] = Range{begin, end};
+  }
+
+  // Checks that the ranges are in order and inside a file of size 'fileSize'.
+  bool tryValidate(size_t fileSize, const kosak::coding::FailFrame &ff) const;
+
+private:
+  std::array<Range, (size_t)IndexSection::numSections> ranges_;
+
+  friend std::ostream &operator<<(std::ostream &s, const IndexSectionTable &o);
+};
+
+struct SectionResidency {
+  IndexSection section_ = IndexSection::header;
+  size_t numPages_ = 0;
+  size_t numResidentPages_ = 0;
+
+  friend std::ostream &operator<<(std::ostream &s, const SectionResidency &o);
+};
+
+class IndexLayout {
+  typedef kosak::coding::FailFrame FailFrame;
+public:
+  struct Options {
+    // Ask for transparent hugepages on the hot sections.
+    bool hugePages_ = false;
+    // mlock the hot sections. Failure (e.g. RLIMIT_MEMLOCK) is reported and otherwise ignored.
+    bool lockHotSet_ = false;
+  };
+
+  // Applies each section's policy to the index mapped at 'base'. All of this is advisory, so
+  // failures are logged rather than returned.
+  static void advise(const char *base, const IndexSectionTable &sections, const Options &options);
+
+  // Reports how many pages of each section are currently in memory.
+  static bool tryMeasureResidency(const char *base, const IndexSectionTable &sections,
+      std::vector<SectionResidency> *result, const FailFrame &ff);
+};
+}  // namespace z2kplus::backend::reverse_index::index
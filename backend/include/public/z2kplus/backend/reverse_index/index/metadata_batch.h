@@ -0,0 +1,100 @@
+// Copyright 2023 The Z2K Plus+ Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+#include "kosak/coding/coding.h"
+#include "kosak/coding/containers/slice.h"
+#include "z2kplus/backend/reverse_index/metadata/plusplus_key_dictionary.h"
+#include "z2kplus/backend/shared/zephyrgram.h"
+
+namespace z2kplus::backend::reverse_index::index {
+// The metadata for a batch of zgrams, as resolved by ConsolidatedIndex::resolveMetadata. The
+// strings are views into the index (the frozen string pool or the dynamic metadata), so nothing is
+// copied until the caller builds its MetadataRecords, and they stay valid until the index next
+// changes. The vectors keep their capacity across clear(), so a caller that keeps one of these
+// around stops allocating after the first few pages.
+class MetadataBatch {
+  typedef z2kplus::backend::shared::MetadataRecord MetadataRecord;
+  typedef z2kplus::backend::shared::RenderStyle RenderStyle;
+  typedef z2kplus::backend::shared::ZgramId ZgramId;
+  typedef z2kplus::backend::reverse_index::metadata::PlusPlusKeyDictionary::keyId_t plusPlusKeyId_t;
+
+  template<typename T>
+  using Slice = kosak::coding::containers::Slice<T>;
+
+public:
+  struct Reaction {
+    std::string_view reaction_;
+    std::string_view creator_;
+  };
+
+  struct Revision {
+    std::string_view instance_;
+    std::string_view body_;
+    RenderStyle renderStyle_ = RenderStyle::Default;
+  };
+
+  MetadataBatch();
+  DISALLOW_COPY_AND_ASSIGN(MetadataBatch);
+  DECLARE_MOVE_COPY_AND_ASSIGN(MetadataBatch);
+  ~MetadataBatch();
+
+  void clear();
+
+  // The zgrams in the batch, in ascending order.
+  size_t size() const { return zgrams_.size(); }
+  ZgramId zgramId(size_t index) const { return zgrams_[index].zgramId_; }
+  bool tryFind(ZgramId zgramId, size_t *index) const;
+
+  // Only the reactions that are currently set, sorted by (reaction, creator).
+  Slice<const Reaction> reactions(size_t index) const;
+  // Frozen revisions first, then dynamic ones, each in order of arrival.
+  Slice<const Revision> revisions(size_t index) const;
+  Slice<const ZgramId> refersTo(size_t index) const;
+  // Key ids (see ConsolidatedIndex::plusPlusKeys()), sorted, without duplicates.
+  Slice<const plusPlusKeyId_t> plusPlusKeys(size_t index) const;
+
+  // Appends the reactions, revisions and refers-tos of the index'th zgram, in the same order as
+  // ConsolidatedIndex::getMetadataFor.
+  void appendMetadataRecords(size_t index, std::vector<MetadataRecord> *result) const;
+
+private:
+  // The items for the i'th zgram run from the previous zgram's ends up to these ends.
+  struct Zgram {
+    ZgramId zgramId_;
+    uint32_t reactionsEnd_ = 0;
+    uint32_t revisionsEnd_ = 0;
+    uint32_t refersToEnd_ = 0;
+    uint32_t plusPlusKeysEnd_ = 0;
+  };
+
+  // Called by ConsolidatedIndex, after it has appended the items for 'zgramId'.
+  void finishZgram(ZgramId zgramId);
+
+  template<typename T>
+  Slice<const T> sliceOf(const std::vector<T> &items, size_t index, uint32_t Zgram::*end) const;
+
+  std::vector<Zgram> zgrams_;
+  std::vector<Reaction> reactions_;
+  std::vector<Revision> revisions_;
+  std::vector<ZgramId> refersTo_;
+  std::vector<plusPlusKeyId_t> plusPlusKeys_;
+
+  friend class ConsolidatedIndex;
+};
+}  // namespace z2kplus::backend::reverse_index::index
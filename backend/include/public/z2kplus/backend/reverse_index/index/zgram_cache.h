@@ -14,37 +14,66 @@
 
 #pragma once
 
+#include <deque>
+#include <map>
+#include <memory>
 #include <utility>
 #include <vector>
 #include "kosak/coding/coding.h"
 #include "kosak/coding/failures.h"
 #include "z2kplus/backend/files/path_master.h"
 #include "z2kplus/backend/shared/zephyrgram.h"
+#include "z2kplus/backend/shared/zgram_view.h"
 
 namespace z2kplus::backend::reverse_index::index {
+// Caches recently-requested zgrams as ZgramViews, which hold the zgram's log text (plus a few
+// offsets) rather than a parsed Zephyrgram. The main cache favors the newest zgrams. Zgrams that
+// were read ahead for a client paging through the archive (see coordinator::Prefetcher) are held
+// separately, and only until first use, so they neither evict nor get refused by the main cache.
 class ZgramCache {
   typedef kosak::coding::FailFrame FailFrame;
   typedef z2kplus::backend::files::LogLocation LogLocation;
   typedef z2kplus::backend::files::PathMaster PathMaster;
   typedef z2kplus::backend::shared::Zephyrgram Zephyrgram;
   typedef z2kplus::backend::shared::ZgramId ZgramId;
+  typedef z2kplus::backend::shared::ZgramView ZgramView;
 
   template<typename R, typename ...Args>
   using Delegate = kosak::coding::Delegate<R, Args...>;
 
 public:
   ZgramCache();
-  explicit ZgramCache(size_t capacity);
+  ZgramCache(size_t capacity, size_t prefetchCapacity);
   DECLARE_MOVE_COPY_AND_ASSIGN(ZgramCache);
   DISALLOW_COPY_AND_ASSIGN(ZgramCache);
   ~ZgramCache();
 
+  // Appends the zgrams referenced by 'locators' to 'result', in the same order.
+  bool tryLookupOrResolve(const PathMaster &pm,
+      const std::vector<std::pair<ZgramId, LogLocation>> &locators,
+      std::vector<std::shared_ptr<const ZgramView>> *result, const FailFrame &ff);
+
+  // As above, but decodes each zgram, for the few callers that need the unescaped fields.
   bool tryLookupOrResolve(const PathMaster &pm,
       const std::vector<std::pair<ZgramId, LogLocation>> &locators,
       std::vector<std::shared_ptr<const Zephyrgram>> *result, const FailFrame &ff);
 
+  bool contains(ZgramId zgramId) const {
+    return cache_.find(zgramId) != cache_.end() || prefetched_.find(zgramId) != prefetched_.end();
+  }
+
+  // Holds a read-ahead zgram until it is first looked up. When full, the oldest arrival is dropped.
+  void insertPrefetched(std::shared_ptr<const ZgramView> zgram);
+
 private:
+  void remember(const std::shared_ptr<const ZgramView> &zgram);
+
   size_t capacity_ = 0;
-  std::map<ZgramId, std::shared_ptr<const Zephyrgram>> cache_;
+  std::map<ZgramId, std::shared_ptr<const ZgramView>> cache_;
+
+  size_t prefetchCapacity_ = 0;
+  std::map<ZgramId, std::shared_ptr<const ZgramView>> prefetched_;
+  // Arrival order of prefetched_, for eviction. May mention ids that have since been consumed.
+  std::deque<ZgramId> prefetchOrder_;
 };
 }  // namespace z2kplus::backend::reverse_index::index
@@ -29,19 +29,44 @@ class Near final : public ZgramIterator {
   struct Private {};
 
 public:
+  // Lockstep: advance all the children together until they line up. Best when the children are
+  //   about equally common.
+  // RarestFirst: stream only the rarest child, and verify each of its words by seeking the other
+  //   children within a small window around it. Best when one child is much rarer than the rest,
+  //   as in phrases like "in the house".
+  // Auto: choose one of the above based on the children's estimated sizes. The choice is made the
+  //   first time a state is created against a given index, and kept until the index is replaced.
+  enum class Strategy { Auto, Lockstep, RarestFirst };
+
   static std::unique_ptr<ZgramIterator> create(size_t margin,
-    std::vector<std::unique_ptr<WordIterator>> &&children);
-  Near(Private, size_t margin, std::vector<std::unique_ptr<WordIterator>> children);
+    std::vector<std::unique_ptr<WordIterator>> &&children, Strategy strategy = Strategy::Auto);
+  Near(Private, size_t margin, std::vector<std::unique_ptr<WordIterator>> children, Strategy strategy);
   ~Near() final;
 
   std::unique_ptr<ZgramIteratorState> createState(const IteratorContext &ctx) const final;
   size_t getMore(const IteratorContext &ctx, ZgramIteratorState *state, zgramRel_t lowerBound,
       zgramRel_t *result, size_t capacity) const final;
 
+  PlanEstimate estimate(const ConsolidatedIndex &ci) const final;
+
 private:
+  // What createState should do. 'anchorIndex_' (for RarestFirst) indexes 'children_'.
+  struct Plan {
+    uint64_t generation_ = 0;
+    bool rarestFirst_ = false;
+    size_t anchorIndex_ = 0;
+  };
+
   void dump(std::ostream &s) const override;
 
+  // Returns 'plan_', first bringing it up to date with 'ci'.
+  const Plan &getPlan(const ConsolidatedIndex &ci) const;
+
   size_t margin_ = 0;
   std::vector<std::unique_ptr<WordIterator>> children_;
+  Strategy strategy_ = Strategy::Auto;
+  // Estimating the children can mean walking the trie, and callers create states over and over
+  // (for example after every budget trip), so the plan is only worked out once per index.
+  mutable Plan plan_;
 };
 }  // namespace z2kplus::backend::reverse_index::iterators::boundary
@@ -34,6 +34,8 @@ public:
   size_t getMore(const IteratorContext &ctx, ZgramIteratorState *state, zgramRel_t lowerBound,
       zgramRel_t *result, size_t capacity) const final;
 
+  PlanEstimate estimate(const ConsolidatedIndex &ci) const final;
+
 private:
   void dump(std::ostream &s) const final;
 
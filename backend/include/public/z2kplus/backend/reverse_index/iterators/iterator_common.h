@@ -14,6 +14,7 @@
 
 #pragma once
 
+#include <chrono>
 #include "kosak/coding/coding.h"
 #include "kosak/coding/strongint.h"
 #include "z2kplus/backend/reverse_index/index/consolidated_index.h"
@@ -39,12 +40,66 @@ public:
   }
 };
 
+// Rough estimates used by the query planner. 'size' is an upper bound on the number of items the
+// iterator can yield. 'cost' approximates the number of index entries it needs to touch to yield them.
+struct PlanEstimate {
+  PlanEstimate() = default;
+  PlanEstimate(size_t size, size_t cost) : size(size), cost(cost) {}
+
+  size_t size = 0;
+  size_t cost = 0;
+};
+
+// Bounds the work done by one evaluation of a query. Iterators poll IteratorContext::outOfBudget()
+// in their loops. Once the budget trips it stays tripped, and composite iterators discard any
+// candidate computed after the trip that a falsely exhausted child could have made wrong, so
+// whatever the top-level iterator did return is a correct prefix. The iterator state itself can no longer be trusted, so the caller needs to recreate it and
+// resume just past the last item it received, or at the state's nextStart() if that is further.
+//
+// There is no way to cancel a query from outside: the coordinator evaluates queries on its one
+// thread, so an unsubscribe or an index swap can only arrive between evaluations.
+class QueryBudget {
+public:
+  explicit QueryBudget(std::chrono::steady_clock::time_point deadline,
+      size_t maxPostings = std::numeric_limits<size_t>::max());
+  DISALLOW_COPY_AND_ASSIGN(QueryBudget);
+  DISALLOW_MOVE_COPY_AND_ASSIGN(QueryBudget);
+  ~QueryBudget();
+
+  bool exhausted();
+
+  void notePostings(size_t numPostings) {
+    ++trieNodesMatched_;
+    postingsTouched_ += numPostings;
+  }
+
+  bool tripped() const { return tripped_; }
+  size_t postingsTouched() const { return postingsTouched_; }
+  size_t trieNodesMatched() const { return trieNodesMatched_; }
+
+private:
+  // Looking at the clock is too expensive to do on every poll.
+  static constexpr size_t pollInterval = 64;
+
+  std::chrono::steady_clock::time_point deadline_;
+  size_t maxPostings_ = 0;
+  size_t pollCount_ = 0;
+  bool tripped_ = false;
+
+  size_t postingsTouched_ = 0;
+  size_t trieNodesMatched_ = 0;
+
+  friend std::ostream &operator<<(std::ostream &s, const QueryBudget &o);
+};
+
 class IteratorContext {
 protected:
   typedef z2kplus::backend::reverse_index::index::ConsolidatedIndex ConsolidatedIndex;
 
 public:
   IteratorContext(const ConsolidatedIndex &ci, bool forward) : ci_(ci), forward_(forward) {}
+  IteratorContext(const ConsolidatedIndex &ci, bool forward, QueryBudget *budget) : ci_(ci),
+      forward_(forward), budget_(budget) {}
   DISALLOW_COPY_AND_ASSIGN(IteratorContext);
   DISALLOW_MOVE_COPY_AND_ASSIGN(IteratorContext);
   ~IteratorContext() = default;
@@ -87,9 +142,23 @@ public:
   const ConsolidatedIndex &ci() const { return ci_; }
   bool forward() const { return forward_; }
 
+  QueryBudget *budget() const { return budget_; }
+
+  bool outOfBudget() const {
+    return budget_ != nullptr && budget_->exhausted();
+  }
+
+  void notePostings(size_t numPostings) const {
+    if (budget_ != nullptr) {
+      budget_->notePostings(numPostings);
+    }
+  }
+
 protected:
   const ConsolidatedIndex &ci_;
   bool forward_ = false;
+  // Does not own. Null means unbounded.
+  QueryBudget *budget_ = nullptr;
 
   uint32_t maybeFlip(uint32_t raw) const {
     return forward_ ? raw : std::numeric_limits<uint32_t>::max() - 1 - raw;
@@ -113,6 +182,9 @@ public:
   virtual ~ZgramIteratorState() = default;
   bool updateNextStart(const IteratorContext &ctx, zgramRel_t lowerBound, size_t capacity);
 
+  // Everything before this has been returned or is known not to match. Iterators only move it
+  // forward on the strength of results that were computed before any trip, so it remains a safe
+  // place to resume even after the budget runs out (and may be well past the last item returned).
   zgramRel_t nextStart() const { return nextStart_; }
 
 protected:
@@ -168,6 +240,18 @@ public:
     return false;
   }
 
+  // True if the set of matching zgrams can change when metadata (e.g. reactions) changes, rather
+  // than only when new zgrams arrive. Such queries must not have their results cached.
+  virtual bool isSensitiveToMetadata() const {
+    return false;
+  }
+
+  // Used by the query planner. The default is the pessimistic "every zgram in the index".
+  virtual PlanEstimate estimate(const ConsolidatedIndex &ci) const {
+    auto n = ci.zgramInfoSize();
+    return {n, n};
+  }
+
 protected:
   virtual void dump(std::ostream &s) const = 0;
 
@@ -192,11 +276,22 @@ public:
   virtual size_t getMore(const IteratorContext &ctx, WordIteratorState *state, wordRel_t lowerBound,
       wordRel_t *result, size_t capacity) const = 0;
 
+  // Sets *result to the first word at or after 'target'. Unlike getMore, this neither depends on
+  // nor disturbs the progress of earlier calls, so 'target' is allowed to move backwards. 'state'
+  // (which came from createState) may be used as a cache, but it is tied to the index it was created
+  // against. The default implementation is correct but slow; iterators that have random access to
+  // their postings should override it.
+  virtual bool trySeek(const IteratorContext &ctx, WordIteratorState *state, wordRel_t target,
+      wordRel_t *result) const;
+
   // Methods that enable certain optimizations
   virtual bool matchesAnyWord(FieldMask *fieldMask) const { return false; }
   virtual bool tryGetAnchorChild(std::unique_ptr<WordIterator> *child, bool *anchoredLeft,
     bool *anchoredRight) { return false; }
 
+  // Upper bound on the number of words this iterator can yield. Used by the query planner.
+  virtual size_t estimateSize(const ConsolidatedIndex &ci) const { return ci.wordInfoSize(); }
+
 protected:
   virtual void dump(std::ostream &s) const {}
 
@@ -37,6 +37,13 @@ public:
   size_t getMore(const IteratorContext &ctx, WordIteratorState *state, wordRel_t lowerBound,
       wordRel_t *result, size_t capacity) const final;
 
+  bool trySeek(const IteratorContext &ctx, WordIteratorState *state, wordRel_t target,
+      wordRel_t *result) const final;
+
+  size_t estimateSize(const ConsolidatedIndex &ci) const final {
+    return child_->estimateSize(ci);
+  }
+
 private:
   size_t applyFilter(const IteratorContext &ctx, WordIteratorState *state, wordRel_t *result,
       size_t capacity) const;
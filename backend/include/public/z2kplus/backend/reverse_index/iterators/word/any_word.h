@@ -31,6 +31,9 @@ public:
   size_t getMore(const IteratorContext &ctx, WordIteratorState *state, wordRel_t lowerBound,
       wordRel_t *result, size_t capacity) const final;
 
+  bool trySeek(const IteratorContext &ctx, WordIteratorState *state, wordRel_t target,
+      wordRel_t *result) const final;
+
   bool matchesAnyWord(FieldMask *fieldMask) const final;
 
 protected:
@@ -14,8 +14,10 @@
 
 #pragma once
 
+#include <utility>
 #include <vector>
 #include "kosak/coding/merger.h"
+#include "z2kplus/backend/reverse_index/index/consolidated_index.h"
 #include "z2kplus/backend/reverse_index/iterators/iterator_common.h"
 #include "z2kplus/backend/util/automaton/automaton.h"
 #include "z2kplus/backend/util/misc.h"
@@ -23,6 +25,7 @@
 namespace z2kplus::backend::reverse_index::iterators::word {
 class Pattern final : public WordIterator {
   typedef z2kplus::backend::util::automaton::FiniteAutomaton FiniteAutomaton;
+  typedef z2kplus::backend::reverse_index::index::TrieWalkPosition TrieWalkPosition;
 
   struct Private {};
 public:
@@ -35,11 +38,38 @@ public:
   size_t getMore(const IteratorContext &ctx, WordIteratorState *state, wordRel_t lowerBound,
       wordRel_t *result, size_t capacity) const final;
 
+  bool trySeek(const IteratorContext &ctx, WordIteratorState *state, wordRel_t target,
+      wordRel_t *result) const final;
+
+  size_t estimateSize(const ConsolidatedIndex &ci) const final;
+
 private:
+  typedef std::vector<std::pair<const wordOff_t *, const wordOff_t *>> spans_t;
+
   void dump(std::ostream &s) const final;
 
+  // Brings 'matches_' up to date with the index in 'ctx'. Returns false if the budget ran out
+  // first, in which case the next call picks up the trie walk where this one stopped.
+  bool tryRefreshMatches(const IteratorContext &ctx) const;
+
   FiniteAutomaton dfa_;
   FieldMask fieldMask_ = FieldMask::none;
+
+  // The posting lists of the words matching 'dfa_'. A wildcard can match a large part of the trie,
+  // so the walk is budgeted like everything else. This lives here rather than in the state because
+  // callers throw their states away when the budget runs out, and the walk needs to survive that.
+  struct Matches {
+    // The index these were gathered from.
+    uint64_t generation_ = 0;
+    TrieWalkPosition position_;
+    bool done_ = false;
+    spans_t frozenSpans_;
+    // The dynamic index reallocates its posting lists as words are added, so these are only good
+    // while the word count stays at 'dynamicWordSize_'.
+    spans_t dynamicSpans_;
+    size_t dynamicWordSize_ = 0;
+  };
+  mutable Matches matches_;
 };
 
 }  // namespace z2kplus::backend::reverse_index::iterators
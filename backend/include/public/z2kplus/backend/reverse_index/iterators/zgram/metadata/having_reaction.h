@@ -38,6 +38,12 @@ public:
   size_t getMore(const IteratorContext &ctx, ZgramIteratorState *state, zgramRel_t lowerBound,
       zgramRel_t *result, size_t capacity) const final;
 
+  bool isSensitiveToMetadata() const final {
+    return true;
+  }
+
+  PlanEstimate estimate(const ConsolidatedIndex &ci) const final;
+
   const std::string &reaction() const { return reaction_; }
 
 protected:
@@ -41,6 +41,10 @@ public:
 
   bool tryNegate(std::unique_ptr<ZgramIterator> *result) final;
 
+  bool isSensitiveToMetadata() const final {
+    return child_->isSensitiveToMetadata();
+  }
+
 private:
   void dump(std::ostream &s) const final;
 
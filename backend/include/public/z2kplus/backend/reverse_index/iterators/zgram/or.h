@@ -31,6 +31,8 @@ public:
   size_t getMore(const IteratorContext &ctx, ZgramIteratorState *state, zgramRel_t lowerBound,
       zgramRel_t *result, size_t capacity) const final;
 
+  bool isSensitiveToMetadata() const final;
+
   bool tryReleaseOrChildren(std::vector<std::unique_ptr<ZgramIterator>> *result) final;
 
 private:
@@ -53,6 +53,14 @@ public:
     return includePopulated_ == FieldMask::none && includeUnpopulated_ == FieldMask::none;
   }
 
+  PlanEstimate estimate(const ConsolidatedIndex &ci) const final {
+    if (matchesNothing()) {
+      return {0, 0};
+    }
+    auto n = ci.zgramInfoSize();
+    return {n, n};
+  }
+
 private:
   void dump(std::ostream &s) const final;
 
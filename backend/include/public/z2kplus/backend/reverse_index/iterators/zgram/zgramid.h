@@ -38,6 +38,10 @@ public:
   size_t getMore(const IteratorContext &ctx, ZgramIteratorState *state, zgramRel_t lowerBound,
       zgramRel_t *result, size_t capacity) const final;
 
+  PlanEstimate estimate(const ConsolidatedIndex &/*ci*/) const final {
+    return {1, 1};
+  }
+
 protected:
   void dump(std::ostream &s) const final;
 
@@ -15,36 +15,57 @@
 #pragma once
 
 #include <map>
-#include <set>
-#include <string>
+#include <string_view>
+#include <tuple>
+#include <utility>
 #include <vector>
 #include <ostream>
 #include "kosak/coding/coding.h"
 #include "kosak/coding/failures.h"
-#include "z2kplus/backend/files/keys.h"
-#include "z2kplus/backend/reverse_index/fields.h"
 #include "z2kplus/backend/reverse_index/index/frozen_index.h"
 #include "z2kplus/backend/reverse_index/metadata/frozen_metadata.h"
-#include "z2kplus/backend/reverse_index/types.h"
+#include "z2kplus/backend/reverse_index/metadata/id_table.h"
+#include "z2kplus/backend/reverse_index/metadata/plusplus_key_dictionary.h"
+#include "z2kplus/backend/reverse_index/metadata/string_interner.h"
 #include "z2kplus/backend/shared/zephyrgram.h"
-#include "z2kplus/backend/util/frozen/frozen_map.h"
-#include "z2kplus/backend/util/frozen/frozen_set.h"
 #include "z2kplus/backend/util/frozen/frozen_string_pool.h"
-#include "z2kplus/backend/util/frozen/frozen_vector.h"
 
 namespace z2kplus::backend::reverse_index::metadata {
+// The metadata that has arrived since the last reindex. Strings are interned (sharing ids with
+// the frozen string pool where possible), per-zgram items live in chains threaded through a few
+// shared record vectors, and the lookups go through flat open-addressing tables. So adding an
+// item is usually a couple of vector appends rather than a cascade of node allocations.
 class DynamicMetadata {
   typedef kosak::coding::FailFrame FailFrame;
   typedef z2kplus::backend::reverse_index::index::FrozenIndex FrozenIndex;
-  typedef z2kplus::backend::reverse_index::metadata::FrozenMetadata FrozenMetadata;
-  typedef z2kplus::backend::shared::ZgramCore ZgramCore;
+  typedef z2kplus::backend::shared::RenderStyle RenderStyle;
   typedef z2kplus::backend::shared::ZgramId ZgramId;
-
-  template<typename K, typename V>
-  using lessMap_t = std::map<K, V, std::less<>>;
+  typedef z2kplus::backend::util::frozen::FrozenStringPool FrozenStringPool;
+  typedef StringInterner::stringId_t stringId_t;
+  typedef PlusPlusKeyDictionary::keyId_t keyId_t;
 
 public:
+  // zgramId -> count, for a single reaction. This stays an ordered map because HavingReaction
+  // walks it in both directions and getReactionCount needs lower_bound.
+  typedef std::map<ZgramId, int32_t> reactionCounts_t;
+  // (reaction, creator, value)
+  typedef std::tuple<std::string_view, std::string_view, bool> reaction_t;
+  // (instance, body, renderStyle)
+  typedef std::tuple<std::string_view, std::string_view, RenderStyle> zgramRevision_t;
+  // (refersTo, valid). Set to false to hide a frozen reference.
+  typedef std::pair<ZgramId, bool> zgramRefersTo_t;
+
+  // The ZgramIds containing "key++" and "key--" respectively. We can figure out the net ++ by
+  // doing a rank operation. The vectors need to remain sorted, so internal changes to them are
+  // costly. However the dynamic index is typically small so these changes may not matter.
+  struct PlusPlusEntries {
+    std::vector<ZgramId> pluses_;
+    std::vector<ZgramId> minuses_;
+  };
+
   DynamicMetadata();
+  // Does not own 'frozenPool', which may be null. Strings already in the pool are not copied.
+  explicit DynamicMetadata(const FrozenStringPool *frozenPool);
   DISALLOW_COPY_AND_ASSIGN(DynamicMetadata);
   DECLARE_MOVE_COPY_AND_ASSIGN(DynamicMetadata);
   ~DynamicMetadata();
@@ -58,47 +79,97 @@ public:
   bool tryAddHelper(const FrozenIndex &lhs,
       const z2kplus::backend::shared::userMetadata::Zmojis &o, const FailFrame &ff);
 
-  // zgramId -> reaction -> creator -> {add, remove}
-  typedef lessMap_t<ZgramId, lessMap_t<std::string, lessMap_t<std::string, bool>>> reactions_t;
-  // reaction -> zgramId -> count
-  typedef lessMap_t<std::string, std::map<ZgramId, int32_t>> reactionCounts_t;
-  // zgramId -> ZgramCore revisions.
-  typedef std::map<ZgramId, std::vector<ZgramCore>> zgramRevisions_t;
-  // zgramId -> map<ZgramId, valid> referred-to zgrams. Set to false to hide a frozen reference
-  typedef std::map<ZgramId, std::map<ZgramId, bool>> zgramRefersTo_t;
-  // userId -> zmojis
-  typedef lessMap_t<std::string, std::string> zmojis_t;
-  // key -> vector<ZgramIds> containing "key++". We can figure out the net ++ by doing a rank
-  // operation. The vector needs to remain sorted, so internal changes to it are costly. However the
-  // dynamic index is typically small so these changes may not matter. If we care we would need to
-  // switch to a more efficient data structure (one that still supports rank).
-  typedef lessMap_t<std::string, std::vector<ZgramId>> plusPluses_t;
-  typedef plusPluses_t minusMinuses_t;
-  typedef std::map<ZgramId, std::set<std::string>> plusPlusKeys_t;
-
-  const reactions_t &reactions() const { return reactions_; }
-  const reactionCounts_t &reactionCounts() const { return reactionCounts_; }
-  const zgramRevisions_t &zgramRevisions() const { return zgramRevisions_; }
-  const zgramRefersTo_t &zgramRefersTo() const { return zgramRefersTo_; }
-  const zmojis_t &zmojis() const { return zmojis_; }
-  plusPluses_t &plusPluses() { return plusPluses_; }
-  const plusPluses_t &plusPluses() const { return plusPluses_; }
-  minusMinuses_t &minusMinuses() { return minusMinuses_; }
-  const minusMinuses_t &minusMinuses() const { return minusMinuses_; }
-  plusPlusKeys_t &plusPlusKeys() { return plusPlusKeys_; }
-  const plusPlusKeys_t &plusPlusKeys() const { return plusPlusKeys_; }
+  // Records 'count' net ++s (or --s, if negative) of 'key' in 'zgramId'.
+  void addPlusPlusDelta(keyId_t key, ZgramId zgramId, int64_t count);
+
+  // Returns false if no (add or remove) reaction has arrived for this triple.
+  bool tryFindReaction(ZgramId zgramId, std::string_view reaction, std::string_view creator,
+      bool *value) const;
+  // Sorted by (reaction, creator).
+  void getReactions(ZgramId zgramId, std::vector<reaction_t> *result) const;
+  // Returns nullptr if there are no dynamic counts for 'reaction'.
+  const reactionCounts_t *findReactionCounts(std::string_view reaction) const;
+  // In order of arrival.
+  void getZgramRevisions(ZgramId zgramId, std::vector<zgramRevision_t> *result) const;
+  // Sorted by refersTo.
+  void getRefersTo(ZgramId zgramId, std::vector<zgramRefersTo_t> *result) const;
+  // The reverse of getRefersTo: the zgrams that have referred to 'zgramId', each with its current
+  // value. Sorted by the referring zgram.
+  void getReferredBy(ZgramId zgramId, std::vector<zgramRefersTo_t> *result) const;
+  bool tryFindZmojis(std::string_view userId, std::string_view *result) const;
+  // Returns nullptr if 'key' has not been ++ed or --ed.
+  const PlusPlusEntries *findPlusPlusEntries(keyId_t key) const;
+  // Unsorted, without duplicates.
+  void getPlusPlusKeys(ZgramId zgramId, std::vector<keyId_t> *result) const;
 
 private:
-  reactions_t reactions_;
-  reactionCounts_t reactionCounts_;
-  zgramRevisions_t zgramRevisions_;
-  zgramRefersTo_t zgramRefersTo_;
-  zmojis_t zmojis_;
-  plusPluses_t plusPluses_;
-  minusMinuses_t minusMinuses_;
-  plusPlusKeys_t plusPlusKeys_;
+  static constexpr uint32_t noRecord = UINT32_MAX;
+
+  // The heads (and for revisions, the tail) of the per-zgram chains.
+  struct ZgramSlot {
+    uint32_t reactions_ = noRecord;
+    uint32_t revisionsHead_ = noRecord;
+    uint32_t revisionsTail_ = noRecord;
+    uint32_t refersTo_ = noRecord;
+    uint32_t referredBy_ = noRecord;
+    uint32_t plusPlusKeys_ = noRecord;
+  };
+
+  struct ReactionRecord {
+    stringId_t reaction_ = 0;
+    stringId_t creator_ = 0;
+    bool value_ = false;
+    uint32_t next_ = noRecord;
+  };
+
+  struct RevisionRecord {
+    stringId_t instance_ = 0;
+    stringId_t body_ = 0;
+    RenderStyle renderStyle_ = RenderStyle::Default;
+    uint32_t next_ = noRecord;
+  };
+
+  struct RefersToRecord {
+    ZgramId refersTo_;
+    bool value_ = false;
+    uint32_t next_ = noRecord;
+  };
+
+  // Shares its value with the forward record, so the two directions can't disagree.
+  struct ReferredByRecord {
+    ZgramId referrer_;
+    uint32_t refersTo_ = noRecord;
+    uint32_t next_ = noRecord;
+  };
+
+  struct PlusPlusKeyRecord {
+    keyId_t key_ = 0;
+    uint32_t next_ = noRecord;
+  };
+
+  const ZgramSlot *findSlot(ZgramId zgramId) const;
+  ZgramSlot *findOrCreateSlot(ZgramId zgramId);
+
+  StringInterner strings_;
+
+  // zgramId -> index into slots_
+  IdTable slotIndex_;
+  std::vector<ZgramSlot> slots_;
+  std::vector<ReactionRecord> reactions_;
+  std::vector<RevisionRecord> revisions_;
+  std::vector<RefersToRecord> refersTo_;
+  std::vector<ReferredByRecord> referredBy_;
+  std::vector<PlusPlusKeyRecord> plusPlusKeys_;
+
+  // reaction id -> index into reactionCounts_
+  IdTable reactionCountsIndex_;
+  std::vector<reactionCounts_t> reactionCounts_;
+  // userId id -> zmojis id
+  IdTable zmojis_;
+  // key id -> index into plusPlusEntries_
+  IdTable plusPlusIndex_;
+  std::vector<PlusPlusEntries> plusPlusEntries_;
 
   friend std::ostream &operator<<(std::ostream &s, const DynamicMetadata &o);
-  DECLARE_TYPICAL_JSON(DynamicMetadata);
 };
 }  // namespace z2kplus::backend::reverse_index
@@ -20,17 +20,74 @@
 #include "z2kplus/backend/reverse_index/fields.h"
 #include "z2kplus/backend/reverse_index/types.h"
 #include "z2kplus/backend/shared/zephyrgram.h"
+#include "z2kplus/backend/util/frozen/frozen_adjacency.h"
+#include "z2kplus/backend/util/frozen/frozen_bitmap.h"
 #include "z2kplus/backend/util/frozen/frozen_map.h"
 #include "z2kplus/backend/util/frozen/frozen_set.h"
 #include "z2kplus/backend/util/frozen/frozen_string_pool.h"
 #include "z2kplus/backend/util/frozen/frozen_vector.h"
 
 namespace z2kplus::backend::reverse_index::metadata {
+// The frozen zgrams having a given reaction, as a bitmap over zgramOff, together with the number
+// of creators of each. The counts are in a parallel array, indexed by rank in the bitmap.
+class FrozenReactionCounts {
+  typedef z2kplus::backend::util::frozen::FrozenBitmap FrozenBitmap;
+  template<typename T>
+  using FrozenVector = z2kplus::backend::util::frozen::FrozenVector<T>;
+
+public:
+  FrozenReactionCounts() = default;
+  FrozenReactionCounts(FrozenBitmap &&zgramOffs, FrozenVector<uint32_t> &&counts) :
+      zgramOffs_(std::move(zgramOffs)), counts_(std::move(counts)) {}
+  DISALLOW_COPY_AND_ASSIGN(FrozenReactionCounts);
+  DECLARE_MOVE_COPY_AND_ASSIGN(FrozenReactionCounts);
+  ~FrozenReactionCounts();
+
+  const FrozenBitmap &zgramOffs() const { return zgramOffs_; }
+  // The count for the member of zgramOffs() with this rank.
+  uint32_t countAt(size_t rank) const { return counts_[rank]; }
+  size_t size() const { return counts_.size(); }
+
+private:
+  FrozenBitmap zgramOffs_;
+  FrozenVector<uint32_t> counts_;
+
+  friend std::ostream &operator<<(std::ostream &s, const FrozenReactionCounts &o);
+};
+
+// The running net ++ count of one key, over the zgrams that mention it with ++ or --.
+// cumulative()[i] is the net count as of zgramIds()[i].
+class FrozenPlusPlusCounts {
+  typedef z2kplus::backend::shared::ZgramId ZgramId;
+  template<typename T>
+  using FrozenVector = z2kplus::backend::util::frozen::FrozenVector<T>;
+
+public:
+  FrozenPlusPlusCounts() = default;
+  FrozenPlusPlusCounts(FrozenVector<ZgramId> &&zgramIds, FrozenVector<int64_t> &&cumulative) :
+      zgramIds_(std::move(zgramIds)), cumulative_(std::move(cumulative)) {}
+  DISALLOW_COPY_AND_ASSIGN(FrozenPlusPlusCounts);
+  DECLARE_MOVE_COPY_AND_ASSIGN(FrozenPlusPlusCounts);
+  ~FrozenPlusPlusCounts();
+
+  // Sorted and unique.
+  const FrozenVector<ZgramId> &zgramIds() const { return zgramIds_; }
+  const FrozenVector<int64_t> &cumulative() const { return cumulative_; }
+
+private:
+  FrozenVector<ZgramId> zgramIds_;
+  FrozenVector<int64_t> cumulative_;
+
+  friend std::ostream &operator<<(std::ostream &s, const FrozenPlusPlusCounts &o);
+};
+
 class FrozenMetadata {
   typedef z2kplus::backend::shared::RenderStyle RenderStyle;
   typedef z2kplus::backend::shared::ZgramId ZgramId;
   typedef z2kplus::backend::util::frozen::frozenStringRef_t frozenStringRef_t;
 
+  template<typename T>
+  using FrozenAdjacency = z2kplus::backend::util::frozen::FrozenAdjacency<T>;
   template<typename K, typename V>
   using FrozenMap = z2kplus::backend::util::frozen::FrozenMap<K, V>;
   template<typename T>
@@ -44,12 +101,14 @@ class FrozenMetadata {
 public:
   // zgramId -> reaction -> {creator}
   typedef FrozenMap<ZgramId, FrozenMap<frozenStringRef_t, FrozenSet<frozenStringRef_t>>> reactions_t;
-  // reaction -> zgramId -> count
-  typedef FrozenMap<frozenStringRef_t, FrozenMap<ZgramId, int64_t>> reactionCounts_t;
-  // zgramId -> [tuple<instance, body, renderstyle>].
-  typedef FrozenMap<ZgramId, FrozenVector<FrozenTuple<frozenStringRef_t, frozenStringRef_t, uint32_t>>> zgramRevisions_t;
-  // zgramId -> set<referred to ZgramId>
-  typedef FrozenMap<ZgramId, FrozenSet<ZgramId>> zgramRefersTo_t;
+  // reaction -> {zgramOff} and count
+  typedef FrozenMap<frozenStringRef_t, FrozenReactionCounts> reactionCounts_t;
+  // zgramOff -> [tuple<instance, body, renderstyle>], in order of arrival.
+  typedef FrozenAdjacency<FrozenTuple<frozenStringRef_t, frozenStringRef_t, uint32_t>> zgramRevisions_t;
+  // zgramOff -> sorted [referred to ZgramId]. The referred-to zgram need not be in the index.
+  typedef FrozenAdjacency<ZgramId> zgramRefersTo_t;
+  // zgramOff -> sorted [zgramOff of the zgrams referring to it]. The reverse of zgramRefersTo.
+  typedef FrozenAdjacency<zgramOff_t> zgramReferredBy_t;
   // userId -> zmojis
   typedef FrozenMap<frozenStringRef_t, frozenStringRef_t> zmojis_t;
   // key -> vector<ZgramIds> containing "key++". We can figure out the net ++ by doing a rank operation
@@ -58,15 +117,20 @@ public:
   typedef plusPluses_t minusMinuses_t;
   // zgram -> vector<keys> mentioned in zgram, even if they net to zero or if they are ~~ or ??
   typedef FrozenMap<ZgramId, FrozenVector<frozenStringRef_t>> plusPlusKeys_t;
+  // key -> its running net count, merged from plusPluses and minusMinuses
+  typedef FrozenMap<frozenStringRef_t, FrozenPlusPlusCounts> plusPlusCounts_t;
 
   FrozenMetadata();
 
   FrozenMetadata(reactions_t reactions, reactionCounts_t reactionCounts, zgramRevisions_t zgramRevisions,
-      zgramRefersTo_t zgramRefersTo, zmojis_t zmojis, plusPluses_t plusPluses, minusMinuses_t minusminuses,
-      plusPlusKeys_t plusPlusKeys) : reactions_(std::move(reactions)), reactionCounts_(std::move(reactionCounts)),
-      zgramRevisions_(std::move(zgramRevisions)), zgramRefersTo_(std::move(zgramRefersTo)), zmojis_(std::move(zmojis)),
+      zgramRefersTo_t zgramRefersTo, zgramReferredBy_t zgramReferredBy, zmojis_t zmojis,
+      plusPluses_t plusPluses, minusMinuses_t minusminuses, plusPlusKeys_t plusPlusKeys,
+      plusPlusCounts_t plusPlusCounts) :
+      reactions_(std::move(reactions)), reactionCounts_(std::move(reactionCounts)),
+      zgramRevisions_(std::move(zgramRevisions)), zgramRefersTo_(std::move(zgramRefersTo)),
+      zgramReferredBy_(std::move(zgramReferredBy)), zmojis_(std::move(zmojis)),
       plusPluses_(std::move(plusPluses)), minusMinuses_(std::move(minusminuses)),
-      plusPlusKeys_(std::move(plusPlusKeys)) {}
+      plusPlusKeys_(std::move(plusPlusKeys)), plusPlusCounts_(std::move(plusPlusCounts)) {}
   DISALLOW_COPY_AND_ASSIGN(FrozenMetadata);
   DECLARE_MOVE_COPY_AND_ASSIGN(FrozenMetadata);
   ~FrozenMetadata();
@@ -75,20 +139,24 @@ public:
   const reactionCounts_t &reactionCounts() const { return reactionCounts_; }
   const zgramRevisions_t &zgramRevisions() const { return zgramRevisions_; }
   const zgramRefersTo_t &zgramRefersTo() const { return zgramRefersTo_; }
+  const zgramReferredBy_t &zgramReferredBy() const { return zgramReferredBy_; }
   const zmojis_t &zmojis() const { return zmojis_; }
   const plusPluses_t &plusPluses() const { return plusPluses_; }
   const minusMinuses_t &minusMinuses() const { return minusMinuses_; }
   const plusPlusKeys_t &plusPlusKeys() const { return plusPlusKeys_; }
+  const plusPlusCounts_t &plusPlusCounts() const { return plusPlusCounts_; }
 
 private:
   reactions_t reactions_;
   reactionCounts_t reactionCounts_;
   zgramRevisions_t zgramRevisions_;
   zgramRefersTo_t zgramRefersTo_;
+  zgramReferredBy_t zgramReferredBy_;
   zmojis_t zmojis_;
   plusPluses_t plusPluses_;
   minusMinuses_t minusMinuses_;
   plusPlusKeys_t plusPlusKeys_;
+  plusPlusCounts_t plusPlusCounts_;
 
   friend std::ostream &operator<<(std::ostream &s, const FrozenMetadata &o);
 };
@@ -0,0 +1,64 @@
+// Copyright 2023 The Z2K Plus+ Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include "kosak/coding/coding.h"
+#include "kosak/coding/hashtable.h"
+
+namespace z2kplus::backend::reverse_index::metadata {
+// An open-addressing map from a 64-bit key (a raw ZgramId or an interned string id) to a 32-bit
+// value, which is usually an index into some other vector. Built on kosak's Hashtable, so an
+// entry is a flat 16 bytes and there are no per-entry allocations.
+class IdTable {
+public:
+  IdTable();
+  DISALLOW_COPY_AND_ASSIGN(IdTable);
+  DECLARE_MOVE_COPY_AND_ASSIGN(IdTable);
+  ~IdTable();
+
+  // Returns nullptr if 'key' is not present.
+  const uint32_t *tryFind(uint64_t key) const;
+
+  // Returns the value for 'key'. If 'key' is not present, first inserts it with 'valueIfAbsent'
+  // and sets *inserted.
+  uint32_t findOrInsert(uint64_t key, uint32_t valueIfAbsent, bool *inserted);
+
+  void insertOrAssign(uint64_t key, uint32_t value);
+
+  size_t size() const { return table_.size(); }
+
+private:
+  struct Entry {
+    uint64_t key_ = 0;
+    uint32_t value_ = 0;
+    bool valid_ = false;
+  };
+
+  struct Utils {
+    static void makeInvalid(Entry *entry) { entry->valid_ = false; }
+    static bool isValid(const Entry &entry) { return entry.valid_; }
+    static bool equal(const Entry &entry, uint64_t key) { return entry.key_ == key; }
+    static bool equal(const Entry &lhs, const Entry &rhs) { return lhs.key_ == rhs.key_; }
+    static std::pair<size_t, size_t> hash(uint64_t key);
+    static std::pair<size_t, size_t> hash(const Entry &entry) { return hash(entry.key_); }
+  };
+
+  Entry *findOrInsertEntry(uint64_t key, bool *inserted);
+
+  kosak::coding::Hashtable<Entry, Utils> table_;
+};
+}  // namespace z2kplus::backend::reverse_index::metadata
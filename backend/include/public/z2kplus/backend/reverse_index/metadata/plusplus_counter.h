@@ -0,0 +1,84 @@
+// Copyright 2023 The Z2K Plus+ Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <vector>
+#include "kosak/coding/coding.h"
+#include "z2kplus/backend/reverse_index/metadata/frozen_metadata.h"
+#include "z2kplus/backend/reverse_index/metadata/plusplus_key_dictionary.h"
+#include "z2kplus/backend/shared/zephyrgram.h"
+
+namespace z2kplus::backend::reverse_index::metadata {
+// Answers "what is the net ++ count for 'key' as of zgram X" for the frozen and dynamic tiers
+// together. Keys are identified by their PlusPlusKeyDictionary id. The frozen tier's running totals
+// are laid out in the index by the MetadataBuilder and used where they lie; all this class keeps on
+// the heap is a pointer per frozen key and the deltas that have arrived since the index was built.
+// A query is one array index plus a binary search in each tier.
+class PlusPlusCounter {
+  typedef z2kplus::backend::shared::ZgramId ZgramId;
+  typedef PlusPlusKeyDictionary::keyId_t keyId_t;
+
+public:
+  static PlusPlusCounter createFromFrozen(const FrozenMetadata &metadata,
+      const PlusPlusKeyDictionary &keys);
+
+  PlusPlusCounter();
+  DISALLOW_COPY_AND_ASSIGN(PlusPlusCounter);
+  DECLARE_MOVE_COPY_AND_ASSIGN(PlusPlusCounter);
+  ~PlusPlusCounter();
+
+  void add(keyId_t key, ZgramId zgramId, int64_t delta);
+
+  // The net count for 'key', counting every ++ and -- in zgrams up to and including 'zgramId'.
+  int64_t countAfter(keyId_t key, ZgramId zgramId) const;
+
+  // Batch form of 'countAfter' for a single key. 'zgramIds' must be sorted in ascending order.
+  // Writes 'size' counts to 'result'.
+  void countsAfter(keyId_t key, const ZgramId *zgramIds, size_t size, int64_t *result) const;
+
+private:
+  // The dynamic deltas for one key. New zgrams have the largest ids, so a delta is almost always an
+  // append to the running totals. A delta for an older zgram (from an edit) would mean adjusting
+  // every total after it, so it is kept in 'late_' instead and added in at query time.
+  struct Tail {
+    // Sorted and unique.
+    std::vector<ZgramId> zgramIds_;
+    // cumulative_[i] is the net of the deltas in zgramIds_ up to and including zgramIds_[i].
+    std::vector<int64_t> cumulative_;
+    // zgramId -> the net of the deltas that arrived for it out of order.
+    std::map<ZgramId, int64_t> late_;
+
+    void add(ZgramId zgramId, int64_t delta);
+    int64_t countAfter(ZgramId zgramId) const;
+    // Adds the counts for the sorted 'zgramIds' to 'result'.
+    void addCountsAfter(const ZgramId *zgramIds, size_t size, int64_t *result) const;
+  };
+
+  // Returns nullptr if 'key' isn't in the frozen index.
+  const FrozenPlusPlusCounts *findFrozen(keyId_t key) const;
+  // Returns nullptr if 'key' has had no dynamic deltas.
+  const Tail *findTail(keyId_t key) const;
+
+  // Indexed by key id. These point into the frozen index.
+  std::vector<const FrozenPlusPlusCounts *> frozen_;
+  // key id -> its dynamic deltas.
+  std::map<keyId_t, Tail> tails_;
+
+  friend std::ostream &operator<<(std::ostream &s, const PlusPlusCounter &o);
+};
+}  // namespace z2kplus::backend::reverse_index::metadata
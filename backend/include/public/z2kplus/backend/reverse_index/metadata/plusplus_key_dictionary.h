@@ -0,0 +1,71 @@
+// Copyright 2023 The Z2K Plus+ Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "kosak/coding/coding.h"
+#include "z2kplus/backend/reverse_index/metadata/frozen_metadata.h"
+#include "z2kplus/backend/util/frozen/frozen_string_pool.h"
+
+namespace z2kplus::backend::reverse_index::metadata {
+// Assigns dense 32-bit ids to plusplus keys, so that everything downstream of the scanner can
+// work on integers. The keys mentioned anywhere in the frozen metadata get ids 0..numFrozen() - 1,
+// in frozenStringRef_t (that is, canonical string) order, so a frozen ref maps to its id by binary
+// search. Keys first seen on the dynamic side get ids from numFrozen() upward. Ids are stable for
+// the lifetime of the dictionary.
+class PlusPlusKeyDictionary {
+  typedef z2kplus::backend::util::frozen::FrozenStringPool FrozenStringPool;
+  typedef z2kplus::backend::util::frozen::frozenStringRef_t frozenStringRef_t;
+
+public:
+  typedef uint32_t keyId_t;
+
+  // Does not own 'stringPool'.
+  static PlusPlusKeyDictionary createFromFrozen(const FrozenMetadata &metadata,
+      const FrozenStringPool *stringPool);
+
+  PlusPlusKeyDictionary();
+  DISALLOW_COPY_AND_ASSIGN(PlusPlusKeyDictionary);
+  DECLARE_MOVE_COPY_AND_ASSIGN(PlusPlusKeyDictionary);
+  ~PlusPlusKeyDictionary();
+
+  keyId_t intern(std::string_view key);
+  bool tryFind(std::string_view key, keyId_t *result) const;
+  bool tryFindFrozen(frozenStringRef_t fsr, keyId_t *result) const;
+  // Returns false for keys that aren't in the frozen metadata.
+  bool tryGetFrozenRef(keyId_t id, frozenStringRef_t *result) const;
+  std::string_view toStringView(keyId_t id) const;
+
+  size_t size() const { return frozenKeys_.size() + dynamicKeys_.size(); }
+  size_t numFrozen() const { return frozenKeys_.size(); }
+
+private:
+  // Does not own.
+  const FrozenStringPool *stringPool_ = nullptr;
+  // Sorted. Indexed by id.
+  std::vector<frozenStringRef_t> frozenKeys_;
+  // key -> id
+  std::map<std::string, keyId_t, std::less<>> dynamicIds_;
+  // Indexed by (id - numFrozen()). These point at the keys of dynamicIds_.
+  std::vector<std::string_view> dynamicKeys_;
+
+  friend std::ostream &operator<<(std::ostream &s, const PlusPlusKeyDictionary &o);
+};
+}  // namespace z2kplus::backend::reverse_index::metadata
@@ -0,0 +1,83 @@
+// Copyright 2023 The Z2K Plus+ Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "kosak/coding/coding.h"
+#include "kosak/coding/hashtable.h"
+#include "z2kplus/backend/util/frozen/frozen_string_pool.h"
+
+namespace z2kplus::backend::reverse_index::metadata {
+// Assigns dense 32-bit ids to strings, sharing an id space with a FrozenStringPool: ids below
+// frozenPool->size() are the raw frozenStringRef_t of strings that are already in the frozen pool,
+// and new strings get ids from there upward. The text of new strings is copied into large chunks,
+// so interning doesn't do an allocation per string, and the string_views we hand out stay valid
+// for the lifetime of the interner.
+class StringInterner {
+  typedef z2kplus::backend::util::frozen::FrozenStringPool FrozenStringPool;
+
+public:
+  typedef uint32_t stringId_t;
+
+  StringInterner();
+  // Does not own 'frozenPool', which may be null.
+  explicit StringInterner(const FrozenStringPool *frozenPool);
+  DISALLOW_COPY_AND_ASSIGN(StringInterner);
+  DECLARE_MOVE_COPY_AND_ASSIGN(StringInterner);
+  ~StringInterner();
+
+  stringId_t intern(std::string_view s);
+  bool tryFind(std::string_view s, stringId_t *result) const;
+  std::string_view toStringView(stringId_t id) const;
+
+  size_t numDynamicStrings() const { return dynamicStrings_.size(); }
+
+private:
+  struct Entry {
+    const char *data_ = nullptr;
+    uint32_t size_ = 0;
+    stringId_t id_ = 0;
+
+    std::string_view sv() const { return {data_, size_}; }
+  };
+
+  struct Utils {
+    static void makeInvalid(Entry *entry) { entry->data_ = nullptr; }
+    static bool isValid(const Entry &entry) { return entry.data_ != nullptr; }
+    static bool equal(const Entry &entry, std::string_view key) { return entry.sv() == key; }
+    static bool equal(const Entry &lhs, const Entry &rhs) { return lhs.sv() == rhs.sv(); }
+    static std::pair<size_t, size_t> hash(std::string_view key);
+    static std::pair<size_t, size_t> hash(const Entry &entry) { return hash(entry.sv()); }
+  };
+
+  std::string_view copyToArena(std::string_view s);
+
+  // Does not own.
+  const FrozenStringPool *frozenPool_ = nullptr;
+  size_t frozenSize_ = 0;
+
+  // Indexed by (id - frozenSize_).
+  std::vector<std::string_view> dynamicStrings_;
+  kosak::coding::Hashtable<Entry, Utils> lookup_;
+
+  std::vector<std::unique_ptr<char[]>> chunks_;
+  char *chunkCurrent_ = nullptr;
+  size_t chunkRemaining_ = 0;
+};
+}  // namespace z2kplus::backend::reverse_index::metadata
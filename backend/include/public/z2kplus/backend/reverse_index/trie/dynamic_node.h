@@ -44,9 +44,12 @@ public:
       std::pair<const wordOff_t *, const wordOff_t *> *result) const;
   void insert(std::u32string_view probe, const wordOff_t *begin, size_t size);
 
-  void findMatching(const FiniteAutomaton &dfa,
+  // Like FrozenNode::tryFindMatching. Inserting words changes the shape of the trie, so a '*path'
+  // from before an insert is no good afterwards.
+  bool tryFindMatching(const FiniteAutomaton &dfa, const kosak::coding::Delegate<bool> &outOfBudget,
+      std::vector<uint32_t> *path,
       const kosak::coding::Delegate<void, const wordOff_t *, const wordOff_t *> &callback) const {
-    findMatchingHelper(dfa.start(), callback);
+    return tryFindMatchingHelper(dfa.start(), outOfBudget, path, 0, callback);
   }
 
   void dump(std::ostream &s, std::u32string *prefix) const;
@@ -55,7 +58,8 @@ private:
   DynamicNode(std::u32string &&prefix, std::vector<wordOff_t> &&wordsHere,
       transitions_t &&transitions);
 
-  void findMatchingHelper(const DFANode *dfaNode,
+  bool tryFindMatchingHelper(const DFANode *dfaNode,
+      const kosak::coding::Delegate<bool> &outOfBudget, std::vector<uint32_t> *path, size_t depth,
       const kosak::coding::Delegate<void, const wordOff_t *, const wordOff_t *> &callback) const;
 
   void insertHelper(std::u32string_view probe, const wordOff_t *begin, size_t size);
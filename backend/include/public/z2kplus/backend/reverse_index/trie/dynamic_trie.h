@@ -42,9 +42,10 @@ public:
     root_.insert(probe, begin, size);
   }
 
-  void findMatching(const FiniteAutomaton &dfa,
+  bool tryFindMatching(const FiniteAutomaton &dfa, const kosak::coding::Delegate<bool> &outOfBudget,
+      std::vector<uint32_t> *path,
       const kosak::coding::Delegate<void, const wordOff_t *, const wordOff_t *> &callback) const {
-    root_.findMatching(dfa, callback);
+    return root_.tryFindMatching(dfa, outOfBudget, path, callback);
   }
 
 private:
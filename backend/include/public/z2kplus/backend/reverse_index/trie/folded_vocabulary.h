@@ -0,0 +1,77 @@
+// Copyright 2023 The Z2K Plus+ Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include "kosak/coding/coding.h"
+#include "kosak/coding/delegate.h"
+#include "z2kplus/backend/util/frozen/frozen_vector.h"
+
+namespace z2kplus::backend::reverse_index::trie {
+// A side table for the frozen trie that maps the folded form of a word (see foldLookalike) back to
+// the words in the trie that fold to it. Only words that differ from their folded form are stored;
+// a word that is already folded can be looked up in the trie directly. This lets a Loose pattern
+// like "~cinnabon" be answered with a few exact lookups instead of walking every branch of the trie
+// that the (very wide) Loose DFA admits.
+class FoldedVocabulary {
+  template<typename T>
+  using FrozenVector = z2kplus::backend::util::frozen::FrozenVector<T>;
+
+public:
+  // Both the key and the word are ranges of 'text'.
+  struct Entry {
+    Entry() = default;
+    Entry(uint32_t keyBegin, uint32_t keySize, uint32_t wordBegin, uint32_t wordSize) :
+        keyBegin_(keyBegin), keySize_(keySize), wordBegin_(wordBegin), wordSize_(wordSize) {}
+
+    uint32_t keyBegin_ = 0;
+    uint32_t keySize_ = 0;
+    uint32_t wordBegin_ = 0;
+    uint32_t wordSize_ = 0;
+  };
+
+  // Appends the folded form of 'word' to 'result'.
+  static void fold(std::u32string_view word, std::u32string *result);
+
+  FoldedVocabulary();
+  // 'entries' must be sorted by key.
+  FoldedVocabulary(FrozenVector<char32_t> text, FrozenVector<Entry> entries);
+  DISALLOW_COPY_AND_ASSIGN(FoldedVocabulary);
+  DECLARE_MOVE_COPY_AND_ASSIGN(FoldedVocabulary);
+  ~FoldedVocabulary();
+
+  // Invokes 'callback' on every stored word whose folded form is 'key'.
+  void findOriginals(std::u32string_view key,
+      const kosak::coding::Delegate<void, std::u32string_view> &callback) const;
+
+  size_t size() const { return entries_.size(); }
+
+private:
+  std::u32string_view keyOf(const Entry &e) const {
+    return {text_.data() + e.keyBegin_, e.keySize_};
+  }
+  std::u32string_view wordOf(const Entry &e) const {
+    return {text_.data() + e.wordBegin_, e.wordSize_};
+  }
+
+  FrozenVector<char32_t> text_;
+  FrozenVector<Entry> entries_;
+
+  friend std::ostream &operator<<(std::ostream &s, const FoldedVocabulary &o);
+};
+}  // namespace z2kplus::backend::reverse_index::trie
@@ -18,6 +18,8 @@
 #include <memory>
 #include <string>
 #include <string_view>
+#include <vector>
+#include "kosak/coding/delegate.h"
 #include "z2kplus/backend/reverse_index/types.h"
 #include "z2kplus/backend/util/misc.h"
 #include "z2kplus/backend/util/myallocator.h"
@@ -27,7 +29,8 @@
 namespace z2kplus::backend::reverse_index::trie {
 // This class points to a variable-sized object, described below in
 // internal::FrozenNodeDocumentation. You interpret this class with a FrozenNodeView
-// (defined anonymously in frozen_node.cc)
+// (defined anonymously in frozen_node.cc). The words at a node aren't stored in the node but in the
+// trie's postings array, which is passed in as 'postings'.
 class FrozenNode {
   typedef kosak::coding::FailFrame FailFrame;
   template<typename T>
@@ -35,24 +38,30 @@ class FrozenNode {
   typedef z2kplus::backend::util::automaton::FiniteAutomaton FiniteAutomaton;
 
 public:
-  bool tryFind(std::u32string_view probe,
+  bool tryFind(const wordOff_t *postings, std::u32string_view probe,
       std::pair<const wordOff_t *, const wordOff_t *> *result) const;
 
-  void findMatching(const FiniteAutomaton &dfa,
+  // Walks the nodes depth-first, reporting the words of those that 'dfa' accepts. Polls
+  // 'outOfBudget' before visiting each node, and if it says to stop, returns false with '*path'
+  // holding the indices of the transitions that lead to that node. Calling again with that path
+  // picks up at that node, without repeating any callbacks. A complete walk leaves '*path' empty.
+  bool tryFindMatching(const wordOff_t *postings, const FiniteAutomaton &dfa,
+      const kosak::coding::Delegate<bool> &outOfBudget, std::vector<uint32_t> *path,
       const kosak::coding::Delegate<void, const wordOff_t *, const wordOff_t *> &callback) const;
 
-  bool tryDump(std::ostream &s, std::string *debugReadable, const FailFrame &ff) const;
+  bool tryDump(const wordOff_t *postings, std::ostream &s, std::string *debugReadable,
+      const FailFrame &ff) const;
 
   // The fixed part of the data structure
   uint32_t prefixSize_;
+  // The words at this node are postings[firstWordHere_, firstWordHere_ + numWordsHere_).
+  uint32_t firstWordHere_;
   uint32_t numWordsHere_;
   uint32_t numTransitions_;
   // These lengths are all wrong (they are written as length 0), so you actually have to
   // dynamically step through the rest of this type.
   // Incoming prefix to this node.
   char32_t prefix_[0];
-  // // The words at this node. Has size numWordsHere_.
-  // wordOff_t wordsHere[numWordsHere_];
   // // The keys of the outgoing transitions. Has size numTransitions_.
   // char32_t transitionKeys_[numTranstitions_];
   // // The transitions themselves. Has size numTransitions_. Since they are aligned to 64 bits,
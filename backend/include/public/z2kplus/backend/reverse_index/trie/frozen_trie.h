@@ -21,6 +21,7 @@
 #include <vector>
 #include "kosak/coding/coding.h"
 #include "z2kplus/backend/reverse_index/trie/dynamic_node.h"
+#include "z2kplus/backend/reverse_index/trie/folded_vocabulary.h"
 #include "z2kplus/backend/reverse_index/trie/frozen_node.h"
 #include "z2kplus/backend/reverse_index/types.h"
 #include "z2kplus/backend/util/automaton/automaton.h"
@@ -29,6 +30,10 @@
 
 namespace z2kplus::backend::reverse_index::trie {
 
+// The nodes of the trie live in the index's trie section, and the words at the nodes (the postings)
+// live in one array in the postings section. The nodes are walked on every lookup, whereas the
+// postings of a word are only read when the word matches, so the two have different access
+// policies (see IndexLayout).
 class FrozenTrie {
   typedef z2kplus::backend::util::automaton::FiniteAutomaton FiniteAutomaton;
   template<typename T>
@@ -36,23 +41,35 @@ class FrozenTrie {
 
 public:
   FrozenTrie() = default;
-  explicit FrozenTrie(const FrozenNode *root) : root_(root) {}
+  FrozenTrie(const FrozenNode *root, FoldedVocabulary folded) : root_(root),
+      folded_(std::move(folded)) {}
   DISALLOW_COPY_AND_ASSIGN(FrozenTrie);
   DEFINE_MOVE_COPY_AND_ASSIGN(FrozenTrie);
   ~FrozenTrie() = default;
 
   bool tryFind(std::u32string_view probe,
       std::pair<const wordOff_t *, const wordOff_t *> *result) const {
-    return root_.get()->tryFind(probe, result);
+    return root_.get()->tryFind(postings_.get(), probe, result);
   }
 
-  void findMatching(const FiniteAutomaton &dfa,
-      const kosak::coding::Delegate<void, const wordOff_t *, const wordOff_t *> &callback) const {
-    root_.get()->findMatching(dfa, callback);
-  }
+  // If the DFA offers folded probes, answers via exact lookups of those probes and of the words in
+  // 'folded_' that fold to them. Otherwise walks the trie with the DFA. Either way the walk can be
+  // interrupted and resumed, as described at FrozenNode::tryFindMatching. When looking up probes,
+  // '*path' is just the index of the next probe, and 'outOfBudget' is polled once per probe.
+  bool tryFindMatching(const FiniteAutomaton &dfa, const kosak::coding::Delegate<bool> &outOfBudget,
+      std::vector<uint32_t> *path,
+      const kosak::coding::Delegate<void, const wordOff_t *, const wordOff_t *> &callback) const;
+
+  const FoldedVocabulary &folded() const { return folded_; }
+
+  const wordOff_t *postings() const { return postings_.get(); }
+  // The builder lays out the postings after the nodes, and then points the trie at them.
+  void setPostings(const wordOff_t *postings) { postings_.set(postings); }
 
 private:
   RelativePtr<const FrozenNode> root_;
+  RelativePtr<const wordOff_t> postings_;
+  FoldedVocabulary folded_;
 
   friend std::ostream &operator<<(std::ostream &s, const FrozenTrie &o);
 };
@@ -25,20 +25,90 @@ namespace magicConstants {
 
 constexpr int listenPort = 8001;
 constexpr size_t nearMargin = 3;
-constexpr size_t numIndexBuilderShards = 4;
+// The index builder splits the logs into chunks of about this many bytes (whole days at a time)
+// and digests them on a pool of threads (0 means one per core). The chunking, and therefore the
+// index, does not depend on the number of threads.
+constexpr size_t indexBuilderChunkSize = 64 * 1024 * 1024;
+constexpr size_t indexBuilderNumThreads = 0;
+// Each digester groups its trie postings by word in memory, spilling a sorted run to disk whenever
+// they take up about this many bytes.
+constexpr size_t trieEntriesBudget = 64 * 1024 * 1024;
+// The memory budget for a whole index build (0 means unlimited). Stages spill earlier, run fewer
+// threads, or give their external sorts smaller buffers to stay within it.
+constexpr size_t indexBuilderMemoryBudget = 4UL * 1024 * 1024 * 1024;
+constexpr size_t indexBuilderMinSortBuffer = 1024 * 1024;
+constexpr size_t indexBuilderMaxSortBuffer = 256 * 1024 * 1024;
+// Part of every digest cache key. Bump it whenever the splitter's or the digester's output format
+// changes, so that a build never picks up entries written by an older one.
+constexpr uint64_t digestCacheVersion = 2;
+// A digest cache hit is normally vouched for by the size, inode and mtime of its files. One hit in
+// this many also re-checksums them, to catch damage that leaves all three alone.
+constexpr size_t digestCacheChecksumEvery = 16;
+// The index file grows (with real blocks, not holes) this much at a time as the builder lays it
+// out. Pages this far behind the builder are written back in order and then, if so configured,
+// dropped from the page cache.
+constexpr size_t indexWriterGrowStep = 64 * 1024 * 1024;
+constexpr size_t indexWriterWriteBehind = 64 * 1024 * 1024;
+constexpr bool indexWriterDropWrittenPages = true;
 
 constexpr auto purgeInterval = std::chrono::minutes(5);
 constexpr auto reindexingInterval = std::chrono::minutes(10);
+// Background reindexing runs at lower CPU and I/O priority, paces its writes, and pauses while the
+// server is struggling (a batch of requests took longer than the latency threshold, or the queue
+// was deeper than the depth threshold).
+constexpr int reindexingNiceness = 10;
+constexpr size_t reindexingWriteBytesPerSecond = 128 * 1024 * 1024;
+constexpr auto reindexingLatencyThreshold = std::chrono::milliseconds(50);
+constexpr size_t reindexingQueueDepthThreshold = 64;
+// How long the reindexer stays paused after the server last reported trouble, and the longest a
+// single write will wait for it to clear.
+constexpr auto reindexingPressureHold = std::chrono::seconds(1);
+constexpr auto reindexingMaxPause = std::chrono::seconds(5);
 constexpr auto unloggedLifespan = std::chrono::hours(24 * 7);
 constexpr const char *zalexaId = "zalexa";
 constexpr const char *zalexaSignature = "Zalexa";
 
 constexpr size_t iteratorChunkSize = 256;
+// How long a single topUp of a subscription may spend evaluating its query before returning
+// partial results.
+constexpr auto queryTimeBudget = std::chrono::milliseconds(100);
+// A query that keeps running out of budget without progress gets twice the budget each time, but
+// never more than this, so that one expensive query can't stall the coordinator (which serves every
+// subscription on one thread) for long.
+constexpr auto maxQueryTimeBudget = queryTimeBudget * 8;
+// How many trie nodes the planner may visit to estimate the size of one pattern before settling
+// for the trivial estimate.
+constexpr size_t maxEstimateTrieNodes = 4096;
 
 constexpr size_t zgramCacheSize = 500;
+// Read-ahead for clients paging steadily through a subscription. A subscription side counts as
+// paging sequentially when its GetMoreZgrams requests arrive within prefetchWindow of each other.
+constexpr auto prefetchWindow = std::chrono::seconds(3);
+// Each consecutive page widens the read-ahead by one page, up to this many zgrams per side.
+constexpr size_t prefetchMaxZgrams = 200;
+// How many read-ahead zgrams the ZgramCache holds (until first use) across all subscriptions.
+constexpr size_t prefetchCacheSize = 400;
+// Time the coordinator may spend between requests resolving read-ahead query results.
+constexpr auto prefetchTimeBudget = std::chrono::milliseconds(10);
+// Time the coordinator may spend between requests extending the QueryCache's entries.
+constexpr auto queryCacheTimeBudget = std::chrono::milliseconds(10);
+// Starting size of the open-addressing tables in DynamicMetadata. They double as they fill.
+constexpr size_t idTableInitialBuckets = 16;
+// Size of the chunks that DynamicMetadata's string arena allocates (larger strings get their own).
+constexpr size_t stringArenaChunkSize = 64 * 1024;
 
 constexpr size_t maxPlusPlusKeySize = 256;
 
+// Layout of the frozen index. Every section starts on a page boundary, and the group of hot
+// sections at the front of the file is padded out to a hugepage boundary.
+constexpr size_t indexSectionAlignment = 4096;
+constexpr size_t indexHotGroupAlignment = 2 * 1024 * 1024;
+// Whether the loader asks for transparent hugepages on the hot sections, and whether it mlocks
+// them. Both are off by default: the first needs kernel support for file-backed THP, and the
+// second needs a generous RLIMIT_MEMLOCK.
+constexpr bool indexUseHugePages = false;
+constexpr bool indexLockHotSet = false;
+
 extern std::regex plusPlusRegex;
 
 namespace filenames {
@@ -56,6 +126,7 @@ constexpr const char *plusPlusKeys = "plusplus_keys";
 constexpr const char *reactionsByZgramId = "reactions_by_zgid";
 constexpr const char *reactionsByReaction = "reactions_by_reaction";
 constexpr const char *trieEntries = "trie_entries";
+constexpr const char *triePostings = "trie_postings";
 constexpr const char *wordInfos = "wordInfos";
 constexpr const char *zgramInfos = "zgramInfos";
 constexpr const char *zgramRevisions = "zgram_revisions";
@@ -24,6 +24,7 @@
 #include "z2kplus/backend/shared/profile.h"
 #include "z2kplus/backend/shared/protocol/misc.h"
 #include "z2kplus/backend/shared/zephyrgram.h"
+#include "z2kplus/backend/shared/zgram_view.h"
 
 namespace z2kplus::backend::shared::protocol::message {
 
@@ -75,18 +76,19 @@ private:
 // temporarily hold values to and from their JSON representation, would *not* normally use
 // shared_ptr in their representation. However, in this case, this plays so nicely with our cache,
 // that I'm going to do it anyway. In the future I might have these objects be some kind of
-// interface representation or something.
+// interface representation or something. The zgrams are ZgramViews, so their JSON is spliced
+// straight from the log text.
 class AckMoreZgrams {
 public:
   AckMoreZgrams();
-  AckMoreZgrams(bool forBackside, std::vector<std::shared_ptr<const Zephyrgram>> zgrams,
+  AckMoreZgrams(bool forBackside, std::vector<std::shared_ptr<const ZgramView>> zgrams,
       Estimates estimates);
   DISALLOW_COPY_AND_ASSIGN(AckMoreZgrams);
   DECLARE_MOVE_COPY_AND_ASSIGN(AckMoreZgrams);
   ~AckMoreZgrams();
 
-  std::vector<std::shared_ptr<const Zephyrgram>> &zgrams() { return zgrams_; }
-  const std::vector<std::shared_ptr<const Zephyrgram>> &zgrams() const { return zgrams_; }
+  std::vector<std::shared_ptr<const ZgramView>> &zgrams() { return zgrams_; }
+  const std::vector<std::shared_ptr<const ZgramView>> &zgrams() const { return zgrams_; }
 
   bool forBackside() const { return forBackside_; }
   Estimates &estimates() { return estimates_; }
@@ -94,7 +96,7 @@ public:
 
 private:
   bool forBackside_ = false;
-  std::vector<std::shared_ptr<const Zephyrgram>> zgrams_;
+  std::vector<std::shared_ptr<const ZgramView>> zgrams_;
   Estimates estimates_;
 
   friend std::ostream &operator<<(std::ostream &s, const AckMoreZgrams &o);
@@ -139,16 +141,16 @@ private:
 class AckSpecificZgrams {
 public:
   AckSpecificZgrams();
-  explicit AckSpecificZgrams(std::vector<std::shared_ptr<const Zephyrgram>> zgrams);
+  explicit AckSpecificZgrams(std::vector<std::shared_ptr<const ZgramView>> zgrams);
   DISALLOW_COPY_AND_ASSIGN(AckSpecificZgrams);
   DECLARE_MOVE_COPY_AND_ASSIGN(AckSpecificZgrams);
   ~AckSpecificZgrams();
 
-  std::vector<std::shared_ptr<const Zephyrgram>> &zgrams() { return zgrams_; }
-  const std::vector<std::shared_ptr<const Zephyrgram>> &zgrams() const { return zgrams_; }
+  std::vector<std::shared_ptr<const ZgramView>> &zgrams() { return zgrams_; }
+  const std::vector<std::shared_ptr<const ZgramView>> &zgrams() const { return zgrams_; }
 
 private:
-  std::vector<std::shared_ptr<const Zephyrgram>> zgrams_;
+  std::vector<std::shared_ptr<const ZgramView>> zgrams_;
 
   friend std::ostream &operator<<(std::ostream &s, const AckSpecificZgrams &o);
   DECLARE_TYPICAL_JSON(AckSpecificZgrams);
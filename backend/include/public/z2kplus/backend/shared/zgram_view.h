@@ -0,0 +1,91 @@
+// Copyright 2023 The Z2K Plus+ Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include "kosak/coding/coding.h"
+#include "kosak/coding/failures.h"
+#include "kosak/coding/myjson.h"
+#include "z2kplus/backend/shared/zephyrgram.h"
+
+namespace z2kplus::backend::shared {
+// An immutable, compact stand-in for a Zephyrgram, backed by the zgram's JSON text exactly as it
+// appears in the log. The scalar fields are decoded up front; the string fields are kept as spans
+// of still-escaped JSON within that text. Appending a ZgramView to a JSON response splices the
+// text verbatim, so serving a cached zgram costs neither a parse nor a re-serialization.
+class ZgramView {
+  typedef kosak::coding::FailFrame FailFrame;
+  typedef kosak::coding::ParseContext ParseContext;
+
+public:
+  // The half-open range of a JSON string token (quotes included) within json().
+  struct Span {
+    uint32_t begin_ = 0;
+    uint32_t end_ = 0;
+  };
+
+  // 'logRecord' is the text of one log record (as referenced by a LogLocation). Fails if the record
+  // is not a zgram.
+  static bool tryCreateFromLogRecord(std::string_view logRecord,
+      std::shared_ptr<const ZgramView> *result, const FailFrame &ff);
+
+  ZgramView();
+  DISALLOW_COPY_AND_ASSIGN(ZgramView);
+  DECLARE_MOVE_COPY_AND_ASSIGN(ZgramView);
+  ~ZgramView();
+
+  ZgramId zgramId() const { return zgramId_; }
+  uint64_t timesecs() const { return timesecs_; }
+  bool isLogged() const { return isLogged_; }
+  RenderStyle renderStyle() const { return renderStyle_; }
+
+  // The JSON for the whole zgram, in the same format as tryAppendJson(const Zephyrgram &).
+  std::string_view json() const { return json_; }
+  std::string_view senderJson() const { return spanToJson(sender_); }
+  std::string_view signatureJson() const { return spanToJson(signature_); }
+  std::string_view instanceJson() const { return spanToJson(instance_); }
+  std::string_view bodyJson() const { return spanToJson(body_); }
+
+  // Decodes the view into a full Zephyrgram, for callers that need the unescaped strings.
+  bool tryDecode(Zephyrgram *result, const FailFrame &ff) const;
+
+private:
+  // Parses one Zephyrgram from 'ctx' into our scalar fields and spans, where the spans are relative
+  // to 'base'. Does not touch json_.
+  bool tryParseFields(ParseContext *ctx, const char *base, const FailFrame &ff);
+
+  std::string_view spanToJson(const Span &span) const {
+    return std::string_view(json_).substr(span.begin_, span.end_ - span.begin_);
+  }
+
+  std::string json_;
+  ZgramId zgramId_;
+  uint64_t timesecs_ = 0;
+  Span sender_;
+  Span signature_;
+  Span instance_;
+  Span body_;
+  bool isLogged_ = true;
+  RenderStyle renderStyle_ = RenderStyle::Default;
+
+  friend bool tryAppendJson(const ZgramView &o, std::string *result, const FailFrame &ff);
+  friend bool tryParseJson(ParseContext *ctx, ZgramView *result, const FailFrame &ff);
+  friend std::ostream &operator<<(std::ostream &s, const ZgramView &o);
+};
+}  // namespace z2kplus::backend::shared
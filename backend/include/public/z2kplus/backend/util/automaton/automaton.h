@@ -41,13 +41,28 @@ public:
   const DFANode *start() const { return start_; }
   const std::string &description() const { return description_; }
 
+  // For a pattern that contains Loose characters but no wildcards, every word it matches folds
+  // (via foldLookalike) to one of a small number of strings. These are those strings, for use as
+  // exact lookups into a folded vocabulary. Candidates found that way still need to be confirmed by
+  // running them through the DFA. Returns nullptr if the pattern doesn't qualify, or if it would
+  // produce more than maxFoldedProbes strings.
+  const std::vector<std::u32string> *foldedProbes() const {
+    return hasFoldedProbes_ ? &foldedProbes_ : nullptr;
+  }
+
+  static constexpr size_t maxFoldedProbes = 64;
+
 private:
+  void computeFoldedProbes(const PatternChar *begin, size_t patternSize);
+
   // All the nodes.
   std::vector<DFANode> nodes_;
   // The start node.
   const DFANode *start_ = nullptr;
   // Human-readable description.
   std::string description_;
+  bool hasFoldedProbes_ = false;
+  std::vector<std::u32string> foldedProbes_;
 
   friend std::ostream &operator<<(std::ostream &s, const FiniteAutomaton &o);
 };
@@ -14,8 +14,19 @@
 
 #pragma once
 
+#include <string>
 #include <string_view>
 
 namespace z2kplus::backend::util::automaton {
 std::string_view getFuzzyEquivalents(char ch);
+
+// Maps a character to the ASCII lowercase letter it is a lookalike of (for example 'C', 'ç' and '𝓬'
+// all map to 'c'). Characters that resemble no letter map to themselves. The handful of characters
+// that resemble more than one letter map to the first of them, so callers that need an exact answer
+// must consult getLooseFoldings as well.
+char32_t foldLookalike(char32_t ch);
+
+// The set of values foldLookalike can produce for a character that a Loose 'ch' matches. Usually
+// this is just 'ch' itself. Returns an empty string if 'ch' is not an ASCII lowercase letter.
+std::u32string_view getLooseFoldings(char ch);
 }  // namespace z2kplus::backend::util::automaton
@@ -0,0 +1,64 @@
+// Copyright 2023 The Z2K Plus+ Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include "kosak/coding/coding.h"
+#include "kosak/coding/containers/slice.h"
+#include "z2kplus/backend/util/frozen/frozen_vector.h"
+
+namespace z2kplus::backend::util::frozen {
+// A graph in compressed sparse row form. The rows are numbered densely from 0, and the neighbors
+// of row i are targets_[offsets_[i], offsets_[i + 1]). So looking up a row is two array reads
+// rather than a search.
+template<typename T>
+class FrozenAdjacency {
+  template<typename U>
+  using Slice = kosak::coding::containers::Slice<U>;
+
+public:
+  typedef T value_type;
+
+  FrozenAdjacency() = default;
+  // 'offsets' has one more element than there are rows.
+  FrozenAdjacency(FrozenVector<uint32_t> &&offsets, FrozenVector<T> &&targets) :
+      offsets_(std::move(offsets)), targets_(std::move(targets)) {}
+  DISALLOW_COPY_AND_ASSIGN(FrozenAdjacency);
+  DEFINE_MOVE_COPY_AND_ASSIGN(FrozenAdjacency);
+  ~FrozenAdjacency() = default;
+
+  size_t numRows() const { return offsets_.empty() ? 0 : offsets_.size() - 1; }
+  size_t numEdges() const { return targets_.size(); }
+
+  // Rows past the end are empty.
+  Slice<const T> row(size_t index) const {
+    if (index >= numRows()) {
+      return {};
+    }
+    auto begin = offsets_[index];
+    auto end = offsets_[index + 1];
+    return Slice<const T>(targets_.data() + begin, end - begin);
+  }
+
+private:
+  FrozenVector<uint32_t> offsets_;
+  FrozenVector<T> targets_;
+
+  friend std::ostream &operator<<(std::ostream &s, const FrozenAdjacency &o) {
+    return s << "{offsets=" << o.offsets_ << ", targets=" << o.targets_ << '}';
+  }
+};
+}  // namespace z2kplus::backend::util::frozen
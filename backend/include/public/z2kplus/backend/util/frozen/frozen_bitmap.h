@@ -0,0 +1,79 @@
+// Copyright 2023 The Z2K Plus+ Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include "kosak/coding/coding.h"
+#include "z2kplus/backend/util/frozen/frozen_vector.h"
+
+namespace z2kplus::backend::util::frozen {
+// A compressed set of uint32s, laid out in the style of a roaring bitmap. Values are grouped into
+// containers by their high 16 bits. A container with few members stores their low 16 bits as a
+// sorted array; a container with more than 'maxArraySize' members stores all 65536 possibilities
+// as a bitset. Each container records how many members precede it, so rank() is cheap, which lets
+// callers keep per-member data in a parallel array.
+class FrozenBitmap {
+public:
+  struct Container {
+    uint16_t high_ = 0;
+    uint16_t isBitset_ = 0;
+    // Offset into arrays_ (in elements) or bitsets_ (in words).
+    uint32_t offset_ = 0;
+    uint32_t cardinality_ = 0;
+    // The number of members in all the preceding containers.
+    uint32_t rankBefore_ = 0;
+  };
+
+  // Past this many members, a bitset (8K) is smaller than an array.
+  static constexpr size_t maxArraySize = 4096;
+  static constexpr size_t wordsPerBitset = 65536 / 64;
+
+  FrozenBitmap() = default;
+  FrozenBitmap(FrozenVector<Container> &&containers, FrozenVector<uint16_t> &&arrays,
+      FrozenVector<uint64_t> &&bitsets) : containers_(std::move(containers)),
+      arrays_(std::move(arrays)), bitsets_(std::move(bitsets)) {}
+  DISALLOW_COPY_AND_ASSIGN(FrozenBitmap);
+  DECLARE_MOVE_COPY_AND_ASSIGN(FrozenBitmap);
+  ~FrozenBitmap() = default;
+
+  size_t size() const;
+  bool empty() const { return containers_.empty(); }
+
+  // The smallest member >= 'value'.
+  bool tryFindNext(uint32_t value, uint32_t *result) const;
+  // The largest member <= 'value'.
+  bool tryFindPrev(uint32_t value, uint32_t *result) const;
+  // The number of members < 'value'.
+  size_t rank(uint32_t value) const;
+  bool contains(uint32_t value) const;
+
+  const FrozenVector<Container> &containers() const { return containers_; }
+
+private:
+  // The first container whose high_ >= 'high'.
+  const Container *lowerBound(uint16_t high) const;
+  bool tryFindNextInContainer(const Container &c, uint32_t low, uint16_t *result) const;
+  bool tryFindPrevInContainer(const Container &c, uint32_t low, uint16_t *result) const;
+  // The number of members of 'c' whose low bits are < 'low'.
+  size_t rankInContainer(const Container &c, uint32_t low) const;
+
+  FrozenVector<Container> containers_;
+  FrozenVector<uint16_t> arrays_;
+  FrozenVector<uint64_t> bitsets_;
+
+  friend std::ostream &operator<<(std::ostream &s, const FrozenBitmap &o);
+};
+}  // namespace z2kplus::backend::util::frozen
@@ -0,0 +1,38 @@
+// Copyright 2023 The Z2K Plus+ Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <string_view>
+
+namespace z2kplus::backend::util {
+// Structural scanning for the JSON we write to the logs. The hot loop (finding the end of a string)
+// looks at 32 or 16 bytes at a time, using AVX2 when the CPU has it and SSE2 otherwise, with a
+// scalar fallback on other architectures.
+struct JsonScanner {
+  JsonScanner() = delete;
+
+  // Returns the first '"', '\\' or control character (0x00 through 0x1f) in [begin, end), or
+  // 'end' if there is none.
+  static const char *findSpecial(const char *begin, const char *end);
+
+  // 'begin' points just past the opening quote of a JSON string. Returns a pointer just past the
+  // closing quote, or nullptr if the string is not terminated before 'end' or contains a raw
+  // control character. On success, *contents is the text between the quotes (still escaped) and
+  // *hasEscapes says whether it contains any backslashes. Escape sequences are skipped over but not
+  // validated.
+  static const char *scanString(const char *begin, const char *end, std::string_view *contents,
+      bool *hasEscapes);
+};
+}  // namespace z2kplus::backend::util
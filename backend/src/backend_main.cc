@@ -98,8 +98,9 @@ bool tryStartServer(std::shared_ptr<PathMaster> pm, std::shared_ptr<Server> *res
   if (!exists) {
     // Since there's no index file, it would be safe to purge old graffiti here.
     // Otherwise it will be purged at the next index rebuild.
-    if (!IndexBuilder::tryClearScratchDirectory(*pm, ff.nest(HERE)) ||
-        !IndexBuilder::tryBuild(*pm,
+    // The builder keeps whatever an interrupted build finished in the scratch directory, and
+    // clears out the rest.
+    if (!IndexBuilder::tryBuild(*pm,
             InterFileRange<FileKeyKind::Logged>::everything,
             InterFileRange<FileKeyKind::Unlogged>::everything,
             ff.nest(HERE)) ||
@@ -14,6 +14,9 @@
 
 #include "z2kplus/backend/communicator/channel.h"
 
+#include <sys/uio.h>
+#include <algorithm>
+#include <climits>
 #include <optional>
 #include <string_view>
 #include <thread>
@@ -62,18 +65,20 @@ Channel::Channel(Private, channelId_t id, std::string humanReadablePrefix, MySoc
     socket_(std::move(socket)), callbacks_(std::move(callbacks)) {}
 Channel::~Channel() = default;
 
-bool Channel::trySend(std::string message, const FailFrame &/*ff*/) {
+bool Channel::trySend(std::string message, const FailFrame &ff) {
   if (message.empty()) {
     return true;
   }
+  return trySend(std::make_shared<const std::string>(std::move(message)), ff.nest(HERE));
+}
+
+bool Channel::trySend(std::shared_ptr<const std::string> message, const FailFrame &/*ff*/) {
+  if (message->empty()) {
+    return true;
+  }
   std::unique_lock guard(mutex_);
   auto needsNotify = outgoing_.empty();
-  if (needsNotify) {
-    outgoing_ = std::move(message);
-  } else {
-    outgoing_.append(message);
-  }
-  outgoing_.push_back('\n');
+  outgoing_.push_back(std::move(message));
   guard.unlock();
   if (needsNotify) {
     condVar_.notify_all();
@@ -191,8 +196,12 @@ bool Channel::runReaderThreadForever(const FailFrame &ff) {
 }
 
 bool Channel::runWriterThreadForever(const FailFrame &ff) {
+  static const char newline = '\n';
+  // Each message is followed by a newline, so each message takes two iovecs.
+  static_assert(IOV_MAX >= 2);
   std::unique_lock guard(mutex_);
-  std::string localBuffer;
+  std::vector<std::shared_ptr<const std::string>> localBuffer;
+  std::vector<struct iovec> iovecs;
   while (true) {
     while (true) {
       if (shutdownRequested_) {
@@ -207,9 +216,19 @@ bool Channel::runWriterThreadForever(const FailFrame &ff) {
     localBuffer.swap(outgoing_);
     guard.unlock();
 
-    debug("%o: writing %o", id_, localBuffer);
-    if (!nsunix::tryWriteAll(socket_.fd(), localBuffer.data(), localBuffer.size(), ff.nest(HERE))) {
-      return false;
+    for (size_t begin = 0; begin != localBuffer.size(); ) {
+      auto end = std::min(localBuffer.size(), begin + IOV_MAX / 2);
+      iovecs.clear();
+      for (auto i = begin; i != end; ++i) {
+        const auto &message = *localBuffer[i];
+        debug("%o: writing %o", id_, message);
+        iovecs.push_back({const_cast<char*>(message.data()), message.size()});
+        iovecs.push_back({const_cast<char*>(&newline), 1});
+      }
+      if (!nsunix::tryWritevAll(socket_.fd(), iovecs.data(), iovecs.size(), ff.nest(HERE))) {
+        return false;
+      }
+      begin = end;
     }
 
     localBuffer.clear();
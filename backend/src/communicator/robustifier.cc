@@ -37,9 +37,10 @@ bool Robustifier::trySend(const Delegate<bool, uint64_t, uint64_t, std::string *
   if (!cb(nextOutgoingId_, nextExpectedIncomingId_, &text, ff.nest(HERE))) {
     return false;
   }
-  unacknowledgedOutgoing_.emplace_back(nextOutgoingId_, text);
+  auto message = std::make_shared<const std::string>(std::move(text));
+  unacknowledgedOutgoing_.emplace_back(nextOutgoingId_, message);
   ++nextOutgoingId_;
-  return channel->trySend(std::move(text), ff.nest(HERE));
+  return channel->trySend(std::move(message), ff.nest(HERE));
 }
 
 bool Robustifier::noteIncoming(uint64_t incomingId, uint64_t nextExpectedOutgoingId) {
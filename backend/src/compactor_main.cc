@@ -12,17 +12,23 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <atomic>
 #include <clocale>
 #include <ctime>
+#include <map>
 #include <vector>
 #include "kosak/coding/coding.h"
 #include "kosak/coding/failures.h"
-#include "kosak/coding/memory/mapped_file.h"
 #include "kosak/coding/text/conversions.h"
+#include "kosak/coding/text/misc.h"
+#include "kosak/coding/unix.h"
 #include "z2kplus/backend/coordinator/coordinator.h"
+#include "z2kplus/backend/factories/log_parser.h"
 #include "z2kplus/backend/server/server.h"
+#include "z2kplus/backend/files/compactor.h"
 #include "z2kplus/backend/files/path_master.h"
 #include "z2kplus/backend/reverse_index/builder/index_builder.h"
+#include "z2kplus/backend/reverse_index/builder/task_runner.h"
 #include "z2kplus/backend/reverse_index/index/consolidated_index.h"
 #include "z2kplus/backend/reverse_index/index/frozen_index.h"
 #include "z2kplus/backend/shared/magic_constants.h"
@@ -30,20 +36,22 @@
 using kosak::coding::Delegate;
 using kosak::coding::FailFrame;
 using kosak::coding::FailRoot;
-using kosak::coding::memory::MappedFile;
 using kosak::coding::streamf;
 using kosak::coding::text::tryParseDecimal;
 using z2kplus::backend::coordinator::Coordinator;
+using z2kplus::backend::files::Compactor;
+using z2kplus::backend::files::CompactorManifest;
+using z2kplus::backend::files::CompactorStats;
 using z2kplus::backend::files::FileKey;
 using z2kplus::backend::files::FileKeyKind;
 using z2kplus::backend::files::InterFileRange;
 using z2kplus::backend::files::PathMaster;
 using z2kplus::backend::reverse_index::builder::IndexBuilder;
+using z2kplus::backend::reverse_index::builder::TaskRunner;
 using z2kplus::backend::reverse_index::index::ConsolidatedIndex;
 using z2kplus::backend::reverse_index::index::FrozenIndex;
 using z2kplus::backend::reverse_index::ZgramInfo;
 using z2kplus::backend::server::Server;
-using z2kplus::backend::shared::Zephyrgram;
 
 namespace nsunix = kosak::coding::nsunix;
 namespace magicConstants = z2kplus::backend::shared::magicConstants;
@@ -76,6 +84,10 @@ struct OldFileKey {
 };
 bool tryRun(int argc, char **argv, const FailFrame &ff);
 
+bool tryCompactDay(const PathMaster &pm, const OldFileKey &group,
+    const std::vector<OldFileKey> &keys, CompactorManifest *manifest, CompactorStats *stats,
+    const FailFrame &ff);
+
 bool tryGetLegacyPlaintexts(const std::string &loggedRoot, const std::string &unloggedRoot,
     const Delegate<bool, OldFileKey, const FailFrame &> &cb, const FailFrame &ff);
 bool tryGetLegacyPlaintextsHelper(const std::string &root, bool expectLogged,
@@ -98,8 +110,19 @@ int main(int argc, char **argv) {
 
 namespace {
 bool tryRun(int argc, char **argv, const FailFrame &ff) {
-  if (argc != 2) {
-    return ff.failf(HERE, "Expected 1 arguments: fileRoot");
+  if (argc != 2 && argc != 3) {
+    return ff.failf(HERE, "Expected 1 or 2 arguments: fileRoot [numThreads]");
+  }
+  // 0 means one per core.
+  size_t numThreads = 0;
+  if (argc == 3) {
+    std::string_view residual;
+    if (!tryParseDecimal(argv[2], &numThreads, &residual, ff.nest(HERE))) {
+      return false;
+    }
+    if (!residual.empty()) {
+      return ff.failf(HERE, "Trailing matter in numThreads: %o", argv[2]);
+    }
   }
 
   std::shared_ptr<PathMaster> pm;
@@ -119,34 +142,58 @@ bool tryRun(int argc, char **argv, const FailFrame &ff) {
     OldFileKey canonical(fk.year_, fk.month_, fk.day_, 0, fk.isLogged_);
     grouped[canonical].push_back(fk);
   }
+  std::vector<const std::pair<const OldFileKey, std::vector<OldFileKey>> *> days;
+  for (const auto &entry : grouped) {
+    days.push_back(&entry);
+  }
 
-  for (const auto &[group, keys] : grouped) {
-    FileKey<FileKeyKind::Either> destFk;
-    if (!FileKey<FileKeyKind::Either>::tryCreate(group.year_, group.month_, group.day_, group.isLogged_,
-        &destFk, ff.nest(HERE))) {
+  // The manifest lives next to the logged and unlogged directories, out of the scratch directory,
+  // which the index builder tidies.
+  std::string root(argv[1]);
+  if (root.empty() || root.back() != '/') {
+    root.push_back('/');
+  }
+  CompactorManifest manifest;
+  CompactorStats stats;
+  std::atomic<size_t> numDone = 0;
+  // The days are independent, so they are compacted concurrently. Each one is streamed from the
+  // mapped sources to its destination, a record at a time when verifying, so the memory a day
+  // needs doesn't depend on its size.
+  auto compactDay = [&](size_t index, const FailFrame &ff2) {
+    const auto &[group, keys] = *days[index];
+    if (!tryCompactDay(*pm, group, keys, &manifest, &stats, ff2.nest(HERE))) {
       return false;
     }
-    auto srcPrefix = pm->getPlaintextPath(destFk);
-    auto destFilename = pm->getPlaintextPath(destFk);
-
-    std::string allContents;
-    for (const auto &key : keys) {
-      char fakeSuffix[32];
-      snprintf(fakeSuffix, sizeof(fakeSuffix), ".%03d", (int)key.part_);
-      auto srcFilename = srcPrefix + fakeSuffix;
-
-      std::string contents;
-      if (!nsunix::tryReadAll(srcFilename, &contents, ff.nest(HERE))) {
-        return false;
-      }
-      allContents += contents;
-    }
-    if (!nsunix::tryWriteAll(destFilename, allContents, ff.nest(HERE))) {
-      return false;
+    auto thisNumDone = ++numDone;
+    auto progressInterval = std::max<size_t>(days.size() / 100, 1);
+    if (thisNumDone % progressInterval == 0 || thisNumDone == days.size()) {
+      streamf(std::cerr, "Compactor: %o of %o days done (%o resumed), %o records\n", thisNumDone,
+          days.size(), stats.numResumed_.load(), stats.numRecords_.load());
     }
-  }
+    return true;
+  };
+  return manifest.tryOpen(root + "compactor_manifest", ff.nest(HERE)) &&
+      TaskRunner::tryRun("Compactor", days.size(), numThreads, &compactDay, ff.nest(HERE));
+}
 
-  return true;
+bool tryCompactDay(const PathMaster &pm, const OldFileKey &group,
+    const std::vector<OldFileKey> &keys, CompactorManifest *manifest, CompactorStats *stats,
+    const FailFrame &ff) {
+  FileKey<FileKeyKind::Either> destFk;
+  if (!FileKey<FileKeyKind::Either>::tryCreate(group.year_, group.month_, group.day_,
+      group.isLogged_, &destFk, ff.nest(HERE))) {
+    return false;
+  }
+  auto srcPrefix = pm.getPlaintextPath(destFk);
+  auto destFilename = pm.getPlaintextPath(destFk);
+  std::vector<std::string> srcFilenames;
+  for (const auto &key : keys) {
+    char fakeSuffix[32];
+    snprintf(fakeSuffix, sizeof(fakeSuffix), ".%03d", (int)key.part_);
+    srcFilenames.push_back(srcPrefix + fakeSuffix);
+  }
+  return Compactor::tryCompactDay(srcFilenames, destFilename, group.isLogged_, manifest, stats,
+      ff.nest(HERE));
 }
 
 bool tryGetLegacyPlaintexts(const std::string &loggedRoot, const std::string &unloggedRoot,
@@ -200,6 +247,11 @@ bool tryGetLegacyPlaintextsHelper(const std::string &root, bool expectLogged,
       return f3.failf(HERE, "Can't find logged/unlogged indicator in %o", fullName);
     }
 
+    // The output of an earlier, interrupted run.
+    if (loggedRes.empty() || loggedRes == Compactor::compactingSuffix) {
+      return true;
+    }
+
     if (expectLogged != logged) {
       return f3.failf(HERE, "Expected this directory to have logged=%o. Got logged=%o", expectLogged, logged);
     }
@@ -14,13 +14,18 @@
 
 #include "z2kplus/backend/coordinator/coordinator.h"
 
+#include <algorithm>
+#include <map>
 #include <memory>
 #include <string>
 #include <string_view>
+#include <tuple>
+#include <utility>
 #include <vector>
 #include "kosak/coding/text/misc.h"
 #include "z2kplus/backend/coordinator/subscription.h"
 #include "z2kplus/backend/queryparsing/parser.h"
+#include "z2kplus/backend/queryparsing/planner.h"
 #include "z2kplus/backend/reverse_index/iterators/iterator_common.h"
 #include "z2kplus/backend/reverse_index/types.h"
 #include "z2kplus/backend/shared/magic_constants.h"
@@ -45,12 +50,12 @@ using z2kplus::backend::files::FileKey;
 using z2kplus::backend::files::FileKeyKind;
 using z2kplus::backend::files::LogLocation;
 using z2kplus::backend::files::PathMaster;
+using z2kplus::backend::queryparsing::QueryPlanner;
 using z2kplus::backend::reverse_index::FieldMask;
 using z2kplus::backend::reverse_index::index::ConsolidatedIndex;
 using z2kplus::backend::reverse_index::index::FrozenIndex;
 using z2kplus::backend::reverse_index::iterators::IteratorContext;
 using z2kplus::backend::reverse_index::iterators::zgramRel_t;
-using z2kplus::backend::reverse_index::metadata::DynamicMetadata;
 using z2kplus::backend::reverse_index::metadata::FrozenMetadata;
 using z2kplus::backend::reverse_index::zgramOff_t;
 using z2kplus::backend::shared::getZgramId;
@@ -60,13 +65,14 @@ using z2kplus::backend::shared::Profile;
 using z2kplus::backend::shared::Zephyrgram;
 using z2kplus::backend::shared::ZgramCore;
 using z2kplus::backend::shared::ZgramId;
+using z2kplus::backend::shared::ZgramView;
 using z2kplus::backend::shared::protocol::Estimates;
 using z2kplus::backend::shared::protocol::message::DResponse;
 using z2kplus::backend::util::streamf;
-using z2kplus::backend::util::frozen::FrozenStringPool;
 using z2kplus::backend::util::frozen::frozenStringRef_t;
 
 typedef z2kplus::backend::coordinator::Coordinator::response_t response_t;
+typedef ConsolidatedIndex::plusPlusKeyId_t plusPlusKeyId_t;
 
 #define HERE KOSAK_CODING_HERE
 
@@ -103,7 +109,12 @@ void Coordinator::subscribe(std::shared_ptr<Profile> profile, drequests::Subscri
   {
     FailRoot fr;
     std::string queryText(trim(req.query()));
-    if (!parsing::parse(queryText, true, &query, fr.nest(HERE)) ||
+    auto parsed = parsing::parse(queryText, true, &query, fr.nest(HERE));
+    if (parsed) {
+      query = QueryPlanner(index_).plan(std::move(query), nullptr);
+      query = queryCache_.lookupOrInsert(std::move(query));
+    }
+    if (!parsed ||
         !Subscription::tryCreate(index_, std::move(profile), std::move(queryText), std::move(query), req.start(),
             req.pageSize(), req.queryMargin(), &sub, fr.nest(HERE))) {
       responses->emplace_back(nullptr, dresponses::AckSubscribe(false, toString(fr), Estimates()));
@@ -136,7 +147,13 @@ void Coordinator::checkSyntax(Subscription *sub, CheckSyntax &&cs, std::vector<r
   FailRoot fr;
   std::unique_ptr<ZgramIterator> iterator;
   auto success = parsing::parse(cs.query(), true, &iterator, fr.nest(HERE));
-  auto message = success ? toString(*iterator) : toString(fr);
+  std::string message;
+  if (success) {
+    // Report the plan we would actually run, along with its estimated sizes and costs.
+    QueryPlanner(index_).plan(std::move(iterator), &message);
+  } else {
+    message = toString(fr);
+  }
 
   dresponses::AckSyntaxCheck asc(std::move(cs.query()), success, std::move(message));
   responses->emplace_back(sub, DResponse(std::move(asc)));
@@ -149,6 +166,13 @@ void Coordinator::getMoreZgrams(Subscription *sub, GetMoreZgrams &&o, std::vecto
   auto targetResidualSize = resultSize + sub->queryMargin();
   auto forBackSide = o.forBackSide();
   auto *pss = forBackSide ? &sub->backStatus() : &sub->frontStatus();
+  if (prefetcher_ != nullptr) {
+    prefetcher_->drainInto(&index_.zgramCache());
+  }
+  auto readAhead = pss->notePageRequest(std::chrono::steady_clock::now(), resultSize);
+  if (readAhead != 0) {
+    prefetchCandidates_.emplace_back(sub->weak_from_this(), forBackSide, readAhead);
+  }
   auto &residual = *pss->residual_;
   IteratorContext ctx(index_, forBackSide);
 
@@ -163,7 +187,7 @@ void Coordinator::getMoreZgrams(Subscription *sub, GetMoreZgrams &&o, std::vecto
     sub->updateDisplayed(zgInfo.zgramId());
   }
 
-  std::vector<std::shared_ptr<const Zephyrgram>> zgrams;
+  std::vector<std::shared_ptr<const ZgramView>> zgrams;
   {
     FailRoot fr;
     if (!index_.zgramCache().tryLookupOrResolve(*pathMaster_, locators, &zgrams, fr.nest(HERE))) {
@@ -174,22 +198,47 @@ void Coordinator::getMoreZgrams(Subscription *sub, GetMoreZgrams &&o, std::vecto
   }
   auto [ests, _1] = sub->updateEstimates();
 
-  // Grab all the needed metadataRecords, but while you're at it, pick out the right zgram body
-  // to use.
-  std::vector<MetadataRecord> metadataRecords;
+  // Resolve the metadata for the whole page in one sweep. The page may be in either order, but
+  // resolveMetadata wants ascending zgramIds.
+  std::vector<ZgramId> sortedIds;
+  sortedIds.reserve(zgrams.size());
   for (const auto &zgram: zgrams) {
-    // This repeatedly appends to the vector.
-    index_.getMetadataFor(zgram->zgramId(), &metadataRecords);
+    sortedIds.push_back(zgram->zgramId());
   }
+  std::sort(sortedIds.begin(), sortedIds.end());
+  sortedIds.erase(std::unique(sortedIds.begin(), sortedIds.end()), sortedIds.end());
+  index_.resolveMetadata(sortedIds.data(), sortedIds.size(), &metadataBatch_);
 
-  // Get the pluspluses
+  // Emit the metadataRecords and pluspluses in page order. The counts are looked up one key at a
+  // time, for all the zgrams on the page that mention that key, but the entries are emitted in
+  // zgram order.
+  std::vector<MetadataRecord> metadataRecords;
   std::vector<dresponses::PlusPlusUpdate::entry_t> entries;
+  std::map<plusPlusKeyId_t, std::vector<std::pair<ZgramId, size_t>>> keyToEntries;
   for (const auto &zgram: zgrams) {
     auto zgramId = zgram->zgramId();
-    auto keys = index_.getPlusPlusKeys(zgramId);
-    for (const auto &key: keys) {
-      auto count = index_.getPlusPlusCountAfter(zgramId, key);
-      entries.emplace_back(zgramId, std::string(key), count);
+    size_t batchIndex;
+    if (!metadataBatch_.tryFind(zgramId, &batchIndex)) {
+      continue;
+    }
+    metadataBatch_.appendMetadataRecords(batchIndex, &metadataRecords);
+    for (const auto &key: metadataBatch_.plusPlusKeys(batchIndex)) {
+      keyToEntries[key].emplace_back(zgramId, entries.size());
+      entries.emplace_back(zgramId, std::string(index_.plusPlusKeys().toStringView(key)), 0);
+    }
+  }
+  std::vector<ZgramId> idsForKey;
+  std::vector<int64_t> countsForKey;
+  for (auto &[key, items] : keyToEntries) {
+    std::sort(items.begin(), items.end());
+    idsForKey.clear();
+    for (const auto &item : items) {
+      idsForKey.push_back(item.first);
+    }
+    countsForKey.resize(idsForKey.size());
+    index_.getPlusPlusCountsAfter(key, idsForKey.data(), idsForKey.size(), countsForKey.data());
+    for (size_t i = 0; i != items.size(); ++i) {
+      std::get<2>(entries[items[i].second]) = countsForKey[i];
     }
   }
 
@@ -294,7 +343,7 @@ void Coordinator::getSpecificZgrams(Subscription *sub, GetSpecificZgrams &&o,
     locators.emplace_back(zgramId, info.location());
   }
 
-  auto zgrams = makeReservedVector<std::shared_ptr<const Zephyrgram>>(locators.size());
+  auto zgrams = makeReservedVector<std::shared_ptr<const ZgramView>>(locators.size());
   FailRoot fr;
   if (!index_.zgramCache().tryLookupOrResolve(*pathMaster_, locators, &zgrams, fr.nest(HERE))) {
     // for now, silently ignore.
@@ -305,6 +354,39 @@ void Coordinator::getSpecificZgrams(Subscription *sub, GetSpecificZgrams &&o,
   responses->emplace_back(sub, dresponses::AckSpecificZgrams(std::move(zgrams)));
 }
 
+void Coordinator::prefetch() {
+  queryCache_.extend(index_);
+  if (prefetchCandidates_.empty()) {
+    return;
+  }
+  if (prefetcher_ == nullptr) {
+    prefetcher_ = Prefetcher::create(pathMaster_);
+  }
+  const auto &cache = index_.zgramCache();
+  Prefetcher::locators_t locators;
+  for (const auto &[weakSub, forBackSide, readAhead] : prefetchCandidates_) {
+    auto sub = weakSub.lock();
+    if (sub == nullptr) {
+      continue;
+    }
+    auto *pss = forBackSide ? &sub->backStatus() : &sub->frontStatus();
+    pss->readAhead(index_, sub->query(), readAhead);
+    IteratorContext ctx(index_, forBackSide);
+    const auto &residual = *pss->residual_;
+    auto size = std::min(residual.size(), readAhead);
+    for (size_t i = 0; i != size; ++i) {
+      // Looking up the ZgramInfo here also faults in those pages of the index, off the critical
+      // path of the next request.
+      const auto &zgInfo = index_.getZgramInfo(ctx.relToOff(residual[i]));
+      if (!cache.contains(zgInfo.zgramId())) {
+        locators.emplace_back(zgInfo.zgramId(), zgInfo.location());
+      }
+    }
+  }
+  prefetchCandidates_.clear();
+  prefetcher_->request(std::move(locators));
+}
+
 void Coordinator::proposeFilters(Subscription *sub, ProposeFilters &&o, std::vector<response_t> *responses) {
   const auto &userId = sub->profile()->userId();
   auto filterp = filters_.find(userId);
@@ -349,6 +431,7 @@ bool Coordinator::tryResetIndex(std::chrono::system_clock::time_point now, const
   }
 
   index_ = std::move(newIndex);
+  queryCache_.resetIndex();
   for (auto &sub : subscriptions_) {
     sub->resetIndex(index_);
   }
@@ -393,35 +476,35 @@ void gatherZgramsHelper(const ZgramId *vecBegin, const ZgramId *vecEnd,
   zgsToUpdate->insert(zgsToUpdate->end(), beginp, endp);
 }
 
-void gatherFrozenZgrams(const FrozenStringPool &fsp, const FrozenMetadata::plusPluses_t &dict,
-    std::string_view key, ZgramId beginRange, ZgramId endRange,
-    std::vector<ZgramId> *zgs) {
-  frozenStringRef_t fsr;
-  if (!fsp.tryFind(key, &fsr)) {
+void gatherFrozenZgrams(const FrozenMetadata::plusPluses_t &dict, frozenStringRef_t fsr,
+    ZgramId beginRange, ZgramId endRange, std::vector<ZgramId> *zgs) {
+  auto vecp = dict.find(fsr);
+  if (vecp == dict.end()) {
     return;
   }
-  auto vecp = dict.find(fsr);
   const auto &vec = vecp->second;
   gatherZgramsHelper(vec.data(), vec.data() + vec.size(), beginRange, endRange, zgs);
 }
 
-void gatherDynamicZgrams(const DynamicMetadata::plusPluses_t &dict, std::string_view key,
-    ZgramId beginRange, ZgramId endRange, std::vector<ZgramId> *zgs) {
-  auto vecp = dict.find(key);
-  const auto &vec = vecp->second;
+void gatherDynamicZgrams(const std::vector<ZgramId> &vec, ZgramId beginRange, ZgramId endRange,
+    std::vector<ZgramId> *zgs) {
   gatherZgramsHelper(vec.data(), vec.data() + vec.size(), beginRange, endRange, zgs);
 }
 
 std::vector<ZgramId> gatherZgramsToUpdate(const ConsolidatedIndex &index,
-    ZgramId beginRange, ZgramId endRange, std::string_view key) {
+    ZgramId beginRange, ZgramId endRange, plusPlusKeyId_t key) {
   std::vector<ZgramId> zgs;
-  const auto &fsp = index.frozenIndex().stringPool();
-  const auto &frozenMetadata = index.frozenIndex().metadata();
-  const auto &dynamicMetadata = index.dynamicIndex().metadata();
-  gatherFrozenZgrams(fsp, frozenMetadata.plusPluses(), key, beginRange, endRange, &zgs);
-  gatherFrozenZgrams(fsp, frozenMetadata.minusMinuses(), key, beginRange, endRange, &zgs);
-  gatherDynamicZgrams(dynamicMetadata.plusPluses(), key, beginRange, endRange, &zgs);
-  gatherDynamicZgrams(dynamicMetadata.minusMinuses(), key, beginRange, endRange, &zgs);
+  frozenStringRef_t fsr;
+  if (index.plusPlusKeys().tryGetFrozenRef(key, &fsr)) {
+    const auto &frozenMetadata = index.frozenIndex().metadata();
+    gatherFrozenZgrams(frozenMetadata.plusPluses(), fsr, beginRange, endRange, &zgs);
+    gatherFrozenZgrams(frozenMetadata.minusMinuses(), fsr, beginRange, endRange, &zgs);
+  }
+  const auto *dynamicEntries = index.dynamicIndex().metadata().findPlusPlusEntries(key);
+  if (dynamicEntries != nullptr) {
+    gatherDynamicZgrams(dynamicEntries->pluses_, beginRange, endRange, &zgs);
+    gatherDynamicZgrams(dynamicEntries->minuses_, beginRange, endRange, &zgs);
+  }
   std::sort(zgs.begin(), zgs.end());
   auto newEndp = std::unique(zgs.begin(), zgs.end());
   zgs.erase(newEndp, zgs.end());
@@ -431,7 +514,7 @@ std::vector<ZgramId> gatherZgramsToUpdate(const ConsolidatedIndex &index,
 
 void Coordinator::notifySubscribersAboutPpChanges(const ConsolidatedIndex::ppDeltaMap_t &deltaMap,
     std::vector<response_t> *responses) {
-  std::map<std::string_view, ZgramId> keyToFirstZgramId;
+  std::map<plusPlusKeyId_t, ZgramId> keyToFirstZgramId;
   for (auto &[zgramId, inner]: deltaMap) {
     for (auto &[key, count]: inner) {
       keyToFirstZgramId.try_emplace(key, zgramId);
@@ -442,12 +525,13 @@ void Coordinator::notifySubscribersAboutPpChanges(const ConsolidatedIndex::ppDel
     std::vector<dresponses::PlusPlusUpdate::entry_t> entries;
     const auto &disp = sub->displayed();
     for (const auto &[key, firstZgramId]: keyToFirstZgramId) {
+      auto keyName = index_.plusPlusKeys().toStringView(key);
       // For the primary zgram (the first zgram where the key change was mentioned), we send the
       // new value. This helpfully covers the case where the value doesn't exist any more (e.g.
       // "foo++" was changed to "bar++" or even "baz" (no operator).
       if (firstZgramId >= disp.first && firstZgramId < disp.second) {
         auto count = index_.getPlusPlusCountAfter(firstZgramId, key);
-        entries.emplace_back(firstZgramId, key, count);
+        entries.emplace_back(firstZgramId, std::string(keyName), count);
       }
 
       // Calculate dependent zgrams (later zgrams that mention the key)
@@ -460,9 +544,11 @@ void Coordinator::notifySubscribersAboutPpChanges(const ConsolidatedIndex::ppDel
 
       auto zgsToUpdate = gatherZgramsToUpdate(index_, affectedRangeBegin, affectedRangeEnd, key);
 
-      for (auto zgramId: zgsToUpdate) {
-        auto count = index_.getPlusPlusCountAfter(zgramId, key);
-        entries.emplace_back(zgramId, key, count);
+      // zgsToUpdate is sorted, so the counts can be looked up in one batch.
+      std::vector<int64_t> counts(zgsToUpdate.size());
+      index_.getPlusPlusCountsAfter(key, zgsToUpdate.data(), zgsToUpdate.size(), counts.data());
+      for (size_t i = 0; i != zgsToUpdate.size(); ++i) {
+        entries.emplace_back(zgsToUpdate[i], std::string(keyName), counts[i]);
       }
     }
     if (!entries.empty()) {
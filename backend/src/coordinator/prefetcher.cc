@@ -0,0 +1,167 @@
+// Copyright 2023 The Z2K Plus+ Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "z2kplus/backend/coordinator/prefetcher.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "kosak/coding/coding.h"
+#include "kosak/coding/failures.h"
+#include "kosak/coding/memory/mapped_file.h"
+#include "kosak/coding/unix.h"
+
+using kosak::coding::FailRoot;
+using kosak::coding::memory::MappedFile;
+
+#define HERE KOSAK_CODING_HERE
+
+namespace nsunix = kosak::coding::nsunix;
+
+namespace z2kplus::backend::coordinator {
+namespace {
+// Purely advisory, so failures are not worth reporting.
+void adviseWillNeed(const char *begin, size_t size) {
+  static const auto pageSize = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+  auto start = reinterpret_cast<uintptr_t>(begin) & ~(pageSize - 1);
+  auto end = reinterpret_cast<uintptr_t>(begin) + size;
+  (void)madvise(reinterpret_cast<void*>(start), end - start, MADV_WILLNEED);
+}
+}  // namespace
+
+std::unique_ptr<Prefetcher> Prefetcher::create(std::shared_ptr<PathMaster> pm) {
+  auto result = std::make_unique<Prefetcher>(Private(), std::move(pm));
+  FailRoot fr(true);
+  if (!nsunix::trySetThreadName(&result->thread_, "prefetcher", fr.nest(HERE))) {
+    warn("Couldn't name prefetcher thread (ignoring): %o", fr);
+  }
+  return result;
+}
+
+Prefetcher::Prefetcher(Private, std::shared_ptr<PathMaster> pm) : pm_(std::move(pm)),
+    thread_(&Prefetcher::threadMain, this) {}
+
+Prefetcher::~Prefetcher() {
+  {
+    std::unique_lock guard(mutex_);
+    stopRequested_ = true;
+  }
+  condVar_.notify_all();
+  thread_.join();
+}
+
+void Prefetcher::request(locators_t locators) {
+  if (locators.empty()) {
+    return;
+  }
+  {
+    std::unique_lock guard(mutex_);
+    pending_ = std::move(locators);
+  }
+  condVar_.notify_all();
+}
+
+void Prefetcher::drainInto(ZgramCache *cache) {
+  std::vector<std::shared_ptr<const ZgramView>> finished;
+  {
+    std::unique_lock guard(mutex_);
+    finished.swap(finished_);
+  }
+  for (auto &zgram : finished) {
+    cache->insertPrefetched(std::move(zgram));
+  }
+}
+
+void Prefetcher::threadMain() {
+  locators_t todo;
+  std::unique_lock guard(mutex_);
+  while (true) {
+    condVar_.wait(guard, [this] { return stopRequested_ || !pending_.empty(); });
+    if (stopRequested_) {
+      return;
+    }
+    todo.clear();
+    todo.swap(pending_);
+    guard.unlock();
+    warm(&todo);
+    guard.lock();
+  }
+}
+
+void Prefetcher::warm(locators_t *locators) {
+  // Visit each file once, in offset order.
+  std::sort(locators->begin(), locators->end(), [](const auto &lhs, const auto &rhs) {
+    const auto &ll = lhs.second;
+    const auto &rl = rhs.second;
+    return std::make_pair(ll.fileKey().raw(), ll.offset()) <
+        std::make_pair(rl.fileKey().raw(), rl.offset());
+  });
+
+  std::vector<std::shared_ptr<const ZgramView>> views;
+  auto begin = locators->begin();
+  while (begin != locators->end()) {
+    auto fileKey = begin->second.fileKey();
+    auto end = std::find_if(begin, locators->end(), [&fileKey](const auto &item) {
+      return item.second.fileKey().raw() != fileKey.raw();
+    });
+    auto first = begin;
+    begin = end;
+
+    FailRoot fr(true);
+    MappedFile<const char> file;
+    if (!file.tryMap(pm_->getPlaintextPath(fileKey), false, fr.nest(HERE))) {
+      warn("Prefetcher couldn't map %o (skipping): %o", fileKey, fr);
+      continue;
+    }
+    // Ask for the whole span up front, so the kernel reads it ahead in large requests rather than
+    // faulting it in a page at a time as we parse.
+    const auto &last = std::prev(end)->second;
+    auto spanBegin = first->second.offset();
+    auto spanEnd = std::min<size_t>(last.offset() + last.size(), file.byteSize());
+    if (spanBegin < spanEnd) {
+      adviseWillNeed(file.get() + spanBegin, spanEnd - spanBegin);
+    }
+
+    views.clear();
+    for (auto ip = first; ip != end; ++ip) {
+      const auto &location = ip->second;
+      if (location.offset() + location.size() > file.byteSize()) {
+        warn("Prefetcher: location %o is beyond the end of the file (skipping)", location);
+        continue;
+      }
+      std::string_view text(file.get() + location.offset(), location.size());
+      FailRoot zgfr(true);
+      std::shared_ptr<const ZgramView> view;
+      if (!ZgramView::tryCreateFromLogRecord(text, &view, zgfr.nest(HERE))) {
+        warn("Prefetcher couldn't parse %o (skipping): %o", location, zgfr);
+        continue;
+      }
+      views.push_back(std::move(view));
+    }
+
+    // Publish file by file, so the coordinator can use what we have so far.
+    std::unique_lock guard(mutex_);
+    if (stopRequested_) {
+      return;
+    }
+    finished_.insert(finished_.end(), std::make_move_iterator(views.begin()),
+        std::make_move_iterator(views.end()));
+  }
+}
+}  // namespace z2kplus::backend::coordinator
@@ -0,0 +1,363 @@
+// Copyright 2023 The Z2K Plus+ Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "z2kplus/backend/coordinator/query_cache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "kosak/coding/coding.h"
+#include "z2kplus/backend/shared/magic_constants.h"
+
+using kosak::coding::streamf;
+using kosak::coding::toString;
+using z2kplus::backend::reverse_index::index::ConsolidatedIndex;
+using z2kplus::backend::reverse_index::iterators::IteratorContext;
+using z2kplus::backend::reverse_index::iterators::QueryBudget;
+using z2kplus::backend::reverse_index::iterators::ZgramIterator;
+using z2kplus::backend::reverse_index::iterators::ZgramIteratorState;
+using z2kplus::backend::reverse_index::iterators::zgramRel_t;
+using z2kplus::backend::reverse_index::zgramOff_t;
+namespace magicConstants = z2kplus::backend::shared::magicConstants;
+
+namespace z2kplus::backend::coordinator {
+namespace internal {
+namespace {
+void appendVarint(uint32_t value, std::vector<uint8_t> *bytes);
+uint32_t readVarint(const uint8_t **current);
+}  // namespace
+
+RunList::RunList() = default;
+RunList::RunList(RunList &&) noexcept = default;
+RunList &RunList::operator=(RunList &&) noexcept = default;
+RunList::~RunList() = default;
+
+void RunList::append(uint32_t zgramOff) {
+  if (!blocks_.empty()) {
+    if (last_.second == zgramOff) {
+      ++last_.second;
+      return;
+    }
+    appendVarint(last_.first - encodedEnd_, &bytes_);
+    appendVarint(last_.second - last_.first, &bytes_);
+    encodedEnd_ = last_.second;
+  }
+  if (blocks_.empty() || runsInLastBlock_ == runsPerBlock) {
+    blocks_.push_back(Block{zgramOff, (uint32_t)bytes_.size()});
+    encodedEnd_ = zgramOff;
+    runsInLastBlock_ = 0;
+  }
+  last_ = run_t(zgramOff, zgramOff + 1);
+  ++runsInLastBlock_;
+}
+
+size_t RunList::countBlocksStartingAtOrBefore(uint32_t zgramOff) const {
+  auto ip = std::upper_bound(blocks_.begin(), blocks_.end(), zgramOff,
+      [](uint32_t o, const Block &block) { return o < block.begin_; });
+  return ip - blocks_.begin();
+}
+
+size_t RunList::decodeBlock(size_t index, run_t *result) const {
+  const auto &block = blocks_[index];
+  auto isLast = index + 1 == blocks_.size();
+  const auto *current = bytes_.data() + block.offset_;
+  const auto *end = bytes_.data() + (isLast ? bytes_.size() : blocks_[index + 1].offset_);
+  auto prevEnd = block.begin_;
+  size_t i = 0;
+  while (current != end) {
+    auto first = prevEnd + readVarint(&current);
+    prevEnd = first + readVarint(&current);
+    result[i++] = run_t(first, prevEnd);
+  }
+  if (isLast) {
+    result[i++] = last_;
+  }
+  return i;
+}
+
+CachedQueryEntry::CachedQueryEntry(std::unique_ptr<ZgramIterator> query) : query_(std::move(query)) {}
+CachedQueryEntry::~CachedQueryEntry() = default;
+
+void CachedQueryEntry::extend(const IteratorContext &ctx) {
+  auto end = ctx.ci().zgramEndOff().raw();
+  if (evaluatedEnd_ == end) {
+    return;
+  }
+  IteratorContext forwardCtx(ctx.ci(), true, ctx.budget());
+  if (state_ == nullptr) {
+    state_ = query_->createState(forwardCtx);
+  }
+  while (true) {
+    zgramRel_t items[magicConstants::iteratorChunkSize];
+    auto numItems = query_->getMore(forwardCtx, state_.get(), zgramRel_t(evaluatedEnd_), items,
+        magicConstants::iteratorChunkSize);
+    for (size_t i = 0; i < numItems; ++i) {
+      runs_.append(forwardCtx.relToOff(items[i]).raw());
+    }
+    if (numItems != 0) {
+      evaluatedEnd_ = forwardCtx.relToOff(items[numItems - 1]).raw() + 1;
+    }
+    if (forwardCtx.outOfBudget()) {
+      // What we have is good, but the state can't be trusted. Its nextStart() can, though, and
+      // it may be well past the last match (for example if we were crossing a long stretch of
+      // non-matches), so the next call starts over from there rather than redoing that stretch.
+      auto scanned = forwardCtx.relToOff(state_->nextStart()).raw();
+      evaluatedEnd_ = std::min(std::max(evaluatedEnd_, scanned), end);
+      state_.reset();
+      return;
+    }
+    if (numItems == 0) {
+      evaluatedEnd_ = end;
+      return;
+    }
+  }
+}
+
+void CachedQueryEntry::invalidate() {
+  state_.reset();
+  // Assigning a fresh RunList (rather than clearing this one) gives back its memory.
+  runs_ = RunList();
+  evaluatedEnd_ = 0;
+}
+
+namespace {
+// Seven bits per byte, low bits first. The high bit says whether more bytes follow.
+void appendVarint(uint32_t value, std::vector<uint8_t> *bytes) {
+  while (value >= 0x80) {
+    bytes->push_back((uint8_t)(value | 0x80));
+    value >>= 7;
+  }
+  bytes->push_back((uint8_t)value);
+}
+
+uint32_t readVarint(const uint8_t **current) {
+  uint32_t result = 0;
+  for (int shift = 0; ; shift += 7) {
+    auto b = *(*current)++;
+    result |= (uint32_t)(b & 0x7f) << shift;
+    if ((b & 0x80) == 0) {
+      return result;
+    }
+  }
+}
+}  // namespace
+}  // namespace internal
+
+namespace {
+typedef internal::RunList RunList;
+typedef RunList::run_t run_t;
+
+class MyState final : public ZgramIteratorState {
+public:
+  MyState() = default;
+  ~MyState() final = default;
+
+  size_t getMoreForward(const IteratorContext &ctx, const internal::CachedQueryEntry &entry,
+      zgramRel_t *result, size_t capacity);
+  size_t getMoreBackward(const IteratorContext &ctx, const internal::CachedQueryEntry &entry,
+      zgramRel_t *result, size_t capacity);
+
+private:
+  size_t getMoreLive(const IteratorContext &ctx, const internal::CachedQueryEntry &entry,
+      zgramRel_t *result, size_t capacity);
+
+  // Used for zgrams beyond entry.evaluatedEnd(). This only happens when the entry ran out of budget
+  // while extending itself.
+  std::unique_ptr<ZgramIteratorState> liveState_;
+};
+}  // namespace
+
+std::unique_ptr<CachedQuery> CachedQuery::create(std::shared_ptr<internal::CachedQueryEntry> entry) {
+  return std::make_unique<CachedQuery>(Private(), std::move(entry));
+}
+
+CachedQuery::CachedQuery(Private, std::shared_ptr<internal::CachedQueryEntry> entry) :
+    entry_(std::move(entry)) {}
+CachedQuery::~CachedQuery() = default;
+
+std::unique_ptr<ZgramIteratorState> CachedQuery::createState(const IteratorContext &/*ctx*/) const {
+  return std::make_unique<MyState>();
+}
+
+size_t CachedQuery::getMore(const IteratorContext &ctx, ZgramIteratorState *state, zgramRel_t lowerBound,
+    zgramRel_t *result, size_t capacity) const {
+  auto *ms = dynamic_cast<MyState*>(state);
+  if (!ms->updateNextStart(ctx, lowerBound, capacity)) {
+    return 0;
+  }
+  return ctx.forward() ? ms->getMoreForward(ctx, *entry_, result, capacity) :
+      ms->getMoreBackward(ctx, *entry_, result, capacity);
+}
+
+void CachedQuery::dump(std::ostream &s) const {
+  streamf(s, "Cached(%o)", *entry_->query());
+}
+
+namespace {
+// In the forward direction we serve from the runs first and then (if the entry is behind) from the
+// live query.
+size_t MyState::getMoreForward(const IteratorContext &ctx, const internal::CachedQueryEntry &entry,
+    zgramRel_t *result, size_t capacity) {
+  const auto &runs = entry.runs();
+  auto off = ctx.relToOff(nextStart_).raw();
+  // The first run that ends after 'off' is in the last block that starts at or before 'off', or
+  // in a later one. Runs in that block that end at or before 'off' contribute nothing.
+  auto blockIndex = std::max<size_t>(runs.countBlocksStartingAtOrBefore(off), 1) - 1;
+  run_t block[RunList::runsPerBlock];
+  size_t i = 0;
+  for (; blockIndex < runs.numBlocks() && i != capacity; ++blockIndex) {
+    auto numRuns = runs.decodeBlock(blockIndex, block);
+    for (size_t r = 0; r != numRuns && i != capacity; ++r) {
+      for (auto o = std::max(off, block[r].first); o < block[r].second && i != capacity; ++o) {
+        result[i++] = ctx.offToRel(zgramOff_t(o));
+      }
+    }
+  }
+  if (i != 0) {
+    nextStart_ = result[i - 1].addRaw(1);
+  }
+  if (i == capacity) {
+    return i;
+  }
+  nextStart_ = std::max(nextStart_, ctx.offToRel(zgramOff_t(entry.evaluatedEnd())));
+  return i + getMoreLive(ctx, entry, result + i, capacity - i);
+}
+
+// In the reverse direction we serve from the live query first (if the entry is behind) and then
+// from the runs.
+size_t MyState::getMoreBackward(const IteratorContext &ctx, const internal::CachedQueryEntry &entry,
+    zgramRel_t *result, size_t capacity) {
+  size_t i = 0;
+  // Everything at or beyond evaluatedEnd() is "live". In relative terms, that's everything
+  // before 'liveEnd'.
+  auto liveEnd = ctx.offToRel(zgramOff_t(entry.evaluatedEnd())).addRaw(1);
+  if (nextStart_ < liveEnd) {
+    auto numItems = getMoreLive(ctx, entry, result, capacity);
+    while (i != numItems && result[i] < liveEnd) {
+      ++i;
+    }
+    if (i == capacity) {
+      return i;
+    }
+    // Either the live query crossed into the runs, or it is exhausted. But if we ran out of budget,
+    // the exhaustion may be bogus.
+    if (i == numItems && ctx.outOfBudget()) {
+      return i;
+    }
+    nextStart_ = liveEnd;
+  }
+  if (nextStart_ >= ctx.getIndexZgBoundsRel().second) {
+    return i;
+  }
+
+  const auto &runs = entry.runs();
+  auto off = ctx.relToOff(nextStart_).raw();
+  // Runs in the last of these blocks that start after 'off' contribute nothing.
+  auto blockIndex = runs.countBlocksStartingAtOrBefore(off);
+  run_t block[RunList::runsPerBlock];
+  while (blockIndex != 0 && i != capacity) {
+    --blockIndex;
+    auto r = runs.decodeBlock(blockIndex, block);
+    while (r != 0 && i != capacity) {
+      --r;
+      for (auto o = std::min(off + 1, block[r].second); o > block[r].first && i != capacity; ) {
+        --o;
+        result[i++] = ctx.offToRel(zgramOff_t(o));
+      }
+    }
+  }
+  if (i != 0) {
+    nextStart_ = std::max(nextStart_, result[i - 1].addRaw(1));
+  }
+  return i;
+}
+
+size_t MyState::getMoreLive(const IteratorContext &ctx, const internal::CachedQueryEntry &entry,
+    zgramRel_t *result, size_t capacity) {
+  const auto *query = entry.query();
+  if (liveState_ == nullptr) {
+    liveState_ = query->createState(ctx);
+  }
+  auto numItems = query->getMore(ctx, liveState_.get(), nextStart_, result, capacity);
+  if (numItems != 0) {
+    nextStart_ = result[numItems - 1].addRaw(1);
+  }
+  return numItems;
+}
+}  // namespace
+
+QueryCache::QueryCache() = default;
+QueryCache::QueryCache(QueryCache &&) noexcept = default;
+QueryCache &QueryCache::operator=(QueryCache &&) noexcept = default;
+QueryCache::~QueryCache() = default;
+
+std::unique_ptr<ZgramIterator> QueryCache::lookupOrInsert(std::unique_ptr<ZgramIterator> &&query) {
+  if (query->isSensitiveToMetadata()) {
+    return std::move(query);
+  }
+  purgeUnused();
+  auto key = toString(*query);
+  auto &slot = entries_[std::move(key)];
+  auto entry = slot.lock();
+  if (entry == nullptr) {
+    entry = std::make_shared<internal::CachedQueryEntry>(std::move(query));
+    slot = entry;
+  }
+  return CachedQuery::create(std::move(entry));
+}
+
+void QueryCache::extend(const ConsolidatedIndex &ci) {
+  purgeUnused();
+  QueryBudget budget(std::chrono::steady_clock::now() + magicConstants::queryCacheTimeBudget);
+  IteratorContext ctx(ci, true, &budget);
+  auto ip = entries_.upper_bound(lastExtended_);
+  for (size_t i = 0; i != entries_.size() && !budget.tripped(); ++i, ++ip) {
+    if (ip == entries_.end()) {
+      ip = entries_.begin();
+    }
+    lastExtended_ = ip->first;
+    if (auto entry = ip->second.lock(); entry != nullptr) {
+      entry->extend(ctx);
+    }
+  }
+}
+
+void QueryCache::resetIndex() {
+  purgeUnused();
+  for (auto &[_, weak] : entries_) {
+    if (auto entry = weak.lock(); entry != nullptr) {
+      entry->invalidate();
+    }
+  }
+}
+
+size_t QueryCache::size() const {
+  return std::count_if(entries_.begin(), entries_.end(),
+      [](const auto &kv) { return !kv.second.expired(); });
+}
+
+// The entries themselves are gone already; this just drops their keys.
+void QueryCache::purgeUnused() {
+  for (auto ip = entries_.begin(); ip != entries_.end(); ) {
+    if (ip->second.expired()) {
+      ip = entries_.erase(ip);
+    } else {
+      ++ip;
+    }
+  }
+}
+}  // namespace z2kplus::backend::coordinator
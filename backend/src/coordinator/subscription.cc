@@ -14,13 +14,16 @@
 
 #include "z2kplus/backend/coordinator/subscription.h"
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
 #include "z2kplus/backend/shared/magic_constants.h"
 
 using kosak::coding::streamf;
 using kosak::coding::Unit;
 
 using z2kplus::backend::reverse_index::iterators::IteratorContext;
+using z2kplus::backend::reverse_index::iterators::QueryBudget;
 using z2kplus::backend::reverse_index::iterators::ZgramIterator;
 using z2kplus::backend::reverse_index::iterators::zgramRel_t;
 using z2kplus::backend::shared::ZgramId;
@@ -50,30 +53,81 @@ PerSideStatus PerSideStatus::create(const ConsolidatedIndex &index, const ZgramI
 PerSideStatus::PerSideStatus() = default;
 PerSideStatus::PerSideStatus(bool forward, std::unique_ptr<ZgramIteratorState> iteratorState) :
     forward_(forward), iteratorState_(std::move(iteratorState)),
-    residual_(std::make_unique<std::deque<zgramRel_t>>()), exhaustVersion_(-1) {}
+    timeBudget_(magicConstants::queryTimeBudget), residual_(std::make_unique<std::deque<zgramRel_t>>()),
+    exhaustVersion_(-1) {}
 PerSideStatus::PerSideStatus(PerSideStatus &&) noexcept = default;
 PerSideStatus &PerSideStatus::operator=(PerSideStatus &&) noexcept = default;
 PerSideStatus::~PerSideStatus() = default;
 
 bool PerSideStatus::topUp(const ConsolidatedIndex &index, const ZgramIterator *query,
     zgramRel_t lowerBound, size_t minItems) {
-  IteratorContext ctx(index, forward_);
+  return topUpWithin(index, query, lowerBound, minItems, timeBudget_, true);
+}
+
+size_t PerSideStatus::notePageRequest(std::chrono::steady_clock::time_point now,
+    size_t pageSize) {
+  auto sequential = now - lastPageTime_ <= magicConstants::prefetchWindow;
+  sequentialPages_ = sequential ? sequentialPages_ + 1 : 0;
+  lastPageTime_ = now;
+  return std::min(sequentialPages_ * pageSize, magicConstants::prefetchMaxZgrams);
+}
+
+void PerSideStatus::readAhead(const ConsolidatedIndex &index, const ZgramIterator *query,
+    size_t minItems) {
+  if (morePending_) {
+    return;
+  }
+  topUpWithin(index, query, zgramRel_t(0), minItems, magicConstants::prefetchTimeBudget, false);
+}
+
+bool PerSideStatus::topUpWithin(const ConsolidatedIndex &index, const ZgramIterator *query,
+    zgramRel_t lowerBound, size_t minItems, std::chrono::milliseconds timeBudget,
+    bool adaptBudget) {
+  QueryBudget budget(std::chrono::steady_clock::now() + timeBudget);
+  IteratorContext ctx(index, forward_, &budget);
+  morePending_ = false;
+  bool madeProgress = false;
+  bool result = true;
   while (residual_->size() < minItems) {
     if (isExhausted(index)) {
-      return false;
+      result = false;
+      break;
     }
     zgramRel_t items[magicConstants::iteratorChunkSize];
-    auto numItems = query->getMore(ctx, iteratorState_.get(), lowerBound, items,
+    auto numItems = query->getMore(ctx, iteratorState_.get(), std::max(lowerBound, resumeFrom_), items,
         magicConstants::iteratorChunkSize);
-    if (numItems == 0) {
-      setExhausted(index);
-      return false;
-    }
     for (size_t i = 0; i < numItems; ++i) {
       residual_->push_back(items[i]);
     }
+    if (numItems != 0) {
+      resumeFrom_ = items[numItems - 1].addRaw(1);
+      madeProgress = true;
+    }
+    if (budget.tripped()) {
+      // The items we did get are good, but the iterator state can't be trusted any more.
+      iteratorState_ = query->createState(ctx);
+      morePending_ = true;
+      if (adaptBudget) {
+        timeBudget_ = madeProgress ? magicConstants::queryTimeBudget :
+            std::min(timeBudget_ * 2, magicConstants::maxQueryTimeBudget);
+        warn("Query ran out of budget %o: %o. Next budget is %o ms", budget, *query,
+            timeBudget_.count());
+      }
+      result = false;
+      break;
+    }
+    if (numItems == 0) {
+      setExhausted(index);
+      result = false;
+      break;
+    }
   }
-  return true;
+  if (adaptBudget && !budget.tripped()) {
+    timeBudget_ = magicConstants::queryTimeBudget;
+  }
+  postingsTouched_ += budget.postingsTouched();
+  trieNodesMatched_ += budget.trieNodesMatched();
+  return result;
 }
 
 bool PerSideStatus::isExhausted(const ConsolidatedIndex &index) const {
@@ -87,7 +141,8 @@ void PerSideStatus::setExhausted(const ConsolidatedIndex &index) {
 }
 
 std::ostream &operator<<(std::ostream &s, const PerSideStatus &o) {
-  return streamf(s, "%o,[iter state],[res],%o)", o.forward_, o.exhaustVersion_);
+  return streamf(s, "%o,[iter state],[res],%o,pending=%o,postings=%o,trieNodes=%o)", o.forward_,
+      o.exhaustVersion_, o.morePending_, o.postingsTouched_, o.trieNodesMatched_);
 }
 
 bool Subscription::tryCreate(const ConsolidatedIndex &index, std::shared_ptr<Profile> profile,
@@ -145,7 +200,9 @@ void Subscription::resetIndex(const ConsolidatedIndex &newIndex) {
 std::pair<Estimates, bool> Subscription::updateEstimates() {
   const auto fSize = std::min(frontStatus_.residual_->size(), queryMargin_);
   const auto bSize = std::min(backStatus_.residual_->size(), queryMargin_);
-  auto newEstimates = Estimates::create(fSize, bSize, fSize < queryMargin_, bSize < queryMargin_);
+  // If a side ran out of budget, there may be more items that we haven't found yet.
+  auto newEstimates = Estimates::create(fSize, bSize, fSize < queryMargin_ && !frontStatus_.morePending_,
+      bSize < queryMargin_ && !backStatus_.morePending_);
   auto changed = lastEstimates_ != newEstimates;
   lastEstimates_ = newEstimates;
   return std::make_pair(newEstimates, changed);
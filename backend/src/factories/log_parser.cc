@@ -21,12 +21,12 @@
 #include "kosak/coding/memory/mapped_file.h"
 #include "kosak/coding/myjson.h"
 #include "kosak/coding/text/misc.h"
+#include "z2kplus/backend/factories/log_record_scanner.h"
 #include "z2kplus/backend/shared/zephyrgram.h"
 
 namespace z2kplus::backend::factories {
 using kosak::coding::Delegate;
 using kosak::coding::FailFrame;
-using kosak::coding::ParseContext;
 using kosak::coding::memory::MappedFile;
 using kosak::coding::text::Splitter;
 using z2kplus::backend::files::FileKey;
@@ -34,6 +34,7 @@ using z2kplus::backend::files::FileKeyKind;
 using z2kplus::backend::files::IntraFileRange;
 using z2kplus::backend::files::PathMaster;
 using z2kplus::backend::shared::LogRecord;
+using z2kplus::backend::shared::Zephyrgram;
 using z2kplus::backend::shared::ZgramCore;
 
 #define HERE KOSAK_CODING_HERE
@@ -58,24 +59,28 @@ bool LogParser::tryParseLogFile(const PathMaster &pm, const IntraFileRange<FileK
 bool LogParser::tryParseLogRecords(std::string_view text, FileKey<FileKeyKind::Either> fileKey,
     size_t startingOffset, std::vector<logRecordAndLocation_t> *logRecordsAndLocations,
     const FailFrame &ff) {
-  auto splitter = Splitter::ofRecords(text, '\n');
-  size_t offset = startingOffset;
-  std::string_view line;
-  while (splitter.moveNext(&line)) {
-    LogRecord logRecord;
-    if (!tryParseLogRecord(line, &logRecord, ff.nest(HERE))) {
-      return ff.failf(HERE, "...at (offset %o, size %o)", offset, line.size());
+  LogRecordBatch batch;
+  if (!LogRecordScanner::tryScanRegion(text, fileKey, startingOffset, &batch, ff.nest(HERE))) {
+    return false;
+  }
+  logRecordsAndLocations->reserve(logRecordsAndLocations->size() + batch.order().size());
+  for (const auto &[isZgram, index] : batch.order()) {
+    if (!isZgram) {
+      auto &[mdr, location] = batch.metadata()[index];
+      logRecordsAndLocations->emplace_back(LogRecord(std::move(mdr)), location);
+      continue;
+    }
+    Zephyrgram zgram;
+    if (!batch.tryDecodeZgram(index, &zgram, ff.nest(HERE))) {
+      return false;
     }
-    LogLocation location(fileKey, offset, line.size());
-    logRecordsAndLocations->emplace_back(std::move(logRecord), location);
-    offset += line.size() + 1;
+    logRecordsAndLocations->emplace_back(LogRecord(std::move(zgram)),
+        batch.zgrams().locations_[index]);
   }
   return true;
 }
 
 bool LogParser::tryParseLogRecord(std::string_view text, LogRecord *result, const FailFrame &ff) {
-  using kosak::coding::tryParseJson;
-  ParseContext ctx(text);
-  return tryParseJson(&ctx, result, ff.nest(HERE));
+  return LogRecordScanner::tryParse(text, result, ff.nest(HERE));
 }
 }  // namespace z2kplus::backend::factories
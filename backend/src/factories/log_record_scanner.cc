@@ -0,0 +1,453 @@
+// Copyright 2023 The Z2K Plus+ Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "z2kplus/backend/factories/log_record_scanner.h"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "kosak/coding/coding.h"
+#include "kosak/coding/failures.h"
+#include "kosak/coding/myjson.h"
+#include "kosak/coding/text/misc.h"
+#include "z2kplus/backend/shared/zephyrgram.h"
+#include "z2kplus/backend/util/json_scanner.h"
+
+using kosak::coding::FailFrame;
+using kosak::coding::FailRoot;
+using kosak::coding::ParseContext;
+using kosak::coding::text::Splitter;
+using kosak::coding::tryParseJson;
+using z2kplus::backend::files::FileKey;
+using z2kplus::backend::files::FileKeyKind;
+using z2kplus::backend::files::LogLocation;
+using z2kplus::backend::shared::LogRecord;
+using z2kplus::backend::shared::LogRecordPayloadHolder;
+using z2kplus::backend::shared::MetadataRecord;
+using z2kplus::backend::shared::RenderStyle;
+using z2kplus::backend::shared::RenderStyleHolder;
+using z2kplus::backend::shared::Zephyrgram;
+using z2kplus::backend::shared::ZgramCore;
+using z2kplus::backend::shared::ZgramId;
+using z2kplus::backend::util::JsonScanner;
+
+namespace userMetadata = z2kplus::backend::shared::userMetadata;
+namespace zgMetadata = z2kplus::backend::shared::zgMetadata;
+
+#define HERE KOSAK_CODING_HERE
+
+namespace z2kplus::backend::factories {
+namespace {
+// Walks a record that is expected to be in exactly the form we write. Every method returns false
+// (without reporting anything) as soon as the text departs from that form; the caller then hands
+// the record to the generic parser.
+class Cursor {
+public:
+  explicit Cursor(std::string_view text) : current_(text.data()),
+      end_(text.data() + text.size()) {}
+
+  bool atEnd() const { return current_ == end_; }
+
+  bool consume(char ch) {
+    if (current_ == end_ || *current_ != ch) {
+      return false;
+    }
+    ++current_;
+    return true;
+  }
+
+  bool consumeUint64(uint64_t *result) {
+    // Up to 19 digits can't overflow. Anything longer (or signed) goes the slow way.
+    constexpr size_t maxDigits = 19;
+    uint64_t value = 0;
+    const auto *start = current_;
+    while (current_ != end_ && *current_ >= '0' && *current_ <= '9') {
+      if (current_ - start == maxDigits) {
+        return false;
+      }
+      value = value * 10 + (*current_ - '0');
+      ++current_;
+    }
+    // JSON doesn't allow leading zeros, so a number like 007 goes the slow way too.
+    if (current_ == start || (*start == '0' && current_ - start > 1)) {
+      return false;
+    }
+    *result = value;
+    return true;
+  }
+
+  bool consumeBool(bool *result) {
+    constexpr std::string_view trueText = "true";
+    constexpr std::string_view falseText = "false";
+    std::string_view remaining(current_, end_ - current_);
+    if (remaining.substr(0, trueText.size()) == trueText) {
+      current_ += trueText.size();
+      *result = true;
+      return true;
+    }
+    if (remaining.substr(0, falseText.size()) == falseText) {
+      current_ += falseText.size();
+      *result = false;
+      return true;
+    }
+    return false;
+  }
+
+  bool consumeString(RawJsonString *result) {
+    if (!consume('"')) {
+      return false;
+    }
+    std::string_view contents;
+    bool hasEscapes;
+    const auto *next = JsonScanner::scanString(current_, end_, &contents, &hasEscapes);
+    if (next == nullptr) {
+      return false;
+    }
+    current_ = next;
+    *result = RawJsonString(contents, hasEscapes);
+    return true;
+  }
+
+  // Matches one of the tags of a variant or enum, returning its index.
+  template<typename Tags>
+  bool consumeTag(const Tags &tags, size_t *index) {
+    RawJsonString tag;
+    if (!consumeString(&tag) || tag.hasEscapes()) {
+      return false;
+    }
+    for (size_t i = 0; i != tags.size(); ++i) {
+      if (tag.contents() == tags[i]) {
+        *index = i;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool consumeZgramId(ZgramId *result) {
+    uint64_t raw;
+    if (!consume('[') || !consumeUint64(&raw) || !consume(']')) {
+      return false;
+    }
+    *result = ZgramId(raw);
+    return true;
+  }
+
+  bool consumeRenderStyle(RenderStyle *result) {
+    size_t index;
+    if (!consumeTag(RenderStyleHolder::enumTags, &index)) {
+      return false;
+    }
+    *result = (RenderStyle)RenderStyleHolder::enumValues[index];
+    return true;
+  }
+
+private:
+  const char *current_ = nullptr;
+  const char *end_ = nullptr;
+};
+
+struct ScannedZgram {
+  ZgramId zgramId_;
+  uint64_t timesecs_ = 0;
+  RawJsonString sender_;
+  RawJsonString signature_;
+  bool isLogged_ = true;
+  RawJsonString instance_;
+  RawJsonString body_;
+  RenderStyle renderStyle_ = RenderStyle::Default;
+};
+
+// Same layouts as DEFINE_TYPICAL_JSON(ZgramCore, ...) and DEFINE_TYPICAL_JSON(Zephyrgram, ...).
+bool scanZgramCore(Cursor *c, RawJsonString *instance, RawJsonString *body,
+    RenderStyle *renderStyle) {
+  return c->consume('[') &&
+      c->consumeString(instance) && c->consume(',') &&
+      c->consumeString(body) && c->consume(',') &&
+      c->consumeRenderStyle(renderStyle) &&
+      c->consume(']');
+}
+
+bool scanZgram(Cursor *c, ScannedZgram *zg) {
+  return c->consume('[') &&
+      c->consumeZgramId(&zg->zgramId_) && c->consume(',') &&
+      c->consumeUint64(&zg->timesecs_) && c->consume(',') &&
+      c->consumeString(&zg->sender_) && c->consume(',') &&
+      c->consumeString(&zg->signature_) && c->consume(',') &&
+      c->consumeBool(&zg->isLogged_) && c->consume(',') &&
+      scanZgramCore(c, &zg->instance_, &zg->body_, &zg->renderStyle_) &&
+      c->consume(']');
+}
+
+bool decode(const RawJsonString &raw, std::string *result) {
+  FailRoot fr(true);
+  return raw.tryDecode(result, fr.nest(HERE));
+}
+
+bool makeZephyrgram(const ScannedZgram &zg, Zephyrgram *result) {
+  std::string sender;
+  std::string signature;
+  std::string instance;
+  std::string body;
+  if (!decode(zg.sender_, &sender) || !decode(zg.signature_, &signature) ||
+      !decode(zg.instance_, &instance) || !decode(zg.body_, &body)) {
+    return false;
+  }
+  ZgramCore zgc(std::move(instance), std::move(body), zg.renderStyle_);
+  *result = Zephyrgram(zg.zgramId_, zg.timesecs_, std::move(sender), std::move(signature),
+      zg.isLogged_, std::move(zgc));
+  return true;
+}
+
+// The payload of a MetadataRecord, i.e. the part after its variant tag.
+bool scanMetadataPayload(Cursor *c, size_t tagIndex, MetadataRecord *result) {
+  switch (tagIndex) {
+    case 0: {
+      ZgramId zgramId;
+      RawJsonString reaction;
+      RawJsonString creator;
+      bool value;
+      std::string reactionText;
+      std::string creatorText;
+      if (!c->consume('[') ||
+          !c->consumeZgramId(&zgramId) || !c->consume(',') ||
+          !c->consumeString(&reaction) || !c->consume(',') ||
+          !c->consumeString(&creator) || !c->consume(',') ||
+          !c->consumeBool(&value) ||
+          !c->consume(']') ||
+          !decode(reaction, &reactionText) || !decode(creator, &creatorText)) {
+        return false;
+      }
+      *result = MetadataRecord(zgMetadata::Reaction(zgramId, std::move(reactionText),
+          std::move(creatorText), value));
+      return true;
+    }
+    case 1: {
+      ZgramId zgramId;
+      RawJsonString instance;
+      RawJsonString body;
+      RenderStyle renderStyle;
+      std::string instanceText;
+      std::string bodyText;
+      if (!c->consume('[') ||
+          !c->consumeZgramId(&zgramId) || !c->consume(',') ||
+          !scanZgramCore(c, &instance, &body, &renderStyle) ||
+          !c->consume(']') ||
+          !decode(instance, &instanceText) || !decode(body, &bodyText)) {
+        return false;
+      }
+      ZgramCore zgc(std::move(instanceText), std::move(bodyText), renderStyle);
+      *result = MetadataRecord(zgMetadata::ZgramRevision(zgramId, std::move(zgc)));
+      return true;
+    }
+    case 2: {
+      ZgramId zgramId;
+      ZgramId refersTo;
+      bool value;
+      if (!c->consume('[') ||
+          !c->consumeZgramId(&zgramId) || !c->consume(',') ||
+          !c->consumeZgramId(&refersTo) || !c->consume(',') ||
+          !c->consumeBool(&value) ||
+          !c->consume(']')) {
+        return false;
+      }
+      *result = MetadataRecord(zgMetadata::ZgramRefersTo(zgramId, refersTo, value));
+      return true;
+    }
+    case 3: {
+      RawJsonString userId;
+      RawJsonString zmojis;
+      std::string userIdText;
+      std::string zmojisText;
+      if (!c->consume('[') ||
+          !c->consumeString(&userId) || !c->consume(',') ||
+          !c->consumeString(&zmojis) ||
+          !c->consume(']') ||
+          !decode(userId, &userIdText) || !decode(zmojis, &zmojisText)) {
+        return false;
+      }
+      *result = MetadataRecord(userMetadata::Zmojis(std::move(userIdText), std::move(zmojisText)));
+      return true;
+    }
+    default:
+      return false;
+  }
+}
+static_assert(userMetadata::MetadataRecordPayloadHolder::variantTags.size() == 4,
+    "scanMetadataPayload needs a case for the new metadata type");
+
+// A log record is a one-element tuple holding a logRecordPayload_t variant, encoded as
+// [tag, value]. A MetadataRecord is in turn a one-element tuple holding a variant.
+// On success, exactly one of *isZgram (with *zgram filled in) or !*isZgram (with *metadata filled
+// in) holds.
+bool scanRecord(std::string_view text, bool *isZgram, ScannedZgram *zgram,
+    MetadataRecord *metadata) {
+  Cursor c(text);
+  size_t tagIndex;
+  if (!c.consume('[') || !c.consume('[') ||
+      !c.consumeTag(LogRecordPayloadHolder::variantTags, &tagIndex) ||
+      !c.consume(',')) {
+    return false;
+  }
+  if (tagIndex == 0) {
+    *isZgram = true;
+    if (!scanZgram(&c, zgram)) {
+      return false;
+    }
+  } else {
+    *isZgram = false;
+    size_t mdTagIndex;
+    if (!c.consume('[') || !c.consume('[') ||
+        !c.consumeTag(userMetadata::MetadataRecordPayloadHolder::variantTags, &mdTagIndex) ||
+        !c.consume(',') ||
+        !scanMetadataPayload(&c, mdTagIndex, metadata) ||
+        !c.consume(']') || !c.consume(']')) {
+      return false;
+    }
+  }
+  return c.consume(']') && c.consume(']') && c.atEnd();
+}
+
+bool tryParseGeneric(std::string_view text, LogRecord *result, const FailFrame &ff) {
+  ParseContext ctx(text);
+  return tryParseJson(&ctx, result, ff.nest(HERE));
+}
+}  // namespace
+
+bool RawJsonString::tryDecode(std::string *result, const FailFrame &ff) const {
+  if (!hasEscapes_) {
+    result->append(contents_);
+    return true;
+  }
+  // Our contents are always a view into the original text, where they sit between quotes.
+  ParseContext ctx(std::string_view(contents_.data() - 1, contents_.size() + 2));
+  return tryParseJson(&ctx, result, ff.nest(HERE));
+}
+
+LogRecordBatch::LogRecordBatch() = default;
+LogRecordBatch::LogRecordBatch(LogRecordBatch &&) noexcept = default;
+LogRecordBatch &LogRecordBatch::operator=(LogRecordBatch &&) noexcept = default;
+LogRecordBatch::~LogRecordBatch() = default;
+
+void LogRecordBatch::clear() {
+  order_.clear();
+  zgrams_ = ZgramColumns();
+  metadata_.clear();
+  ownedText_.clear();
+}
+
+bool LogRecordBatch::tryDecodeZgram(size_t index, Zephyrgram *result, const FailFrame &ff) const {
+  const auto &z = zgrams_;
+  std::string sender;
+  std::string signature;
+  std::string instance;
+  std::string body;
+  if (!z.senders_[index].tryDecode(&sender, ff.nest(HERE)) ||
+      !z.signatures_[index].tryDecode(&signature, ff.nest(HERE)) ||
+      !z.instances_[index].tryDecode(&instance, ff.nest(HERE)) ||
+      !z.bodies_[index].tryDecode(&body, ff.nest(HERE))) {
+    return false;
+  }
+  ZgramCore zgc(std::move(instance), std::move(body), z.renderStyles_[index]);
+  *result = Zephyrgram(z.zgramIds_[index], z.timesecs_[index], std::move(sender),
+      std::move(signature), z.isLogged_[index], std::move(zgc));
+  return true;
+}
+
+bool LogRecordScanner::tryParse(std::string_view text, LogRecord *result, const FailFrame &ff) {
+  bool isZgram;
+  ScannedZgram zgram;
+  MetadataRecord metadata;
+  if (scanRecord(text, &isZgram, &zgram, &metadata)) {
+    if (!isZgram) {
+      *result = LogRecord(std::move(metadata));
+      return true;
+    }
+    Zephyrgram zg;
+    if (makeZephyrgram(zgram, &zg)) {
+      *result = LogRecord(std::move(zg));
+      return true;
+    }
+  }
+  return tryParseGeneric(text, result, ff.nest(HERE));
+}
+
+bool LogRecordScanner::tryScanRegion(std::string_view text, FileKey<FileKeyKind::Either> fileKey,
+    size_t startingOffset, LogRecordBatch *batch, const FailFrame &ff) {
+  auto &z = batch->zgrams_;
+  auto appendZgram = [&z](const ScannedZgram &zg, const LogLocation &location) {
+    z.zgramIds_.push_back(zg.zgramId_);
+    z.timesecs_.push_back(zg.timesecs_);
+    z.senders_.push_back(zg.sender_);
+    z.signatures_.push_back(zg.signature_);
+    z.isLogged_.push_back(zg.isLogged_);
+    z.instances_.push_back(zg.instance_);
+    z.bodies_.push_back(zg.body_);
+    z.renderStyles_.push_back(zg.renderStyle_);
+    z.locations_.push_back(location);
+  };
+  // A zgram that only the generic parser understands has no raw text we can point into, so we keep
+  // its (already unescaped) strings alive in the batch.
+  auto own = [batch](std::string s) {
+    batch->ownedText_.push_back(std::move(s));
+    return RawJsonString(batch->ownedText_.back(), false);
+  };
+
+  auto splitter = Splitter::ofRecords(text, '\n');
+  size_t offset = startingOffset;
+  std::string_view line;
+  while (splitter.moveNext(&line)) {
+    LogLocation location(fileKey, offset, line.size());
+    offset += line.size() + 1;
+
+    bool isZgram;
+    ScannedZgram zgram;
+    MetadataRecord metadata;
+    if (scanRecord(line, &isZgram, &zgram, &metadata)) {
+      if (isZgram) {
+        batch->order_.emplace_back(true, z.zgramIds_.size());
+        appendZgram(zgram, location);
+      } else {
+        batch->order_.emplace_back(false, batch->metadata_.size());
+        batch->metadata_.emplace_back(std::move(metadata), location);
+      }
+      continue;
+    }
+
+    LogRecord logRecord;
+    if (!tryParseGeneric(line, &logRecord, ff.nest(HERE))) {
+      return ff.failf(HERE, "...at (offset %o, size %o)", location.offset(), line.size());
+    }
+    if (auto *mdp = std::get_if<MetadataRecord>(&logRecord.payload())) {
+      batch->order_.emplace_back(false, batch->metadata_.size());
+      batch->metadata_.emplace_back(std::move(*mdp), location);
+      continue;
+    }
+    auto &zg = std::get<Zephyrgram>(logRecord.payload());
+    zgram.zgramId_ = zg.zgramId();
+    zgram.timesecs_ = zg.timesecs();
+    zgram.sender_ = own(std::string(zg.sender()));
+    zgram.signature_ = own(std::string(zg.signature()));
+    zgram.isLogged_ = zg.isLogged();
+    zgram.instance_ = own(std::string(zg.zgramCore().instance()));
+    zgram.body_ = own(std::string(zg.zgramCore().body()));
+    zgram.renderStyle_ = zg.zgramCore().renderStyle();
+    batch->order_.emplace_back(true, z.zgramIds_.size());
+    appendZgram(zgram, location);
+  }
+  return true;
+}
+}  // namespace z2kplus::backend::factories
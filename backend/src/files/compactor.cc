@@ -0,0 +1,294 @@
+// Copyright 2023 The Z2K Plus+ Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "z2kplus/backend/files/compactor.h"
+
+#include <algorithm>
+#include <iostream>
+#include <optional>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "kosak/coding/coding.h"
+#include "kosak/coding/memory/mapped_file.h"
+#include "kosak/coding/text/conversions.h"
+#include "kosak/coding/text/misc.h"
+#include "z2kplus/backend/factories/log_parser.h"
+#include "z2kplus/backend/reverse_index/builder/digest_cache.h"
+#include "z2kplus/backend/shared/magic_constants.h"
+
+namespace z2kplus::backend::files {
+
+using kosak::coding::FailFrame;
+using kosak::coding::FailRoot;
+using kosak::coding::memory::MappedFile;
+using kosak::coding::nsunix::FileCloser;
+using kosak::coding::streamf;
+using kosak::coding::stringf;
+using kosak::coding::text::Splitter;
+using kosak::coding::text::tryParseDecimal;
+using z2kplus::backend::factories::LogParser;
+using z2kplus::backend::reverse_index::builder::DigestKey;
+using z2kplus::backend::shared::LogRecord;
+using z2kplus::backend::shared::Zephyrgram;
+using z2kplus::backend::shared::ZgramId;
+
+namespace nsunix = kosak::coding::nsunix;
+namespace magicConstants = z2kplus::backend::shared::magicConstants;
+
+#define HERE KOSAK_CODING_HERE
+
+namespace {
+bool tryMakeSourceKey(const std::vector<std::string> &srcFilenames, std::string *result,
+    const FailFrame &ff);
+bool tryAppendPart(int destFd, const std::string &srcFilename, uint64_t *numRecords,
+    const FailFrame &ff);
+bool trySyncFile(const std::string &name, int extraFlags, const FailFrame &ff);
+bool tryParseManifestLine(std::string_view line, std::string *fileName, CompactedFile *result,
+    const FailFrame &ff);
+}  // namespace
+
+// A day that the manifest says is done, and whose output still checks out, is skipped. Otherwise
+// its parts are concatenated into a temporary file, which is verified (every record parses, the
+// record count matches the parts', zgramIds increase) and then renamed into place.
+bool Compactor::tryCompactDay(const std::vector<std::string> &srcFilenames,
+    const std::string &destFilename, bool isLogged, CompactorManifest *manifest,
+    CompactorStats *stats, const FailFrame &ff) {
+  std::string sourceKey;
+  if (!tryMakeSourceKey(srcFilenames, &sourceKey, ff.nest(HERE))) {
+    return false;
+  }
+
+  if (const auto *recorded = manifest->find(destFilename); recorded != nullptr) {
+    bool exists;
+    CompactedFile actual;
+    // A file that no longer verifies, or whose parts have changed, is simply redone.
+    FailRoot verifyFailure;
+    if (!nsunix::tryExists(destFilename, &exists, ff.nest(HERE))) {
+      return false;
+    }
+    actual.sourceKey_ = sourceKey;
+    if (exists && tryVerify(destFilename, isLogged, &actual, verifyFailure.nest(HERE)) &&
+        actual == *recorded) {
+      ++stats->numResumed_;
+      stats->numRecords_ += actual.numRecords_;
+      return true;
+    }
+    streamf(std::cerr, "%o doesn't match the manifest, so compacting it again\n", destFilename);
+  }
+
+  auto tempFilename = destFilename + std::string(compactingSuffix);
+  FileCloser fc;
+  uint64_t numSourceRecords = 0;
+  if (!nsunix::tryOpen(tempFilename, O_CREAT | O_TRUNC | O_WRONLY,
+      magicConstants::filenames::standardMode, &fc, ff.nest(HERE))) {
+    return false;
+  }
+  for (const auto &srcFilename : srcFilenames) {
+    if (!tryAppendPart(fc.get(), srcFilename, &numSourceRecords, ff.nest(HERE))) {
+      return false;
+    }
+  }
+  CompactedFile result;
+  result.sourceKey_ = std::move(sourceKey);
+  if (!nsunix::trySync(fc.get(), ff.nest(HERE)) ||
+      !fc.tryClose(ff.nest(HERE)) ||
+      !tryVerify(tempFilename, isLogged, &result, ff.nest(HERE))) {
+    return false;
+  }
+  if (result.numRecords_ != numSourceRecords) {
+    return ff.failf(HERE, "%o: wrote %o records, but the parts have %o", destFilename,
+        result.numRecords_, numSourceRecords);
+  }
+  stats->numRecords_ += result.numRecords_;
+  return nsunix::tryRename(tempFilename, destFilename, ff.nest(HERE)) &&
+      manifest->tryAppend(destFilename, result, ff.nest(HERE));
+}
+
+bool Compactor::tryVerify(const std::string &fileName, bool expectLogged, CompactedFile *result,
+    const FailFrame &ff) {
+  MappedFile<char> mf;
+  if (!mf.tryMap(fileName, false, ff.nest(HERE))) {
+    return false;
+  }
+  std::string_view text(mf.get(), mf.byteSize());
+  auto splitter = Splitter::ofRecords(text, '\n');
+  std::string_view line;
+  std::optional<ZgramId> prev;
+  uint64_t numRecords = 0;
+  while (splitter.moveNext(&line)) {
+    if (line.empty()) {
+      // Blank lines count as records in the parts too.
+      ++numRecords;
+      continue;
+    }
+    LogRecord record;
+    if (!LogParser::tryParseLogRecord(line, &record, ff.nest(HERE))) {
+      return ff.failf(HERE, "%o: can't parse record %o", fileName, numRecords);
+    }
+    if (const auto *zg = std::get_if<Zephyrgram>(&record.payload()); zg != nullptr) {
+      if (prev.has_value() && *prev >= zg->zgramId()) {
+        return ff.failf(HERE, "%o: zgrams out of order: %o then %o", fileName, *prev,
+            zg->zgramId());
+      }
+      if (zg->isLogged() != expectLogged) {
+        return ff.failf(HERE, "%o: expected zgramId %o to have logged=%o", fileName,
+            zg->zgramId(), expectLogged);
+      }
+      prev = zg->zgramId();
+    }
+    ++numRecords;
+  }
+  DigestKey key;
+  key.add(text);
+  result->size_ = text.size();
+  result->checksum_ = key.toString();
+  result->numRecords_ = numRecords;
+  return true;
+}
+
+bool CompactorManifest::tryOpen(std::string fileName, const FailFrame &ff) {
+  bool exists;
+  std::string text;
+  if (!nsunix::tryExists(fileName, &exists, ff.nest(HERE)) ||
+      (exists && !nsunix::tryReadAll(fileName, &text, ff.nest(HERE)))) {
+    return false;
+  }
+  // A line without its newline was cut off by the interruption; its file gets redone. So does a
+  // file that appears twice: the later line wins.
+  auto end = text.rfind('\n');
+  text.resize(end == std::string::npos ? 0 : end + 1);
+  auto splitter = Splitter::ofRecords(text, '\n');
+  std::string_view line;
+  while (splitter.moveNext(&line)) {
+    if (line.empty()) {
+      continue;
+    }
+    std::string name;
+    CompactedFile file;
+    if (!tryParseManifestLine(line, &name, &file, ff.nest(HERE))) {
+      return false;
+    }
+    files_[std::move(name)] = std::move(file);
+  }
+  // Replace it with a copy that lacks the torn line, if any, and carry on appending. The copy is
+  // synced before it is renamed over the original, so a crash here can't lose the lines we kept.
+  auto slash = fileName.rfind('/');
+  auto dirName = slash == std::string::npos ? std::string(".") : fileName.substr(0, slash + 1);
+  auto tempName = fileName + ".tmp";
+  return nsunix::tryWriteAll(tempName, text, ff.nest(HERE)) &&
+      trySyncFile(tempName, 0, ff.nest(HERE)) &&
+      nsunix::tryRename(tempName, fileName, ff.nest(HERE)) &&
+      trySyncFile(dirName, O_DIRECTORY, ff.nest(HERE)) &&
+      nsunix::tryOpen(fileName, O_WRONLY | O_APPEND, 0, &fc_, ff.nest(HERE));
+}
+
+const CompactedFile *CompactorManifest::find(const std::string &fileName) const {
+  // Appending doesn't touch files_, so this needs no lock.
+  auto ip = files_.find(fileName);
+  return ip == files_.end() ? nullptr : &ip->second;
+}
+
+bool CompactorManifest::tryAppend(const std::string &fileName, const CompactedFile &file,
+    const FailFrame &ff) {
+  auto line = stringf("%o %o %o %o %o\n", file.size_, file.checksum_, file.numRecords_,
+      file.sourceKey_, fileName);
+  std::unique_lock guard(mutex_);
+  return nsunix::tryWriteAll(fc_.get(), line.data(), line.size(), ff.nest(HERE)) &&
+      nsunix::trySync(fc_.get(), ff.nest(HERE));
+}
+
+namespace {
+bool tryMakeSourceKey(const std::vector<std::string> &srcFilenames, std::string *result,
+    const FailFrame &ff) {
+  DigestKey key;
+  key.add(srcFilenames.size());
+  for (const auto &srcFilename : srcFilenames) {
+    FileCloser fc;
+    struct stat st = {};
+    if (!nsunix::tryOpen(srcFilename, O_RDONLY, 0, &fc, ff.nest(HERE)) ||
+        !nsunix::tryFstat(fc.get(), &st, ff.nest(HERE))) {
+      return false;
+    }
+    key.add(srcFilename);
+    key.add((uint64_t)st.st_size);
+    key.add((uint64_t)st.st_mtim.tv_sec);
+    key.add((uint64_t)st.st_mtim.tv_nsec);
+  }
+  *result = key.toString();
+  return true;
+}
+
+// Writes straight from the mapping, so the part is never copied into our memory. A part whose last
+// record lacks its newline gets one, so that it doesn't run into the next part's first record.
+bool tryAppendPart(int destFd, const std::string &srcFilename, uint64_t *numRecords,
+    const FailFrame &ff) {
+  MappedFile<char> mf;
+  if (!mf.tryMap(srcFilename, false, ff.nest(HERE))) {
+    return false;
+  }
+  std::string_view text(mf.get(), mf.byteSize());
+  if (text.empty()) {
+    return true;
+  }
+  *numRecords += std::count(text.begin(), text.end(), '\n');
+  if (!nsunix::tryWriteAll(destFd, text.data(), text.size(), ff.nest(HERE))) {
+    return false;
+  }
+  if (text.back() == '\n') {
+    return true;
+  }
+  ++*numRecords;
+  return nsunix::tryWriteAll(destFd, "\n", 1, ff.nest(HERE));
+}
+
+bool trySyncFile(const std::string &name, int extraFlags, const FailFrame &ff) {
+  FileCloser fc;
+  return nsunix::tryOpen(name, O_RDONLY | extraFlags, 0, &fc, ff.nest(HERE)) &&
+      nsunix::trySync(fc.get(), ff.nest(HERE)) &&
+      fc.tryClose(ff.nest(HERE));
+}
+
+bool tryParseManifestLine(std::string_view line, std::string *fileName, CompactedFile *result,
+    const FailFrame &ff) {
+  std::string_view residual;
+  auto tryNextWord = [&residual](std::string *word) {
+    auto space = residual.find(' ');
+    if (space == std::string_view::npos) {
+      return false;
+    }
+    *word = residual.substr(0, space);
+    residual = residual.substr(space + 1);
+    return true;
+  };
+  auto maybeConsumeSpace = [&residual]() {
+    if (residual.empty() || residual.front() != ' ') {
+      return false;
+    }
+    residual.remove_prefix(1);
+    return true;
+  };
+  if (!tryParseDecimal(line, &result->size_, &residual, ff.nest(HERE)) ||
+      !maybeConsumeSpace() ||
+      !tryNextWord(&result->checksum_) ||
+      !tryParseDecimal(residual, &result->numRecords_, &residual, ff.nest(HERE)) ||
+      !maybeConsumeSpace() ||
+      !tryNextWord(&result->sourceKey_) ||
+      residual.empty()) {
+    return ff.failf(HERE, "Malformed manifest line: %o", line);
+  }
+  *fileName = residual;
+  return true;
+}
+}  // namespace
+}  // namespace z2kplus::backend::files
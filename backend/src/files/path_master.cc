@@ -14,6 +14,7 @@
 
 #include "z2kplus/backend/files/path_master.h"
 
+#include <fcntl.h>
 #include <string_view>
 #include "kosak/coding/coding.h"
 #include "kosak/coding/text/conversions.h"
@@ -54,6 +55,7 @@ bool PathMaster::tryCreate(std::string root, std::shared_ptr<PathMaster> *result
   auto indexRoot = root + "index/";
   auto scratchRoot = root + "scratch/";
   auto mediaRoot = root + "media/";
+  auto digestCacheRoot = root + "digest_cache/";
 
   auto mkdirIfNotExists = [](const std::string &name, const FailFrame &f2) {
     bool exists;
@@ -67,21 +69,24 @@ bool PathMaster::tryCreate(std::string root, std::shared_ptr<PathMaster> *result
       !mkdirIfNotExists(unloggedRoot, ff.nest(HERE)) ||
       !mkdirIfNotExists(indexRoot, ff.nest(HERE)) ||
       !mkdirIfNotExists(scratchRoot, ff.nest(HERE)) ||
-      !mkdirIfNotExists(mediaRoot, ff.nest(HERE))) {
+      !mkdirIfNotExists(mediaRoot, ff.nest(HERE)) ||
+      !mkdirIfNotExists(digestCacheRoot, ff.nest(HERE))) {
     return false;
   }
 
   *result = std::make_shared<PathMaster>(Private(), std::move(loggedRoot),
       std::move(unloggedRoot), std::move(indexRoot), std::move(scratchRoot),
-      std::move(mediaRoot));
+      std::move(mediaRoot), std::move(digestCacheRoot));
   return true;
 }
 
 PathMaster::PathMaster(Private, std::string loggedRoot, std::string unloggedRoot,
-    std::string indexRoot, std::string scratchRoot, std::string mediaRoot) :
+    std::string indexRoot, std::string scratchRoot, std::string mediaRoot,
+    std::string digestCacheRoot) :
     loggedRoot_(std::move(loggedRoot)),
     unloggedRoot_(std::move(unloggedRoot)), indexRoot_(std::move(indexRoot)),
-    scratchRoot_(std::move(scratchRoot)), mediaRoot_(std::move(mediaRoot)) {}
+    scratchRoot_(std::move(scratchRoot)), mediaRoot_(std::move(mediaRoot)),
+    digestCacheRoot_(std::move(digestCacheRoot)) {}
 PathMaster::~PathMaster() = default;
 
 std::string PathMaster::getPlaintextPath(FileKey<FileKeyKind::Either> fileKey) const {
@@ -119,7 +124,13 @@ bool PathMaster::tryGetPlaintexts(
 bool PathMaster::tryPublishBuild(const FailFrame &ff) const {
   auto src = getScratchIndexPath();
   auto dest = getIndexPath();
-  return nsunix::tryRename(src, dest, ff.nest(HERE));
+  // The builder has already made the file itself durable. Syncing the directory does the same for
+  // the rename.
+  nsunix::FileCloser dir;
+  return nsunix::tryRename(src, dest, ff.nest(HERE)) &&
+      nsunix::tryOpen(indexRoot_, O_RDONLY | O_DIRECTORY, 0, &dir, ff.nest(HERE)) &&
+      nsunix::trySync(dir.get(), ff.nest(HERE)) &&
+      dir.tryClose(ff.nest(HERE));
 }
 
 namespace {
@@ -0,0 +1,279 @@
+// Copyright 2023 The Z2K Plus+ Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "z2kplus/backend/queryparsing/planner.h"
+
+#include <algorithm>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "kosak/coding/coding.h"
+#include "z2kplus/backend/reverse_index/iterators/zgram/and.h"
+#include "z2kplus/backend/reverse_index/iterators/zgram/not.h"
+#include "z2kplus/backend/reverse_index/iterators/zgram/or.h"
+#include "z2kplus/backend/reverse_index/iterators/zgram/popornot.h"
+
+namespace z2kplus::backend::queryparsing {
+
+using kosak::coding::streamf;
+using kosak::coding::toString;
+using z2kplus::backend::reverse_index::FieldMask;
+using z2kplus::backend::reverse_index::index::ConsolidatedIndex;
+using z2kplus::backend::reverse_index::iterators::And;
+using z2kplus::backend::reverse_index::iterators::Not;
+using z2kplus::backend::reverse_index::iterators::Or;
+using z2kplus::backend::reverse_index::iterators::PlanEstimate;
+using z2kplus::backend::reverse_index::iterators::ZgramIterator;
+using z2kplus::backend::reverse_index::iterators::zgram::PopOrNot;
+
+namespace {
+struct PlanNode {
+  PlanNode() = default;
+  PlanNode(std::string label, PlanEstimate estimate) : label_(std::move(label)), estimate_(estimate) {}
+
+  void explain(std::ostream &s, size_t depth) const;
+
+  std::string label_;
+  PlanEstimate estimate_;
+  std::vector<PlanNode> children_;
+};
+
+struct Planned {
+  std::unique_ptr<ZgramIterator> iterator_;
+  // The canonical text of 'iterator_', used to detect duplicates and complements.
+  std::string key_;
+  PlanNode node_;
+};
+
+class Planner {
+public:
+  explicit Planner(const ConsolidatedIndex &ci) : ci_(ci) {}
+
+  Planned plan(std::unique_ptr<ZgramIterator> &&iterator);
+
+private:
+  Planned planAnd(std::vector<std::unique_ptr<ZgramIterator>> &&children);
+  Planned planOr(std::vector<std::unique_ptr<ZgramIterator>> &&children);
+  Planned planNot(std::unique_ptr<ZgramIterator> &&child);
+  std::vector<Planned> planChildren(std::vector<std::unique_ptr<ZgramIterator>> &&children, bool isAnd);
+  Planned makeLeaf(std::unique_ptr<ZgramIterator> &&iterator);
+
+  const ConsolidatedIndex &ci_;
+};
+
+std::string makeNotKey(const std::string &key);
+}  // namespace
+
+std::unique_ptr<ZgramIterator> QueryPlanner::plan(std::unique_ptr<ZgramIterator> &&query,
+    std::string *explanation) const {
+  Planner planner(ci_);
+  auto planned = planner.plan(std::move(query));
+  if (explanation != nullptr) {
+    std::ostringstream s;
+    planned.node_.explain(s, 0);
+    *explanation = s.str();
+  }
+  return std::move(planned.iterator_);
+}
+
+namespace {
+Planned Planner::plan(std::unique_ptr<ZgramIterator> &&iterator) {
+  std::vector<std::unique_ptr<ZgramIterator>> children;
+  if (iterator->tryReleaseAndChildren(&children)) {
+    return planAnd(std::move(children));
+  }
+  if (iterator->tryReleaseOrChildren(&children)) {
+    return planOr(std::move(children));
+  }
+  std::unique_ptr<ZgramIterator> negated;
+  if (iterator->tryNegate(&negated)) {
+    return planNot(std::move(negated));
+  }
+  return makeLeaf(std::move(iterator));
+}
+
+// Optimizations, beyond the ones And::create already does:
+// * Remove duplicate children
+// * "x and not x" matches nothing
+// * Order the children by estimated size, smallest first, so the leapfrog is driven by the rarest
+//   operand.
+Planned Planner::planAnd(std::vector<std::unique_ptr<ZgramIterator>> &&children) {
+  auto planned = planChildren(std::move(children), true);
+  std::vector<Planned> kept;
+  std::set<std::string> keys;
+  for (auto &p : planned) {
+    if (p.iterator_->matchesEverything()) {
+      continue;
+    }
+    if (p.iterator_->matchesNothing()) {
+      return std::move(p);
+    }
+    if (!keys.insert(p.key_).second) {
+      continue;
+    }
+    kept.push_back(std::move(p));
+  }
+  for (const auto &p : kept) {
+    if (keys.find(makeNotKey(p.key_)) != keys.end()) {
+      return makeLeaf(PopOrNot::create(FieldMask::none, FieldMask::none));
+    }
+  }
+  if (kept.empty()) {
+    return makeLeaf(PopOrNot::create(FieldMask::all, FieldMask::all));
+  }
+  if (kept.size() == 1) {
+    return std::move(kept[0]);
+  }
+  std::stable_sort(kept.begin(), kept.end(), [](const Planned &lhs, const Planned &rhs) {
+    return lhs.node_.estimate_.size < rhs.node_.estimate_.size;
+  });
+
+  // The first child is streamed in full. Each subsequent child is asked to catch up at most once per
+  // candidate of the first child, so it costs no more than the smaller of its own cost and that size.
+  const auto &driver = kept.front().node_.estimate_;
+  PlanEstimate estimate(driver.size, driver.cost);
+  std::vector<std::unique_ptr<ZgramIterator>> iterators;
+  PlanNode node;
+  for (auto &p : kept) {
+    if (&p != &kept.front()) {
+      estimate.cost += std::min(p.node_.estimate_.cost, driver.size);
+    }
+    iterators.push_back(std::move(p.iterator_));
+    node.children_.push_back(std::move(p.node_));
+  }
+  node.label_ = "And";
+  node.estimate_ = estimate;
+  auto iterator = And::create(std::move(iterators));
+  auto key = toString(*iterator);
+  return {std::move(iterator), std::move(key), std::move(node)};
+}
+
+// Optimizations, beyond the ones Or::create already does:
+// * Remove duplicate children
+// * "x or not x" matches everything
+Planned Planner::planOr(std::vector<std::unique_ptr<ZgramIterator>> &&children) {
+  auto planned = planChildren(std::move(children), false);
+  std::vector<Planned> kept;
+  std::set<std::string> keys;
+  for (auto &p : planned) {
+    if (p.iterator_->matchesNothing()) {
+      continue;
+    }
+    if (p.iterator_->matchesEverything()) {
+      return std::move(p);
+    }
+    if (!keys.insert(p.key_).second) {
+      continue;
+    }
+    kept.push_back(std::move(p));
+  }
+  for (const auto &p : kept) {
+    if (keys.find(makeNotKey(p.key_)) != keys.end()) {
+      return makeLeaf(PopOrNot::create(FieldMask::all, FieldMask::all));
+    }
+  }
+  if (kept.empty()) {
+    return makeLeaf(PopOrNot::create(FieldMask::none, FieldMask::none));
+  }
+  if (kept.size() == 1) {
+    return std::move(kept[0]);
+  }
+
+  PlanEstimate estimate;
+  std::vector<std::unique_ptr<ZgramIterator>> iterators;
+  PlanNode node;
+  for (auto &p : kept) {
+    estimate.size += p.node_.estimate_.size;
+    estimate.cost += p.node_.estimate_.cost;
+    iterators.push_back(std::move(p.iterator_));
+    node.children_.push_back(std::move(p.node_));
+  }
+  estimate.size = std::min(estimate.size, ci_.zgramInfoSize());
+  node.label_ = "Or";
+  node.estimate_ = estimate;
+  auto iterator = Or::create(std::move(iterators));
+  auto key = toString(*iterator);
+  return {std::move(iterator), std::move(key), std::move(node)};
+}
+
+Planned Planner::planNot(std::unique_ptr<ZgramIterator> &&child) {
+  auto planned = plan(std::move(child));
+  if (planned.iterator_->matchesNothing()) {
+    return makeLeaf(PopOrNot::create(FieldMask::all, FieldMask::all));
+  }
+  if (planned.iterator_->matchesEverything()) {
+    return makeLeaf(PopOrNot::create(FieldMask::none, FieldMask::none));
+  }
+  // Not(Not(x)) collapses to x.
+  std::unique_ptr<ZgramIterator> inner;
+  if (planned.iterator_->tryNegate(&inner)) {
+    passert(planned.node_.children_.size() == 1);
+    auto innerNode = std::move(planned.node_.children_[0]);
+    auto innerKey = toString(*inner);
+    return {std::move(inner), std::move(innerKey), std::move(innerNode)};
+  }
+  // Not walks every zgram in the index, plus its child.
+  auto n = ci_.zgramInfoSize();
+  PlanNode node("Not", PlanEstimate(n, n + planned.node_.estimate_.cost));
+  node.children_.push_back(std::move(planned.node_));
+  auto iterator = Not::create(std::move(planned.iterator_));
+  auto key = toString(*iterator);
+  return {std::move(iterator), std::move(key), std::move(node)};
+}
+
+// Nested nodes of the same kind are folded in before planning. And::create and Or::create would
+// do this anyway, but doing it here lets us dedupe and reorder across the whole group.
+std::vector<Planned> Planner::planChildren(std::vector<std::unique_ptr<ZgramIterator>> &&children,
+    bool isAnd) {
+  std::vector<Planned> result;
+  result.reserve(children.size());
+  for (auto &child : children) {
+    std::vector<std::unique_ptr<ZgramIterator>> grandchildren;
+    if (isAnd ? child->tryReleaseAndChildren(&grandchildren) : child->tryReleaseOrChildren(&grandchildren)) {
+      auto planned = planChildren(std::move(grandchildren), isAnd);
+      for (auto &p : planned) {
+        result.push_back(std::move(p));
+      }
+      continue;
+    }
+    result.push_back(plan(std::move(child)));
+  }
+  return result;
+}
+
+Planned Planner::makeLeaf(std::unique_ptr<ZgramIterator> &&iterator) {
+  auto key = toString(*iterator);
+  PlanNode node(key, iterator->estimate(ci_));
+  return {std::move(iterator), std::move(key), std::move(node)};
+}
+
+void PlanNode::explain(std::ostream &s, size_t depth) const {
+  streamf(s, "%o%o [size=%o, cost=%o]\n", std::string(depth * 2, ' '), label_, estimate_.size,
+      estimate_.cost);
+  for (const auto &child : children_) {
+    child.explain(s, depth + 1);
+  }
+}
+
+std::string makeNotKey(const std::string &key) {
+  std::string result = "Not(";
+  result += key;
+  result += ')';
+  return result;
+}
+}  // namespace
+}  // namespace z2kplus::backend::queryparsing
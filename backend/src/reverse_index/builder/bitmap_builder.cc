@@ -0,0 +1,105 @@
+// Copyright 2023 The Z2K Plus+ Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "z2kplus/backend/reverse_index/builder/bitmap_builder.h"
+
+#include <algorithm>
+#include <cstring>
+#include "kosak/coding/coding.h"
+#include "kosak/coding/failures.h"
+
+using kosak::coding::FailFrame;
+using z2kplus::backend::util::frozen::FrozenBitmap;
+using z2kplus::backend::util::frozen::FrozenVector;
+
+#define HERE KOSAK_CODING_HERE
+
+namespace z2kplus::backend::reverse_index::builder {
+bool BitmapBuilder::tryMake(const uint32_t *values, size_t size, SimpleAllocator *alloc,
+    FrozenBitmap *result, const FailFrame &ff) {
+  typedef FrozenBitmap::Container Container;
+  // First pass: size everything.
+  size_t numContainers = 0;
+  size_t numArrayElements = 0;
+  size_t numBitsetWords = 0;
+  for (size_t i = 1; i < size; ++i) {
+    if (values[i] <= values[i - 1]) {
+      return ff.failf(HERE, "values not strictly increasing at %o: %o then %o", i, values[i - 1],
+          values[i]);
+    }
+  }
+  for (size_t i = 0; i != size; ) {
+    auto high = values[i] >> 16;
+    auto j = i + 1;
+    while (j != size && (values[j] >> 16) == high) {
+      ++j;
+    }
+    ++numContainers;
+    if (j - i > FrozenBitmap::maxArraySize) {
+      numBitsetWords += FrozenBitmap::wordsPerBitset;
+    } else {
+      numArrayElements += j - i;
+    }
+    i = j;
+  }
+
+  Container *containers;
+  uint16_t *arrays;
+  uint64_t *bitsets;
+  if (!alloc->tryAllocate(numContainers, &containers, ff.nest(HERE)) ||
+      !alloc->tryAllocate(numArrayElements, &arrays, ff.nest(HERE)) ||
+      !alloc->tryAllocate(numBitsetWords, &bitsets, ff.nest(HERE))) {
+    return false;
+  }
+  std::memset(bitsets, 0, numBitsetWords * sizeof(uint64_t));
+
+  // Second pass: fill them in.
+  size_t containerIndex = 0;
+  size_t arrayOffset = 0;
+  size_t bitsetOffset = 0;
+  for (size_t i = 0; i != size; ) {
+    auto high = values[i] >> 16;
+    auto j = i + 1;
+    while (j != size && (values[j] >> 16) == high) {
+      ++j;
+    }
+    Container c;
+    c.high_ = high;
+    c.cardinality_ = j - i;
+    c.rankBefore_ = i;
+    if (j - i > FrozenBitmap::maxArraySize) {
+      c.isBitset_ = 1;
+      c.offset_ = bitsetOffset;
+      auto *words = bitsets + bitsetOffset;
+      for (auto k = i; k != j; ++k) {
+        auto low = values[k] & 0xffff;
+        words[low / 64] |= uint64_t(1) << (low % 64);
+      }
+      bitsetOffset += FrozenBitmap::wordsPerBitset;
+    } else {
+      c.offset_ = arrayOffset;
+      for (auto k = i; k != j; ++k) {
+        arrays[arrayOffset++] = values[k] & 0xffff;
+      }
+    }
+    containers[containerIndex++] = c;
+    i = j;
+  }
+
+  *result = FrozenBitmap(FrozenVector<Container>(containers, numContainers),
+      FrozenVector<uint16_t>(arrays, numArrayElements),
+      FrozenVector<uint64_t>(bitsets, numBitsetWords));
+  return true;
+}
+}  // namespace z2kplus::backend::reverse_index::builder
@@ -0,0 +1,153 @@
+// Copyright 2023 The Z2K Plus+ Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "z2kplus/backend/reverse_index/builder/build_governor.h"
+
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <thread>
+#include "kosak/coding/coding.h"
+#include "kosak/coding/failures.h"
+#include "z2kplus/backend/shared/magic_constants.h"
+
+using kosak::coding::FailFrame;
+using kosak::coding::streamf;
+
+namespace magicConstants = z2kplus::backend::shared::magicConstants;
+
+#define HERE KOSAK_CODING_HERE
+
+namespace z2kplus::backend::reverse_index::builder {
+namespace {
+// From linux/ioprio.h, which glibc doesn't wrap.
+constexpr int ioprioWhoProcess = 1;
+constexpr int ioprioClassIdle = 3;
+constexpr int ioprioClassShift = 13;
+
+// How often a paused writer checks whether the pressure has cleared.
+constexpr auto pausePollInterval = std::chrono::milliseconds(10);
+
+int64_t toNanos(BuildGovernor::clock_t::time_point tp) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(tp.time_since_epoch()).count();
+}
+}  // namespace
+
+BuildGovernor::Options BuildGovernor::defaultOptions() {
+  Options result;
+  result.niceness_ = magicConstants::reindexingNiceness;
+  result.idleIoPriority_ = true;
+  result.writeBytesPerSecond_ = magicConstants::reindexingWriteBytesPerSecond;
+  result.latencyThreshold_ = magicConstants::reindexingLatencyThreshold;
+  result.queueDepthThreshold_ = magicConstants::reindexingQueueDepthThreshold;
+  result.pressureHold_ = magicConstants::reindexingPressureHold;
+  result.maxPause_ = magicConstants::reindexingMaxPause;
+  return result;
+}
+
+BuildGovernor::BuildGovernor(const Options &options) : options_(options),
+    tokens_((double)options.writeBytesPerSecond_), lastRefill_(clock_t::now()) {}
+BuildGovernor::~BuildGovernor() = default;
+
+bool BuildGovernor::tryLowerCurrentThreadPriority(const FailFrame &ff) const {
+  // On Linux the nice value and the I/O priority belong to the thread, and are inherited by the
+  // threads and processes it creates.
+  auto tid = (id_t)syscall(SYS_gettid);
+  if (options_.niceness_ != 0) {
+    errno = 0;
+    auto current = getpriority(PRIO_PROCESS, tid);
+    if (errno != 0) {
+      return ff.failf(HERE, "getpriority(%o) failed, errno=%o", tid, errno);
+    }
+    if (setpriority(PRIO_PROCESS, tid, current + options_.niceness_) != 0) {
+      return ff.failf(HERE, "setpriority(%o, %o) failed, errno=%o", tid,
+          current + options_.niceness_, errno);
+    }
+  }
+  if (options_.idleIoPriority_ &&
+      syscall(SYS_ioprio_set, ioprioWhoProcess, tid, ioprioClassIdle << ioprioClassShift) != 0) {
+    return ff.failf(HERE, "ioprio_set(%o) failed, errno=%o", tid, errno);
+  }
+  return true;
+}
+
+void BuildGovernor::beforeWrite(size_t bytes) {
+  waitForServer();
+  waitForTokens(bytes);
+  bytesWritten_ += bytes;
+}
+
+void BuildGovernor::reportServerLoad(std::chrono::microseconds batchLatency, size_t queueDepth) {
+  if (batchLatency <= options_.latencyThreshold_ && queueDepth <= options_.queueDepthThreshold_) {
+    return;
+  }
+  auto until = toNanos(clock_t::now() + options_.pressureHold_);
+  auto prev = pressureUntil_.load();
+  while (until > prev && !pressureUntil_.compare_exchange_weak(prev, until)) {
+  }
+}
+
+BuildGovernor::Metrics BuildGovernor::metrics() const {
+  Metrics result;
+  result.bytesWritten_ = bytesWritten_;
+  result.rateLimited_ = std::chrono::microseconds(rateLimitedMicros_.load());
+  result.paused_ = std::chrono::microseconds(pausedMicros_.load());
+  result.numPauses_ = numPauses_;
+  return result;
+}
+
+void BuildGovernor::waitForServer() {
+  auto start = clock_t::now();
+  if (toNanos(start) >= pressureUntil_) {
+    return;
+  }
+  ++numPauses_;
+  auto now = start;
+  while (toNanos(now) < pressureUntil_ && now - start < options_.maxPause_) {
+    std::this_thread::sleep_for(pausePollInterval);
+    now = clock_t::now();
+  }
+  pausedMicros_ += std::chrono::duration_cast<std::chrono::microseconds>(now - start).count();
+}
+
+void BuildGovernor::waitForTokens(size_t bytes) {
+  if (options_.writeBytesPerSecond_ == 0) {
+    return;
+  }
+  auto rate = (double)options_.writeBytesPerSecond_;
+  double debt;
+  {
+    std::lock_guard guard(mutex_);
+    auto now = clock_t::now();
+    std::chrono::duration<double> elapsed = now - lastRefill_;
+    lastRefill_ = now;
+    tokens_ = std::min(tokens_ + elapsed.count() * rate, rate);
+    tokens_ -= (double)bytes;
+    debt = -tokens_;
+  }
+  if (debt <= 0) {
+    return;
+  }
+  // Whoever goes into debt waits it out, so later writers see the debt and wait behind us.
+  std::chrono::duration<double> wait(debt / rate);
+  std::this_thread::sleep_for(wait);
+  rateLimitedMicros_ += std::chrono::duration_cast<std::chrono::microseconds>(wait).count();
+}
+
+std::ostream &operator<<(std::ostream &s, const BuildGovernor::Metrics &o) {
+  return streamf(s, "wrote %o bytes, rate-limited for %o ms, paused %o times for %o ms",
+      o.bytesWritten_, o.rateLimited_.count() / 1000, o.numPauses_, o.paused_.count() / 1000);
+}
+}  // namespace z2kplus::backend::reverse_index::builder
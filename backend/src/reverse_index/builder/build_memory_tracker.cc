@@ -0,0 +1,149 @@
+// Copyright 2023 The Z2K Plus+ Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "z2kplus/backend/reverse_index/builder/build_memory_tracker.h"
+
+#include <algorithm>
+#include <iostream>
+#include "kosak/coding/coding.h"
+#include "kosak/coding/failures.h"
+#include "kosak/coding/unix.h"
+#include "z2kplus/backend/shared/magic_constants.h"
+
+using kosak::coding::FailFrame;
+using kosak::coding::streamf;
+
+namespace magicConstants = z2kplus::backend::shared::magicConstants;
+namespace nsunix = kosak::coding::nsunix;
+
+#define HERE KOSAK_CODING_HERE
+
+namespace z2kplus::backend::reverse_index::builder {
+BuildMemoryTracker::BuildMemoryTracker(size_t budget) : budget_(budget) {}
+BuildMemoryTracker::~BuildMemoryTracker() = default;
+
+bool BuildMemoryTracker::tryReserve(size_t bytes, const FailFrame &ff) {
+  if (!reserveIfAvailable(bytes)) {
+    return ff.failf(HERE, "Reserving %o bytes would exceed the build budget (%o of %o in use)",
+        bytes, used_.load(), budget_);
+  }
+  return true;
+}
+
+void BuildMemoryTracker::release(size_t bytes) {
+  auto prev = used_.fetch_sub(bytes);
+  passert(prev >= bytes, prev, bytes);
+}
+
+size_t BuildMemoryTracker::estimateMemoryUsed() const {
+  return used_.load();
+}
+
+bool BuildMemoryTracker::resourcesExceeded() {
+  return budget_ != 0 && used_.load() > budget_;
+}
+
+bool BuildMemoryTracker::reserveIfAvailable(size_t bytes) {
+  auto used = used_.load();
+  while (true) {
+    if (budget_ != 0 && (used > budget_ || bytes > budget_ - used)) {
+      return false;
+    }
+    if (used_.compare_exchange_weak(used, used + bytes)) {
+      notePeak(used + bytes);
+      return true;
+    }
+  }
+}
+
+void BuildMemoryTracker::forceReserve(size_t bytes) {
+  notePeak(used_.fetch_add(bytes) + bytes);
+}
+
+size_t BuildMemoryTracker::threadsFor(size_t requested, size_t bytesPerThread) const {
+  if (requested == 0) {
+    requested = std::max<size_t>(nsunix::numCores(), 1);
+  }
+  if (budget_ == 0 || bytesPerThread == 0) {
+    return requested;
+  }
+  return std::clamp<size_t>(available() / bytesPerThread, 1, requested);
+}
+
+size_t BuildMemoryTracker::sortBufferSize(size_t numSorts) const {
+  if (budget_ == 0) {
+    return 0;
+  }
+  // Leave half of what's left for whatever runs alongside the sorts.
+  auto share = available() / 2 / std::max<size_t>(numSorts, 1);
+  return std::clamp(share, magicConstants::indexBuilderMinSortBuffer,
+      magicConstants::indexBuilderMaxSortBuffer);
+}
+
+size_t BuildMemoryTracker::endStage(std::string_view stageName) {
+  auto peak = stagePeak_.exchange(used_.load());
+  streamf(std::cerr, "%o: peak reservation %o bytes (budget %o)\n", stageName, peak, budget_);
+  return peak;
+}
+
+size_t BuildMemoryTracker::available() const {
+  auto used = used_.load();
+  return used < budget_ ? budget_ - used : 0;
+}
+
+void BuildMemoryTracker::notePeak(size_t used) {
+  auto peak = stagePeak_.load();
+  while (used > peak && !stagePeak_.compare_exchange_weak(peak, used)) {
+  }
+}
+
+MemoryReservation::MemoryReservation() = default;
+MemoryReservation::MemoryReservation(BuildMemoryTracker *tracker) : tracker_(tracker) {}
+MemoryReservation::MemoryReservation(MemoryReservation &&other) noexcept :
+    tracker_(other.tracker_), size_(other.size_) {
+  other.size_ = 0;
+}
+MemoryReservation &MemoryReservation::operator=(MemoryReservation &&other) noexcept {
+  if (this != &other) {
+    forceResize(0);
+    tracker_ = other.tracker_;
+    size_ = other.size_;
+    other.size_ = 0;
+  }
+  return *this;
+}
+MemoryReservation::~MemoryReservation() {
+  forceResize(0);
+}
+
+bool MemoryReservation::tryResizeIfAvailable(size_t bytes) {
+  if (bytes > size_ && !tracker_->reserveIfAvailable(bytes - size_)) {
+    return false;
+  }
+  if (bytes < size_) {
+    tracker_->release(size_ - bytes);
+  }
+  size_ = bytes;
+  return true;
+}
+
+void MemoryReservation::forceResize(size_t bytes) {
+  if (bytes > size_) {
+    tracker_->forceReserve(bytes - size_);
+  } else if (bytes < size_) {
+    tracker_->release(size_ - bytes);
+  }
+  size_ = bytes;
+}
+}  // namespace z2kplus::backend::reverse_index::builder
@@ -51,14 +51,15 @@ namespace filenames = z2kplus::backend::shared::magicConstants::filenames;
 namespace z2kplus::backend::reverse_index::builder {
 namespace {
 bool tryScanAllStrings(const PathMaster &pm, const LogSplitterResult &lsr,
-    const ZgramDigestorResult &zgdr, std::string *canonicalStringsResult, const FailFrame &ff);
+    const ZgramDigestorResult &zgdr, BuildMemoryTracker *memory,
+    std::string *canonicalStringsResult, const FailFrame &ff);
 }  // namespace
 
 bool CanonicalStringProcessor::tryMakeCanonicalStringPool(const PathMaster &pm, const LogSplitterResult &lsr,
-    const ZgramDigestorResult &zgdr, SimpleAllocator *alloc, FrozenStringPool *stringPool,
-    const FailFrame &ff) {
+    const ZgramDigestorResult &zgdr, BuildMemoryTracker *memory, SimpleAllocator *alloc,
+    FrozenStringPool *stringPool, const FailFrame &ff) {
   std::string canonicalStringFile;
-  if (!tryScanAllStrings(pm, lsr, zgdr, &canonicalStringFile, ff.nest(HERE))) {
+  if (!tryScanAllStrings(pm, lsr, zgdr, memory, &canonicalStringFile, ff.nest(HERE))) {
     return false;
   }
   MappedFile<char> mf;
@@ -100,7 +101,8 @@ template<typename Tuple>
 bool tryScanHelper(BufferedWriter *writer, TupleIterator<Tuple> *iter, const FailFrame &ff);
 
 bool tryScanAllStrings(const PathMaster &pm, const LogSplitterResult &lsr,
-    const ZgramDigestorResult &zgdr, std::string *canonicalStringsResult, const FailFrame &ff) {
+    const ZgramDigestorResult &zgdr, BuildMemoryTracker *memory,
+    std::string *canonicalStringsResult, const FailFrame &ff) {
   auto canonicalStrings = pm.getScratchPathFor(filenames::canonicalStrings);
   auto canonicalStringsBeforeSorting = canonicalStrings + filenames::beforeSortingSuffix;
   FileCloser fc;
@@ -141,6 +143,9 @@ bool tryScanAllStrings(const PathMaster &pm, const LogSplitterResult &lsr,
 
   SortManager sm;
   SortOptions sortOptions(false, true, defaultFieldSeparator, true);
+  sortOptions.bufferSize_ = memory->sortBufferSize(1);
+  MemoryReservation sortMemory(memory);
+  sortMemory.forceResize(sortOptions.bufferSize_);
   std::vector<KeyOptions> keyOptions{{1, false}};
   if (!SortManager::tryCreate(sortOptions, keyOptions, {canonicalStringsBeforeSorting},
       canonicalStrings, &sm, ff.nest(HERE)) ||
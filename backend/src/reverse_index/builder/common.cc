@@ -13,15 +13,21 @@
 // limitations under the License.
 
 #include "z2kplus/backend/reverse_index/builder/common.h"
+#include "kosak/coding/memory/buffered_writer.h"
 #include "kosak/coding/memory/mapped_file.h"
 
 using kosak::coding::bit_cast;
 using kosak::coding::FailFrame;
 using kosak::coding::memory::MappedFile;
+using kosak::coding::memory::WriteThrottle;
 
 #define HERE KOSAK_CODING_HERE
 
 namespace z2kplus::backend::reverse_index::builder {
+namespace {
+constexpr size_t throttleSlice = 1024 * 1024;
+}  // namespace
+
 RecordIterator::RecordIterator(MappedFile<char> &&mf) : mf_(std::move(mf)),
     remaining_(mf_.get(), mf_.byteSize()) {}
 RecordIterator::~RecordIterator() = default;
@@ -51,6 +57,11 @@ SimpleAllocator::SimpleAllocator(char *start, size_t capacity, size_t initialAli
   passert((initialAlignment_ & (initialAlignment_ - 1)) == 0, initialAlignment_);
 }
 
+SimpleAllocator::SimpleAllocator(IndexFileWriter *writer, size_t initialAlignment) :
+    SimpleAllocator(writer->start(), writer->capacity(), initialAlignment) {
+  writer_ = writer;
+}
+
 bool SimpleAllocator::tryAllocate(size_t size, size_t alignment, char **result, const FailFrame &ff) {
   if (!tryAlign(alignment, ff.nest(HERE))) {
     return false;
@@ -64,6 +75,30 @@ bool SimpleAllocator::tryAlign(size_t alignment, const FailFrame &ff) {
     return ff.failf(HERE, "Can't provide an alignment %o wider than initial alignment %o", alignment,
         initialAlignment_);
   }
+  return tryPad(alignment, ff.nest(HERE));
+}
+
+bool SimpleAllocator::tryBeginSection(IndexSection section, size_t alignment, const FailFrame &ff) {
+  if (currentSection_ != IndexSection::numSections && section <= currentSection_) {
+    return ff.failf(HERE, "Section %o can't follow section %o", section, currentSection_);
+  }
+  endSections();
+  if (!tryPad(alignment, ff.nest(HERE))) {
+    return false;
+  }
+  currentSection_ = section;
+  currentSectionBegin_ = offset_;
+  return true;
+}
+
+void SimpleAllocator::endSections() {
+  if (currentSection_ != IndexSection::numSections) {
+    sections_.setRange(currentSection_, currentSectionBegin_, offset_);
+    currentSection_ = IndexSection::numSections;
+  }
+}
+
+bool SimpleAllocator::tryPad(size_t alignment, const FailFrame &ff) {
   size_t mask = alignment - 1;
   if ((alignment & mask) != 0) {
     return ff.failf(HERE, "Alignment %o is not a power of 2", alignment);
@@ -85,6 +120,17 @@ bool SimpleAllocator::tryAdvance(size_t size, const FailFrame &ff) {
     return ff.failf(HERE, "Request %o exceeds remaining capacity %o", size, remaining);
   }
   offset_ += size;
+  if (writer_ != nullptr && !writer_->tryAdvanceTo(offset_, ff.nest(HERE))) {
+    return false;
+  }
+  // The index file is written through the mapping, so pace it here, a slice at a time.
+  unthrottledBytes_ += size;
+  if (unthrottledBytes_ >= throttleSlice) {
+    if (auto *throttle = WriteThrottle::current(); throttle != nullptr) {
+      throttle->beforeWrite(unthrottledBytes_);
+    }
+    unthrottledBytes_ = 0;
+  }
   return true;
 }
 }  // namespace z2kplus::backend::reverse_index::builder
@@ -0,0 +1,374 @@
+// Copyright 2023 The Z2K Plus+ Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "z2kplus/backend/reverse_index/builder/digest_cache.h"
+
+#include <charconv>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include "kosak/coding/coding.h"
+#include "kosak/coding/failures.h"
+#include "kosak/coding/memory/mapped_file.h"
+#include "kosak/coding/unix.h"
+#include "z2kplus/backend/shared/magic_constants.h"
+
+using kosak::coding::FailFrame;
+using kosak::coding::FailRoot;
+using kosak::coding::memory::MappedFile;
+using kosak::coding::nsunix::FileCloser;
+using kosak::coding::streamf;
+using kosak::coding::stringf;
+
+namespace magicConstants = z2kplus::backend::shared::magicConstants;
+namespace nsunix = kosak::coding::nsunix;
+
+#define HERE KOSAK_CODING_HERE
+
+namespace z2kplus::backend::reverse_index::builder {
+namespace {
+constexpr const char *manifestSuffix = ".manifest";
+
+// The finalizer from MurmurHash3.
+uint64_t fmix64(uint64_t k) {
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdULL;
+  k ^= k >> 33;
+  k *= 0xc4ceb9fe1a85ec53ULL;
+  k ^= k >> 33;
+  return k;
+}
+
+uint64_t rotl(uint64_t value, int shift) {
+  return (value << shift) | (value >> (64 - shift));
+}
+
+// What a cached file looked like when it was stored.
+struct FileChecksum {
+  uint64_t size_ = 0;
+  std::string checksum_;
+  uint64_t inode_ = 0;
+  uint64_t mtimeNanos_ = 0;
+};
+
+bool tryStatFile(const std::string &name, FileChecksum *result, const FailFrame &ff);
+bool tryRemoveIfExists(const std::string &name, const FailFrame &ff);
+bool trySyncFile(const std::string &name, int extraFlags, const FailFrame &ff);
+bool tryParseManifest(std::string_view text, std::vector<FileChecksum> *files,
+    std::vector<uint64_t> *values, const FailFrame &ff);
+}  // namespace
+
+DigestKey::DigestKey() : lane0_(0x9e3779b97f4a7c15ULL), lane1_(0xc3a5c85c97cb3127ULL) {}
+DigestKey::~DigestKey() = default;
+
+void DigestKey::add(std::string_view bytes) {
+  add(bytes.size());
+  size_t i = 0;
+  for (; i + sizeof(uint64_t) <= bytes.size(); i += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, bytes.data() + i, sizeof(word));
+    mix(word);
+  }
+  uint64_t tail = 0;
+  if (i != bytes.size()) {
+    memcpy(&tail, bytes.data() + i, bytes.size() - i);
+  }
+  mix(tail);
+}
+
+void DigestKey::add(uint64_t value) {
+  mix(value);
+}
+
+void DigestKey::mix(uint64_t word) {
+  lane0_ = rotl(lane0_ ^ fmix64(word), 27) * 0x9ddfea08eb382d69ULL;
+  lane1_ = rotl(lane1_ + fmix64(word ^ 0xb492b66fbe98f273ULL), 31) * 0x9ae16a3b2f90404fULL;
+}
+
+std::string DigestKey::toString() const {
+  char buffer[33];
+  snprintf(buffer, STATIC_ARRAYSIZE(buffer), "%016lx%016lx", (unsigned long)fmix64(lane0_),
+      (unsigned long)fmix64(lane1_));
+  return buffer;
+}
+
+bool tryChecksumFile(const std::string &fileName, uint64_t *size, std::string *checksum,
+    const FailFrame &ff) {
+  MappedFile<char> mf;
+  if (!mf.tryMap(fileName, false, ff.nest(HERE))) {
+    return false;
+  }
+  DigestKey key;
+  key.add(std::string_view(mf.get(), mf.byteSize()));
+  *size = mf.byteSize();
+  *checksum = key.toString();
+  return true;
+}
+
+DigestCache::DigestCache(std::string root) : root_(std::move(root)) {}
+DigestCache::~DigestCache() = default;
+
+bool DigestCache::tryLookup(const std::string &key, bool *found, Entry *result,
+    const FailFrame &ff) {
+  bool checksum;
+  {
+    std::unique_lock guard(mutex_);
+    used_.insert(key);
+    checksum = lookups_++ % magicConstants::digestCacheChecksumEvery == 0;
+  }
+  // An entry exists once its manifest does: tryStore writes the manifest last. An entry that
+  // doesn't check out (say, a file was damaged after it was stored) is a miss, and gets stored
+  // again.
+  auto manifest = manifestName(key);
+  bool exists;
+  Entry entry;
+  if (!nsunix::tryExists(manifest, &exists, ff.nest(HERE))) {
+    return false;
+  }
+  if (exists) {
+    FailRoot invalid;
+    if (!tryCheckEntry(key, checksum, &entry, invalid.nest(HERE))) {
+      streamf(std::cerr, "Ignoring digest cache entry %o: %o\n", key, invalid);
+      exists = false;
+    }
+  }
+
+  std::unique_lock guard(mutex_);
+  if (!exists) {
+    ++misses_;
+    *found = false;
+    return true;
+  }
+  ++hits_;
+  *found = true;
+  *result = std::move(entry);
+  return true;
+}
+
+// The files are checksummed and synced before the manifest is written, and the manifest is synced
+// before it is renamed into place, so a crash leaves either a whole entry or none.
+bool DigestCache::tryStore(const std::string &key, const Entry &entry, const FailFrame &ff) {
+  {
+    std::unique_lock guard(mutex_);
+    used_.insert(key);
+  }
+  // Clear out the remains of any earlier attempt (say, a build that crashed midway).
+  auto manifest = manifestName(key);
+  if (!tryRemoveIfExists(manifest, ff.nest(HERE))) {
+    return false;
+  }
+  std::string fileLines;
+  for (size_t i = 0; i != entry.files_.size(); ++i) {
+    auto name = fileName(key, i);
+    FileChecksum checksum;
+    if (!tryRemoveIfExists(name, ff.nest(HERE)) ||
+        !nsunix::tryLink(entry.files_[i], name, ff.nest(HERE)) ||
+        !tryChecksumFile(name, &checksum.size_, &checksum.checksum_, ff.nest(HERE)) ||
+        !trySyncFile(name, 0, ff.nest(HERE)) ||
+        !tryStatFile(name, &checksum, ff.nest(HERE))) {
+      return false;
+    }
+    fileLines.append(stringf("%o %o %o %o\n", checksum.size_, checksum.checksum_,
+        checksum.inode_, checksum.mtimeNanos_));
+  }
+  auto text = stringf("%o %o", entry.files_.size(), entry.values_.size());
+  for (auto value : entry.values_) {
+    text.append(stringf(" %o", value));
+  }
+  text.push_back('\n');
+  text.append(fileLines);
+  auto tempName = manifest + ".tmp";
+  return nsunix::tryWriteAll(tempName, text, ff.nest(HERE)) &&
+      trySyncFile(tempName, 0, ff.nest(HERE)) &&
+      nsunix::tryRename(tempName, manifest, ff.nest(HERE)) &&
+      trySyncFile(root_, O_DIRECTORY, ff.nest(HERE));
+}
+
+bool DigestCache::tryRemoveUnused(const FailFrame &ff) {
+  std::unique_lock guard(mutex_);
+  std::string storage;
+  auto cb = [this, &storage](std::string_view fullPath, bool isDir, const FailFrame &ff2) {
+    if (isDir) {
+      return true;
+    }
+    auto name = fullPath.substr(fullPath.rfind('/') + 1);
+    auto key = name.substr(0, name.find('.'));
+    if (used_.find(key) != used_.end()) {
+      return true;
+    }
+    storage = fullPath;
+    return nsunix::tryUnlink(storage, ff2.nest(HERE));
+  };
+  return nsunix::tryEnumerateFilesAndDirsRecursively(root_, &cb, ff.nest(HERE));
+}
+
+size_t DigestCache::hits() const {
+  std::unique_lock guard(mutex_);
+  return hits_;
+}
+
+size_t DigestCache::misses() const {
+  std::unique_lock guard(mutex_);
+  return misses_;
+}
+
+bool DigestCache::tryCheckEntry(const std::string &key, bool checksum, Entry *result,
+    const FailFrame &ff) const {
+  std::string text;
+  std::vector<FileChecksum> expected;
+  if (!nsunix::tryReadAll(manifestName(key), &text, ff.nest(HERE)) ||
+      !tryParseManifest(text, &expected, &result->values_, ff.nest(HERE))) {
+    return false;
+  }
+  for (size_t i = 0; i != expected.size(); ++i) {
+    auto name = fileName(key, i);
+    bool exists;
+    FileChecksum actual;
+    if (!nsunix::tryExists(name, &exists, ff.nest(HERE))) {
+      return false;
+    }
+    if (!exists) {
+      return ff.failf(HERE, "%o is missing", name);
+    }
+    if (!tryStatFile(name, &actual, ff.nest(HERE))) {
+      return false;
+    }
+    if (actual.size_ != expected[i].size_ || actual.inode_ != expected[i].inode_ ||
+        actual.mtimeNanos_ != expected[i].mtimeNanos_) {
+      return ff.failf(HERE, "%o has changed since it was stored", name);
+    }
+    if (checksum) {
+      if (!tryChecksumFile(name, &actual.size_, &actual.checksum_, ff.nest(HERE))) {
+        return false;
+      }
+      if (actual.checksum_ != expected[i].checksum_) {
+        return ff.failf(HERE, "%o is damaged", name);
+      }
+    }
+    result->files_.push_back(std::move(name));
+  }
+  return true;
+}
+
+std::string DigestCache::manifestName(const std::string &key) const {
+  return root_ + key + manifestSuffix;
+}
+
+std::string DigestCache::fileName(const std::string &key, size_t index) const {
+  return stringf("%o%o.%o", root_, key, index);
+}
+
+namespace {
+// Fills in everything but the checksum.
+bool tryStatFile(const std::string &name, FileChecksum *result, const FailFrame &ff) {
+  FileCloser fc;
+  struct stat st = {};
+  if (!nsunix::tryOpen(name, O_RDONLY, 0, &fc, ff.nest(HERE)) ||
+      !nsunix::tryFstat(fc.get(), &st, ff.nest(HERE)) ||
+      !fc.tryClose(ff.nest(HERE))) {
+    return false;
+  }
+  result->size_ = st.st_size;
+  result->inode_ = st.st_ino;
+  result->mtimeNanos_ = uint64_t(st.st_mtim.tv_sec) * 1'000'000'000 + st.st_mtim.tv_nsec;
+  return true;
+}
+
+bool tryRemoveIfExists(const std::string &name, const FailFrame &ff) {
+  bool exists;
+  if (!nsunix::tryExists(name, &exists, ff.nest(HERE))) {
+    return false;
+  }
+  return !exists || nsunix::tryUnlink(name, ff.nest(HERE));
+}
+
+bool trySyncFile(const std::string &name, int extraFlags, const FailFrame &ff) {
+  FileCloser fc;
+  return nsunix::tryOpen(name, O_RDONLY | extraFlags, 0, &fc, ff.nest(HERE)) &&
+      nsunix::trySync(fc.get(), ff.nest(HERE)) &&
+      fc.tryClose(ff.nest(HERE));
+}
+
+// Format: a line "numFiles numValues value...", then a line "size checksum inode mtimeNanos" per
+// file.
+bool tryParseManifest(std::string_view text, std::vector<FileChecksum> *files,
+    std::vector<uint64_t> *values, const FailFrame &ff) {
+  auto malformed = [&ff, text]() {
+    return ff.failf(HERE, "Malformed digest cache manifest \"%o\"", text);
+  };
+  auto lineEnd = text.find('\n');
+  if (lineEnd == std::string_view::npos) {
+    return malformed();
+  }
+  std::vector<uint64_t> numbers;
+  const char *current = text.data();
+  const char *end = text.data() + lineEnd;
+  while (true) {
+    while (current != end && *current == ' ') {
+      ++current;
+    }
+    if (current == end) {
+      break;
+    }
+    uint64_t number;
+    auto [ptr, ec] = std::from_chars(current, end, number);
+    if (ec != std::errc()) {
+      return malformed();
+    }
+    numbers.push_back(number);
+    current = ptr;
+  }
+  if (numbers.size() < 2 || numbers.size() != 2 + numbers[1]) {
+    return malformed();
+  }
+  values->assign(numbers.begin() + 2, numbers.end());
+
+  text.remove_prefix(lineEnd + 1);
+  files->clear();
+  auto tryParseNumber = [](std::string_view word, uint64_t *result) {
+    auto [ptr, ec] = std::from_chars(word.data(), word.data() + word.size(), *result);
+    return !word.empty() && ec == std::errc() && ptr == word.data() + word.size();
+  };
+  for (size_t i = 0; i != numbers[0]; ++i) {
+    lineEnd = text.find('\n');
+    if (lineEnd == std::string_view::npos) {
+      return malformed();
+    }
+    auto line = text.substr(0, lineEnd);
+    text.remove_prefix(lineEnd + 1);
+    std::string_view words[4];
+    for (size_t j = 0; j != STATIC_ARRAYSIZE(words); ++j) {
+      auto space = line.find(' ');
+      if ((space == std::string_view::npos) != (j == STATIC_ARRAYSIZE(words) - 1)) {
+        return malformed();
+      }
+      words[j] = line.substr(0, space);
+      line.remove_prefix(space == std::string_view::npos ? line.size() : space + 1);
+    }
+    FileChecksum file;
+    if (!tryParseNumber(words[0], &file.size_) ||
+        !tryParseNumber(words[2], &file.inode_) ||
+        !tryParseNumber(words[3], &file.mtimeNanos_)) {
+      return malformed();
+    }
+    file.checksum_ = words[1];
+    files->push_back(std::move(file));
+  }
+  if (!text.empty()) {
+    return malformed();
+  }
+  return true;
+}
+}  // namespace
+}  // namespace z2kplus::backend::reverse_index::builder
@@ -15,6 +15,9 @@
 #include "z2kplus/backend/reverse_index/builder/index_builder.h"
 
 #include <experimental/array>
+#include <optional>
+#include <fcntl.h>
+#include <sys/stat.h>
 #include "kosak/coding/memory/buffered_writer.h"
 #include "kosak/coding/memory/mapped_file.h"
 #include "kosak/coding/sorting/sort_manager.h"
@@ -22,9 +25,11 @@
 #include "kosak/coding/text/conversions.h"
 #include "z2kplus/backend/queryparsing/util.h"
 #include "z2kplus/backend/reverse_index/builder/canonical_string_processor.h"
+#include "z2kplus/backend/reverse_index/builder/digest_cache.h"
 #include "z2kplus/backend/reverse_index/builder/log_analyzer.h"
 #include "z2kplus/backend/reverse_index/builder/log_splitter.h"
 #include "z2kplus/backend/reverse_index/builder/metadata_builder.h"
+#include "z2kplus/backend/reverse_index/builder/stage_manifest.h"
 #include "z2kplus/backend/reverse_index/builder/tuple_iterators/last_keeper.h"
 #include "z2kplus/backend/reverse_index/builder/tuple_iterators/row_iterator.h"
 #include "z2kplus/backend/reverse_index/index/frozen_index.h"
@@ -48,17 +53,26 @@ using kosak::coding::sorting::SortOptions;
 using z2kplus::backend::files::FileKey;
 using z2kplus::backend::files::FileKeyKind;
 using z2kplus::backend::files::FilePosition;
+using z2kplus::backend::files::IntraFileRange;
 using z2kplus::backend::files::PathMaster;
+using z2kplus::backend::reverse_index::builder::BuildMemoryTracker;
 using z2kplus::backend::queryparsing::WordSplitter;
 using z2kplus::backend::reverse_index::builder::CanonicalStringProcessor;
+using z2kplus::backend::reverse_index::builder::DigestCache;
+using z2kplus::backend::reverse_index::builder::DigestedShards;
+using z2kplus::backend::reverse_index::builder::DigestKey;
+using z2kplus::backend::reverse_index::builder::IndexFileWriter;
 using z2kplus::backend::reverse_index::builder::LogSplitter;
 using z2kplus::backend::reverse_index::builder::LogSplitterResult;
 using z2kplus::backend::reverse_index::builder::MetadataBuilder;
+using z2kplus::backend::reverse_index::builder::StageManifest;
+using z2kplus::backend::reverse_index::builder::StageRecord;
 using z2kplus::backend::reverse_index::builder::tuple_iterators::makeLastKeeper;
 using z2kplus::backend::reverse_index::builder::tuple_iterators::RowIterator;
 using z2kplus::backend::reverse_index::builder::tuple_iterators::TupleIterator;
 using z2kplus::backend::reverse_index::builder::ZgramDigestor;
 using z2kplus::backend::reverse_index::index::FrozenIndex;
+using z2kplus::backend::reverse_index::index::IndexSection;
 using z2kplus::backend::reverse_index::metadata::FrozenMetadata;
 using z2kplus::backend::reverse_index::trie::FrozenTrie;
 using z2kplus::backend::reverse_index::trie::FrozenNode;
@@ -77,6 +91,18 @@ namespace userMetadata = z2kplus::backend::shared::userMetadata;
 namespace zgMetadata = z2kplus::backend::shared::zgMetadata;
 
 namespace z2kplus::backend::reverse_index::builder {
+namespace {
+template<FileKeyKind Kind>
+bool tryAddRanges(const PathMaster &pm, const std::vector<IntraFileRange<Kind>> &ranges,
+    DigestKey *key, const FailFrame &ff);
+bool tryMakeSplitterKey(const PathMaster &pm, const LogAnalyzer &lazr, size_t chunkSize,
+    std::string *result, const FailFrame &ff);
+std::string makeDigestorKey(const std::string &splitterKey);
+StageRecord packSplitterResult(const LogSplitterResult &lsr);
+bool tryUnpackSplitterResult(StageRecord record, LogSplitterResult *result, const FailFrame &ff);
+StageRecord packDigestedShards(const DigestedShards &shards);
+bool tryUnpackDigestedShards(StageRecord record, DigestedShards *result, const FailFrame &ff);
+}  // namespace
 
 // 1. Make the "next" directory
 
@@ -135,39 +161,126 @@ bool IndexBuilder::tryClearScratchDirectory(const PathMaster &pm, const FailFram
 // 2. Scan this to make canonicalStringPool.unsorted
 // 3. Sort to make
 bool IndexBuilder::tryBuild(const PathMaster &pm, const InterFileRange<FileKeyKind::Logged> &loggedRange,
-    const InterFileRange<FileKeyKind::Unlogged> &unloggedRange, const FailFrame &ff) {
+    const InterFileRange<FileKeyKind::Unlogged> &unloggedRange, const Options &options,
+    const FailFrame &ff) {
+  // Every stage draws on this one budget, and logs its peak when it's done.
+  BuildMemoryTracker memory(options.memoryBudget_);
+  std::optional<DigestCache> digestCache;
+  if (options.useDigestCache_) {
+    digestCache.emplace(pm.digestCacheRoot());
+  }
+  auto *cache = digestCache.has_value() ? &*digestCache : nullptr;
+  // The stages up to and including the digesting leave all their output in scratch files. The
+  // manifest remembers them, so that if this build fails later on, or the process dies, the next
+  // build with the same inputs picks up where this one left off.
+  StageManifest manifest;
   LogAnalyzer lazr;
+  std::string splitterKey;
+  if (!StageManifest::tryLoad(pm, &manifest, ff.nest(HERE)) ||
+      !LogAnalyzer::tryAnalyze(pm, loggedRange, unloggedRange, &lazr, ff.nest(HERE)) ||
+      !tryMakeSplitterKey(pm, lazr, options.chunkSize_, &splitterKey, ff.nest(HERE))) {
+    return false;
+  }
+
+  bool resumed;
+  bool resumedAny = false;
+  StageRecord record;
   LogSplitterResult lsr;
-  if (!LogAnalyzer::tryAnalyze(pm, loggedRange, unloggedRange, &lazr, ff.nest(HERE)) ||
-      !LogSplitter::split(pm, lazr.sortedLoggedRanges(), lazr.sortedUnloggedRanges(),
-          magicConstants::numIndexBuilderShards, &lsr, ff.nest(HERE))) {
+  if (!manifest.tryResume("LogSplitter", splitterKey, &resumed, &record, ff.nest(HERE))) {
     return false;
   }
+  if (resumed) {
+    resumedAny = true;
+    if (!tryUnpackSplitterResult(std::move(record), &lsr, ff.nest(HERE))) {
+      return false;
+    }
+  } else {
+    if (!LogSplitter::split(pm, lazr.sortedLoggedRanges(), lazr.sortedUnloggedRanges(),
+            options.chunkSize_, options.numThreads_, &memory, cache, &lsr, ff.nest(HERE))) {
+      return false;
+    }
+    record = packSplitterResult(lsr);
+    record.inputKey_ = splitterKey;
+    if (!manifest.tryRecord(std::move(record), ff.nest(HERE))) {
+      return false;
+    }
+  }
+  memory.endStage("LogSplitter");
 
-  // The strategy here is to make a "very large" sparse file and mmap it.
+  DigestedShards shards;
+  if (!manifest.tryResume("ZgramDigestor", makeDigestorKey(splitterKey), &resumed, &record,
+      ff.nest(HERE))) {
+    return false;
+  }
+  if (resumed) {
+    resumedAny = true;
+    if (!tryUnpackDigestedShards(std::move(record), &shards, ff.nest(HERE))) {
+      return false;
+    }
+  } else {
+    if (!ZgramDigestor::tryDigestShards(pm, lsr, options.numThreads_, options.trieEntriesBudget_,
+            &memory, cache, &shards, ff.nest(HERE))) {
+      return false;
+    }
+    record = packDigestedShards(shards);
+    record.inputKey_ = makeDigestorKey(splitterKey);
+    if (!manifest.tryRecord(std::move(record), ff.nest(HERE))) {
+      return false;
+    }
+  }
+  memory.endStage("ZgramDigestor");
+
+  // The remaining stages lay out the index file in place, so there is nothing more to checkpoint.
+  // Clear out whatever an earlier, failed attempt left of them.
+  if (!manifest.tryRemoveUnrecordedFiles(ff.nest(HERE))) {
+    return false;
+  }
+
+  // The structures are laid out in place, front to back, while the file grows behind them.
   auto outputFileName = pm.getScratchIndexPath();
-  MappedFile<char> outputFile;
-  if (!nsunix::tryMakeFileOfSize(outputFileName, 0644, outputFileMaxSize, ff.nest(HERE)) ||
-      !outputFile.tryMap(outputFileName, true, ff.nest(HERE))) {
+  IndexFileWriter outputFile((IndexFileWriter::Options()));
+  if (!outputFile.tryOpen(outputFileName, outputFileMaxSize, ff.nest(HERE))) {
     return false;
   }
 
-  SimpleAllocator alloc(outputFile.get(), outputFile.byteSize(), 8);
+  SimpleAllocator alloc(&outputFile, 8);
   FrozenIndex *start;
-  if (!alloc.tryAllocate(1, &start, ff.nest(HERE))) {
+  if (!alloc.tryBeginSection(IndexSection::header, magicConstants::indexSectionAlignment,
+          ff.nest(HERE)) ||
+      !alloc.tryAllocate(1, &start, ff.nest(HERE))) {
     return false;
   }
+  // The sections go into the file in IndexSection order: first the hot ones (zgramInfos, trie,
+  // string pool), then, starting on a hugepage boundary, the cold ones (word infos, postings,
+  // metadata, revisions).
   auto tempFile = pm.getScratchPathFor(filenames::tempFileForTupleCounts);
   ZgramDigestorResult zgdr;
   FrozenStringPool stringPool;
   FrozenMetadata metadata;
-  if (!ZgramDigestor::tryDigest(pm, lsr, &alloc, &zgdr, ff.nest(HERE)) ||
-      !CanonicalStringProcessor::tryMakeCanonicalStringPool(pm, lsr, zgdr, &alloc, &stringPool,
+  if (!ZgramDigestor::tryDigest(std::move(shards), pm.getScratchPathFor(filenames::triePostings),
+          &memory, &alloc, &zgdr, ff.nest(HERE))) {
+    return false;
+  }
+  memory.endStage("TrieFinalizer");
+  if (!alloc.tryBeginSection(IndexSection::stringPool, magicConstants::indexSectionAlignment,
+          ff.nest(HERE)) ||
+      !CanonicalStringProcessor::tryMakeCanonicalStringPool(pm, lsr, zgdr, &memory, &alloc,
+          &stringPool, ff.nest(HERE))) {
+    return false;
+  }
+  memory.endStage("CanonicalStringProcessor");
+  if (!alloc.tryBeginSection(IndexSection::wordInfos, magicConstants::indexHotGroupAlignment,
+          ff.nest(HERE)) ||
+      !ZgramDigestor::tryFinishWordInfos(&alloc, &zgdr, ff.nest(HERE)) ||
+      !alloc.tryBeginSection(IndexSection::postings, magicConstants::indexSectionAlignment,
           ff.nest(HERE)) ||
-      !MetadataBuilder::tryMakeMetadata(lsr, zgdr, tempFile, stringPool, &alloc, &metadata,
-          ff.nest(HERE))) {
+      !ZgramDigestor::tryFinishPostings(&alloc, &zgdr, ff.nest(HERE)) ||
+      !MetadataBuilder::tryMakeMetadata(lsr, zgdr, tempFile, stringPool, options.numThreads_,
+          &memory, &alloc, &metadata, ff.nest(HERE))) {
     return false;
   }
+  memory.endStage("MetadataBuilder");
+  alloc.endSections();
 
   // Default to minimum key.
   FilePosition<FileKeyKind::Logged> loggedEnd;
@@ -183,12 +296,173 @@ bool IndexBuilder::tryBuild(const PathMaster &pm, const InterFileRange<FileKeyKi
 
   new((void*)start) FrozenIndex(loggedEnd, unloggedEnd,
       std::move(zgdr.zgramInfos()), std::move(zgdr.wordInfos()), std::move(zgdr.trie()),
-      std::move(stringPool), std::move(metadata));
-  auto outputSize = alloc.allocatedSize();
-  if (!outputFile.tryUnmap(ff.nest(HERE)) ||
-      !nsunix::tryTruncate(outputFileName, outputSize, ff.nest(HERE))) {
+      std::move(stringPool), std::move(metadata), alloc.sections());
+  if (!outputFile.tryFinish(alloc.allocatedSize(), ff.nest(HERE))) {
     return false;
   }
+  if (cache == nullptr) {
+    return true;
+  }
+  streamf(std::cerr, "DigestCache: %o hits, %o misses\n", cache->hits(), cache->misses());
+  // Whatever this build didn't use is stale (a chunk boundary moved, or a day was edited). But a
+  // resumed stage didn't look anything up, so in that case we can't tell.
+  return resumedAny || cache->tryRemoveUnused(ff.nest(HERE));
+}
+
+namespace {
+// The splitter's output depends on the chunk size and on the bytes in the ranges. Rather than
+// read the whole corpus to fingerprint it, we key on each range's bounds and its file's inode. The
+// logs are only ever appended to (and a rewritten file, like a compacted day, is a new inode), so
+// the bytes in a range don't change while its file keeps the same inode. Notably this key doesn't
+// change when today's log grows past the end of its range during a build.
+template<FileKeyKind Kind>
+bool tryAddRanges(const PathMaster &pm, const std::vector<IntraFileRange<Kind>> &ranges,
+    DigestKey *key, const FailFrame &ff) {
+  key->add(ranges.size());
+  for (const auto &range : ranges) {
+    FileCloser fc;
+    struct stat st = {};
+    if (!nsunix::tryOpen(pm.getPlaintextPath(range.fileKey()), O_RDONLY, 0, &fc,
+            ff.nest(HERE)) ||
+        !nsunix::tryFstat(fc.get(), &st, ff.nest(HERE))) {
+      return false;
+    }
+    key->add(range.fileKey().raw());
+    key->add(range.begin());
+    key->add(range.end());
+    key->add((uint64_t)st.st_ino);
+  }
+  return true;
+}
+
+bool tryMakeSplitterKey(const PathMaster &pm, const LogAnalyzer &lazr, size_t chunkSize,
+    std::string *result, const FailFrame &ff) {
+  DigestKey key;
+  key.add(std::string_view("LogSplitter"));
+  key.add(magicConstants::digestCacheVersion);
+  key.add(chunkSize);
+  if (!tryAddRanges(pm, lazr.sortedLoggedRanges(), &key, ff.nest(HERE)) ||
+      !tryAddRanges(pm, lazr.sortedUnloggedRanges(), &key, ff.nest(HERE))) {
+    return false;
+  }
+  *result = key.toString();
+  return true;
+}
+
+// The digested shards depend only on the split chunks.
+std::string makeDigestorKey(const std::string &splitterKey) {
+  DigestKey key;
+  key.add(std::string_view("ZgramDigestor"));
+  key.add(magicConstants::digestCacheVersion);
+  key.add(splitterKey);
+  return key.toString();
+}
+
+// Files: logged zgrams and unlogged zgrams (one per chunk each), then the metadata files.
+// Strings: the chunks' cache keys. Values: the number of chunks, then for each chunk whether it
+// has zgrams and its first and last zgramIds.
+StageRecord packSplitterResult(const LogSplitterResult &lsr) {
+  StageRecord result;
+  result.stage_ = "LogSplitter";
+  auto numChunks = lsr.loggedZgrams_.size();
+  result.files_.insert(result.files_.end(), lsr.loggedZgrams_.begin(), lsr.loggedZgrams_.end());
+  result.files_.insert(result.files_.end(), lsr.unloggedZgrams_.begin(),
+      lsr.unloggedZgrams_.end());
+  for (const auto *name : {&lsr.reactionsByZgramId_, &lsr.reactionsByReaction_,
+      &lsr.zgramRevisions_, &lsr.zgramRefersTo_, &lsr.zmojis_}) {
+    result.files_.push_back(*name);
+  }
+  result.values_.push_back(numChunks);
+  for (const auto &info : lsr.chunkInfos_) {
+    result.strings_.push_back(info.cacheKey_);
+    result.values_.push_back(info.firstZgramId_.has_value() ? 1 : 0);
+    result.values_.push_back(info.firstZgramId_.has_value() ? info.firstZgramId_->raw() : 0);
+    result.values_.push_back(info.lastZgramId_.has_value() ? info.lastZgramId_->raw() : 0);
+  }
+  return result;
+}
+
+bool tryUnpackSplitterResult(StageRecord record, LogSplitterResult *result, const FailFrame &ff) {
+  const auto &values = record.values_;
+  auto &files = record.files_;
+  auto numChunks = values.empty() ? 0 : values[0];
+  if (values.size() != 1 + numChunks * 3 || files.size() != numChunks * 2 + 5 ||
+      record.strings_.size() != numChunks) {
+    return ff.failf(HERE, "Malformed %o record", record.stage_);
+  }
+  auto fileIt = std::make_move_iterator(files.begin());
+  std::vector<std::string> logged(fileIt, fileIt + (ptrdiff_t)numChunks);
+  fileIt += (ptrdiff_t)numChunks;
+  std::vector<std::string> unlogged(fileIt, fileIt + (ptrdiff_t)numChunks);
+  fileIt += (ptrdiff_t)numChunks;
+  *result = LogSplitterResult(std::move(logged), std::move(unlogged), fileIt[0], fileIt[1],
+      fileIt[2], fileIt[3], fileIt[4]);
+  for (size_t i = 0; i != numChunks; ++i) {
+    auto &info = result->chunkInfos_.emplace_back();
+    info.cacheKey_ = std::move(record.strings_[i]);
+    if (values[1 + i * 3] != 0) {
+      info.firstZgramId_ = ZgramId(values[2 + i * 3]);
+      info.lastZgramId_ = ZgramId(values[3 + i * 3]);
+    }
+  }
+  return true;
+}
+
+// Files: zgramInfos and wordInfos (one per shard each), then each shard's trie runs, then the
+// plusplus files. Values: the number of shards, then for each shard its number of zgrams, number
+// of words and number of trie runs.
+StageRecord packDigestedShards(const DigestedShards &shards) {
+  StageRecord result;
+  result.stage_ = "ZgramDigestor";
+  auto numShards = shards.zgramInfoNames_.size();
+  result.files_.insert(result.files_.end(), shards.zgramInfoNames_.begin(),
+      shards.zgramInfoNames_.end());
+  result.files_.insert(result.files_.end(), shards.wordInfoNames_.begin(),
+      shards.wordInfoNames_.end());
+  for (const auto &runs : shards.trieEntriesRuns_) {
+    result.files_.insert(result.files_.end(), runs.begin(), runs.end());
+  }
+  result.files_.push_back(shards.plusPlusEntriesName_);
+  result.files_.push_back(shards.minusMinusEntriesName_);
+  result.files_.push_back(shards.plusPlusKeysName_);
+  result.values_.push_back(numShards);
+  for (size_t i = 0; i != numShards; ++i) {
+    result.values_.push_back(shards.numZgramsPerShard_[i]);
+    result.values_.push_back(shards.numWordsPerShard_[i]);
+    result.values_.push_back(shards.trieEntriesRuns_[i].size());
+  }
+  return result;
+}
+
+bool tryUnpackDigestedShards(StageRecord record, DigestedShards *result, const FailFrame &ff) {
+  const auto &values = record.values_;
+  auto &files = record.files_;
+  auto numShards = values.empty() ? 0 : values[0];
+  size_t numRuns = 0;
+  if (values.size() == 1 + numShards * 3) {
+    for (size_t i = 0; i != numShards; ++i) {
+      numRuns += values[3 + i * 3];
+    }
+  }
+  if (values.size() != 1 + numShards * 3 || files.size() != numShards * 2 + numRuns + 3) {
+    return ff.failf(HERE, "Malformed %o record", record.stage_);
+  }
+  auto fileIt = std::make_move_iterator(files.begin());
+  result->zgramInfoNames_.assign(fileIt, fileIt + (ptrdiff_t)numShards);
+  fileIt += (ptrdiff_t)numShards;
+  result->wordInfoNames_.assign(fileIt, fileIt + (ptrdiff_t)numShards);
+  fileIt += (ptrdiff_t)numShards;
+  for (size_t i = 0; i != numShards; ++i) {
+    result->numZgramsPerShard_.push_back(values[1 + i * 3]);
+    result->numWordsPerShard_.push_back(values[2 + i * 3]);
+    auto thisNumRuns = (ptrdiff_t)values[3 + i * 3];
+    result->trieEntriesRuns_.emplace_back(fileIt, fileIt + thisNumRuns);
+    fileIt += thisNumRuns;
+  }
+  result->plusPlusEntriesName_ = fileIt[0];
+  result->minusMinusEntriesName_ = fileIt[1];
+  result->plusPlusKeysName_ = fileIt[2];
   return true;
 }
+}  // namespace
 }  // namespace z2kplus::backend::reverse_index::builder
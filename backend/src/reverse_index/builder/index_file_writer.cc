@@ -0,0 +1,159 @@
+// Copyright 2023 The Z2K Plus+ Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "z2kplus/backend/reverse_index/builder/index_file_writer.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include "kosak/coding/coding.h"
+#include "kosak/coding/failures.h"
+#include "kosak/coding/unix.h"
+
+using kosak::coding::FailFrame;
+using kosak::coding::nsunix::FileCloser;
+
+namespace nsunix = kosak::coding::nsunix;
+
+#define HERE KOSAK_CODING_HERE
+
+namespace z2kplus::backend::reverse_index::builder {
+namespace {
+size_t roundUp(size_t value, size_t multiple) {
+  return (value + multiple - 1) / multiple * multiple;
+}
+
+size_t roundDown(size_t value, size_t multiple) {
+  return value / multiple * multiple;
+}
+}  // namespace
+
+IndexFileWriter::IndexFileWriter(const Options &options) : options_(options) {}
+
+IndexFileWriter::~IndexFileWriter() {
+  unmap();
+}
+
+bool IndexFileWriter::tryOpen(const std::string &fileName, size_t capacity, const FailFrame &ff) {
+  auto pageSize = (size_t)sysconf(_SC_PAGESIZE);
+  if (options_.growStep_ == 0 || options_.growStep_ % pageSize != 0) {
+    return ff.failf(HERE, "Grow step %o is not a multiple of the page size %o", options_.growStep_,
+        pageSize);
+  }
+  unmap();
+  fileName_ = fileName;
+  capacity_ = roundUp(capacity, options_.growStep_);
+  fileSize_ = 0;
+  written_ = 0;
+  writing_ = 0;
+  if (!nsunix::tryOpen(fileName_, O_RDWR | O_CREAT | O_TRUNC, 0644, &fc_, ff.nest(HERE))) {
+    return false;
+  }
+  auto *reserved = mmap(nullptr, capacity_, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+      -1, 0);
+  if (reserved == MAP_FAILED) {
+    return ff.failf(HERE, "Can't reserve %o bytes of address space for %o: %o", capacity_,
+        fileName_, strerror(errno));
+  }
+  start_ = static_cast<char*>(reserved);
+  return true;
+}
+
+bool IndexFileWriter::tryAdvanceTo(size_t end, const FailFrame &ff) {
+  return tryGrow(end, ff.nest(HERE)) && tryWriteBehind(end, ff.nest(HERE));
+}
+
+bool IndexFileWriter::tryGrow(size_t end, const FailFrame &ff) {
+  if (end <= fileSize_) {
+    return true;
+  }
+  if (end > capacity_) {
+    return ff.failf(HERE, "%o: %o bytes exceeds the capacity %o", fileName_, end, capacity_);
+  }
+  auto newSize = std::min(roundUp(end, options_.growStep_), capacity_);
+  auto growth = newSize - fileSize_;
+  // Real blocks, not a hole, so that running out of space is reported here.
+  if (auto error = posix_fallocate(fc_.get(), (off_t)fileSize_, (off_t)growth); error != 0) {
+    return ff.failf(HERE, "Can't grow %o to %o bytes: %o", fileName_, newSize, strerror(error));
+  }
+  auto *mapped = mmap(start_ + fileSize_, growth, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+      fc_.get(), (off_t)fileSize_);
+  if (mapped == MAP_FAILED) {
+    return ff.failf(HERE, "Can't map %o bytes of %o at offset %o: %o", growth, fileName_,
+        fileSize_, strerror(errno));
+  }
+  fileSize_ = newSize;
+  return true;
+}
+
+bool IndexFileWriter::tryWriteBehind(size_t end, const FailFrame &ff) {
+  // Write back in slices of writeBehind_ bytes, one slice in flight at a time.
+  auto slice = options_.writeBehind_;
+  if (slice == 0 || end < 2 * slice) {
+    return true;
+  }
+  auto target = roundDown(end - slice, slice);
+  if (target <= writing_) {
+    return true;
+  }
+  if (writing_ != written_) {
+    auto size = writing_ - written_;
+    if (sync_file_range(fc_.get(), (off_t)written_, (off_t)size,
+        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER) != 0) {
+      return ff.failf(HERE, "Can't write back %o bytes of %o: %o", size, fileName_,
+          strerror(errno));
+    }
+    if (options_.dropWrittenPages_) {
+      // Unmap our view of the pages (a later touch maps them back in), then drop the clean ones.
+      if (madvise(start_ + written_, size, MADV_DONTNEED) != 0) {
+        return ff.failf(HERE, "madvise(MADV_DONTNEED) failed on %o: %o", fileName_,
+            strerror(errno));
+      }
+      (void)posix_fadvise(fc_.get(), (off_t)written_, (off_t)size, POSIX_FADV_DONTNEED);
+    }
+    written_ = writing_;
+  }
+  if (sync_file_range(fc_.get(), (off_t)writing_, (off_t)(target - writing_),
+      SYNC_FILE_RANGE_WRITE) != 0) {
+    return ff.failf(HERE, "Can't start writing back %o: %o", fileName_, strerror(errno));
+  }
+  writing_ = target;
+  return true;
+}
+
+bool IndexFileWriter::tryFinish(size_t size, const FailFrame &ff) {
+  if (size > fileSize_) {
+    return ff.failf(HERE, "%o: final size %o exceeds the %o bytes written", fileName_, size,
+        fileSize_);
+  }
+  unmap();
+  if (!nsunix::tryTruncate(fileName_, size, ff.nest(HERE))) {
+    return false;
+  }
+  if (fdatasync(fc_.get()) != 0) {
+    return ff.failf(HERE, "fdatasync failed on %o: %o", fileName_, strerror(errno));
+  }
+  return fc_.tryClose(ff.nest(HERE));
+}
+
+void IndexFileWriter::unmap() {
+  if (start_ != nullptr) {
+    munmap(start_, capacity_);
+    start_ = nullptr;
+  }
+}
+}  // namespace z2kplus::backend::reverse_index::builder
@@ -14,10 +14,15 @@
 
 #include "z2kplus/backend/reverse_index/builder/log_splitter.h"
 
+#include <algorithm>
+#include <array>
+#include <chrono>
 #include "kosak/coding/memory/buffered_writer.h"
 #include "kosak/coding/sorting/sort_manager.h"
 #include "kosak/coding/text/misc.h"
+#include "z2kplus/backend/factories/log_record_scanner.h"
 #include "z2kplus/backend/reverse_index/builder/schemas.h"
+#include "z2kplus/backend/reverse_index/builder/task_runner.h"
 #include "z2kplus/backend/reverse_index/builder/tuple_iterators/tuple_serializer.h"
 #include "z2kplus/backend/reverse_index/builder/tuple_iterators/util.h"
 #include "z2kplus/backend/shared/magic_constants.h"
@@ -34,9 +39,9 @@ using kosak::coding::stringf;
 using kosak::coding::toString;
 using kosak::coding::text::Splitter;
 using kosak::coding::text::trim;
-using kosak::coding::ParseContext;
 using kosak::coding::sorting::SortManager;
 using kosak::coding::nsunix::FileCloser;
+using z2kplus::backend::factories::LogRecordScanner;
 using z2kplus::backend::files::FileKey;
 using z2kplus::backend::files::FileKeyKind;
 using z2kplus::backend::files::IntraFileRange;
@@ -82,26 +87,28 @@ struct NameAndWriter {
   BufferedWriter writer_;
 };
 
-struct SplitterThread {
-  static bool tryCreate(size_t shard, const PathMaster &pm, const SplitterInputs &sis,
-      std::vector<IntraFileRange<FileKeyKind::Either>> ranges, std::shared_ptr<SplitterThread> *result,
+struct SplitterTask {
+  static bool tryCreate(size_t chunk, const PathMaster &pm, const SplitterInputs &sis,
+      std::vector<IntraFileRange<FileKeyKind::Either>> ranges, std::shared_ptr<SplitterTask> *result,
       const FailFrame &ff);
+  // Makes a task that has, in effect, already run, out of an entry made by toCacheEntry.
+  static bool tryCreateFromCache(size_t chunk, const PathMaster &pm, DigestCache::Entry entry,
+      std::shared_ptr<SplitterTask> *result, const FailFrame &ff);
 
-  SplitterThread(size_t shard, std::shared_ptr<const PathMaster> pm,
+  SplitterTask(size_t chunk, std::shared_ptr<const PathMaster> pm,
       std::vector<IntraFileRange<FileKeyKind::Either>> ranges,
       NameAndWriter logged, NameAndWriter unlogged, NameAndWriter reactionsByZgramId,
       NameAndWriter reactionsByReaction, NameAndWriter zgramRevs, NameAndWriter zgramRefersTo,
       NameAndWriter zmojis);
-  DISALLOW_COPY_AND_ASSIGN(SplitterThread);
-  DISALLOW_MOVE_COPY_AND_ASSIGN(SplitterThread);
-  ~SplitterThread();
+  DISALLOW_COPY_AND_ASSIGN(SplitterTask);
+  DISALLOW_MOVE_COPY_AND_ASSIGN(SplitterTask);
+  ~SplitterTask();
 
-  bool tryFinish(const FailFrame &ff);
+  bool tryRun(const FailFrame &ff);
 
-  static void run(std::shared_ptr<SplitterThread> self);
-  bool tryRunHelper(const FailFrame &ff);
+  DigestCache::Entry toCacheEntry() const;
 
-  size_t shard_;
+  size_t chunk_;
   std::shared_ptr<const PathMaster> pm_;
   std::vector<IntraFileRange<FileKeyKind::Either>> ranges_;
 
@@ -115,15 +122,25 @@ struct SplitterThread {
 
   std::optional<ZgramId> prevLoggedZgramId_;
   std::optional<ZgramId> prevUnloggedZgramId_;
+  // Over logged and unlogged zgrams together.
+  std::optional<ZgramId> firstZgramId_;
+  std::optional<ZgramId> lastZgramId_;
+};
 
-  std::optional<std::string> error_;
-
-  std::thread thread_;
+// The outputs a cache entry holds, in order.
+constexpr NameAndWriter SplitterTask::*cachedOutputs[] = {
+    &SplitterTask::logged_, &SplitterTask::unlogged_, &SplitterTask::reactionsByZgramId_,
+    &SplitterTask::reactionsByReaction_, &SplitterTask::zgramRevs_, &SplitterTask::zgramRefersTo_,
+    &SplitterTask::zmojis_
 };
 
+bool tryMakeChunkKey(const PathMaster &pm,
+    const std::vector<IntraFileRange<FileKeyKind::Either>> &ranges, std::string *result,
+    const FailFrame &ff);
+
 class SplitterVisitor {
 public:
-  SplitterVisitor(SplitterThread *owner, FileKey<FileKeyKind::Either> fileKey,
+  SplitterVisitor(SplitterTask *owner, FileKey<FileKeyKind::Either> fileKey,
       size_t offset, size_t size, const FailFrame *ff);
   ~SplitterVisitor() = default;
 
@@ -138,7 +155,7 @@ private:
   template<typename ...Args>
   bool appendHelper(BufferedWriter *bw, const std::tuple<Args...> &tuple) const;
 
-  SplitterThread *owner_ = nullptr;
+  SplitterTask *owner_ = nullptr;
   FileKey<FileKeyKind::Either> fileKey_;
   size_t offset_ = 0;
   size_t size_ = 0;
@@ -149,7 +166,8 @@ private:
 bool LogSplitter::split(const PathMaster &pm,
     const std::vector<IntraFileRange<FileKeyKind::Logged>> &loggedRanges,
     const std::vector<IntraFileRange<FileKeyKind::Unlogged>> &unloggedRanges,
-    size_t numShards, LogSplitterResult *result, const FailFrame &ff) {
+    size_t chunkSize, size_t numThreads, BuildMemoryTracker *memory, DigestCache *cache,
+    LogSplitterResult *result, const FailFrame &ff) {
   auto loggedZgrams = pm.getScratchPathFor(filenames::loggedZgrams);
   auto unloggedZgrams = pm.getScratchPathFor(filenames::unloggedZgrams);
   auto reactionsByZgramId = pm.getScratchPathFor(filenames::reactionsByZgramId);
@@ -168,47 +186,74 @@ bool LogSplitter::split(const PathMaster &pm,
     return lhs.fileKey().canonicalRaw() < rhs.fileKey().canonicalRaw();
   });
 
-  const auto *prevShardEnd = allRanges.data();
-  const auto *allShardEnd = &*allRanges.end();
-  std::vector<std::shared_ptr<SplitterThread>> sts(numShards);
-  for (size_t i = 0; i != numShards; ++i) {
-    auto divisor = numShards - i;
-    auto shardSize = (allShardEnd - prevShardEnd) / divisor;
-    auto newShardEnd = prevShardEnd + shardSize;
-
-    if (prevShardEnd != newShardEnd && newShardEnd != allShardEnd) {
-      // Shard is non-empty and not the last shard
-      const auto *back = newShardEnd - 1;
-      if (back->fileKey().canonicalRaw() == newShardEnd->fileKey().canonicalRaw()) {
-        // Don't let logged and unlogged zgrams of the same date fall into different shards.
-        ++newShardEnd;
-      }
+  // Group the ranges into chunks of about chunkSize bytes. The chunks depend only on the input,
+  // so the outputs (and the index) are the same no matter how many threads process them.
+  std::vector<std::vector<IntraFileRange<FileKeyKind::Either>>> chunks;
+  std::vector<size_t> chunkBytes;
+  size_t totalBytes = 0;
+  for (size_t i = 0; i != allRanges.size(); ++i) {
+    const auto &range = allRanges[i];
+    // Don't let logged and unlogged zgrams of the same date fall into different chunks.
+    auto sameDateAsPrev = i != 0 &&
+        allRanges[i - 1].fileKey().canonicalRaw() == range.fileKey().canonicalRaw();
+    if (chunks.empty() || (chunkBytes.back() >= chunkSize && !sameDateAsPrev)) {
+      chunks.emplace_back();
+      chunkBytes.push_back(0);
     }
+    chunks.back().push_back(range);
+    chunkBytes.back() += range.end() - range.begin();
+    totalBytes += range.end() - range.begin();
+  }
+  if (chunks.empty()) {
+    // Downstream stages expect at least one (possibly empty) chunk.
+    chunks.emplace_back();
+    chunkBytes.push_back(0);
+  }
 
-    std::vector<IntraFileRange<FileKeyKind::Either>> rangesForShard(prevShardEnd, newShardEnd);
-    if (!SplitterThread::tryCreate(i, pm, sis, std::move(rangesForShard), &sts[i], ff.nest(HERE))) {
+  // A task's parsed records take up about as much memory as its chunk. A chunk found in the cache
+  // costs only the reading of its input, to fingerprint it.
+  std::vector<std::shared_ptr<SplitterTask>> sts(chunks.size());
+  std::vector<std::string> cacheKeys(chunks.size());
+  auto runChunk = [&pm, &sis, &chunks, &chunkBytes, memory, cache, &sts, &cacheKeys](size_t chunk,
+      const FailFrame &ff2) {
+    auto *key = &cacheKeys[chunk];
+    bool found = false;
+    DigestCache::Entry entry;
+    if (cache != nullptr &&
+        (!tryMakeChunkKey(pm, chunks[chunk], key, ff2.nest(HERE)) ||
+            !cache->tryLookup(*key, &found, &entry, ff2.nest(HERE)))) {
       return false;
     }
-    prevShardEnd = newShardEnd;
-  }
-
-  if (prevShardEnd != allShardEnd) {
-    return ff.fail(HERE, "Programming error");
+    if (found) {
+      return SplitterTask::tryCreateFromCache(chunk, pm, std::move(entry), &sts[chunk],
+          ff2.nest(HERE));
+    }
+    MemoryReservation reservation(memory);
+    reservation.forceResize(chunkBytes[chunk]);
+    return SplitterTask::tryCreate(chunk, pm, sis, std::move(chunks[chunk]), &sts[chunk],
+        ff2.nest(HERE)) &&
+        sts[chunk]->tryRun(ff2.nest(HERE)) &&
+        (cache == nullptr || cache->tryStore(*key, sts[chunk]->toCacheEntry(), ff2.nest(HERE)));
+  };
+  numThreads = memory->threadsFor(numThreads, chunkSize);
+  auto start = std::chrono::steady_clock::now();
+  if (!TaskRunner::tryRun("LogSplitter", chunks.size(), numThreads, &runChunk, ff.nest(HERE))) {
+    return false;
   }
+  auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+  streamf(std::cerr, "LogSplitter: parsed %o bytes in %o chunks (%o MB/s)\n", totalBytes,
+      chunks.size(), totalBytes / 1e6 / std::max(elapsed.count(), 1e-6));
 
-  // Finish all the threads before reporting errors in any of them.
-  for (size_t i = 0; i != numShards; ++i) {
-    (void)sts[i]->tryFinish(ff.nest(HERE));
-  }
-  if (!ff.ok()) {
-    return false;
+  auto chunkInfos = makeReservedVector<LogSplitterChunkInfo>(sts.size());
+  for (size_t i = 0; i != sts.size(); ++i) {
+    chunkInfos.push_back({std::move(cacheKeys[i]), sts[i]->firstZgramId_, sts[i]->lastZgramId_});
   }
 
   // We don't have to sort the zgrams because they are already sorted in the
   // log files. The only complication is that logged and unlogged zgrams are
   // in different files. But so long as the logged/unlogged zgrams for a given
-  // day are processed by the same shard, they will be fine.
-  auto gatherAndMoveInputs = [&sts](NameAndWriter SplitterThread::*field) {
+  // day are processed by the same chunk, they will be fine.
+  auto gatherAndMoveInputs = [&sts](NameAndWriter SplitterTask::*field) {
     auto result = makeReservedVector<std::string>(sts.size());
     for (const auto &st : sts) {
       result.push_back(std::move((st.get()->*field).outputName_));
@@ -216,16 +261,20 @@ bool LogSplitter::split(const PathMaster &pm,
     return result;
   };
 
-  auto rxByZInputs = gatherAndMoveInputs(&SplitterThread::reactionsByZgramId_);
-  auto rxByRInputs = gatherAndMoveInputs(&SplitterThread::reactionsByReaction_);
-  auto zgRevInputs = gatherAndMoveInputs(&SplitterThread::zgramRevs_);
-  auto zgRefersToInputs = gatherAndMoveInputs(&SplitterThread::zgramRefersTo_);
-  auto zmojiInputs = gatherAndMoveInputs(&SplitterThread::zmojis_);
+  auto rxByZInputs = gatherAndMoveInputs(&SplitterTask::reactionsByZgramId_);
+  auto rxByRInputs = gatherAndMoveInputs(&SplitterTask::reactionsByReaction_);
+  auto zgRevInputs = gatherAndMoveInputs(&SplitterTask::zgramRevs_);
+  auto zgRefersToInputs = gatherAndMoveInputs(&SplitterTask::zgramRefersTo_);
+  auto zmojiInputs = gatherAndMoveInputs(&SplitterTask::zmojis_);
   // These are kept separate so they can be processed in separate threads in a later stage.
-  auto loggedZgramInputs = gatherAndMoveInputs(&SplitterThread::logged_);
-  auto unloggedZgramInputs = gatherAndMoveInputs(&SplitterThread::unlogged_);
+  auto loggedZgramInputs = gatherAndMoveInputs(&SplitterTask::logged_);
+  auto unloggedZgramInputs = gatherAndMoveInputs(&SplitterTask::unlogged_);
 
+  constexpr size_t numSorts = 5;
   SortOptions sortOptions(true, false, defaultFieldSeparator, true);
+  sortOptions.bufferSize_ = memory->sortBufferSize(numSorts);
+  MemoryReservation sortMemory(memory);
+  sortMemory.forceResize(numSorts * sortOptions.bufferSize_);
   SortManager rxByZSorter;
   SortManager rxByRSorter;
   SortManager zgRevSorter;
@@ -259,18 +308,21 @@ bool LogSplitter::split(const PathMaster &pm,
       std::move(loggedZgramInputs), std::move(unloggedZgramInputs),
       std::move(sis.reactionsByZgramId_), std::move(sis.reactionsByReaction_),
       std::move(sis.zgramRevisions_), std::move(sis.zgramRefersTo_), std::move(sis.zmojis_));
+  result->chunkInfos_ = std::move(chunkInfos);
   return true;
 }
 
 namespace {
-bool SplitterThread::tryCreate(size_t shard, const PathMaster &pm, const SplitterInputs &sis,
-    std::vector<IntraFileRange<FileKeyKind::Either>> ranges, std::shared_ptr<SplitterThread> *result,
+bool SplitterTask::tryCreate(size_t chunk, const PathMaster &pm, const SplitterInputs &sis,
+    std::vector<IntraFileRange<FileKeyKind::Either>> ranges, std::shared_ptr<SplitterTask> *result,
     const FailFrame &ff) {
-  auto createBw = [](size_t shard, const std::string &filename, NameAndWriter *result,
+  auto createBw = [](size_t chunk, const std::string &filename, NameAndWriter *result,
       const FailFrame &ff) {
-    result->outputName_ = stringf("%o.presorted.%o", filename, shard);
+    result->outputName_ = stringf("%o.presorted.%o", filename, chunk);
+    // Not O_TRUNC: a stale file here could be a hard link into the digest cache.
     FileCloser fc;
-    if (!nsunix::tryOpen(result->outputName_, O_CREAT | O_WRONLY | O_TRUNC, 0644, &fc, ff.nest(HERE))) {
+    if (!nsunix::tryOpen(result->outputName_, filenames::standardFlags, filenames::standardMode,
+        &fc, ff.nest(HERE))) {
       return false;
     }
     result->writer_ = BufferedWriter(std::move(fc));
@@ -283,47 +335,60 @@ bool SplitterThread::tryCreate(size_t shard, const PathMaster &pm, const Splitte
   NameAndWriter zgramRevs;
   NameAndWriter zgramRefersTo;
   NameAndWriter zmojis;
-  if (!createBw(shard, sis.loggedZgrams_, &logged, ff.nest(HERE)) ||
-      !createBw(shard, sis.unloggedZgrams_, &unlogged, ff.nest(HERE)) ||
-      !createBw(shard, sis.reactionsByZgramId_, &reactionsByZgramId, ff.nest(HERE)) ||
-      !createBw(shard, sis.reactionsByReaction_, &reactionsByReaction, ff.nest(HERE)) ||
-      !createBw(shard, sis.zgramRevisions_, &zgramRevs, ff.nest(HERE)) ||
-      !createBw(shard, sis.zgramRefersTo_, &zgramRefersTo, ff.nest(HERE)) ||
-      !createBw(shard, sis.zmojis_, &zmojis, ff.nest(HERE))) {
+  if (!createBw(chunk, sis.loggedZgrams_, &logged, ff.nest(HERE)) ||
+      !createBw(chunk, sis.unloggedZgrams_, &unlogged, ff.nest(HERE)) ||
+      !createBw(chunk, sis.reactionsByZgramId_, &reactionsByZgramId, ff.nest(HERE)) ||
+      !createBw(chunk, sis.reactionsByReaction_, &reactionsByReaction, ff.nest(HERE)) ||
+      !createBw(chunk, sis.zgramRevisions_, &zgramRevs, ff.nest(HERE)) ||
+      !createBw(chunk, sis.zgramRefersTo_, &zgramRefersTo, ff.nest(HERE)) ||
+      !createBw(chunk, sis.zmojis_, &zmojis, ff.nest(HERE))) {
     return false;
   }
 
   auto pms = pm.shared_from_this();
-  auto st = std::make_shared<SplitterThread>(shard, std::move(pms), std::move(ranges),
+  auto st = std::make_shared<SplitterTask>(chunk, std::move(pms), std::move(ranges),
       std::move(logged), std::move(unlogged), std::move(reactionsByZgramId),
       std::move(reactionsByReaction), std::move(zgramRevs), std::move(zgramRefersTo),
       std::move(zmojis));
-  st->thread_ = std::thread(&run, st);
   *result = std::move(st);
   return true;
 }
 
-void SplitterThread::run(std::shared_ptr<SplitterThread> self) {
-  FailRoot fr;
-  streamf(std::cerr, "Splitter thread %o waking up\n", self->shard_);
-  if (!self->tryRunHelper(fr.nest(HERE))) {
-    self->error_ = toString(fr);
+bool SplitterTask::tryCreateFromCache(size_t chunk, const PathMaster &pm,
+    DigestCache::Entry entry, std::shared_ptr<SplitterTask> *result, const FailFrame &ff) {
+  constexpr size_t numOutputs = STATIC_ARRAYSIZE(cachedOutputs);
+  if (entry.files_.size() != numOutputs || entry.values_.size() != 3) {
+    return ff.failf(HERE, "Expected %o files and 3 values in cache entry, got %o and %o",
+        numOutputs, entry.files_.size(), entry.values_.size());
+  }
+  std::array<NameAndWriter, numOutputs> outputs;
+  for (size_t i = 0; i != numOutputs; ++i) {
+    outputs[i].outputName_ = std::move(entry.files_[i]);
   }
-  streamf(std::cerr, "Splitter thread %o shutting down\n", self->shard_);
+  auto st = std::make_shared<SplitterTask>(chunk, pm.shared_from_this(),
+      std::vector<IntraFileRange<FileKeyKind::Either>>(), std::move(outputs[0]),
+      std::move(outputs[1]), std::move(outputs[2]), std::move(outputs[3]), std::move(outputs[4]),
+      std::move(outputs[5]), std::move(outputs[6]));
+  if (entry.values_[0] != 0) {
+    st->firstZgramId_ = ZgramId(entry.values_[1]);
+    st->lastZgramId_ = ZgramId(entry.values_[2]);
+  }
+  *result = std::move(st);
+  return true;
 }
 
-SplitterThread::SplitterThread(size_t shard, std::shared_ptr<const PathMaster> pm,
+SplitterTask::SplitterTask(size_t chunk, std::shared_ptr<const PathMaster> pm,
     std::vector<IntraFileRange<FileKeyKind::Either>> ranges, NameAndWriter logged,
     NameAndWriter unlogged, NameAndWriter reactionsByZgramId, NameAndWriter reactionsByReaction,
-    NameAndWriter zgramRevs, NameAndWriter zgramRefersTo, NameAndWriter zmojis) : shard_(shard),
+    NameAndWriter zgramRevs, NameAndWriter zgramRefersTo, NameAndWriter zmojis) : chunk_(chunk),
     pm_(std::move(pm)), ranges_(std::move(ranges)), logged_(std::move(logged)),
     unlogged_(std::move(unlogged)), reactionsByZgramId_(std::move(reactionsByZgramId)),
     reactionsByReaction_(std::move(reactionsByReaction)), zgramRevs_(std::move(zgramRevs)),
     zgramRefersTo_(std::move(zgramRefersTo)), zmojis_(std::move(zmojis)) {}
 
-SplitterThread::~SplitterThread() = default;
+SplitterTask::~SplitterTask() = default;
 
-bool SplitterThread::tryRunHelper(const FailFrame &ff) {
+bool SplitterTask::tryRun(const FailFrame &ff) {
   // Split records into various individual files so they can be sorted and then digested.
   for (const auto &range : ranges_) {
     auto pathName = pm_->getPlaintextPath(range.fileKey());
@@ -339,10 +404,8 @@ bool SplitterThread::tryRunHelper(const FailFrame &ff) {
     size_t offset = 0;
     while (splitter.moveNext(&record)) {
       record = trim(record);
-      ParseContext ctx(record);
       LogRecord lr;
-      using kosak::coding::tryParseJson;
-      if (!tryParseJson(&ctx, &lr, ff.nest(HERE))) {
+      if (!LogRecordScanner::tryParse(record, &lr, ff.nest(HERE))) {
         return false;
       }
       auto ff2 = ff.nest(HERE);
@@ -353,28 +416,48 @@ bool SplitterThread::tryRunHelper(const FailFrame &ff) {
       offset += record.size() + 1;
     }
   }
-  return true;
+  return logged_.writer_.tryClose(ff.nest(HERE)) &&
+      unlogged_.writer_.tryClose(ff.nest(HERE)) &&
+      reactionsByZgramId_.writer_.tryClose(ff.nest(HERE)) &&
+      reactionsByReaction_.writer_.tryClose(ff.nest(HERE)) &&
+      zgramRevs_.writer_.tryClose(ff.nest(HERE)) &&
+      zgramRefersTo_.writer_.tryClose(ff.nest(HERE)) &&
+      zmojis_.writer_.tryClose(ff.nest(HERE));
 }
 
-bool SplitterThread::tryFinish(const FailFrame &ff) {
-  thread_.join();
-  if (!logged_.writer_.tryClose(ff.nest(HERE)) ||
-      !unlogged_.writer_.tryClose(ff.nest(HERE)) ||
-      !reactionsByZgramId_.writer_.tryClose(ff.nest(HERE)) ||
-      !reactionsByReaction_.writer_.tryClose(ff.nest(HERE)) ||
-      !zgramRevs_.writer_.tryClose(ff.nest(HERE)) ||
-      !zgramRefersTo_.writer_.tryClose(ff.nest(HERE)) ||
-      !zmojis_.writer_.tryClose(ff.nest(HERE))) {
-    return false;
+DigestCache::Entry SplitterTask::toCacheEntry() const {
+  DigestCache::Entry result;
+  for (auto field : cachedOutputs) {
+    result.files_.push_back((this->*field).outputName_);
   }
+  auto hasZgrams = firstZgramId_.has_value();
+  result.values_ = {hasZgrams, hasZgrams ? firstZgramId_->raw() : 0,
+      hasZgrams ? lastZgramId_->raw() : 0};
+  return result;
+}
 
-  if (error_.has_value()) {
-    return ff.failf(HERE, "%o", error_);
+bool tryMakeChunkKey(const PathMaster &pm,
+    const std::vector<IntraFileRange<FileKeyKind::Either>> &ranges, std::string *result,
+    const FailFrame &ff) {
+  DigestKey key;
+  key.add(std::string_view("split"));
+  key.add(magicConstants::digestCacheVersion);
+  for (const auto &range : ranges) {
+    MappedFile<char> mf;
+    if (!mf.tryMap(pm.getPlaintextPath(range.fileKey()), false, ff.nest(HERE))) {
+      return false;
+    }
+    std::string_view wholeFileText(mf.get(), mf.byteSize());
+    key.add(range.fileKey().raw());
+    key.add(range.begin());
+    key.add(range.end());
+    key.add(wholeFileText.substr(range.begin(), range.end() - range.begin()));
   }
+  *result = key.toString();
   return true;
 }
 
-SplitterVisitor::SplitterVisitor(SplitterThread *owner, FileKey<FileKeyKind::Either> fileKey, size_t offset,
+SplitterVisitor::SplitterVisitor(SplitterTask *owner, FileKey<FileKeyKind::Either> fileKey, size_t offset,
     size_t size, const FailFrame *ff) : owner_(owner), fileKey_(fileKey), offset_(offset),
     size_(size), ff_(ff) {}
 
@@ -399,6 +482,12 @@ bool SplitterVisitor::operator()(const Zephyrgram &o) {
         o.zgramId(), expectedLogged, o.isLogged());
   }
   *whichPrev = o.zgramId();
+  if (!owner_->firstZgramId_.has_value() || o.zgramId() < *owner_->firstZgramId_) {
+    owner_->firstZgramId_ = o.zgramId();
+  }
+  if (!owner_->lastZgramId_.has_value() || o.zgramId() > *owner_->lastZgramId_) {
+    owner_->lastZgramId_ = o.zgramId();
+  }
   auto row = schemas::Zephyrgram::createTuple(o, fileKey_, offset_, size_);
   return appendHelper(whichWriter, row);
 }
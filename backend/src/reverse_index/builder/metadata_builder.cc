@@ -14,13 +14,18 @@
 
 #include "z2kplus/backend/reverse_index/builder/metadata_builder.h"
 
+#include <algorithm>
+#include <optional>
 #include <utility>
+#include <vector>
 #include "kosak/coding/coding.h"
 #include "kosak/coding/failures.h"
 #include "kosak/coding/memory/buffered_writer.h"
 #include "kosak/coding/memory/mapped_file.h"
 #include "kosak/coding/unix.h"
+#include "z2kplus/backend/reverse_index/builder/bitmap_builder.h"
 #include "z2kplus/backend/reverse_index/builder/common.h"
+#include "z2kplus/backend/reverse_index/builder/index_file_writer.h"
 #include "z2kplus/backend/reverse_index/builder/inflator.h"
 #include "z2kplus/backend/reverse_index/builder/tuple_iterators/accumulator.h"
 #include "z2kplus/backend/reverse_index/builder/tuple_iterators/counter.h"
@@ -31,7 +36,10 @@
 #include "z2kplus/backend/reverse_index/builder/tuple_iterators/string_freezer.h"
 #include "z2kplus/backend/reverse_index/builder/tuple_iterators/true_keeper.h"
 #include "z2kplus/backend/reverse_index/builder/schemas.h"
+#include "z2kplus/backend/reverse_index/builder/task_runner.h"
+#include "z2kplus/backend/shared/magic_constants.h"
 #include "z2kplus/backend/shared/zephyrgram.h"
+#include "z2kplus/backend/util/frozen/frozen_adjacency.h"
 #include "z2kplus/backend/util/frozen/frozen_map.h"
 #include "z2kplus/backend/util/frozen/frozen_set.h"
 #include "z2kplus/backend/util/frozen/frozen_string_pool.h"
@@ -43,6 +51,7 @@ using kosak::coding::stringf;
 using kosak::coding::memory::MappedFile;
 using kosak::coding::memory::BufferedWriter;
 using kosak::coding::nsunix::FileCloser;
+using z2kplus::backend::reverse_index::ZgramInfo;
 using z2kplus::backend::reverse_index::builder::inflator::tryInflate;
 using z2kplus::backend::reverse_index::builder::tuple_iterators::Accumulator;
 using z2kplus::backend::reverse_index::builder::tuple_iterators::makeAccumulator;
@@ -53,8 +62,11 @@ using z2kplus::backend::reverse_index::builder::tuple_iterators::makeStringFreez
 using z2kplus::backend::reverse_index::builder::tuple_iterators::makeTrueKeeper;
 using z2kplus::backend::reverse_index::builder::tuple_iterators::makeRunningSum;
 using z2kplus::backend::reverse_index::builder::tuple_iterators::RowIterator;
+using z2kplus::backend::reverse_index::index::IndexSection;
 using z2kplus::backend::reverse_index::metadata::FrozenMetadata;
 using z2kplus::backend::shared::ZgramId;
+using z2kplus::backend::util::frozen::FrozenAdjacency;
+using z2kplus::backend::util::frozen::FrozenBitmap;
 using z2kplus::backend::util::frozen::frozenStringRef_t;
 using z2kplus::backend::util::frozen::FrozenMap;
 using z2kplus::backend::util::frozen::FrozenSet;
@@ -64,22 +76,61 @@ using z2kplus::backend::util::RelativePtr;
 
 #define HERE KOSAK_CODING_HERE
 
+namespace magicConstants = z2kplus::backend::shared::magicConstants;
 namespace nsunix = kosak::coding::nsunix;
 namespace schemas = z2kplus::backend::reverse_index::builder::schemas;
 
 namespace z2kplus::backend::reverse_index::builder {
 namespace {
+// The tables are built at the same time, each in a scratch file of its own, and then copied into
+// the index. The frozen structures only point within themselves, so a table can be copied as is,
+// as long as its top-level object comes along: it goes at the front. The index's allocator has the
+// same alignment, so a table comes out the same wherever it lands.
+constexpr size_t tableAlignment = 8;
+
+template<typename T>
+class RelocatableTable {
+public:
+  RelocatableTable();
+  DISALLOW_COPY_AND_ASSIGN(RelocatableTable);
+  DISALLOW_MOVE_COPY_AND_ASSIGN(RelocatableTable);
+  ~RelocatableTable() = default;
+
+  // Calls build(alloc, result, ff) to lay out the table in 'fileName'.
+  template<typename BUILD>
+  bool tryBuild(std::string fileName, const BUILD &build, const FailFrame &ff);
+  // Copies the table to the end of 'alloc', moves its top-level object into *result, and deletes
+  // the scratch file.
+  bool tryMoveInto(SimpleAllocator *alloc, T *result, const FailFrame &ff);
+
+private:
+  std::string fileName_;
+  IndexFileWriter writer_;
+  size_t size_ = 0;
+};
+
 bool tryMakeReactions(const std::string &tempName, const std::string &filename,
     const FrozenStringPool &stringPool, SimpleAllocator *alloc, FrozenMetadata::reactions_t *result,
     const FailFrame &ff);
-bool tryMakeReactionCounts(const std::string &tempName, const std::string &filename,
-    const FrozenStringPool &stringPool, SimpleAllocator *alloc, FrozenMetadata::reactionCounts_t *result,
-    const FailFrame &ff);
-bool tryMakeZgramRevisions(const std::string &tempName, const std::string &filename,
-    const FrozenStringPool &stringPool, SimpleAllocator *alloc, FrozenMetadata::zgramRevisions_t *result,
-    const FailFrame &ff);
-bool tryMakeZgramRefersTos(const std::string &tempName, const std::string &filename,
-    SimpleAllocator *alloc, FrozenMetadata::zgramRefersTo_t *result, const FailFrame &ff);
+bool tryMakeReactionCounts(const std::string &filename, const FrozenStringPool &stringPool,
+    const FrozenVector<ZgramInfo> &zgramInfos, BuildMemoryTracker *memory, SimpleAllocator *alloc,
+    FrozenMetadata::reactionCounts_t *result, const FailFrame &ff);
+bool tryMakeZgramRevisions(const std::string &filename, const FrozenStringPool &stringPool,
+    const FrozenVector<ZgramInfo> &zgramInfos, BuildMemoryTracker *memory, SimpleAllocator *alloc,
+    FrozenMetadata::zgramRevisions_t *result, const FailFrame &ff);
+bool tryMakeZgramRefersTos(const std::string &filename, const FrozenVector<ZgramInfo> &zgramInfos,
+    BuildMemoryTracker *memory, SimpleAllocator *alloc,
+    FrozenMetadata::zgramRefersTo_t *refersToResult,
+    FrozenMetadata::zgramReferredBy_t *referredByResult, const FailFrame &ff);
+bool tryFindZgramOff(const FrozenVector<ZgramInfo> &zgramInfos, ZgramId zgramId,
+    const ZgramInfo **hint, uint32_t *result);
+template<typename T>
+bool tryMakeAdjacency(size_t numRows, const std::vector<std::pair<uint32_t, T>> &edges,
+    SimpleAllocator *alloc, FrozenAdjacency<T> *result, const FailFrame &ff);
+template<typename T>
+size_t capacityBytes(const std::vector<T> &v) {
+  return v.capacity() * sizeof(T);
+}
 bool tryMakeZmojis(const std::string &tempName, const std::string &filename,
     const FrozenStringPool &stringPool, SimpleAllocator *alloc, FrozenMetadata::zmojis_t *result,
     const FailFrame &ff);
@@ -92,39 +143,164 @@ bool tryMakeMinusMinuses(const std::string &tempName, const std::string &filenam
 bool tryMakePlusPlusKeys(const std::string &tempName, const std::string &filename,
     const FrozenStringPool &stringPool, SimpleAllocator *alloc, FrozenMetadata::plusPlusKeys_t *result,
     const FailFrame &ff);
+bool tryMakePlusPlusCounts(const FrozenMetadata::plusPluses_t &plusPluses,
+    const FrozenMetadata::minusMinuses_t &minusMinuses, SimpleAllocator *alloc,
+    FrozenMetadata::plusPlusCounts_t *result, const FailFrame &ff);
 }  // namespace
 
 bool MetadataBuilder::tryMakeMetadata(const LogSplitterResult &lsr, const ZgramDigestorResult &zgdr,
-    const std::string &tempFile, const FrozenStringPool &stringPool, SimpleAllocator *alloc, FrozenMetadata *result,
+    const std::string &tempFile, const FrozenStringPool &stringPool, size_t numThreads,
+    BuildMemoryTracker *memory, SimpleAllocator *alloc, FrozenMetadata *result,
     const FailFrame &ff) {
+  typedef std::pair<FrozenMetadata::zgramRefersTo_t, FrozenMetadata::zgramReferredBy_t>
+      refersTos_t;
+  RelocatableTable<FrozenMetadata::reactions_t> reactionsTable;
+  RelocatableTable<FrozenMetadata::reactionCounts_t> reactionCountsTable;
+  RelocatableTable<FrozenMetadata::zmojis_t> zmojisTable;
+  RelocatableTable<FrozenMetadata::plusPluses_t> plusPlusesTable;
+  RelocatableTable<FrozenMetadata::minusMinuses_t> minusMinusesTable;
+  RelocatableTable<FrozenMetadata::plusPlusKeys_t> plusPlusKeysTable;
+  RelocatableTable<FrozenMetadata::zgramRevisions_t> zgramRevisionsTable;
+  RelocatableTable<refersTos_t> refersTosTable;
+
+  const auto &zgramInfos = zgdr.zgramInfos();
+  // Each table gets its own scratch files.
+  auto nameFor = [&tempFile](size_t table, const char *what) {
+    return stringf("%o.%o.%o", tempFile, table, what);
+  };
+  auto buildTable = [&](size_t table, const FailFrame &ff2) {
+    auto tableName = nameFor(table, "table");
+    auto inflatorTemp = nameFor(table, "inflator");
+    switch (table) {
+      case 0: return reactionsTable.tryBuild(std::move(tableName),
+          [&](SimpleAllocator *tableAlloc, FrozenMetadata::reactions_t *res, const FailFrame &ff3) {
+            return tryMakeReactions(inflatorTemp, lsr.reactionsByZgramId_, stringPool, tableAlloc,
+                res, ff3.nest(HERE));
+          }, ff2.nest(HERE));
+      case 1: return reactionCountsTable.tryBuild(std::move(tableName),
+          [&](SimpleAllocator *tableAlloc, FrozenMetadata::reactionCounts_t *res,
+              const FailFrame &ff3) {
+            return tryMakeReactionCounts(lsr.reactionsByReaction_, stringPool, zgramInfos, memory,
+                tableAlloc, res, ff3.nest(HERE));
+          }, ff2.nest(HERE));
+      case 2: return zmojisTable.tryBuild(std::move(tableName),
+          [&](SimpleAllocator *tableAlloc, FrozenMetadata::zmojis_t *res, const FailFrame &ff3) {
+            return tryMakeZmojis(inflatorTemp, lsr.zmojis_, stringPool, tableAlloc, res,
+                ff3.nest(HERE));
+          }, ff2.nest(HERE));
+      case 3: return plusPlusesTable.tryBuild(std::move(tableName),
+          [&](SimpleAllocator *tableAlloc, FrozenMetadata::plusPluses_t *res,
+              const FailFrame &ff3) {
+            return tryMakePlusPluses(inflatorTemp, zgdr.plusPlusEntriesName(), stringPool,
+                tableAlloc, res, ff3.nest(HERE));
+          }, ff2.nest(HERE));
+      case 4: return minusMinusesTable.tryBuild(std::move(tableName),
+          [&](SimpleAllocator *tableAlloc, FrozenMetadata::minusMinuses_t *res,
+              const FailFrame &ff3) {
+            return tryMakeMinusMinuses(inflatorTemp, zgdr.minusMinusEntriesName(), stringPool,
+                tableAlloc, res, ff3.nest(HERE));
+          }, ff2.nest(HERE));
+      case 5: return plusPlusKeysTable.tryBuild(std::move(tableName),
+          [&](SimpleAllocator *tableAlloc, FrozenMetadata::plusPlusKeys_t *res,
+              const FailFrame &ff3) {
+            return tryMakePlusPlusKeys(inflatorTemp, zgdr.plusPlusKeysName(), stringPool,
+                tableAlloc, res, ff3.nest(HERE));
+          }, ff2.nest(HERE));
+      case 6: return zgramRevisionsTable.tryBuild(std::move(tableName),
+          [&](SimpleAllocator *tableAlloc, FrozenMetadata::zgramRevisions_t *res,
+              const FailFrame &ff3) {
+            return tryMakeZgramRevisions(lsr.zgramRevisions_, stringPool, zgramInfos, memory,
+                tableAlloc, res, ff3.nest(HERE));
+          }, ff2.nest(HERE));
+      case 7: return refersTosTable.tryBuild(std::move(tableName),
+          [&](SimpleAllocator *tableAlloc, refersTos_t *res, const FailFrame &ff3) {
+            return tryMakeZgramRefersTos(lsr.zgramRefersTo_, zgramInfos, memory, tableAlloc,
+                &res->first, &res->second, ff3.nest(HERE));
+          }, ff2.nest(HERE));
+      default: return ff2.failf(HERE, "Unknown table %o", table);
+    }
+  };
+  constexpr size_t numTables = 8;
+  if (!TaskRunner::tryRun("MetadataBuilder", numTables, numThreads, &buildTable, ff.nest(HERE))) {
+    return false;
+  }
+
   FrozenMetadata::reactions_t reactions;
   FrozenMetadata::reactionCounts_t reactionCounts;
-  FrozenMetadata::zgramRevisions_t zgramRevisions;
-  FrozenMetadata::zgramRefersTo_t zgramRefersTo;
   FrozenMetadata::zmojis_t zmojis;
   FrozenMetadata::plusPluses_t plusPluses;
   FrozenMetadata::minusMinuses_t minusMinuses;
   FrozenMetadata::plusPlusKeys_t plusPlusKeys;
-  if (!tryMakeReactions(tempFile, lsr.reactionsByZgramId_, stringPool, alloc, &reactions, ff.nest(HERE)) ||
-      !tryMakeReactionCounts(tempFile, lsr.reactionsByReaction_, stringPool, alloc, &reactionCounts, ff.nest(HERE)) ||
-      !tryMakeZgramRevisions(tempFile, lsr.zgramRevisions_, stringPool, alloc, &zgramRevisions, ff.nest(HERE)) ||
-      !tryMakeZgramRefersTos(tempFile, lsr.zgramRefersTo_, alloc, &zgramRefersTo, ff.nest(HERE)) ||
-      !tryMakeZmojis(tempFile, lsr.zmojis_, stringPool, alloc, &zmojis, ff.nest(HERE)) ||
-      !tryMakePlusPluses(tempFile, zgdr.plusPlusEntriesName(), stringPool, alloc, &plusPluses,
-          ff.nest(HERE))  ||
-      !tryMakeMinusMinuses(tempFile, zgdr.minusMinusEntriesName(), stringPool, alloc, &minusMinuses,
+  FrozenMetadata::plusPlusCounts_t plusPlusCounts;
+  FrozenMetadata::zgramRevisions_t zgramRevisions;
+  refersTos_t refersTos;
+  // Revisions and refers-to are only consulted when a zgram is displayed with its history, so they
+  // go last, in their own (cold) section.
+  if (!alloc->tryBeginSection(IndexSection::metadata, magicConstants::indexSectionAlignment,
           ff.nest(HERE)) ||
-      !tryMakePlusPlusKeys(tempFile, zgdr.plusPlusKeysName(), stringPool, alloc, &plusPlusKeys,
-          ff.nest(HERE))) {
+      !reactionsTable.tryMoveInto(alloc, &reactions, ff.nest(HERE)) ||
+      !reactionCountsTable.tryMoveInto(alloc, &reactionCounts, ff.nest(HERE)) ||
+      !zmojisTable.tryMoveInto(alloc, &zmojis, ff.nest(HERE)) ||
+      !plusPlusesTable.tryMoveInto(alloc, &plusPluses, ff.nest(HERE)) ||
+      !minusMinusesTable.tryMoveInto(alloc, &minusMinuses, ff.nest(HERE)) ||
+      !plusPlusKeysTable.tryMoveInto(alloc, &plusPlusKeys, ff.nest(HERE)) ||
+      !tryMakePlusPlusCounts(plusPluses, minusMinuses, alloc, &plusPlusCounts, ff.nest(HERE)) ||
+      !alloc->tryBeginSection(IndexSection::revisions, magicConstants::indexSectionAlignment,
+          ff.nest(HERE)) ||
+      !zgramRevisionsTable.tryMoveInto(alloc, &zgramRevisions, ff.nest(HERE)) ||
+      !refersTosTable.tryMoveInto(alloc, &refersTos, ff.nest(HERE))) {
     return false;
   }
+  auto &[zgramRefersTo, zgramReferredBy] = refersTos;
   *result = FrozenMetadata(std::move(reactions), std::move(reactionCounts), std::move(zgramRevisions),
-      std::move(zgramRefersTo), std::move(zmojis), std::move(plusPluses), std::move(minusMinuses),
-      std::move(plusPlusKeys));
+      std::move(zgramRefersTo), std::move(zgramReferredBy), std::move(zmojis), std::move(plusPluses),
+      std::move(minusMinuses), std::move(plusPlusKeys), std::move(plusPlusCounts));
   return true;
 }
 
 namespace {
+IndexFileWriter::Options makeTableWriterOptions() {
+  IndexFileWriter::Options result;
+  // The table is read back as soon as it's done.
+  result.dropWrittenPages_ = false;
+  return result;
+}
+
+template<typename T>
+RelocatableTable<T>::RelocatableTable() : writer_(makeTableWriterOptions()) {}
+
+template<typename T>
+template<typename BUILD>
+bool RelocatableTable<T>::tryBuild(std::string fileName, const BUILD &build, const FailFrame &ff) {
+  fileName_ = std::move(fileName);
+  if (!writer_.tryOpen(fileName_, outputFileMaxSize, ff.nest(HERE))) {
+    return false;
+  }
+  SimpleAllocator alloc(&writer_, tableAlignment);
+  T *root;
+  T table;
+  if (!alloc.tryAllocate(1, &root, ff.nest(HERE)) ||
+      !build(&alloc, &table, ff.nest(HERE))) {
+    return false;
+  }
+  new(root) T(std::move(table));
+  size_ = alloc.allocatedSize();
+  return true;
+}
+
+template<typename T>
+bool RelocatableTable<T>::tryMoveInto(SimpleAllocator *alloc, T *result, const FailFrame &ff) {
+  char *dest;
+  if (!alloc->tryAllocate(size_, tableAlignment, &dest, ff.nest(HERE))) {
+    return false;
+  }
+  memcpy(dest, writer_.start(), size_);
+  // The copy's relative pointers are good, so the top-level object can move out of the index and
+  // into the FrozenMetadata like any other.
+  *result = std::move(*reinterpret_cast<T*>(dest));
+  return nsunix::tryUnlink(fileName_, ff.nest(HERE));
+}
+
 // TODO(kosak): put this somewhere
 /**
  * Calculates the "tree depth" aka number of collections in a target data structure. This is used by the inflator
@@ -175,9 +351,13 @@ bool tryMakeReactions(const std::string &tempName, const std::string &filename,
   return res;
 }
 
-bool tryMakeReactionCounts(const std::string &tempName, const std::string &filename,
-    const FrozenStringPool &stringPool, SimpleAllocator *alloc, FrozenMetadata::reactionCounts_t *result,
-    const FailFrame &ff) {
+// The reaction counts are keyed by zgramOff rather than ZgramId, so that HavingReaction can walk
+// them as a bitmap. Reactions to zgrams that aren't in the index are dropped.
+bool tryMakeReactionCounts(const std::string &filename, const FrozenStringPool &stringPool,
+    const FrozenVector<ZgramInfo> &zgramInfos, BuildMemoryTracker *memory, SimpleAllocator *alloc,
+    FrozenMetadata::reactionCounts_t *result, const FailFrame &ff) {
+  typedef FrozenMetadata::reactionCounts_t::mapped_type inner_t;
+  typedef std::pair<frozenStringRef_t, inner_t> entry_t;
   MappedFile<char> mf;
   if (!mf.tryMap(filename, false, ff.nest(HERE))) {
     return false;
@@ -187,53 +367,126 @@ bool tryMakeReactionCounts(const std::string &tempName, const std::string &filen
   auto trueIter = makeTrueKeeper<schemas::ReactionsByReaction::keySize>(&lastIter);  // reaction, zgramId, creator, true
   auto reactions = makePrefixGrabber<2>(&trueIter);  // reaction, zgramId
   auto counter = makeCounter<2>(&reactions);  // reaction, zgramId, count
+  auto frozen = makeStringFreezer(&counter, &stringPool);
 
+  // First pass: count the reactions.
+  size_t numReactions = 0;
+  frozenStringRef_t prev;
   while (true) {
-    std::optional<std::tuple<std::string_view, ZgramId, size_t>> item;
-    if (!counter.tryGetNext(&item, ff.nest(HERE))) {
+    std::optional<std::tuple<frozenStringRef_t, ZgramId, size_t>> item;
+    if (!frozen.tryGetNext(&item, ff.nest(HERE))) {
       return false;
     }
     if (!item.has_value()) {
       break;
     }
+    if (numReactions == 0 || prev != std::get<0>(*item)) {
+      prev = std::get<0>(*item);
+      ++numReactions;
+    }
   }
-  counter.reset();
-  auto frozen = makeStringFreezer(&counter, &stringPool);
+  frozen.reset();
+
+  entry_t *entries;
+  if (!alloc->tryAllocate(numReactions, &entries, ff.nest(HERE))) {
+    return false;
+  }
+
+  // Second pass: build a bitmap and counts array for each reaction.
+  size_t entryIndex = 0;
+  std::vector<uint32_t> zgramOffs;
+  std::vector<uint32_t> counts;
+  MemoryReservation reservation(memory);
+  auto tryFlush = [&](frozenStringRef_t reaction, const FailFrame &ff2) {
+    reservation.forceResize(capacityBytes(zgramOffs) + capacityBytes(counts));
+    FrozenBitmap bitmap;
+    uint32_t *frozenCounts;
+    if (!BitmapBuilder::tryMake(zgramOffs.data(), zgramOffs.size(), alloc, &bitmap, ff2.nest(HERE)) ||
+        !alloc->tryAllocate(counts.size(), &frozenCounts, ff2.nest(HERE))) {
+      return false;
+    }
+    std::copy(counts.begin(), counts.end(), frozenCounts);
+    new(&entries[entryIndex++]) entry_t(reaction,
+        inner_t(std::move(bitmap), FrozenVector<uint32_t>(frozenCounts, counts.size())));
+    zgramOffs.clear();
+    counts.clear();
+    return true;
+  };
+
+  auto zgp = zgramInfos.begin();
+  bool havePrev = false;
   while (true) {
     std::optional<std::tuple<frozenStringRef_t, ZgramId, size_t>> item;
     if (!frozen.tryGetNext(&item, ff.nest(HERE))) {
       return false;
     }
-    if (!item.has_value()) {
-      break;
+    if (!item.has_value() || !havePrev || prev != std::get<0>(*item)) {
+      if (havePrev && !tryFlush(prev, ff.nest(HERE))) {
+        return false;
+      }
+      if (!item.has_value()) {
+        break;
+      }
+      prev = std::get<0>(*item);
+      havePrev = true;
+      zgp = zgramInfos.begin();
     }
+    const auto &[reaction, zgramId, count] = *item;
+    // Within a reaction, the zgramIds arrive in increasing order, so we only search forward.
+    uint32_t zgramOff;
+    if (!tryFindZgramOff(zgramInfos, zgramId, &zgp, &zgramOff)) {
+      continue;
+    }
+    zgramOffs.push_back(zgramOff);
+    counts.push_back(count);
   }
-  frozen.reset();
-  constexpr auto treeDepth = CalcTreeDepth<FrozenMetadata::reactionCounts_t>::value;
-  static_assert(treeDepth == 2);
-  if (!tryInflate(tempName, &frozen, treeDepth, result, alloc, ff.nest(HERE))) {
-    return false;
-  }
+  passert(entryIndex == numReactions, entryIndex, numReactions);
+  *result = FrozenMetadata::reactionCounts_t(FrozenVector<entry_t>(entries, numReactions));
   return true;
 }
 
-bool tryMakeZgramRevisions(const std::string &tempName, const std::string &filename,
-    const FrozenStringPool &stringPool, SimpleAllocator *alloc, FrozenMetadata::zgramRevisions_t *result,
-    const FailFrame &ff) {
+// The revisions are laid out as an adjacency indexed by zgramOff. Revisions to zgrams that aren't
+// in the index are dropped.
+bool tryMakeZgramRevisions(const std::string &filename, const FrozenStringPool &stringPool,
+    const FrozenVector<ZgramInfo> &zgramInfos, BuildMemoryTracker *memory, SimpleAllocator *alloc,
+    FrozenMetadata::zgramRevisions_t *result, const FailFrame &ff) {
+  typedef FrozenMetadata::zgramRevisions_t::value_type revision_t;
   MappedFile<char> mf;
   if (!mf.tryMap(filename, false, ff.nest(HERE))) {
     return false;
   }
-  RowIterator<schemas::ZgramRevisions::tuple_t> iter(std::move(mf));
+  RowIterator<schemas::ZgramRevisions::tuple_t> iter(std::move(mf));  // zgramId, instance, body, renderStyle
   auto frozen = makeStringFreezer(&iter, &stringPool);
-  constexpr auto treeDepth = CalcTreeDepth<FrozenMetadata::zgramRevisions_t>::value;
-  static_assert(treeDepth == 2);
-  return tryInflate(tempName, &frozen, treeDepth, result, alloc, ff.nest(HERE));
+
+  std::vector<std::pair<uint32_t, revision_t>> edges;
+  const auto *zgp = zgramInfos.begin();
+  while (true) {
+    std::optional<std::tuple<ZgramId, frozenStringRef_t, frozenStringRef_t, uint32_t>> item;
+    if (!frozen.tryGetNext(&item, ff.nest(HERE))) {
+      return false;
+    }
+    if (!item.has_value()) {
+      break;
+    }
+    const auto &[zgramId, instance, body, renderStyle] = *item;
+    uint32_t zgramOff;
+    if (tryFindZgramOff(zgramInfos, zgramId, &zgp, &zgramOff)) {
+      edges.emplace_back(zgramOff, revision_t(instance, body, renderStyle));
+    }
+  }
+  // tryMakeAdjacency needs a cursor per row on top of the edges.
+  MemoryReservation reservation(memory);
+  reservation.forceResize(capacityBytes(edges) + zgramInfos.size() * sizeof(uint32_t));
+  return tryMakeAdjacency(zgramInfos.size(), edges, alloc, result, ff.nest(HERE));
 }
 
-bool tryMakeZgramRefersTos(const std::string &tempName, const std::string &filename,
-    SimpleAllocator *alloc, FrozenMetadata::zgramRefersTo_t *result,
-    const FailFrame &ff) {
+// Builds both directions of the refers-to graph. The forward direction keeps the referred-to
+// ZgramId, because that zgram may not be in the index (yet). The reverse direction only has rows
+// for zgrams that are.
+bool tryMakeZgramRefersTos(const std::string &filename, const FrozenVector<ZgramInfo> &zgramInfos,
+    BuildMemoryTracker *memory, SimpleAllocator *alloc,
+    FrozenMetadata::zgramRefersTo_t *refersToResult,
+    FrozenMetadata::zgramReferredBy_t *referredByResult, const FailFrame &ff) {
   MappedFile<char> mf;
   if (!mf.tryMap(filename, false, ff.nest(HERE))) {
     return false;
@@ -242,11 +495,37 @@ bool tryMakeZgramRefersTos(const std::string &tempName, const std::string &filen
   constexpr auto keySize = schemas::ZgramRefersTos::keySize;
   auto lastKeeper = makeLastKeeper<keySize>(&iter);  // zgramId, refersTo, value
   auto trueKeeper = makeTrueKeeper<keySize>(&lastKeeper); // zgramId, refersTo, true
-  auto refersTo = makePrefixGrabber<keySize>(&trueKeeper);  // zgramId, reaction
+  auto refersTo = makePrefixGrabber<keySize>(&trueKeeper);  // zgramId, refersTo
 
-  constexpr auto treeDepth = CalcTreeDepth<FrozenMetadata::zgramRefersTo_t>::value;
-  static_assert(treeDepth == 2);
-  return tryInflate(tempName, &refersTo, treeDepth, result, alloc, ff.nest(HERE));
+  std::vector<std::pair<uint32_t, ZgramId>> forward;
+  std::vector<std::pair<uint32_t, zgramOff_t>> reverse;
+  const auto *zgp = zgramInfos.begin();
+  while (true) {
+    std::optional<std::tuple<ZgramId, ZgramId>> item;
+    if (!refersTo.tryGetNext(&item, ff.nest(HERE))) {
+      return false;
+    }
+    if (!item.has_value()) {
+      break;
+    }
+    const auto &[zgramId, target] = *item;
+    uint32_t zgramOff;
+    if (!tryFindZgramOff(zgramInfos, zgramId, &zgp, &zgramOff)) {
+      continue;
+    }
+    forward.emplace_back(zgramOff, target);
+    // The targets are in no useful order, so this one is a full search.
+    const auto *targetHint = zgramInfos.begin();
+    uint32_t targetOff;
+    if (tryFindZgramOff(zgramInfos, target, &targetHint, &targetOff)) {
+      reverse.emplace_back(targetOff, zgramOff_t(zgramOff));
+    }
+  }
+  MemoryReservation reservation(memory);
+  reservation.forceResize(capacityBytes(forward) + capacityBytes(reverse) +
+      zgramInfos.size() * sizeof(uint32_t));
+  return tryMakeAdjacency(zgramInfos.size(), forward, alloc, refersToResult, ff.nest(HERE)) &&
+      tryMakeAdjacency(zgramInfos.size(), reverse, alloc, referredByResult, ff.nest(HERE));
 }
 
 bool tryMakeZmojis(const std::string &tempName, const std::string &filename,
@@ -297,5 +576,128 @@ bool tryMakePlusPlusKeys(const std::string &tempName, const std::string &filenam
   static_assert(treeDepth == 2);
   return tryInflate(tempName, &frozen, treeDepth, result, alloc, ff.nest(HERE));
 }
+
+// Merges each key's ++ and -- zgrams (already laid out in the index, in key order) into its running
+// net count, so that the PlusPlusCounter can use the counts where they lie instead of rebuilding
+// them on the heap every time an index is loaded.
+bool tryMakePlusPlusCounts(const FrozenMetadata::plusPluses_t &plusPluses,
+    const FrozenMetadata::minusMinuses_t &minusMinuses, SimpleAllocator *alloc,
+    FrozenMetadata::plusPlusCounts_t *result, const FailFrame &ff) {
+  typedef FrozenMetadata::plusPlusCounts_t::mapped_type inner_t;
+  typedef std::pair<frozenStringRef_t, inner_t> entry_t;
+  static const FrozenVector<ZgramId> empty;
+  // Calls visit(key, pluses, minuses) for every key in either map, in key order.
+  auto tryForEachKey = [&plusPluses, &minusMinuses](const auto &visit, const FailFrame &ff2) {
+    auto pp = plusPluses.begin();
+    auto mp = minusMinuses.begin();
+    while (pp != plusPluses.end() || mp != minusMinuses.end()) {
+      bool takePlus = mp == minusMinuses.end() || (pp != plusPluses.end() && pp->first <= mp->first);
+      bool takeMinus = pp == plusPluses.end() || (mp != minusMinuses.end() && mp->first <= pp->first);
+      const auto &key = takePlus ? pp->first : mp->first;
+      if (!visit(key, takePlus ? pp->second : empty, takeMinus ? mp->second : empty,
+          ff2.nest(HERE))) {
+        return false;
+      }
+      pp += takePlus;
+      mp += takeMinus;
+    }
+    return true;
+  };
+  // Calls emit(zgramId, total) once per distinct zgram, with the net count as of that zgram.
+  auto merge = [](const FrozenVector<ZgramId> &pluses, const FrozenVector<ZgramId> &minuses,
+      const auto &emit) {
+    const auto *pp = pluses.begin();
+    const auto *mp = minuses.begin();
+    int64_t total = 0;
+    while (pp != pluses.end() || mp != minuses.end()) {
+      auto zgramId = mp == minuses.end() || (pp != pluses.end() && *pp <= *mp) ? *pp : *mp;
+      for (; pp != pluses.end() && *pp == zgramId; ++pp) {
+        ++total;
+      }
+      for (; mp != minuses.end() && *mp == zgramId; ++mp) {
+        --total;
+      }
+      emit(zgramId, total);
+    }
+  };
+
+  size_t numKeys = 0;
+  auto countKey = [&numKeys](frozenStringRef_t, const FrozenVector<ZgramId> &,
+      const FrozenVector<ZgramId> &, const FailFrame &) {
+    ++numKeys;
+    return true;
+  };
+  entry_t *entries;
+  if (!tryForEachKey(countKey, ff.nest(HERE)) ||
+      !alloc->tryAllocate(numKeys, &entries, ff.nest(HERE))) {
+    return false;
+  }
+
+  size_t entryIndex = 0;
+  auto makeKey = [&](frozenStringRef_t key, const FrozenVector<ZgramId> &pluses,
+      const FrozenVector<ZgramId> &minuses, const FailFrame &ff2) {
+    size_t size = 0;
+    merge(pluses, minuses, [&size](ZgramId, int64_t) { ++size; });
+    ZgramId *zgramIds;
+    int64_t *cumulative;
+    if (!alloc->tryAllocate(size, &zgramIds, ff2.nest(HERE)) ||
+        !alloc->tryAllocate(size, &cumulative, ff2.nest(HERE))) {
+      return false;
+    }
+    size_t i = 0;
+    merge(pluses, minuses, [zgramIds, cumulative, &i](ZgramId zgramId, int64_t total) {
+      new(&zgramIds[i]) ZgramId(zgramId);
+      cumulative[i] = total;
+      ++i;
+    });
+    new(&entries[entryIndex++]) entry_t(key,
+        inner_t(FrozenVector<ZgramId>(zgramIds, size), FrozenVector<int64_t>(cumulative, size)));
+    return true;
+  };
+  if (!tryForEachKey(makeKey, ff.nest(HERE))) {
+    return false;
+  }
+  passert(entryIndex == numKeys, entryIndex, numKeys);
+  *result = FrozenMetadata::plusPlusCounts_t(FrozenVector<entry_t>(entries, numKeys));
+  return true;
+}
+
+bool tryFindZgramOff(const FrozenVector<ZgramInfo> &zgramInfos, ZgramId zgramId,
+    const ZgramInfo **hint, uint32_t *result) {
+  *hint = std::lower_bound(*hint, zgramInfos.end(), zgramId,
+      [](const ZgramInfo &info, ZgramId id) { return info.zgramId() < id; });
+  if (*hint == zgramInfos.end() || (*hint)->zgramId() != zgramId) {
+    return false;
+  }
+  *result = *hint - zgramInfos.begin();
+  return true;
+}
+
+// A counting sort of 'edges' by row, so the neighbors within a row keep their arrival order.
+template<typename T>
+bool tryMakeAdjacency(size_t numRows, const std::vector<std::pair<uint32_t, T>> &edges,
+    SimpleAllocator *alloc, FrozenAdjacency<T> *result, const FailFrame &ff) {
+  uint32_t *offsets;
+  T *targets;
+  if (!alloc->tryAllocate(numRows + 1, &offsets, ff.nest(HERE)) ||
+      !alloc->tryAllocate(edges.size(), &targets, ff.nest(HERE))) {
+    return false;
+  }
+  std::fill(offsets, offsets + numRows + 1, 0);
+  for (const auto &edge : edges) {
+    passert(edge.first < numRows, edge.first, numRows);
+    ++offsets[edge.first + 1];
+  }
+  for (size_t i = 0; i != numRows; ++i) {
+    offsets[i + 1] += offsets[i];
+  }
+  std::vector<uint32_t> cursors(offsets, offsets + numRows);
+  for (const auto &[row, target] : edges) {
+    new(&targets[cursors[row]++]) T(target);
+  }
+  *result = FrozenAdjacency<T>(FrozenVector<uint32_t>(offsets, numRows + 1),
+      FrozenVector<T>(targets, edges.size()));
+  return true;
+}
 }  // namespace
 }  // namespace z2kplus::backend::reverse_index::builder
@@ -0,0 +1,298 @@
+// Copyright 2023 The Z2K Plus+ Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "z2kplus/backend/reverse_index/builder/stage_manifest.h"
+
+#include <charconv>
+#include <iostream>
+#include <set>
+#include <fcntl.h>
+#include "kosak/coding/coding.h"
+#include "kosak/coding/failures.h"
+#include "kosak/coding/memory/mapped_file.h"
+#include "kosak/coding/text/misc.h"
+#include "kosak/coding/unix.h"
+#include "z2kplus/backend/reverse_index/builder/digest_cache.h"
+
+using kosak::coding::FailFrame;
+using kosak::coding::FailRoot;
+using kosak::coding::memory::MappedFile;
+using kosak::coding::nsunix::FileCloser;
+using kosak::coding::streamf;
+using kosak::coding::stringf;
+using kosak::coding::text::Splitter;
+using z2kplus::backend::files::PathMaster;
+
+namespace nsunix = kosak::coding::nsunix;
+
+#define HERE KOSAK_CODING_HERE
+
+namespace z2kplus::backend::reverse_index::builder {
+namespace {
+constexpr const char *manifestFileName = "stage_manifest";
+constexpr std::string_view manifestHeader = "z2k stage manifest 1";
+
+// Splits off the first space-separated word of *line.
+std::string_view nextWord(std::string_view *line);
+bool tryParseNumber(std::string_view text, uint64_t *result, const FailFrame &ff);
+bool tryParse(std::string_view text, std::vector<StageRecord> *records,
+    std::vector<std::vector<std::pair<uint64_t, std::string>>> *checksums, const FailFrame &ff);
+bool trySyncFile(const std::string &name, int extraFlags, const FailFrame &ff);
+}  // namespace
+
+bool StageManifest::tryLoad(const PathMaster &pm, StageManifest *result, const FailFrame &ff) {
+  auto manifestName = pm.getScratchPathFor(manifestFileName);
+  bool exists;
+  std::string text;
+  if (!nsunix::tryExists(manifestName, &exists, ff.nest(HERE)) ||
+      (exists && !nsunix::tryReadAll(manifestName, &text, ff.nest(HERE)))) {
+    return false;
+  }
+  std::vector<StageRecord> records;
+  std::vector<std::vector<std::pair<uint64_t, std::string>>> checksums;
+  std::vector<Stage> stages;
+  FailRoot parseFailure;
+  if (!exists) {
+    // Nothing to resume.
+  } else if (!tryParse(text, &records, &checksums, parseFailure.nest(HERE))) {
+    streamf(std::cerr, "Ignoring unreadable stage manifest %o: %o\n", manifestName, parseFailure);
+  } else {
+    for (size_t i = 0; i != records.size(); ++i) {
+      Stage stage;
+      stage.record_ = std::move(records[i]);
+      for (auto &[size, digest] : checksums[i]) {
+        stage.checksums_.push_back(Checksum {size, std::move(digest)});
+      }
+      stages.push_back(std::move(stage));
+    }
+  }
+  *result = StageManifest(pm.scratchRoot(), std::move(manifestName), std::move(stages));
+  return true;
+}
+
+StageManifest::StageManifest() = default;
+StageManifest::StageManifest(std::string scratchRoot, std::string manifestName,
+    std::vector<Stage> stages) : scratchRoot_(std::move(scratchRoot)),
+    manifestName_(std::move(manifestName)), stages_(std::move(stages)) {}
+StageManifest::StageManifest(StageManifest &&) noexcept = default;
+StageManifest &StageManifest::operator=(StageManifest &&) noexcept = default;
+StageManifest::~StageManifest() = default;
+
+bool StageManifest::tryResume(std::string_view stage, const std::string &inputKey, bool *found,
+    StageRecord *result, const FailFrame &ff) {
+  size_t index = 0;
+  while (index != stages_.size() && stages_[index].record_.stage_ != stage) {
+    ++index;
+  }
+  *found = false;
+  if (index != stages_.size() && stages_[index].record_.inputKey_ == inputKey) {
+    if (!tryIntact(stages_[index], found, ff.nest(HERE))) {
+      return false;
+    }
+    if (*found) {
+      *result = stages_[index].record_;
+      return true;
+    }
+  }
+  // Write the shorter manifest before deleting anything it used to list.
+  stages_.erase(stages_.begin() + (ptrdiff_t)index, stages_.end());
+  return tryWrite(ff.nest(HERE)) &&
+      tryRemoveUnrecordedFiles(ff.nest(HERE));
+}
+
+bool StageManifest::tryRecord(StageRecord record, const FailFrame &ff) {
+  Stage stage;
+  stage.checksums_.resize(record.files_.size());
+  for (size_t i = 0; i != record.files_.size(); ++i) {
+    bool exists;
+    if (!tryChecksum(record.files_[i], &exists, &stage.checksums_[i], ff.nest(HERE))) {
+      return false;
+    }
+    if (!exists) {
+      return ff.failf(HERE, "Stage %o: output %o doesn't exist", record.stage_, record.files_[i]);
+    }
+  }
+  stage.record_ = std::move(record);
+  stages_.push_back(std::move(stage));
+  return tryWrite(ff.nest(HERE));
+}
+
+bool StageManifest::tryRemoveUnrecordedFiles(const FailFrame &ff) {
+  std::set<std::string, std::less<>> keep;
+  keep.insert(manifestName_);
+  for (const auto &stage : stages_) {
+    keep.insert(stage.record_.files_.begin(), stage.record_.files_.end());
+  }
+  std::string storage;
+  auto cb = [&keep, &storage](std::string_view fullPath, bool isDir, const FailFrame &ff2) {
+    if (isDir || keep.find(fullPath) != keep.end()) {
+      return true;
+    }
+    storage = fullPath;
+    return nsunix::tryUnlink(storage, ff2.nest(HERE));
+  };
+  return nsunix::tryEnumerateFilesAndDirsRecursively(scratchRoot_, &cb, ff.nest(HERE));
+}
+
+bool StageManifest::tryChecksum(const std::string &fileName, bool *exists, Checksum *result,
+    const FailFrame &ff) {
+  MappedFile<char> mf;
+  if (!nsunix::tryExists(fileName, exists, ff.nest(HERE))) {
+    return false;
+  }
+  if (!*exists) {
+    return true;
+  }
+  if (!mf.tryMap(fileName, false, ff.nest(HERE))) {
+    return false;
+  }
+  DigestKey key;
+  key.add(std::string_view(mf.get(), mf.byteSize()));
+  result->size_ = mf.byteSize();
+  result->digest_ = key.toString();
+  return true;
+}
+
+bool StageManifest::tryIntact(const Stage &stage, bool *result, const FailFrame &ff) const {
+  *result = false;
+  for (size_t i = 0; i != stage.record_.files_.size(); ++i) {
+    bool exists;
+    Checksum checksum;
+    if (!tryChecksum(stage.record_.files_[i], &exists, &checksum, ff.nest(HERE))) {
+      return false;
+    }
+    const auto &expected = stage.checksums_[i];
+    if (!exists || checksum.size_ != expected.size_ || checksum.digest_ != expected.digest_) {
+      streamf(std::cerr, "Stage %o: %o has changed, so the stage has to run again\n",
+          stage.record_.stage_, stage.record_.files_[i]);
+      return true;
+    }
+  }
+  *result = true;
+  return true;
+}
+
+// Format:
+//   z2k stage manifest 1
+//   stage <name> <inputKey>
+//   file <size> <digest> <path>
+//   string <text>
+//   value <number>
+//   end
+bool StageManifest::tryWrite(const FailFrame &ff) const {
+  std::string text(manifestHeader);
+  text.push_back('\n');
+  for (const auto &stage : stages_) {
+    const auto &record = stage.record_;
+    text.append(stringf("stage %o %o\n", record.stage_, record.inputKey_));
+    for (size_t i = 0; i != record.files_.size(); ++i) {
+      const auto &checksum = stage.checksums_[i];
+      text.append(stringf("file %o %o %o\n", checksum.size_, checksum.digest_, record.files_[i]));
+    }
+    for (const auto &s : record.strings_) {
+      text.append(stringf("string %o\n", s));
+    }
+    for (auto value : record.values_) {
+      text.append(stringf("value %o\n", value));
+    }
+    text.append("end\n");
+  }
+  // The stages it records are only as good as the manifest, so make sure the new one is on disk
+  // before it replaces the old, and that the rename itself is on disk before we report success.
+  auto tempName = manifestName_ + ".tmp";
+  return nsunix::tryWriteAll(tempName, text, ff.nest(HERE)) &&
+      trySyncFile(tempName, 0, ff.nest(HERE)) &&
+      nsunix::tryRename(tempName, manifestName_, ff.nest(HERE)) &&
+      trySyncFile(scratchRoot_, O_DIRECTORY, ff.nest(HERE));
+}
+
+namespace {
+std::string_view nextWord(std::string_view *line) {
+  auto pos = line->find(' ');
+  auto result = line->substr(0, pos);
+  line->remove_prefix(pos == std::string_view::npos ? line->size() : pos + 1);
+  return result;
+}
+
+bool tryParseNumber(std::string_view text, uint64_t *result, const FailFrame &ff) {
+  auto [ptr, ec] = std::from_chars(text.data(), text.data() + text.size(), *result);
+  if (ec != std::errc() || ptr != text.data() + text.size()) {
+    return ff.failf(HERE, "Can't parse \"%o\" as a number", text);
+  }
+  return true;
+}
+
+bool tryParse(std::string_view text, std::vector<StageRecord> *records,
+    std::vector<std::vector<std::pair<uint64_t, std::string>>> *checksums, const FailFrame &ff) {
+  auto splitter = Splitter::ofRecords(text, '\n');
+  std::string_view line;
+  if (!splitter.moveNext(&line) || line != manifestHeader) {
+    return ff.failf(HERE, "Expected header \"%o\"", manifestHeader);
+  }
+  StageRecord *current = nullptr;
+  while (splitter.moveNext(&line)) {
+    if (line.empty()) {
+      continue;
+    }
+    auto tag = nextWord(&line);
+    if (tag == "stage") {
+      if (current != nullptr) {
+        return ff.failf(HERE, "Stage %o has no end", current->stage_);
+      }
+      auto &record = records->emplace_back();
+      checksums->emplace_back();
+      record.stage_ = nextWord(&line);
+      record.inputKey_ = line;
+      current = &record;
+      continue;
+    }
+    if (current == nullptr) {
+      return ff.failf(HERE, "\"%o\" outside of a stage", tag);
+    }
+    if (tag == "file") {
+      uint64_t size;
+      if (!tryParseNumber(nextWord(&line), &size, ff.nest(HERE))) {
+        return false;
+      }
+      std::string digest(nextWord(&line));
+      current->files_.emplace_back(line);
+      checksums->back().emplace_back(size, std::move(digest));
+    } else if (tag == "string") {
+      current->strings_.emplace_back(line);
+    } else if (tag == "value") {
+      uint64_t value;
+      if (!tryParseNumber(line, &value, ff.nest(HERE))) {
+        return false;
+      }
+      current->values_.push_back(value);
+    } else if (tag == "end") {
+      current = nullptr;
+    } else {
+      return ff.failf(HERE, "Unknown tag \"%o\"", tag);
+    }
+  }
+  if (current != nullptr) {
+    return ff.failf(HERE, "Stage %o has no end", current->stage_);
+  }
+  return true;
+}
+
+bool trySyncFile(const std::string &name, int extraFlags, const FailFrame &ff) {
+  FileCloser fc;
+  return nsunix::tryOpen(name, O_RDONLY | extraFlags, 0, &fc, ff.nest(HERE)) &&
+      nsunix::trySync(fc.get(), ff.nest(HERE)) &&
+      fc.tryClose(ff.nest(HERE));
+}
+}  // namespace
+}  // namespace z2kplus::backend::reverse_index::builder
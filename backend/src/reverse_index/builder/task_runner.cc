@@ -0,0 +1,91 @@
+// Copyright 2023 The Z2K Plus+ Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "z2kplus/backend/reverse_index/builder/task_runner.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+#include "kosak/coding/coding.h"
+#include "kosak/coding/failures.h"
+#include "kosak/coding/unix.h"
+#include "kosak/coding/memory/buffered_writer.h"
+
+using kosak::coding::FailFrame;
+using kosak::coding::FailRoot;
+using kosak::coding::memory::WriteThrottle;
+using kosak::coding::streamf;
+using kosak::coding::toString;
+
+namespace nsunix = kosak::coding::nsunix;
+
+#define HERE KOSAK_CODING_HERE
+
+namespace z2kplus::backend::reverse_index::builder {
+bool TaskRunner::tryRun(std::string_view name, size_t numTasks, size_t numThreads,
+    const task_t &task, const FailFrame &ff) {
+  if (numThreads == 0) {
+    numThreads = std::max<size_t>(nsunix::numCores(), 1);
+  }
+  numThreads = std::min(numThreads, numTasks);
+
+  std::atomic<size_t> nextTask(0);
+  std::atomic<bool> failed(false);
+  // One slot per task, so that errors are reported in task order.
+  std::vector<std::optional<std::string>> errors(numTasks);
+
+  // The workers pace their writes the same way the caller does.
+  auto *throttle = WriteThrottle::current();
+  auto worker = [&]() {
+    WriteThrottle::Scope throttleScope(throttle);
+    while (!failed) {
+      auto taskIndex = nextTask++;
+      if (taskIndex >= numTasks) {
+        return;
+      }
+      FailRoot fr;
+      if (!task(taskIndex, fr.nest(HERE))) {
+        errors[taskIndex] = toString(fr);
+        failed = true;
+      }
+    }
+  };
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  threads.reserve(numThreads);
+  for (size_t i = 0; i != numThreads; ++i) {
+    threads.emplace_back(worker);
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - start);
+  streamf(std::cerr, "%o: %o tasks on %o threads took %o ms\n", name, numTasks, numThreads,
+      elapsed.count());
+
+  for (size_t i = 0; i != numTasks; ++i) {
+    if (errors[i].has_value()) {
+      return ff.failf(HERE, "%o task %o failed: %o", name, i, *errors[i]);
+    }
+  }
+  return true;
+}
+}  // namespace z2kplus::backend::reverse_index::builder
@@ -14,14 +14,51 @@
 
 #include "z2kplus/backend/reverse_index/builder/trie_builder.h"
 
+#include <limits>
 #include "kosak/coding/failures.h"
+#include "kosak/coding/unix.h"
+#include "z2kplus/backend/shared/magic_constants.h"
 
 #define HERE KOSAK_CODING_HERE
 
 using kosak::coding::FailFrame;
+using kosak::coding::memory::BufferedWriter;
+using kosak::coding::nsunix::FileCloser;
 using z2kplus::backend::util::RelativePtr;
 
+namespace nsunix = kosak::coding::nsunix;
+namespace filenames = z2kplus::backend::shared::magicConstants::filenames;
+
 namespace z2kplus::backend::reverse_index::builder {
+PostingsWriter::PostingsWriter() = default;
+PostingsWriter::~PostingsWriter() = default;
+
+bool PostingsWriter::tryOpen(const std::string &fileName, const FailFrame &ff) {
+  FileCloser fc;
+  if (!nsunix::tryOpen(fileName, filenames::standardFlags, filenames::standardMode, &fc,
+      ff.nest(HERE))) {
+    return false;
+  }
+  writer_ = BufferedWriter(std::move(fc));
+  size_ = 0;
+  return true;
+}
+
+bool PostingsWriter::tryAppend(const std::vector<wordOff_t> &words, uint32_t *offset,
+    const FailFrame &ff) {
+  // Every wordOff is at exactly one node, so this can't overflow while wordOff_t is 32 bits.
+  if (size_ + words.size() > std::numeric_limits<uint32_t>::max()) {
+    return ff.failf(HERE, "Too many postings: %o", size_ + words.size());
+  }
+  *offset = size_;
+  size_ += words.size();
+  return writer_.tryWritePOD(words.data(), words.size(), ff.nest(HERE));
+}
+
+bool PostingsWriter::tryClose(const FailFrame &ff) {
+  return writer_.tryClose(ff.nest(HERE));
+}
+
 TrieBuilderNode::TrieBuilderNode() = default;
 TrieBuilderNode::TrieBuilderNode(std::u32string prefix, std::vector<wordOff_t> wordsHere,
     char32_t dynamicTransition, std::unique_ptr<TrieBuilderNode> dynamicChild,
@@ -32,7 +69,7 @@ TrieBuilderNode::TrieBuilderNode(std::u32string prefix, std::vector<wordOff_t> w
 TrieBuilderNode::~TrieBuilderNode() = default;
 
 bool TrieBuilderNode::tryInsert(const std::u32string_view &probe, const wordOff_t *begin, size_t size,
-    SimpleAllocator *alloc, const FailFrame &ff) {
+    SimpleAllocator *alloc, PostingsWriter *postings, const FailFrame &ff) {
   if (size == 0) {
     // Nothing to append.
     return true;
@@ -43,7 +80,7 @@ bool TrieBuilderNode::tryInsert(const std::u32string_view &probe, const wordOff_
 
   if (diffIndex == prefix_.size()) {
     // Prefix satisfied, so do remainder of work starting from this node.
-    return tryInsertHelper(probe.substr(diffIndex), begin, size, alloc, ff.nest(HERE));
+    return tryInsertHelper(probe.substr(diffIndex), begin, size, alloc, postings, ff.nest(HERE));
   }
 
   // Need to split this node at 'diffIndex'.
@@ -65,11 +102,11 @@ bool TrieBuilderNode::tryInsert(const std::u32string_view &probe, const wordOff_
   frozenTransitions_.clear();
 
   // Now I can just hand off to the insertHelper logic
-  return tryInsertHelper(probe.substr(diffIndex), begin, size, alloc, ff.nest(HERE));
+  return tryInsertHelper(probe.substr(diffIndex), begin, size, alloc, postings, ff.nest(HERE));
 }
 
 bool TrieBuilderNode::tryInsertHelper(std::u32string_view probe, const wordOff_t *begin, size_t size,
-    SimpleAllocator *alloc, const FailFrame &ff) {
+    SimpleAllocator *alloc, PostingsWriter *postings, const FailFrame &ff) {
   // Three cases:
   // 1. If probe is empty then we're appending right here.
   // 2. Otherwise, if there is an existing transition on the first character of probe, then recurse
@@ -84,14 +121,14 @@ bool TrieBuilderNode::tryInsertHelper(std::u32string_view probe, const wordOff_t
   auto remainder = probe.substr(1);
   if (dynamicChild_ != nullptr && transition == dynamicTransition_) {
     // Recurse.
-    return dynamicChild_->tryInsert(remainder, begin, size, alloc, ff.nest(HERE));
+    return dynamicChild_->tryInsert(remainder, begin, size, alloc, postings, ff.nest(HERE));
   }
 
   // New transition is here. First freeze our dynamic child, if we have one.
   if (dynamicChild_ != nullptr) {
     // we could assert that transition > dynamicTransition_
     FrozenNode *frozenNode;
-    if (!dynamicChild_->tryFreeze(alloc, &frozenNode, ff.nest(HERE))) {
+    if (!dynamicChild_->tryFreeze(alloc, postings, &frozenNode, ff.nest(HERE))) {
       return false;
     }
     frozenTransitions_.emplace_back(dynamicTransition_, frozenNode);
@@ -107,11 +144,12 @@ bool TrieBuilderNode::tryInsertHelper(std::u32string_view probe, const wordOff_t
   return true;
 }
 
-bool TrieBuilderNode::tryFreeze(SimpleAllocator *alloc, FrozenNode **result, const FailFrame &ff) {
+bool TrieBuilderNode::tryFreeze(SimpleAllocator *alloc, PostingsWriter *postings,
+    FrozenNode **result, const FailFrame &ff) {
   if (dynamicChild_ != nullptr) {
     // we could assert that transition > dynamicTransition_
     FrozenNode *frozenChild;
-    if (!dynamicChild_->tryFreeze(alloc, &frozenChild, ff.nest(HERE))) {
+    if (!dynamicChild_->tryFreeze(alloc, postings, &frozenChild, ff.nest(HERE))) {
       return false;
     }
     frozenTransitions_.emplace_back(dynamicTransition_, frozenChild);
@@ -120,21 +158,21 @@ bool TrieBuilderNode::tryFreeze(SimpleAllocator *alloc, FrozenNode **result, con
   }
   FrozenNode *newNode;
   char32_t *prefix;
-  wordOff_t *wordsHere;
+  uint32_t firstWordHere = 0;
   char32_t *transitionKeys;
   RelativePtr<FrozenNode> *transitions;
   if (!alloc->tryAllocate(1, &newNode, ff.nest(HERE)) ||
       !alloc->tryAllocate(prefix_.size(), &prefix, ff.nest(HERE)) ||
-      !alloc->tryAllocate(wordsHere_.size(), &wordsHere, ff.nest(HERE)) ||
+      (!wordsHere_.empty() && !postings->tryAppend(wordsHere_, &firstWordHere, ff.nest(HERE))) ||
       !alloc->tryAllocate(frozenTransitions_.size(), &transitionKeys, ff.nest(HERE)) ||
       !alloc->tryAllocate(frozenTransitions_.size(), &transitions, ff.nest(HERE))) {
     return false;
   }
   newNode->prefixSize_ = prefix_.size();
+  newNode->firstWordHere_ = firstWordHere;
   newNode->numWordsHere_ = wordsHere_.size();
   newNode->numTransitions_ = frozenTransitions_.size();
   std::copy(prefix_.begin(), prefix_.end(), prefix);
-  std::copy(wordsHere_.begin(), wordsHere_.end(), wordsHere);
   for (size_t i = 0; i != frozenTransitions_.size(); ++i) {
     const auto &ft = frozenTransitions_[i];
     transitionKeys[i] = ft.first;
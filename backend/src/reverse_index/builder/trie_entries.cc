@@ -0,0 +1,215 @@
+// Copyright 2023 The Z2K Plus+ Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "z2kplus/backend/reverse_index/builder/trie_entries.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "kosak/coding/coding.h"
+#include "kosak/coding/failures.h"
+#include "kosak/coding/memory/buffered_writer.h"
+#include "kosak/coding/unix.h"
+#include "z2kplus/backend/shared/magic_constants.h"
+
+using kosak::coding::FailFrame;
+using kosak::coding::memory::BufferedWriter;
+using kosak::coding::nsunix::FileCloser;
+using kosak::coding::stringf;
+
+namespace filenames = z2kplus::backend::shared::magicConstants::filenames;
+namespace nsunix = kosak::coding::nsunix;
+
+#define HERE KOSAK_CODING_HERE
+
+namespace z2kplus::backend::reverse_index::builder {
+namespace {
+typedef std::pair<std::string_view, const std::vector<uint32_t> *> spillEntry_t;
+
+void radixSort(spillEntry_t *begin, spillEntry_t *end, size_t depth, spillEntry_t *scratch);
+size_t paddedSize(size_t keySize);
+// Per-key overhead of postings_ (hash node, vector header, slack), for budgeting purposes.
+constexpr size_t perKeyOverhead = 64;
+// How much more to reserve when bytesUsed_ outgrows the reservation.
+constexpr size_t reservationSlice = 1024 * 1024;
+}  // namespace
+
+TrieEntriesWriter::TrieEntriesWriter(std::string runPrefix, size_t budget,
+    BuildMemoryTracker *memory) :
+    runPrefix_(std::move(runPrefix)), budget_(budget), reservation_(memory) {}
+TrieEntriesWriter::TrieEntriesWriter(TrieEntriesWriter &&) noexcept = default;
+TrieEntriesWriter &TrieEntriesWriter::operator=(TrieEntriesWriter &&) noexcept = default;
+TrieEntriesWriter::~TrieEntriesWriter() = default;
+
+bool TrieEntriesWriter::tryAdd(std::string_view key, uint32_t wordOff, const FailFrame &ff) {
+  auto [ip, inserted] = postings_.try_emplace(key);
+  if (inserted) {
+    bytesUsed_ += key.size() + perKeyOverhead;
+  }
+  ip->second.push_back(wordOff);
+  bytesUsed_ += sizeof(uint32_t);
+  if (bytesUsed_ < reservation_.size()) {
+    return true;
+  }
+  return (bytesUsed_ < budget_ &&
+      reservation_.tryResizeIfAvailable(std::min(budget_, bytesUsed_ + reservationSlice))) ||
+      trySpill(ff.nest(HERE));
+}
+
+bool TrieEntriesWriter::tryClose(const FailFrame &ff) {
+  return trySpill(ff.nest(HERE));
+}
+
+bool TrieEntriesWriter::trySpill(const FailFrame &ff) {
+  if (postings_.empty()) {
+    return true;
+  }
+  std::vector<spillEntry_t> entries;
+  entries.reserve(postings_.size());
+  for (const auto &[key, wordOffs] : postings_) {
+    entries.emplace_back(key, &wordOffs);
+  }
+  std::vector<spillEntry_t> scratch(entries.size());
+  radixSort(entries.data(), entries.data() + entries.size(), 0, scratch.data());
+
+  auto name = stringf("%o.%o", runPrefix_, runNames_.size());
+  FileCloser fc;
+  if (!nsunix::tryOpen(name, filenames::standardFlags, filenames::standardMode, &fc,
+      ff.nest(HERE))) {
+    return false;
+  }
+  BufferedWriter writer(std::move(fc));
+  static const std::array<char, sizeof(uint32_t)> zeros = {};
+  for (const auto &[key, wordOffs] : entries) {
+    if (!writer.tryWriteUint32(key.size(), ff.nest(HERE)) ||
+        !writer.tryWriteUint32(wordOffs->size(), ff.nest(HERE)) ||
+        !writer.tryWriteBytes(key.data(), key.size(), ff.nest(HERE)) ||
+        !writer.tryWriteBytes(zeros.data(), paddedSize(key.size()) - key.size(), ff.nest(HERE)) ||
+        !writer.tryWriteBytes(reinterpret_cast<const char*>(wordOffs->data()),
+            wordOffs->size() * sizeof(uint32_t), ff.nest(HERE))) {
+      return false;
+    }
+  }
+  if (!writer.tryClose(ff.nest(HERE))) {
+    return false;
+  }
+  runNames_.push_back(std::move(name));
+  postings_.clear();
+  bytesUsed_ = 0;
+  reservation_.forceResize(0);
+  return true;
+}
+
+bool TrieEntriesReader::tryCreate(const std::string &runName, TrieEntriesReader *result,
+    const FailFrame &ff) {
+  MappedFile<uint32_t> mf;
+  if (!mf.tryMap(runName, false, ff.nest(HERE))) {
+    return false;
+  }
+  if (mf.byteSize() % sizeof(uint32_t) != 0) {
+    return ff.failf(HERE, "%o: size %o is not a multiple of %o", runName, mf.byteSize(),
+        sizeof(uint32_t));
+  }
+  const auto *begin = mf.get();
+  const auto *end = begin + mf.byteSize() / sizeof(uint32_t);
+  std::string_view prevKey;
+  for (const auto *current = begin; current != end; ) {
+    if (end - current < 2) {
+      return ff.failf(HERE, "%o: truncated header at word %o", runName, current - begin);
+    }
+    auto keySize = current[0];
+    auto numWordOffs = current[1];
+    auto recordSize = 2 + paddedSize(keySize) / sizeof(uint32_t) + numWordOffs;
+    if ((size_t)(end - current) < recordSize) {
+      return ff.failf(HERE, "%o: truncated record at word %o", runName, current - begin);
+    }
+    std::string_view key(reinterpret_cast<const char*>(current + 2), keySize);
+    if (current != begin && !(prevKey < key)) {
+      return ff.failf(HERE, "%o: keys out of order: %o then %o", runName, prevKey, key);
+    }
+    prevKey = key;
+    current += recordSize;
+  }
+  result->mf_ = std::move(mf);
+  result->current_ = begin;
+  result->end_ = end;
+  return true;
+}
+
+TrieEntriesReader::TrieEntriesReader() = default;
+TrieEntriesReader::TrieEntriesReader(TrieEntriesReader &&) noexcept = default;
+TrieEntriesReader &TrieEntriesReader::operator=(TrieEntriesReader &&) noexcept = default;
+TrieEntriesReader::~TrieEntriesReader() = default;
+
+bool TrieEntriesReader::tryGetNext(TrieEntry *result) {
+  if (current_ == end_) {
+    return false;
+  }
+  auto keySize = current_[0];
+  auto numWordOffs = current_[1];
+  const auto *keyStart = current_ + 2;
+  const auto *wordOffs = keyStart + paddedSize(keySize) / sizeof(uint32_t);
+  result->key_ = std::string_view(reinterpret_cast<const char*>(keyStart), keySize);
+  result->wordOffs_ = wordOffs;
+  result->numWordOffs_ = numWordOffs;
+  current_ = wordOffs + numWordOffs;
+  return true;
+}
+
+namespace {
+// MSD radix sort on the key bytes. Bucket 0 holds the keys that end at 'depth'; bucket b + 1 holds
+// the keys whose byte at 'depth' is b. Small ranges fall back to a comparison sort.
+void radixSort(spillEntry_t *begin, spillEntry_t *end, size_t depth, spillEntry_t *scratch) {
+  constexpr size_t smallRange = 32;
+  auto size = static_cast<size_t>(end - begin);
+  if (size < smallRange) {
+    std::sort(begin, end, [depth](const spillEntry_t &lhs, const spillEntry_t &rhs) {
+      return lhs.first.substr(depth) < rhs.first.substr(depth);
+    });
+    return;
+  }
+  auto bucketOf = [depth](const spillEntry_t &entry) -> size_t {
+    return entry.first.size() == depth ? 0 : 1 + static_cast<uint8_t>(entry.first[depth]);
+  };
+  std::array<size_t, 258> starts = {};
+  for (const auto *p = begin; p != end; ++p) {
+    ++starts[bucketOf(*p) + 1];
+  }
+  for (size_t i = 1; i != starts.size(); ++i) {
+    starts[i] += starts[i - 1];
+  }
+  auto next = starts;
+  for (const auto *p = begin; p != end; ++p) {
+    scratch[next[bucketOf(*p)]++] = *p;
+  }
+  std::copy(scratch, scratch + size, begin);
+  // Bucket 0 holds at most one key (keys are unique), so only the others need more work.
+  for (size_t bucket = 1; bucket != starts.size() - 1; ++bucket) {
+    auto bucketBegin = starts[bucket];
+    auto bucketEnd = starts[bucket + 1];
+    if (bucketEnd - bucketBegin > 1) {
+      radixSort(begin + bucketBegin, begin + bucketEnd, depth + 1, scratch);
+    }
+  }
+}
+
+size_t paddedSize(size_t keySize) {
+  return (keySize + sizeof(uint32_t) - 1) / sizeof(uint32_t) * sizeof(uint32_t);
+}
+}  // namespace
+}  // namespace z2kplus::backend::reverse_index::builder
@@ -14,25 +14,31 @@
 
 #include "z2kplus/backend/reverse_index/builder/trie_finalizer.h"
 
-#include <charconv>
+#include <algorithm>
+#include <limits>
 #include <chrono>
-#include "kosak/coding/memory/mapped_file.h"
+#include <string>
+#include <utility>
+#include <vector>
+#include "kosak/coding/merger.h"
 #include "kosak/coding/text/conversions.h"
-#include "kosak/coding/text/misc.h"
 #include "kosak/coding/unix.h"
 #include "z2kplus/backend/reverse_index/builder/common.h"
 #include "z2kplus/backend/reverse_index/builder/trie_builder.h"
+#include "z2kplus/backend/reverse_index/builder/trie_entries.h"
 
 using kosak::coding::FailFrame;
-using kosak::coding::memory::MappedFile;
+using kosak::coding::merger::Merger;
+using kosak::coding::streamf;
 using kosak::coding::text::ReusableString32;
-using kosak::coding::text::Splitter;
-using z2kplus::backend::reverse_index::builder::defaultFieldSeparator;
-using z2kplus::backend::reverse_index::builder::defaultRecordSeparator;
 using z2kplus::backend::reverse_index::builder::SimpleAllocator;
 using z2kplus::backend::reverse_index::builder::TrieBuilderNode;
-using z2kplus::backend::reverse_index::builder::wordOffSeparator;
+using z2kplus::backend::reverse_index::builder::TrieEntriesReader;
+using z2kplus::backend::reverse_index::builder::TrieEntry;
+using z2kplus::backend::reverse_index::builder::TrieEntryLess;
+using z2kplus::backend::reverse_index::trie::FoldedVocabulary;
 using z2kplus::backend::reverse_index::trie::FrozenNode;
+using z2kplus::backend::util::frozen::FrozenVector;
 
 namespace nsunix = kosak::coding::nsunix;
 
@@ -42,20 +48,31 @@ void supercow_confirm_sorted_here();
 
 namespace z2kplus::backend::reverse_index::builder {
 namespace {
-bool tryAppendWordOffs(wordOff_t wordOffBase, std::string_view src, std::vector<wordOff_t> *dest,
-    const FailFrame &ff);
-bool tryReadUint32(Splitter *splitter, uint32_t *dest, const FailFrame &ff);
+// Pairs of (folded form, original word), for the words where those differ.
+typedef std::vector<std::pair<std::u32string, std::u32string>> foldedPairs_t;
+bool tryMakeFoldedVocabulary(foldedPairs_t *pairs, SimpleAllocator *alloc,
+    FoldedVocabulary *result, const FailFrame &ff);
 }  // namespace
 
-bool TrieFinalizer::tryMakeTrie(const std::string &trieEntries,
-    const std::vector<wordOff_t> &wordOffs, SimpleAllocator *alloc, FrozenTrie *result,
-    const FailFrame &ff) {
-  MappedFile<char> mf;
-  if (!mf.tryMap(trieEntries, false, ff.nest(HERE))) {
-    return false;
+bool TrieFinalizer::tryMakeTrie(const std::vector<std::vector<std::string>> &runsPerShard,
+    const std::vector<wordOff_t> &wordOffs, const std::string &postingsName,
+    BuildMemoryTracker *memory, SimpleAllocator *alloc, FrozenTrie *result, const FailFrame &ff) {
+  // Merge the runs of all the shards. Streams are numbered in (shard, run) order, which is also
+  // the order of their wordOffs, so for a given word we just concatenate the postings from each
+  // stream in stream order.
+  std::vector<TrieEntriesReader> readers;
+  std::vector<wordOff_t> streamBases;
+  for (size_t shard = 0; shard != runsPerShard.size(); ++shard) {
+    for (const auto &runName : runsPerShard[shard]) {
+      TrieEntriesReader reader;
+      if (!TrieEntriesReader::tryCreate(runName, &reader, ff.nest(HERE))) {
+        return false;
+      }
+      readers.push_back(std::move(reader));
+      streamBases.push_back(wordOffs[shard]);
+    }
   }
-  std::string_view entryText(mf.get(), mf.byteSize());
-  auto splitter = Splitter::ofRecords(entryText, defaultRecordSeparator);
+  Merger<TrieEntriesReader, TrieEntryLess> merger(std::move(readers));
 
   // The observation here is that if you populate a trie in lexicographic order, then every node
   // will always have at most one "active" child (children whose contents are changing), and
@@ -63,104 +80,105 @@ bool TrieFinalizer::tryMakeTrie(const std::string &trieEntries,
   // can be "frozen" / committed, because they will never change again. Put another way, a node
   // can be frozen when its parent is frozen or when its parent moves on to the next child.
   TrieBuilderNode root;
-  std::optional<std::string_view> prevKey;
-  std::vector<wordOff_t> prevWords;
+  PostingsWriter postings;
+  std::vector<wordOff_t> words;
   ReusableString32 rs32;
-  auto flushPrevState = [alloc, &root, &prevKey, &prevWords, &rs32](const FailFrame &ff) {
-    return rs32.tryReset(*prevKey, ff.nest(HERE)) &&
-        root.tryInsert(rs32.storage(), prevWords.data(), prevWords.size(), alloc,
-            ff.nest(HERE));
-  };
-  auto splittyStart = std::chrono::system_clock::now();
-  std::string_view record;
-  while (splitter.moveNext(&record)) {
-    auto recordSplitter = Splitter::of(record, defaultFieldSeparator);
-    std::string_view keyText;
-    uint32_t shard;
-    std::string_view wordOffsText;
-    if (!recordSplitter.tryMoveNext(&keyText, ff.nest(HERE)) ||
-        !tryReadUint32(&recordSplitter, &shard, ff.nest(HERE)) ||
-        !recordSplitter.tryMoveNext(&wordOffsText, ff.nest(HERE)) ||
-        !recordSplitter.tryConfirmEmpty(ff.nest(HERE))) {
-      return false;
-    }
-
-    if (wordOffsText.empty()) {
-      return ff.fail(HERE, "Words field was empty?!");
+  std::u32string folded;
+  foldedPairs_t foldedPairs;
+  std::vector<TrieEntry> group;
+  std::vector<size_t> whence;
+  std::vector<size_t> groupOrder;
+  // Nearly all of our heap is the postings of the current word and the folded pairs.
+  MemoryReservation reservation(memory);
+  size_t foldedPairsBytes = 0;
+  auto mergeStart = std::chrono::steady_clock::now();
+  if (!postings.tryOpen(postingsName, ff.nest(HERE))) {
+    return false;
+  }
+  while (merger.tryGetNext(&group, &whence)) {
+    groupOrder.resize(group.size());
+    for (size_t i = 0; i != group.size(); ++i) {
+      groupOrder[i] = i;
     }
-
-    if (prevKey.has_value() && keyText != *prevKey) {
-      if (!flushPrevState(ff.nest(HERE))) {
-        return false;
+    std::sort(groupOrder.begin(), groupOrder.end(), [&whence](size_t lhs, size_t rhs) {
+      return whence[lhs] < whence[rhs];
+    });
+
+    words.clear();
+    for (auto i : groupOrder) {
+      const auto &entry = group[i];
+      auto base = streamBases[whence[i]];
+      for (size_t j = 0; j != entry.numWordOffs_; ++j) {
+        auto wordOff = base.addRaw(entry.wordOffs_[j]);
+        if (!words.empty() && wordOff <= words.back()) {
+          return ff.failf(HERE, "Words out of order for %o: %o then %o", entry.key_, words.back(),
+              wordOff);
+        }
+        words.push_back(wordOff);
       }
-      prevWords.clear();
     }
-    prevKey = keyText;
-    if (!tryAppendWordOffs(wordOffs[shard], wordOffsText, &prevWords, ff.nest(HERE))) {
+
+    if (!rs32.tryReset(group.front().key_, ff.nest(HERE)) ||
+        !root.tryInsert(rs32.storage(), words.data(), words.size(), alloc, &postings,
+            ff.nest(HERE))) {
       return false;
     }
+    folded.clear();
+    FoldedVocabulary::fold(rs32.storage(), &folded);
+    if (folded != rs32.storage()) {
+      foldedPairs.emplace_back(folded, rs32.storage());
+      foldedPairsBytes += sizeof(foldedPairs_t::value_type) +
+          (folded.size() + rs32.storage().size()) * sizeof(char32_t);
+    }
+    reservation.forceResize(words.capacity() * sizeof(wordOff_t) + foldedPairsBytes);
   }
-  auto splittyStop = std::chrono::system_clock::now();
-  auto splittyDur = splittyStop - splittyStart;
-  std::cerr << "splitty duration is "
-      << std::chrono::duration_cast<std::chrono::seconds>(splittyDur).count()
-      << '\n';
-
-  // Flush the final entry if there is one.
-  if (prevKey.has_value() && !flushPrevState(ff.nest(HERE))) {
-    return false;
-  }
+  auto mergeDuration = std::chrono::steady_clock::now() - mergeStart;
+  streamf(std::cerr, "TrieFinalizer: merged %o runs in %o ms\n", streamBases.size(),
+      std::chrono::duration_cast<std::chrono::milliseconds>(mergeDuration).count());
 
   trie::FrozenNode *frozenRoot;
-  if (!root.tryFreeze(alloc, &frozenRoot, ff.nest(HERE))) {
+  FoldedVocabulary foldedVocabulary;
+  if (!root.tryFreeze(alloc, &postings, &frozenRoot, ff.nest(HERE)) ||
+      !postings.tryClose(ff.nest(HERE)) ||
+      !tryMakeFoldedVocabulary(&foldedPairs, alloc, &foldedVocabulary, ff.nest(HERE))) {
     return false;
   }
-  *result = FrozenTrie(frozenRoot);
+  *result = FrozenTrie(frozenRoot, std::move(foldedVocabulary));
   return true;
 }
 
 namespace {
-bool tryAppendWordOffs(wordOff_t wordOffBase, std::string_view src, std::vector<wordOff_t> *dest,
-    const FailFrame &ff) {
-  auto splitter = Splitter::of(src, wordOffSeparator);
-  uint32_t size;
-  if (!tryReadUint32(&splitter, &size, ff.nest(HERE))) {
-    return false;
-  }
-
-  for (size_t i = 0; i < size; ++i) {
-    uint32_t value;
-    if (!tryReadUint32(&splitter, &value, ff.nest(HERE))) {
-      return false;
-    }
-    auto newWordOff = wordOffBase.addRaw(value);
-    if (!dest->empty() && newWordOff <= dest->back()) {
-      return ff.failf(HERE, "Words out of order: %o then %o", dest->back(), newWordOff);
-    }
-    dest->emplace_back(newWordOff);
+bool tryMakeFoldedVocabulary(foldedPairs_t *pairs, SimpleAllocator *alloc,
+    FoldedVocabulary *result, const FailFrame &ff) {
+  std::sort(pairs->begin(), pairs->end());
+  size_t numChars = 0;
+  for (const auto &[key, word] : *pairs) {
+    numChars += key.size() + word.size();
   }
-  if (!splitter.empty()) {
-    return ff.failf(HERE, R"(Trailing matter "%o")", *splitter.text());
+  // Entries index 'text' with uint32_t.
+  if (numChars > std::numeric_limits<uint32_t>::max()) {
+    return ff.failf(HERE, "Folded vocabulary too large: %o chars", numChars);
   }
-  return true;
-}
-
-bool tryReadUint32(Splitter *splitter, uint32_t *dest, const FailFrame &ff) {
-  std::string_view text;
-  if (!splitter->tryMoveNext(&text, ff.nest(HERE))) {
+  char32_t *text;
+  FoldedVocabulary::Entry *entries;
+  if (!alloc->tryAllocate(numChars, &text, ff.nest(HERE)) ||
+      !alloc->tryAllocate(pairs->size(), &entries, ff.nest(HERE))) {
     return false;
   }
-
-  auto [endp, ec] = std::from_chars(text.begin(), text.end(), *dest);
-  // Probably don't need to check both conditions
-  if (endp == text.begin() || ec != std::errc()) {
-    return ff.failf(HERE, "Couldn't find an unsigned integer starting at %o", text);
-  }
-  if (endp != text.end()) {
-    return ff.failf(HERE, "Trailing matter in %o", text);
+  uint32_t offset = 0;
+  for (size_t i = 0; i != pairs->size(); ++i) {
+    const auto &[key, word] = (*pairs)[i];
+    std::copy(key.begin(), key.end(), text + offset);
+    std::copy(word.begin(), word.end(), text + offset + key.size());
+    entries[i] = FoldedVocabulary::Entry(offset, key.size(), offset + key.size(), word.size());
+    offset += key.size() + word.size();
   }
+  *result = FoldedVocabulary(FrozenVector<char32_t>(text, numChars),
+      FrozenVector<FoldedVocabulary::Entry>(entries, pairs->size()));
+  pairs->clear();
   return true;
 }
+
 }  // namespace
 }  // namespace z2kplus::backend::reverse_index::builder
 
@@ -14,8 +14,9 @@
 
 #include "z2kplus/backend/reverse_index/builder/zgram_digestor.h"
 
+#include <algorithm>
 #include <charconv>
-#include <thread>
+#include <chrono>
 
 #include "kosak/coding/coding.h"
 #include "kosak/coding/failures.h"
@@ -26,6 +27,8 @@
 #include "z2kplus/backend/files/keys.h"
 #include "z2kplus/backend/queryparsing/util.h"
 #include "z2kplus/backend/reverse_index/builder/schemas.h"
+#include "z2kplus/backend/reverse_index/builder/task_runner.h"
+#include "z2kplus/backend/reverse_index/builder/trie_entries.h"
 #include "z2kplus/backend/reverse_index/builder/tuple_iterators/iterator_base.h"
 #include "z2kplus/backend/reverse_index/builder/tuple_iterators/last_keeper.h"
 #include "z2kplus/backend/reverse_index/builder/tuple_iterators/row_iterator.h"
@@ -49,6 +52,7 @@ using kosak::coding::toString;
 using z2kplus::backend::files::LogLocation;
 using z2kplus::backend::files::PathMaster;
 using z2kplus::backend::queryparsing::WordSplitter;
+using z2kplus::backend::reverse_index::index::IndexSection;
 using z2kplus::backend::reverse_index::builder::tuple_iterators::makeLastKeeper;
 using z2kplus::backend::reverse_index::builder::tuple_iterators::RowIterator;
 using z2kplus::backend::reverse_index::builder::tuple_iterators::TupleIterator;
@@ -59,6 +63,7 @@ using z2kplus::backend::shared::ZgramId;
 using z2kplus::backend::util::frozen::FrozenVector;
 
 namespace filenames = z2kplus::backend::shared::magicConstants::filenames;
+namespace magicConstants = z2kplus::backend::shared::magicConstants;
 namespace schemas = z2kplus::backend::reverse_index::builder::schemas;
 namespace nsunix = kosak::coding::nsunix;
 
@@ -77,42 +82,38 @@ struct NameAndWriter {
   BufferedWriter writer_;
 };
 
-struct TrieEntriesWriter {
-  static constexpr const size_t flushThreshold = 16384;
+// What digesting a shard produces, whether by a DigesterTask or out of the digest cache.
+struct ShardOutputs {
+  static bool tryCreateFromCache(DigestCache::Entry entry, ShardOutputs *result,
+      const FailFrame &ff);
 
-  TrieEntriesWriter(uint32_t shard, NameAndWriter entries);
-  DISALLOW_COPY_AND_ASSIGN(TrieEntriesWriter);
-  DECLARE_MOVE_COPY_AND_ASSIGN(TrieEntriesWriter);
-  ~TrieEntriesWriter();
+  DigestCache::Entry toCacheEntry() const;
 
-  bool tryAdd(std::string_view key, wordOff_t wordOff, const FailFrame &ff);
-
-  bool tryClose(const FailFrame &ff);
-
-  bool tryFlush(const FailFrame &ff);
-
-  uint32_t shard_ = 0;
-  NameAndWriter entries_;
-  // Collected Word Offsets that haven't been written out yet.
-  std::map<std::string_view, std::vector<wordOff_t>> wordMap_;
-  // Total number of words in the wordMap_ (used to periodically flush).
+  std::string zgInfos_;
+  std::string wordInfos_;
+  std::string plusPlusEntries_;
+  std::string minusMinusEntries_;
+  std::string plusPlusKeys_;
+  std::vector<std::string> trieEntriesRuns_;
+  size_t numZgrams_ = 0;
   size_t numWords_ = 0;
 };
 
-class DigesterThread {
+class DigesterTask {
 public:
   static bool tryCreate(size_t shard, const PathMaster &pm, const LogSplitterResult &lsr,
-      std::shared_ptr<DigesterThread> *result, const FailFrame &ff);
+      size_t trieEntriesBudget, BuildMemoryTracker *memory, std::shared_ptr<DigesterTask> *result,
+      const FailFrame &ff);
 
-  DigesterThread(size_t shard, MappedFile<char> logged, MappedFile<char> unlogged,
+  DigesterTask(size_t shard, MappedFile<char> logged, MappedFile<char> unlogged,
       MappedFile<char> zgRevs, NameAndWriter zgInfos, NameAndWriter wordInfos,
       NameAndWriter plusPlusEntries, NameAndWriter minusMinusEntries,
       NameAndWriter plusPlusKeys, TrieEntriesWriter trieEntriesWriter);
-  ~DigesterThread();
-  bool tryFinish(const FailFrame &ff);
+  ~DigesterTask();
 
-  static void run(std::shared_ptr<DigesterThread> self);
-  bool tryRunHelper(const FailFrame &ff);
+  bool tryRun(const FailFrame &ff);
+
+  ShardOutputs outputs() const;
 
   static bool checkOrAdvance(const schemas::Zephyrgram &zgView,
       TupleIterator <schemas::ZgramRevisions::tuple_t> *iter,
@@ -142,98 +143,196 @@ public:
   wordOff_t wordOff_;
 
   PlusPlusScanner plusPlusScanner_;
-
-  std::optional<std::string> error_;
-  std::thread thread_;
 };
 
-void appendUint32(std::string *dest, uint32_t value);
+bool tryMakeShardKeys(const LogSplitterResult &lsr, std::vector<std::string> *result,
+    const FailFrame &ff);
 bool tryGatherZgramInfos(const std::vector<std::string> &zgInfoNames, SimpleAllocator *alloc,
     FrozenVector<ZgramInfo> *result, const FailFrame &ff);
 bool tryGatherWordInfos(const std::vector<std::string> &wordInfoNames,
-    const std::vector<size_t> &numZgramsPerShard, SimpleAllocator *alloc,
-    FrozenVector<WordInfo> *result, std::vector<size_t> *numWordsPerShard, const FailFrame &ff);
-bool tryGatherPlusPluses(const std::vector<std::string> &plusPlusEntriesNames,
-    const std::string &plusPlusEntriesSorted, const FailFrame &ff);
-bool tryGatherMinusMinuses(const std::vector<std::string> &plusPlusEntriesNames,
-    const std::string &plusPlusEntriesSorted, const FailFrame &ff);
-bool tryGatherPlusPlusKeys(const std::vector<std::string> &plusPlusKeysNames,
-    const std::string &plusPlusKeysSorted, const FailFrame &ff);
-bool tryGatherTrieEntries(const std::vector<std::string> &trieEntriesNames,
-    const std::string &trieEntriesSorted, const FailFrame &ff);
+    const std::vector<size_t> &numZgramsPerShard, const std::vector<size_t> &numWordsPerShard,
+    SimpleAllocator *alloc, FrozenVector<WordInfo> *result, const FailFrame &ff);
+bool tryStartGatherPlusPluses(const std::vector<std::string> &plusPlusEntriesNames,
+    const std::string &plusPlusEntriesSorted, size_t sortBufferSize, SortManager *sorter,
+    const FailFrame &ff);
+bool tryStartGatherMinusMinuses(const std::vector<std::string> &plusPlusEntriesNames,
+    const std::string &plusPlusEntriesSorted, size_t sortBufferSize, SortManager *sorter,
+    const FailFrame &ff);
+bool tryStartGatherPlusPlusKeys(const std::vector<std::string> &plusPlusKeysNames,
+    const std::string &plusPlusKeysSorted, size_t sortBufferSize, SortManager *sorter,
+    const FailFrame &ff);
 }  // namespace
 
-bool ZgramDigestor::tryDigest(const PathMaster &pm, const LogSplitterResult &lsr,
-    SimpleAllocator *alloc, ZgramDigestorResult *result, const FailFrame &ff) {
+bool ZgramDigestor::tryDigestShards(const PathMaster &pm, const LogSplitterResult &lsr,
+    size_t numThreads, size_t trieEntriesBudget, BuildMemoryTracker *memory, DigestCache *cache,
+    DigestedShards *result, const FailFrame &ff) {
   auto numShards = lsr.loggedZgrams_.size();
   passert(numShards == lsr.unloggedZgrams_.size());
+  passert(numShards == lsr.chunkInfos_.size());
 
   auto plusPlusEntriesName = pm.getScratchPathFor(filenames::plusPlusEntries);
   auto minusMinusEntriesName = pm.getScratchPathFor(filenames::minusMinusEntries);
   auto plusPlusKeysName = pm.getScratchPathFor(filenames::plusPlusKeys);
-  auto trieEntries = pm.getScratchPathFor(filenames::trieEntries);
 
-  std::vector<std::shared_ptr<DigesterThread>> digesters(numShards);
-  for (size_t i = 0; i != numShards; ++i) {
-    if (!DigesterThread::tryCreate(i, pm, lsr, &digesters[i], ff.nest(HERE))) {
+  // Each shard's outputs are numbered relative to the shard, and the gathering steps (here and in
+  // tryDigest) put the shards together in shard order. So it doesn't matter which thread digests which shard, or when.
+  // For the same reason, a shard's outputs can be cached and reused by a later build.
+  std::vector<ShardOutputs> outputs(numShards);
+  std::vector<std::string> keys(numShards);
+  if (cache != nullptr && !tryMakeShardKeys(lsr, &keys, ff.nest(HERE))) {
+    return false;
+  }
+  auto runShard = [&pm, &lsr, trieEntriesBudget, memory, cache, &outputs, &keys](size_t shard,
+      const FailFrame &ff2) {
+    const auto &key = keys[shard];
+    bool found = false;
+    DigestCache::Entry entry;
+    if (!key.empty() && !cache->tryLookup(key, &found, &entry, ff2.nest(HERE))) {
+      return false;
+    }
+    if (found) {
+      return ShardOutputs::tryCreateFromCache(std::move(entry), &outputs[shard], ff2.nest(HERE));
+    }
+    std::shared_ptr<DigesterTask> digester;
+    if (!DigesterTask::tryCreate(shard, pm, lsr, trieEntriesBudget, memory, &digester,
+            ff2.nest(HERE)) ||
+        !digester->tryRun(ff2.nest(HERE))) {
       return false;
     }
+    outputs[shard] = digester->outputs();
+    return key.empty() || cache->tryStore(key, outputs[shard].toCacheEntry(), ff2.nest(HERE));
+  };
+  numThreads = memory->threadsFor(numThreads, trieEntriesBudget);
+  auto start = std::chrono::steady_clock::now();
+  if (!TaskRunner::tryRun("ZgramDigestor", numShards, numThreads, &runShard, ff.nest(HERE))) {
+    return false;
   }
-
-  for (size_t i = 0; i != numShards; ++i) {
-    (void)digesters[i]->tryFinish(ff.nest(HERE));
+  auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+
+  auto numZgramsPerShard = makeReservedVector<size_t>(outputs.size());
+  auto numWordsPerShard = makeReservedVector<size_t>(outputs.size());
+  size_t totalZgrams = 0;
+  size_t totalWords = 0;
+  for (const auto &output : outputs) {
+    numZgramsPerShard.push_back(output.numZgrams_);
+    numWordsPerShard.push_back(output.numWords_);
+    totalZgrams += output.numZgrams_;
+    totalWords += output.numWords_;
   }
-  if (!ff.ok()) {
-    return false;
+  auto seconds = std::max(elapsed.count(), 1e-6);
+  streamf(std::cerr, "ZgramDigestor: digested %o zgrams (%o/s) and %o words (%o/s)\n",
+      totalZgrams, (size_t)(totalZgrams / seconds), totalWords, (size_t)(totalWords / seconds));
+
+  auto zgInfoNames = makeReservedVector<std::string>(outputs.size());
+  auto wordInfoNames = makeReservedVector<std::string>(outputs.size());
+  auto plusPlusEntriesNames = makeReservedVector<std::string>(outputs.size());
+  auto minusMinusEntriesNames = makeReservedVector<std::string>(outputs.size());
+  auto plusPlusKeysNames = makeReservedVector<std::string>(outputs.size());
+  auto trieEntriesRuns = makeReservedVector<std::vector<std::string>>(outputs.size());
+  for (auto &output : outputs) {
+    zgInfoNames.push_back(std::move(output.zgInfos_));
+    wordInfoNames.push_back(std::move(output.wordInfos_));
+    plusPlusEntriesNames.push_back(std::move(output.plusPlusEntries_));
+    minusMinusEntriesNames.push_back(std::move(output.minusMinusEntries_));
+    plusPlusKeysNames.push_back(std::move(output.plusPlusKeys_));
+    trieEntriesRuns.push_back(std::move(output.trieEntriesRuns_));
   }
 
-  auto numZgramsPerShard = makeReservedVector<size_t>(digesters.size());
-  for (const auto &digester : digesters) {
-    numZgramsPerShard.push_back(digester->zgramOff_.raw());
+  // The three sorts run in parallel with each other.
+  SortManager plusPlusSorter;
+  SortManager minusMinusSorter;
+  SortManager plusPlusKeysSorter;
+  constexpr size_t numSorts = 3;
+  auto sortBufferSize = memory->sortBufferSize(numSorts);
+  MemoryReservation sortMemory(memory);
+  sortMemory.forceResize(numSorts * sortBufferSize);
+  if (!tryStartGatherPlusPluses(plusPlusEntriesNames, plusPlusEntriesName, sortBufferSize,
+          &plusPlusSorter, ff.nest(HERE)) ||
+      !tryStartGatherMinusMinuses(minusMinusEntriesNames, minusMinusEntriesName, sortBufferSize,
+          &minusMinusSorter, ff.nest(HERE)) ||
+      !tryStartGatherPlusPlusKeys(plusPlusKeysNames, plusPlusKeysName, sortBufferSize,
+          &plusPlusKeysSorter, ff.nest(HERE)) ||
+      !plusPlusSorter.tryFinish(ff.nest(HERE)) ||
+      !minusMinusSorter.tryFinish(ff.nest(HERE)) ||
+      !plusPlusKeysSorter.tryFinish(ff.nest(HERE))) {
+    return false;
   }
 
-  auto zgInfoNames = makeReservedVector<std::string>(digesters.size());
-  auto wordInfoNames = makeReservedVector<std::string>(digesters.size());
-  auto plusPlusEntriesNames = makeReservedVector<std::string>(digesters.size());
-  auto minusMinusEntriesNames = makeReservedVector<std::string>(digesters.size());
-  auto plusPlusKeysNames = makeReservedVector<std::string>(digesters.size());
-  auto trieEntriesNames = makeReservedVector<std::string>(digesters.size());
-  for (const auto &digester : digesters) {
-    zgInfoNames.push_back(digester->zgInfos_.outputName_);
-    wordInfoNames.push_back(digester->wordInfos_.outputName_);
-    plusPlusEntriesNames.push_back(digester->plusPlusEntries_.outputName_);
-    minusMinusEntriesNames.push_back(digester->minusMinusEntries_.outputName_);
-    plusPlusKeysNames.push_back(digester->plusPlusKeys_.outputName_);
-    trieEntriesNames.push_back(digester->trieEntriesWriter_.entries_.outputName_);
-  }
+  result->zgramInfoNames_ = std::move(zgInfoNames);
+  result->wordInfoNames_ = std::move(wordInfoNames);
+  result->trieEntriesRuns_ = std::move(trieEntriesRuns);
+  result->numZgramsPerShard_ = std::move(numZgramsPerShard);
+  result->numWordsPerShard_ = std::move(numWordsPerShard);
+  result->plusPlusEntriesName_ = std::move(plusPlusEntriesName);
+  result->minusMinusEntriesName_ = std::move(minusMinusEntriesName);
+  result->plusPlusKeysName_ = std::move(plusPlusKeysName);
+  return true;
+}
 
+bool ZgramDigestor::tryDigest(DigestedShards shards, const std::string &postingsName,
+    BuildMemoryTracker *memory, SimpleAllocator *alloc, ZgramDigestorResult *result,
+    const FailFrame &ff) {
+  // The WordInfos and the trie's postings are cold (only the words that match a query are read),
+  // so they are not laid out here but later, by tryFinishWordInfos and tryFinishPostings, after the
+  // hot sections.
   FrozenVector<ZgramInfo> zgramInfos;
-  FrozenVector<WordInfo> wordInfos;
   FrozenTrie trie;
-  std::vector<size_t> numWordsPerShard;
-  if (!tryGatherZgramInfos(zgInfoNames, alloc, &zgramInfos, ff.nest(HERE)) ||
-      !tryGatherWordInfos(wordInfoNames, numZgramsPerShard, alloc, &wordInfos, &numWordsPerShard, ff.nest(HERE)) ||
-      !tryGatherPlusPluses(plusPlusEntriesNames, plusPlusEntriesName, ff.nest(HERE)) ||
-      !tryGatherMinusMinuses(minusMinusEntriesNames, minusMinusEntriesName, ff.nest(HERE)) ||
-      !tryGatherPlusPlusKeys(plusPlusKeysNames, plusPlusKeysName, ff.nest(HERE)) ||
-      !tryGatherTrieEntries(trieEntriesNames, trieEntries, ff.nest(HERE))) {
+  if (!alloc->tryBeginSection(IndexSection::zgramInfos, magicConstants::indexSectionAlignment,
+          ff.nest(HERE)) ||
+      !tryGatherZgramInfos(shards.zgramInfoNames_, alloc, &zgramInfos, ff.nest(HERE))) {
     return false;
   }
-  auto wordOffs = makeReservedVector<wordOff_t>(numShards);
+  auto wordOffs = makeReservedVector<wordOff_t>(shards.numWordsPerShard_.size());
   wordOff_t nextWordOff(0);
-  for (auto nw : numWordsPerShard) {
+  for (auto nw : shards.numWordsPerShard_) {
     wordOffs.push_back(nextWordOff);
     nextWordOff = nextWordOff.addRaw(nw);
   }
-  if (!TrieFinalizer::tryMakeTrie(trieEntries, wordOffs, alloc, &trie, ff.nest(HERE))) {
+  if (!alloc->tryBeginSection(IndexSection::trie, magicConstants::indexSectionAlignment,
+          ff.nest(HERE)) ||
+      !TrieFinalizer::tryMakeTrie(shards.trieEntriesRuns_, wordOffs, postingsName, memory, alloc,
+          &trie, ff.nest(HERE))) {
     return false;
   }
 
-  *result = ZgramDigestorResult(std::move(zgramInfos), std::move(wordInfos), std::move(trie),
-      std::move(plusPlusEntriesName), std::move(minusMinusEntriesName), std::move(plusPlusKeysName));
+  *result = ZgramDigestorResult(std::move(zgramInfos), FrozenVector<WordInfo>(), std::move(trie),
+      std::move(shards.plusPlusEntriesName_), std::move(shards.minusMinusEntriesName_),
+      std::move(shards.plusPlusKeysName_));
+  result->wordInfoNames_ = std::move(shards.wordInfoNames_);
+  result->numZgramsPerShard_ = std::move(shards.numZgramsPerShard_);
+  result->numWordsPerShard_ = std::move(shards.numWordsPerShard_);
+  result->postingsName_ = postingsName;
+  return true;
+}
+
+bool ZgramDigestor::tryFinishWordInfos(SimpleAllocator *alloc, ZgramDigestorResult *result,
+    const FailFrame &ff) {
+  return tryGatherWordInfos(result->wordInfoNames_,
+      result->numZgramsPerShard_, result->numWordsPerShard_, alloc, &result->wordInfos_,
+      ff.nest(HERE));
+}
+
+bool ZgramDigestor::tryFinishPostings(SimpleAllocator *alloc, ZgramDigestorResult *result,
+    const FailFrame &ff) {
+  MappedFile<wordOff_t> mf;
+  wordOff_t *postings;
+  if (!mf.tryMap(result->postingsName_, false, ff.nest(HERE))) {
+    return false;
+  }
+  auto numPostings = mf.byteSize() / sizeof(wordOff_t);
+  if (!alloc->tryAllocate(numPostings, &postings, ff.nest(HERE))) {
+    return false;
+  }
+  std::copy(mf.get(), mf.get() + numPostings, postings);
+  result->trie_.setPostings(postings);
   return true;
 }
 
+DigestedShards::DigestedShards() = default;
+DigestedShards::DigestedShards(DigestedShards &&) noexcept = default;
+DigestedShards &DigestedShards::operator=(DigestedShards &&) noexcept = default;
+DigestedShards::~DigestedShards() = default;
+
 ZgramDigestorResult::ZgramDigestorResult() = default;
 ZgramDigestorResult::ZgramDigestorResult(FrozenVector<ZgramInfo> zgramInfos,
     FrozenVector<WordInfo> wordInfos, FrozenTrie trie, std::string plusPlusEntriesName,
@@ -247,8 +346,39 @@ ZgramDigestorResult &ZgramDigestorResult::operator=(ZgramDigestorResult &&) noex
 ZgramDigestorResult::~ZgramDigestorResult() = default;
 
 namespace {
-bool DigesterThread::tryCreate(size_t shard, const PathMaster &pm,
-    const LogSplitterResult &lsr, std::shared_ptr<DigesterThread> *result, const FailFrame &ff) {
+bool ShardOutputs::tryCreateFromCache(DigestCache::Entry entry, ShardOutputs *result,
+    const FailFrame &ff) {
+  // The five outputs, then the trie runs; the zgram and word counts.
+  constexpr size_t numFixedFiles = 5;
+  if (entry.files_.size() < numFixedFiles || entry.values_.size() != 2) {
+    return ff.failf(HERE, "Malformed cache entry: %o files and %o values", entry.files_.size(),
+        entry.values_.size());
+  }
+  auto &files = entry.files_;
+  result->zgInfos_ = std::move(files[0]);
+  result->wordInfos_ = std::move(files[1]);
+  result->plusPlusEntries_ = std::move(files[2]);
+  result->minusMinusEntries_ = std::move(files[3]);
+  result->plusPlusKeys_ = std::move(files[4]);
+  result->trieEntriesRuns_.assign(std::make_move_iterator(files.begin() + numFixedFiles),
+      std::make_move_iterator(files.end()));
+  result->numZgrams_ = entry.values_[0];
+  result->numWords_ = entry.values_[1];
+  return true;
+}
+
+DigestCache::Entry ShardOutputs::toCacheEntry() const {
+  DigestCache::Entry result;
+  result.files_ = {zgInfos_, wordInfos_, plusPlusEntries_, minusMinusEntries_, plusPlusKeys_};
+  result.files_.insert(result.files_.end(), trieEntriesRuns_.begin(), trieEntriesRuns_.end());
+  result.values_ = {numZgrams_, numWords_};
+  return result;
+}
+
+bool DigesterTask::tryCreate(size_t shard, const PathMaster &pm,
+    const LogSplitterResult &lsr, size_t trieEntriesBudget, BuildMemoryTracker *memory,
+    std::shared_ptr<DigesterTask> *result,
+    const FailFrame &ff) {
   // The logged zgrams for this shard
   MappedFile<char> logged;
   // The unlogged zgrams for this shard
@@ -280,26 +410,24 @@ bool DigesterThread::tryCreate(size_t shard, const PathMaster &pm,
   NameAndWriter plusPlusEntries;
   NameAndWriter minusMinusEntries;
   NameAndWriter plusPlusKeys;
-  NameAndWriter trieEntries;
   if (!tryMakeNameAndWriter(filenames::zgramInfos, &zgInfos, ff.nest(HERE)) ||
       !tryMakeNameAndWriter(filenames::wordInfos, &wordInfos, ff.nest(HERE)) ||
       !tryMakeNameAndWriter(filenames::plusPlusEntries, &plusPlusEntries, ff.nest(HERE)) ||
       !tryMakeNameAndWriter(filenames::minusMinusEntries, &minusMinusEntries, ff.nest(HERE)) ||
-      !tryMakeNameAndWriter(filenames::plusPlusKeys, &plusPlusKeys, ff.nest(HERE)) ||
-      !tryMakeNameAndWriter(filenames::trieEntries, &trieEntries, ff.nest(HERE))) {
+      !tryMakeNameAndWriter(filenames::plusPlusKeys, &plusPlusKeys, ff.nest(HERE))) {
     return false;
   }
-  TrieEntriesWriter trieEntriesWriter(shard, std::move(trieEntries));
+  auto runPrefix = stringf("%o.%o", pm.getScratchPathFor(filenames::trieEntries), shard);
+  TrieEntriesWriter trieEntriesWriter(std::move(runPrefix), trieEntriesBudget, memory);
 
-  auto res = std::make_shared<DigesterThread>(shard, std::move(logged), std::move(unlogged),
+  auto res = std::make_shared<DigesterTask>(shard, std::move(logged), std::move(unlogged),
       std::move(zgRevs), std::move(zgInfos), std::move(wordInfos), std::move(plusPlusEntries),
       std::move(minusMinusEntries), std::move(plusPlusKeys), std::move(trieEntriesWriter));
-  res->thread_ = std::thread(&run, res);
   *result = std::move(res);
   return true;
 }
 
-DigesterThread::DigesterThread(size_t shard, MappedFile<char> logged, MappedFile<char> unlogged,
+DigesterTask::DigesterTask(size_t shard, MappedFile<char> logged, MappedFile<char> unlogged,
     MappedFile<char> zgRevs, NameAndWriter zgInfos, NameAndWriter wordInfos,
     NameAndWriter plusPlusEntries, NameAndWriter minusMinusEntries, NameAndWriter plusPlusKeys,
     TrieEntriesWriter trieEntriesWriter) : shard_(shard),
@@ -307,29 +435,9 @@ DigesterThread::DigesterThread(size_t shard, MappedFile<char> logged, MappedFile
     zgRevs_(std::move(zgRevs)), zgInfos_(std::move(zgInfos)), wordInfos_(std::move(wordInfos)),
     plusPlusEntries_(std::move(plusPlusEntries)), minusMinusEntries_(std::move(minusMinusEntries)),
     plusPlusKeys_(std::move(plusPlusKeys)), trieEntriesWriter_(std::move(trieEntriesWriter)) {}
-DigesterThread::~DigesterThread() = default;
-
-bool DigesterThread::tryFinish(const FailFrame &ff) {
-  thread_.join();
-  if (error_.has_value()) {
-    return ff.failf(HERE, "%o", *error_);
-  }
-  return true;
-}
-
-void DigesterThread::run(std::shared_ptr<DigesterThread> self) {
-  auto id = stringf("Digester-%o", self->shard_);
-  streamf(std::cerr, "%o: waking up\n", id);
-
-  FailRoot fr;
-  if (!self->tryRunHelper(fr.nest(HERE))) {
-    self->error_ = toString(fr);
-    streamf(std::cerr, "%o: got an error: %o", id, *self->error_);
-  }
-  streamf(std::cerr, "%o: shutting down\n", id);
-}
+DigesterTask::~DigesterTask() = default;
 
-bool DigesterThread::tryRunHelper(const FailFrame &ff) {
+bool DigesterTask::tryRun(const FailFrame &ff) {
   RowIterator<schemas::Zephyrgram::tuple_t> loggedIter(std::move(logged_));
   RowIterator<schemas::Zephyrgram::tuple_t> unloggedIter(std::move(unlogged_));
   RowIterator<schemas::ZgramRevisions::tuple_t> zgAllRevsIter(std::move(zgRevs_));
@@ -385,7 +493,20 @@ bool DigesterThread::tryRunHelper(const FailFrame &ff) {
       trieEntriesWriter_.tryClose(ff.nest(HERE));
 }
 
-bool DigesterThread::checkOrAdvance(const schemas::Zephyrgram &zgView,
+ShardOutputs DigesterTask::outputs() const {
+  ShardOutputs result;
+  result.zgInfos_ = zgInfos_.outputName_;
+  result.wordInfos_ = wordInfos_.outputName_;
+  result.plusPlusEntries_ = plusPlusEntries_.outputName_;
+  result.minusMinusEntries_ = minusMinusEntries_.outputName_;
+  result.plusPlusKeys_ = plusPlusKeys_.outputName_;
+  result.trieEntriesRuns_ = trieEntriesWriter_.runNames();
+  result.numZgrams_ = zgramOff_.raw();
+  result.numWords_ = wordOff_.raw();
+  return result;
+}
+
+bool DigesterTask::checkOrAdvance(const schemas::Zephyrgram &zgView,
     TupleIterator <schemas::ZgramRevisions::tuple_t> *iter,
     std::optional<schemas::ZgramRevisions::tuple_t> *item,
     std::string_view *instance, std::string_view *body, const FailFrame &ff) {
@@ -412,7 +533,7 @@ bool DigesterThread::checkOrAdvance(const schemas::Zephyrgram &zgView,
   }
 }
 
-bool DigesterThread::addZgramRow(const schemas::Zephyrgram &zgv, std::string_view instanceToUse,
+bool DigesterTask::addZgramRow(const schemas::Zephyrgram &zgv, std::string_view instanceToUse,
     std::string_view bodyToUse, const FailFrame &ff) {
   static std::array<FieldTag, 4> fieldTags = {
       FieldTag::sender, FieldTag::signature, FieldTag::instance, FieldTag::body
@@ -449,7 +570,7 @@ bool DigesterThread::addZgramRow(const schemas::Zephyrgram &zgv, std::string_vie
         return false;
       }
       wordInfos.emplace_back(wordInfo);
-      if (!trieEntriesWriter_.tryAdd(token, wordOff_, ff.nest(HERE))) {
+      if (!trieEntriesWriter_.tryAdd(token, wordOff_.raw(), ff.nest(HERE))) {
         return false;
       }
       ++wordOff_;
@@ -469,7 +590,7 @@ bool DigesterThread::addZgramRow(const schemas::Zephyrgram &zgv, std::string_vie
       zgInfos_.writer_.tryWritePOD(&zgInfo, 1, ff.nest(HERE));
 }
 
-bool DigesterThread::addPlusPlusesAndMinusMinuses(ZgramId zgramId, std::string_view bodyToUse,
+bool DigesterTask::addPlusPlusesAndMinusMinuses(ZgramId zgramId, std::string_view bodyToUse,
     const FailFrame &ff) {
   PlusPlusScanner::ppDeltas_t netPlusPlusCounts;
   plusPlusScanner_.scan(bodyToUse, 1, &netPlusPlusCounts);
@@ -522,44 +643,6 @@ bool DigesterThread::addPlusPlusesAndMinusMinuses(ZgramId zgramId, std::string_v
   return true;
 }
 
-TrieEntriesWriter::TrieEntriesWriter(uint32_t shard, NameAndWriter entries) :
-    shard_(shard), entries_(std::move(entries)) {}
-TrieEntriesWriter::TrieEntriesWriter(TrieEntriesWriter &&) noexcept = default;
-// TrieEntriesWriter &TrieEntriesWriter::operator=(TrieEntriesWriter &&) noexcept = default;
-TrieEntriesWriter::~TrieEntriesWriter() = default;
-
-bool TrieEntriesWriter::tryAdd(std::string_view key, wordOff_t wordOff, const FailFrame &ff) {
-  wordMap_[key].push_back(wordOff);
-  ++numWords_;
-  return numWords_ < flushThreshold ||
-      tryFlush(ff.nest(HERE));
-}
-
-bool TrieEntriesWriter::tryClose(const FailFrame &ff) {
-  return tryFlush(ff.nest(HERE)) &&
-      entries_.writer_.tryClose(ff.nest(HERE));
-}
-
-bool TrieEntriesWriter::tryFlush(const FailFrame &ff) {
-  std::string buffer;
-  for (const auto &[key, wordOffs] : wordMap_) {
-    // key fieldseparator shard fieldseparator wordoffs.size (';' wordoff)...
-    buffer.append(key);
-    buffer.push_back(defaultFieldSeparator);
-    appendUint32(&buffer, shard_);
-    buffer.push_back(defaultFieldSeparator);
-    appendUint32(&buffer, wordOffs.size());
-    for (auto wordOff : wordOffs) {
-      buffer.push_back(wordOffSeparator);
-      appendUint32(&buffer, wordOff.raw());
-    }
-    buffer.push_back(defaultRecordSeparator);
-  }
-  wordMap_.clear();
-  numWords_ = 0;
-  return entries_.writer_.tryWriteBytes(buffer.data(), buffer.size(), ff.nest(HERE));
-}
-
 NameAndWriter::NameAndWriter() = default;
 NameAndWriter::NameAndWriter(std::string outputName, BufferedWriter writer) :
   outputName_(std::move(outputName)), writer_(std::move(writer)) {}
@@ -567,11 +650,74 @@ NameAndWriter::NameAndWriter(NameAndWriter &&) noexcept = default;
 NameAndWriter &NameAndWriter::operator=(NameAndWriter &&) noexcept = default;
 NameAndWriter::~NameAndWriter() = default;
 
-void appendUint32(std::string *dest, uint32_t value) {
-  // 16 is more than enough for uint32_t which needs at most 10.
-  std::array<char, 16> buffer;
-  auto [endp, ec] = std::to_chars(buffer.begin(), buffer.end(), value);
-  dest->append(buffer.begin(), endp);
+// A shard's digest depends on its chunk and on the revisions to the chunk's zgrams, which may have
+// been logged in any later chunk. The revisions are sorted by zgramId, so one pass over them,
+// sweeping along the shards in order of their first zgramId, finds every shard's revisions. Shards
+// that aren't cached get an empty key.
+bool tryMakeShardKeys(const LogSplitterResult &lsr, std::vector<std::string> *result,
+    const FailFrame &ff) {
+  auto numShards = lsr.chunkInfos_.size();
+  std::vector<DigestKey> keys(numShards);
+  std::vector<size_t> byFirstZgramId;
+  for (size_t shard = 0; shard != numShards; ++shard) {
+    const auto &info = lsr.chunkInfos_[shard];
+    auto &key = keys[shard];
+    key.add(std::string_view("digest"));
+    key.add(magicConstants::digestCacheVersion);
+    key.add(info.cacheKey_);
+    if (!info.cacheKey_.empty() && info.firstZgramId_.has_value()) {
+      byFirstZgramId.push_back(shard);
+    }
+  }
+  std::sort(byFirstZgramId.begin(), byFirstZgramId.end(),
+      [&lsr](size_t lhs, size_t rhs) {
+        return *lsr.chunkInfos_[lhs].firstZgramId_ < *lsr.chunkInfos_[rhs].firstZgramId_;
+      });
+
+  if (!byFirstZgramId.empty()) {
+    MappedFile<char> zgRevs;
+    if (!zgRevs.tryMap(lsr.zgramRevisions_, false, ff.nest(HERE))) {
+      return false;
+    }
+    RowIterator<schemas::ZgramRevisions::tuple_t> iter(std::move(zgRevs));
+    std::optional<schemas::ZgramRevisions::tuple_t> item;
+    // The shards whose [firstZgramId, lastZgramId] contains the current zgramId. Usually just one.
+    std::vector<size_t> active;
+    auto next = byFirstZgramId.begin();
+    while (true) {
+      if (!iter.tryGetNext(&item, ff.nest(HERE))) {
+        return false;
+      }
+      if (!item.has_value()) {
+        break;
+      }
+      const auto &[zgramId, instance, body, renderStyle] = *item;
+      for (; next != byFirstZgramId.end() && *lsr.chunkInfos_[*next].firstZgramId_ <= zgramId;
+          ++next) {
+        active.push_back(*next);
+      }
+      auto finished = [&lsr, &zgramId](size_t shard) {
+        return *lsr.chunkInfos_[shard].lastZgramId_ < zgramId;
+      };
+      active.erase(std::remove_if(active.begin(), active.end(), finished), active.end());
+      if (active.empty() && next == byFirstZgramId.end()) {
+        break;
+      }
+      for (auto shard : active) {
+        auto &key = keys[shard];
+        key.add(zgramId.raw());
+        key.add(instance);
+        key.add(body);
+        key.add(renderStyle);
+      }
+    }
+  }
+
+  result->clear();
+  for (size_t shard = 0; shard != numShards; ++shard) {
+    result->push_back(lsr.chunkInfos_[shard].cacheKey_.empty() ? "" : keys[shard].toString());
+  }
+  return true;
 }
 
 /**
@@ -628,9 +774,8 @@ bool tryGatherZgramInfos(const std::vector<std::string> &zgInfoNames, SimpleAllo
 }
 
 bool tryGatherWordInfos(const std::vector<std::string> &wordInfoNames,
-    const std::vector<size_t> &numZgramsPerShard, SimpleAllocator *alloc,
-    FrozenVector<WordInfo> *result, std::vector<size_t> *numWordsPerShard,
-    const FailFrame &ff) {
+    const std::vector<size_t> &numZgramsPerShard, const std::vector<size_t> &numWordsPerShard,
+    SimpleAllocator *alloc, FrozenVector<WordInfo> *result, const FailFrame &ff) {
   auto numShards = wordInfoNames.size();
   std::vector<MappedFile<WordInfo>> mfs(numShards);
   std::vector<size_t> numElements(numShards);
@@ -641,6 +786,10 @@ bool tryGatherWordInfos(const std::vector<std::string> &wordInfoNames,
       return false;
     }
     auto thisNumElements = mf.byteSize() / sizeof(WordInfo);
+    if (thisNumElements != numWordsPerShard[shard]) {
+      return ff.failf(HERE, "Shard %o: expected %o WordInfos, found %o", shard,
+          numWordsPerShard[shard], thisNumElements);
+    }
     numElements[shard] = thisNumElements;
     totalNumElements += thisNumElements;
   }
@@ -667,37 +816,34 @@ bool tryGatherWordInfos(const std::vector<std::string> &wordInfoNames,
     zgramOffset = zgramOffset.addRaw(numZgramsPerShard[shard]);
   }
   *result = FrozenVector<WordInfo>(start, totalNumElements);
-  *numWordsPerShard = std::move(numElements);
   return true;
 }
 
-bool tryGatherPlusPluses(const std::vector<std::string> &plusPlusEntriesNames,
-    const std::string &plusPlusEntriesSorted, const FailFrame &ff) {
+bool tryStartGatherPlusPluses(const std::vector<std::string> &plusPlusEntriesNames,
+    const std::string &plusPlusEntriesSorted, size_t sortBufferSize, SortManager *sorter,
+    const FailFrame &ff) {
   SortOptions sortOptions(false, false, defaultFieldSeparator, true);
+  sortOptions.bufferSize_ = sortBufferSize;
   std::vector<KeyOptions> keyOptions{{1, false}, {2, true}};
-  return SortManager::trySort(sortOptions, keyOptions, plusPlusEntriesNames, plusPlusEntriesSorted,
-      ff.nest(HERE));
+  return SortManager::tryCreate(sortOptions, keyOptions, plusPlusEntriesNames,
+      plusPlusEntriesSorted, sorter, ff.nest(HERE));
 }
 
-bool tryGatherMinusMinuses(const std::vector<std::string> &plusPlusEntriesNames,
-    const std::string &plusPlusEntriesSorted, const FailFrame &ff) {
-  return tryGatherPlusPluses(plusPlusEntriesNames, plusPlusEntriesSorted, ff.nest(HERE));
+bool tryStartGatherMinusMinuses(const std::vector<std::string> &plusPlusEntriesNames,
+    const std::string &plusPlusEntriesSorted, size_t sortBufferSize, SortManager *sorter,
+    const FailFrame &ff) {
+  return tryStartGatherPlusPluses(plusPlusEntriesNames, plusPlusEntriesSorted, sortBufferSize,
+      sorter, ff.nest(HERE));
 }
 
-bool tryGatherPlusPlusKeys(const std::vector<std::string> &plusPlusKeysNames,
-    const std::string &plusPlusKeysSorted, const FailFrame &ff) {
+bool tryStartGatherPlusPlusKeys(const std::vector<std::string> &plusPlusKeysNames,
+    const std::string &plusPlusKeysSorted, size_t sortBufferSize, SortManager *sorter,
+    const FailFrame &ff) {
   SortOptions sortOptions(false, false, defaultFieldSeparator, true);
+  sortOptions.bufferSize_ = sortBufferSize;
   std::vector<KeyOptions> keyOptions{{1, true}, {2, false}};
-  return SortManager::trySort(sortOptions, keyOptions, plusPlusKeysNames, plusPlusKeysSorted,
-      ff.nest(HERE));
-}
-
-bool tryGatherTrieEntries(const std::vector<std::string> &trieEntriesNames,
-    const std::string &trieEntriesSorted, const FailFrame &ff) {
-  SortOptions sortOptions(true, false, defaultFieldSeparator, true);
-  std::vector<KeyOptions> keyOptions{{1, false}, {2, true}};
-  return SortManager::trySort(sortOptions, keyOptions, trieEntriesNames, trieEntriesSorted,
-      ff.nest(HERE));
+  return SortManager::tryCreate(sortOptions, keyOptions, plusPlusKeysNames, plusPlusKeysSorted,
+      sorter, ff.nest(HERE));
 }
 }  // namespace
 }  // namespace z2kplus::backend::reverse_index::builder
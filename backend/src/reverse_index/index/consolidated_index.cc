@@ -15,13 +15,16 @@
 #include "z2kplus/backend/reverse_index/index/consolidated_index.h"
 
 #include <algorithm>
+#include <atomic>
 #include <string_view>
+#include <tuple>
 #include <fcntl.h>
 #include "kosak/coding/containers/slice.h"
 #include "kosak/coding/map_utils.h"
 #include "kosak/coding/memory/maybe_inlined_buffer.h"
 #include "z2kplus/backend/factories/log_parser.h"
 #include "z2kplus/backend/reverse_index/builder/log_analyzer.h"
+#include "z2kplus/backend/reverse_index/index/index_layout.h"
 #include "z2kplus/backend/shared/logging_policy.h"
 #include "z2kplus/backend/shared/util.h"
 #include "z2kplus/backend/util/frozen/frozen_string_pool.h"
@@ -30,9 +33,12 @@
 namespace z2kplus::backend::reverse_index::index {
 
 using kosak::coding::FailFrame;
+using kosak::coding::FailRoot;
 using kosak::coding::containers::asSlice;
+using kosak::coding::containers::Slice;
 using kosak::coding::makeReservedVector;
 using kosak::coding::maputils::tryFind;
+using kosak::coding::memory::MappedFile;
 using kosak::coding::memory::MaybeInlinedBuffer;
 using kosak::coding::nsunix::FileCloser;
 using kosak::coding::streamf;
@@ -48,6 +54,8 @@ using z2kplus::backend::util::frozen::FrozenStringPool;
 using z2kplus::backend::util::frozen::frozenStringRef_t;
 using z2kplus::backend::reverse_index::builder::LogAnalyzer;
 using z2kplus::backend::reverse_index::index::FrozenIndex;
+using z2kplus::backend::reverse_index::index::IndexLayout;
+using z2kplus::backend::reverse_index::index::SectionResidency;
 using z2kplus::backend::reverse_index::metadata::DynamicMetadata;
 using z2kplus::backend::reverse_index::metadata::FrozenMetadata;
 using z2kplus::backend::shared::getZgramId;
@@ -72,6 +80,9 @@ namespace userMetadata = z2kplus::backend::shared::userMetadata;
 namespace zgMetadata = z2kplus::backend::shared::zgMetadata;
 
 namespace {
+// Source of ConsolidatedIndex::generation_.
+std::atomic<uint64_t> nextGeneration = 0;
+
 template<FileKeyKind Kind>
 bool tryAppendAndFlushHelper(std::string_view buffer, internal::DynamicFileState<Kind> *state,
     const FailFrame &ff);
@@ -107,6 +118,26 @@ bool tryCalcStart(const FilePosition<Kind> &frozenRangeEnd,
   *result = proposedStart;
   return true;
 }
+
+// Right after a (re)index, most of the new file is not in memory yet. Log how much of each section
+// is, then ask the kernel to bring in the hot sections and to stop reading ahead in the ones that
+// are only probed.
+void adviseFrozenIndex(const MappedFile<FrozenIndex> &frozenIndex) {
+  const auto *base = reinterpret_cast<const char*>(frozenIndex.get());
+  const auto &sections = frozenIndex.get()->sections();
+  FailRoot fr(true);
+  std::vector<SectionResidency> residency;
+  if (!sections.tryValidate(frozenIndex.byteSize(), fr.nest(HERE)) ||
+      !IndexLayout::tryMeasureResidency(base, sections, &residency, fr.nest(HERE))) {
+    warn("Not applying index access policies: %o", fr);
+    return;
+  }
+  warn("Frozen index: resident pages before advice: %o", residency);
+  IndexLayout::Options options;
+  options.hugePages_ = magicConstants::indexUseHugePages;
+  options.lockHotSet_ = magicConstants::indexLockHotSet;
+  IndexLayout::advise(base, sections, options);
+}
 }  // namespace
 
 bool ConsolidatedIndex::tryCreate(std::shared_ptr<PathMaster> pm,
@@ -116,6 +147,7 @@ bool ConsolidatedIndex::tryCreate(std::shared_ptr<PathMaster> pm,
   if (!frozenIndex.tryMap(pm->getIndexPath(), false, ff.nest(HERE))) {
     return false;
   }
+  adviseFrozenIndex(frozenIndex);
   // Populate the dynamic index with all files newer than those in the frozen index.
   LogAnalyzer analyzer;
 
@@ -179,9 +211,15 @@ ConsolidatedIndex::ConsolidatedIndex(std::shared_ptr<PathMaster> pm,
     internal::DynamicFileState<FileKeyKind::Logged> loggedState,
     internal::DynamicFileState<FileKeyKind::Unlogged> unloggedState) :
     pm_(std::move(pm)),
+    generation_(++nextGeneration),
     frozenIndex_(std::move(frozenIndex)),
+    dynamicIndex_(&frozenIndex_.get()->stringPool()),
+    plusPlusKeys_(PlusPlusKeyDictionary::createFromFrozen(frozenIndex_.get()->metadata(),
+        &frozenIndex_.get()->stringPool())),
+    plusPlusCounter_(PlusPlusCounter::createFromFrozen(frozenIndex_.get()->metadata(),
+        plusPlusKeys_)),
     loggedState_(std::move(loggedState)), unloggedState_(std::move(unloggedState)),
-    zgramCache_(magicConstants::zgramCacheSize) {
+    zgramCache_(magicConstants::zgramCacheSize, magicConstants::prefetchCacheSize) {
 }
 
 ConsolidatedIndex::ConsolidatedIndex(ConsolidatedIndex &&other) noexcept = default;
@@ -190,10 +228,38 @@ ConsolidatedIndex &ConsolidatedIndex::operator=(ConsolidatedIndex &&other) noexc
 
 ConsolidatedIndex::~ConsolidatedIndex() = default;
 
-void ConsolidatedIndex::findMatching(const FiniteAutomaton &dfa,
-    const kosak::coding::Delegate<void, const wordOff_t *, const wordOff_t *> &callback) const {
-  frozenIndex_.get()->trie().findMatching(dfa, callback);
-  dynamicIndex_.trie().findMatching(dfa, callback);
+bool ConsolidatedIndex::tryFindMatching(const FiniteAutomaton &dfa,
+    const Delegate<bool> &outOfBudget, TrieWalkPosition *position,
+    const Delegate<void, const wordOff_t *, const wordOff_t *> &callback) const {
+  if (!position->inDynamic_) {
+    if (!frozenIndex_.get()->trie().tryFindMatching(dfa, outOfBudget, &position->path_, callback)) {
+      return false;
+    }
+    position->inDynamic_ = true;
+  }
+  return dynamicIndex_.trie().tryFindMatching(dfa, outOfBudget, &position->path_, callback);
+}
+
+bool ConsolidatedIndex::tryCountMatching(const FiniteAutomaton &dfa, size_t maxNodes,
+    size_t *result) const {
+  size_t count = 0;
+  auto cb = [&count](const wordOff_t *begin, const wordOff_t *end) {
+    count += end - begin;
+  };
+  auto nodesLeft = maxNodes;
+  auto outOfNodes = [&nodesLeft]() {
+    if (nodesLeft == 0) {
+      return true;
+    }
+    --nodesLeft;
+    return false;
+  };
+  TrieWalkPosition position;
+  if (!tryFindMatching(dfa, &outOfNodes, &position, &cb)) {
+    return false;
+  }
+  *result = count;
+  return true;
 }
 
 class PlusPlusManager {
@@ -216,12 +282,13 @@ public:
 
   bool tryFinish(const FailFrame &ff);
 
-  DynamicIndex::ppDeltaMap_t &deltaMap() { return deltaMap_; }
+  std::map<ZgramId, PlusPlusScanner::ppDeltas_t> &deltaMap() { return deltaMap_; }
 
 private:
   ConsolidatedIndex *ci_ = nullptr;
   PlusPlusScanner plusPlusScanner_;
-  DynamicIndex::ppDeltaMap_t deltaMap_;
+  // Still keyed by string. ConsolidatedIndex::updatePlusPlusCounts interns them.
+  std::map<ZgramId, PlusPlusScanner::ppDeltas_t> deltaMap_;
   std::vector<std::pair<ZgramId, LogLocation>> locators_;
   bool finished_ = false;
 };
@@ -236,8 +303,7 @@ bool ConsolidatedIndex::tryAddZgrams(std::chrono::system_clock::time_point now,
     return false;
   }
 
-  dynamicIndex_.batchUpdatePlusPlusCounts(ppm.deltaMap());
-  *deltaMap = std::move(ppm.deltaMap());
+  updatePlusPlusCounts(ppm.deltaMap(), deltaMap);
   return true;
 }
 
@@ -250,8 +316,7 @@ bool ConsolidatedIndex::tryAddMetadata(std::vector<MetadataRecord> &&records, pp
     return false;
   }
 
-  dynamicIndex_.batchUpdatePlusPlusCounts(ppm.deltaMap());
-  *deltaMap = std::move(ppm.deltaMap());
+  updatePlusPlusCounts(ppm.deltaMap(), deltaMap);
   return true;
 }
 
@@ -264,10 +329,25 @@ bool ConsolidatedIndex::tryAddForBootstrap(const std::vector<logRecordAndLocatio
     return false;
   }
 
-  dynamicIndex_.batchUpdatePlusPlusCounts(ppm.deltaMap());
+  ppDeltaMap_t deltaMap;
+  updatePlusPlusCounts(ppm.deltaMap(), &deltaMap);
   return true;
 }
 
+void ConsolidatedIndex::updatePlusPlusCounts(
+    const std::map<ZgramId, PlusPlusScanner::ppDeltas_t> &scanned, ppDeltaMap_t *deltaMap) {
+  deltaMap->clear();
+  for (const auto &[zgramId, inner] : scanned) {
+    auto &ids = (*deltaMap)[zgramId];
+    for (const auto &[key, count] : inner) {
+      auto keyId = plusPlusKeys_.intern(key);
+      ids[keyId] += count;
+      plusPlusCounter_.add(keyId, zgramId, count);
+    }
+  }
+  dynamicIndex_.batchUpdatePlusPlusCounts(*deltaMap);
+}
+
 bool
 ConsolidatedIndex::tryAddZgramsHelper(std::chrono::system_clock::time_point now, const Profile &profile,
     std::vector<ZgramCore> &&zgcs, std::vector<Zephyrgram> *zgrams, const FailFrame &ff) {
@@ -589,205 +669,285 @@ ZgramId ConsolidatedIndex::zgramEnd() const {
 }
 
 void ConsolidatedIndex::getMetadataFor(ZgramId zgramId, std::vector<MetadataRecord> *result) const {
-  std::vector<zgMetadata::Reaction> reactions;
-  std::vector<zgMetadata::ZgramRevision> zgRevisions;
-  std::vector<zgMetadata::ZgramRefersTo> zgRefersTo;
-  getReactionsFor(zgramId, &reactions);
-  getZgramRevsFor(zgramId, &zgRevisions);
-  getRefersToFor(zgramId, &zgRefersTo);
-  for (auto &rx : reactions) {
-    result->emplace_back(std::move(rx));
+  MetadataBatch batch;
+  resolveMetadata(&zgramId, 1, &batch);
+  batch.appendMetadataRecords(0, result);
+}
+
+void ConsolidatedIndex::getReactionsFor(ZgramId zgramId, std::vector<zgMetadata::Reaction> *result) const {
+  MetadataBatch batch;
+  resolveMetadata(&zgramId, 1, &batch);
+  for (const auto &rx : batch.reactions(0)) {
+    result->emplace_back(zgramId, std::string(rx.reaction_), std::string(rx.creator_), true);
   }
-  for (auto &rev : zgRevisions) {
-    result->emplace_back(std::move(rev));
+}
+
+void ConsolidatedIndex::getZgramRevsFor(ZgramId zgramId, std::vector<zgMetadata::ZgramRevision> *result) const {
+  MetadataBatch batch;
+  resolveMetadata(&zgramId, 1, &batch);
+  for (const auto &rev : batch.revisions(0)) {
+    ZgramCore zgc(std::string(rev.instance_), std::string(rev.body_), rev.renderStyle_);
+    result->emplace_back(zgramId, std::move(zgc));
   }
-  for (auto &rt : zgRefersTo) {
-    result->emplace_back(std::move(rt));
+}
+
+void ConsolidatedIndex::getRefersToFor(ZgramId zgramId, std::vector<zgMetadata::ZgramRefersTo> *result) const {
+  MetadataBatch batch;
+  resolveMetadata(&zgramId, 1, &batch);
+  for (const auto &refersTo : batch.refersTo(0)) {
+    result->emplace_back(zgramId, refersTo, true);
   }
 }
 
 namespace {
-void getReactions1(const FrozenStringPool &fsp, ZgramId zgramId, std::string_view reaction,
-    const FrozenMetadata::reactions_t::mapped_type::mapped_type &fInner2,
-    const DynamicMetadata::reactions_t::mapped_type::mapped_type &dInner2,
-    std::vector<zgMetadata::Reaction> *result) {
-  auto fp = fInner2.begin();
-  auto dp = dInner2.begin();
-  while (fp != fInner2.end() || dp != dInner2.end()) {
-    int diff;
-    if (dp == dInner2.end()) {
-      diff = -1;
-    } else if (fp == fInner2.end()) {
-      diff = 1;
-    } else {
-      auto fCreator = fsp.toStringView(*fp);
-      diff = fCreator.compare(dp->first);
+// Returns the first entry at or after 'ip' whose key is >= 'zgramId'. The batch visits the maps in
+// ascending order, so rather than binary searching the whole map for each zgram we gallop forward
+// from where the previous search left off. For a page of nearby zgramIds that is a few
+// comparisons each.
+template<typename MAP>
+typename MAP::const_iterator seekForward(const MAP &map, typename MAP::const_iterator ip,
+    ZgramId zgramId) {
+  auto end = map.end();
+  if (ip == end || !(ip->first < zgramId)) {
+    return ip;
+  }
+  auto less = [](const auto &entry, ZgramId id) { return entry.first < id; };
+  // Invariant: lo->first < zgramId
+  auto lo = ip;
+  size_t step = 1;
+  while (true) {
+    auto remaining = static_cast<size_t>(end - lo);
+    if (step >= remaining) {
+      return std::lower_bound(lo + 1, end, zgramId, less);
+    }
+    auto probe = lo + step;
+    if (!(probe->first < zgramId)) {
+      return std::lower_bound(lo + 1, probe, zgramId, less);
     }
+    lo = probe;
+    step *= 2;
+  }
+}
 
-    std::string_view creator;
-    bool value;
-    if (diff <= 0) {
-      creator = fsp.toStringView(*fp);
-      // The fixed side has an implicit value=true
-      value = true;
-      ++fp;
+template<typename MAP>
+const typename MAP::mapped_type *seekAndFind(const MAP &map, typename MAP::const_iterator *ip,
+    ZgramId zgramId) {
+  *ip = seekForward(map, *ip, zgramId);
+  return *ip != map.end() && (*ip)->first == zgramId ? &(*ip)->second : nullptr;
+}
+
+// Returns the frozen zgramOff of 'zgramId', or zgramInfos.size() if it isn't there. '*ip' only moves
+// forward, so a sorted batch costs a single pass.
+size_t seekFrozenZgramOff(const FrozenVector<ZgramInfo> &zgramInfos, const ZgramInfo **ip,
+    ZgramId zgramId) {
+  *ip = std::lower_bound(*ip, zgramInfos.end(), zgramId,
+      [](const ZgramInfo &info, ZgramId id) { return info.zgramId() < id; });
+  if (*ip == zgramInfos.end() || (*ip)->zgramId() != zgramId) {
+    return zgramInfos.size();
+  }
+  return *ip - zgramInfos.begin();
+}
+
+// Frozen reactions are implicitly 'true'. A dynamic reaction for the same (reaction, creator)
+// overrides the frozen one, and only the reactions that end up 'true' are kept.
+void mergeReactions(const FrozenStringPool &fsp,
+    const FrozenMetadata::reactions_t::mapped_type *fInner,
+    const std::vector<DynamicMetadata::reaction_t> &dInner,
+    std::vector<MetadataBatch::Reaction> *result) {
+  auto dp = dInner.begin();
+  auto emitDynamic = [result](const DynamicMetadata::reaction_t &item) {
+    const auto &[reaction, creator, value] = item;
+    if (value) {
+      result->push_back({reaction, creator});
     }
-    if (diff >= 0) {
-      creator = dp->first;
+  };
+  if (fInner != nullptr) {
+    for (const auto &[reactionRef, creators] : *fInner) {
+      auto reaction = fsp.toStringView(reactionRef);
+      for (const auto &creatorRef : creators) {
+        auto creator = fsp.toStringView(creatorRef);
+        auto key = std::tie(reaction, creator);
+        for (; dp != dInner.end() && std::tie(std::get<0>(*dp), std::get<1>(*dp)) < key; ++dp) {
+          emitDynamic(*dp);
+        }
+        if (dp != dInner.end() && std::get<0>(*dp) == reaction && std::get<1>(*dp) == creator) {
+          emitDynamic(*dp);
+          ++dp;
+          continue;
+        }
+        result->push_back({reaction, creator});
+      }
+    }
+  }
+  for (; dp != dInner.end(); ++dp) {
+    emitDynamic(*dp);
+  }
+}
+
+// This pairs up the frozen and dynamic items positionally. That's how it has always worked;
+// a dynamic 'false' hides the frozen item in the same position.
+void mergeRefersTo(const Slice<const ZgramId> &fInner,
+    const std::vector<DynamicMetadata::zgramRefersTo_t> &dInner, std::vector<ZgramId> *result) {
+  const auto *fp = fInner.begin();
+  const auto *fEnd = fInner.end();
+  auto dp = dInner.begin();
+  while (fp != fEnd || dp != dInner.end()) {
+    ZgramId refersTo;
+    bool value = true;
+    if (fp != fEnd) {
+      refersTo = *fp++;
+    }
+    if (dp != dInner.end()) {
+      refersTo = dp->first;
       value = dp->second;
       ++dp;
     }
-
     if (value) {
-      result->emplace_back(zgramId, std::string(reaction), std::string(creator), true);
+      result->push_back(refersTo);
     }
   }
 }
+
+// Both inputs are sorted. A dynamic entry overrides the frozen one for the same zgram.
+void mergeLinks(const std::vector<ZgramId> &fInner,
+    const std::vector<DynamicMetadata::zgramRefersTo_t> &dInner, std::vector<ZgramId> *result) {
+  result->clear();
+  auto fp = fInner.begin();
+  for (const auto &[zgramId, value] : dInner) {
+    for (; fp != fInner.end() && *fp < zgramId; ++fp) {
+      result->push_back(*fp);
+    }
+    if (fp != fInner.end() && *fp == zgramId) {
+      ++fp;
+    }
+    if (value) {
+      result->push_back(zgramId);
+    }
+  }
+  result->insert(result->end(), fp, fInner.end());
 }
+}  // namespace
 
-void ConsolidatedIndex::getReactionsFor(ZgramId zgramId, std::vector<zgMetadata::Reaction> *result) const {
+void ConsolidatedIndex::resolveMetadata(const ZgramId *zgramIds, size_t size,
+    MetadataBatch *result) const {
+  result->clear();
   const auto &fsp = frozenIndex_.get()->stringPool();
+  const auto &fm = frozenIndex_.get()->metadata();
+  const auto &dm = dynamicIndex_.metadata();
 
-  // Push frozen items not overridden by dynamic items
-  typedef FrozenMetadata::reactions_t::mapped_type fInner_t;
-  typedef DynamicMetadata::reactions_t::mapped_type dInner_t;
+  auto reactionsp = fm.reactions().begin();
+  auto plusPlusKeysp = fm.plusPlusKeys().begin();
 
-  fInner_t emptyFinner;
-  dInner_t emptyDinner;
+  const auto *zgramInfop = frozenIndex_.get()->zgramInfos().begin();
 
-  const fInner_t *fInner;
-  const dInner_t *dInner;
-  if (!frozenIndex_.get()->metadata().reactions().tryFind(zgramId, &fInner)) {
-    fInner = &emptyFinner;
-  }
-  if (!kosak::coding::maputils::tryFind(dynamicIndex_.metadata().reactions(), zgramId, &dInner)) {
-    dInner = &emptyDinner;
-  }
+  std::vector<DynamicMetadata::reaction_t> dReactions;
+  std::vector<DynamicMetadata::zgramRevision_t> dRevisions;
+  std::vector<DynamicMetadata::zgramRefersTo_t> dRefersTo;
+  std::vector<plusPlusKeyId_t> dPlusPlusKeys;
 
-  auto fp = fInner->begin();
-  auto dp = dInner->begin();
+  for (size_t i = 0; i != size; ++i) {
+    auto zgramId = zgramIds[i];
+    passert(i == 0 || zgramIds[i - 1] < zgramId, i, zgramIds[i - 1], zgramId);
 
-  typedef fInner_t::mapped_type fInner2_t;
-  typedef dInner_t::mapped_type dInner2_t;
-  dInner2_t emptyDinner2;
-  fInner2_t emptyFinner2;
-  while (fp != fInner->end() || dp != dInner->end()) {
-    int diff;
-    if (dp == dInner->end()) {
-      diff = -1;
-    } else if (fp == fInner->end()) {
-      diff = 1;
-    } else {
-      auto fReaction = fsp.toStringView(fp->first);
-      diff = fReaction.compare(dp->first);
-    }
+    // The frozen revisions and refers-to are indexed by zgramOff. A zgram that isn't on the frozen
+    // side gets an out-of-range row, which is empty.
+    auto frozenOff = seekFrozenZgramOff(frozenIndex_.get()->zgramInfos(), &zgramInfop, zgramId);
 
-    std::string_view reaction;
-    const auto *fInner2 = &emptyFinner2;
-    const auto *dInner2 = &emptyDinner2;
-    if (diff <= 0) {
-      reaction = fsp.toStringView(fp->first);
-      fInner2 = &fp->second;
-      ++fp;
+    const auto *fReactions = seekAndFind(fm.reactions(), &reactionsp, zgramId);
+    dm.getReactions(zgramId, &dReactions);
+    mergeReactions(fsp, fReactions, dReactions, &result->reactions_);
+
+    // All revisions get sent. Frozen items first, followed by dynamic items.
+    for (const auto &item : fm.zgramRevisions().row(frozenOff)) {
+      result->revisions_.push_back({fsp.toStringView(std::get<0>(item)),
+          fsp.toStringView(std::get<1>(item)), (RenderStyle)std::get<2>(item)});
     }
-    if (diff >= 0) {
-      reaction = dp->first;
-      dInner2 = &dp->second;
-      ++dp;
+    dm.getZgramRevisions(zgramId, &dRevisions);
+    for (const auto &[instance, body, renderStyle] : dRevisions) {
+      result->revisions_.push_back({instance, body, renderStyle});
     }
 
-    getReactions1(fsp, zgramId, reaction, *fInner2, *dInner2, result);
-  }
-}
-
-void ConsolidatedIndex::getZgramRevsFor(ZgramId zgramId, std::vector<zgMetadata::ZgramRevision> *result) const {
-  const auto &fsp = frozenIndex_.get()->stringPool();
+    dm.getRefersTo(zgramId, &dRefersTo);
+    mergeRefersTo(fm.zgramRefersTo().row(frozenOff), dRefersTo, &result->refersTo_);
 
-  // All items get sent. Frozen items first...
-  {
-    typedef FrozenMetadata::zgramRevisions_t::mapped_type fInner_t;
-    const fInner_t *fInner;
-    if (frozenIndex_.get()->metadata().zgramRevisions().tryFind(zgramId, &fInner)) {
-      for (const auto &item : *fInner) {
-        auto instanceRef = std::get<0>(item);
-        auto bodyRef = std::get<1>(item);
-        auto renderStyle = std::get<2>(item);
-        auto instanceSv = fsp.toStringView(instanceRef);
-        auto bodySv = fsp.toStringView(bodyRef);
-        ZgramCore zgc(std::string(instanceSv), std::string(bodySv), (RenderStyle)renderStyle);
-        result->emplace_back(zgramId, std::move(zgc));
+    const auto *fPlusPlusKeys = seekAndFind(fm.plusPlusKeys(), &plusPlusKeysp, zgramId);
+    if (fPlusPlusKeys != nullptr) {
+      for (const auto &fsr : *fPlusPlusKeys) {
+        plusPlusKeyId_t keyId;
+        if (plusPlusKeys_.tryFindFrozen(fsr, &keyId)) {
+          result->plusPlusKeys_.push_back(keyId);
+        }
       }
     }
-  }
-  // ... followed by dynamic items
-  typedef DynamicMetadata::zgramRevisions_t::mapped_type dInner_t;
-  const dInner_t *dInner;
-  if (kosak::coding::maputils::tryFind(dynamicIndex_.metadata().zgramRevisions(), zgramId, &dInner)) {
-    for (const auto &item : *dInner) {
-      ZgramCore zgCopy(item);
-      result->emplace_back(zgramId, std::move(zgCopy));
-    }
+    dm.getPlusPlusKeys(zgramId, &dPlusPlusKeys);
+    result->plusPlusKeys_.insert(result->plusPlusKeys_.end(), dPlusPlusKeys.begin(),
+        dPlusPlusKeys.end());
+
+    result->finishZgram(zgramId);
   }
 }
 
-void ConsolidatedIndex::getRefersToFor(ZgramId zgramId, std::vector<zgMetadata::ZgramRefersTo> *result) const {
-  // Push frozen items not overridden by dynamic items
-  typedef FrozenMetadata::zgramRefersTo_t::mapped_type fInner_t;
-  typedef DynamicMetadata::zgramRefersTo_t::mapped_type dInner_t;
-
-  fInner_t emptyFinner;
-  dInner_t emptyDinner;
-
-  const fInner_t *fInner;
-  const dInner_t *dInner;
-  if (!frozenIndex_.get()->metadata().zgramRefersTo().tryFind(zgramId, &fInner)) {
-    fInner = &emptyFinner;
+void ConsolidatedIndex::getReferredBy(ZgramId zgramId, std::vector<ZgramId> *result) const {
+  const auto &zgramInfos = frozenIndex_.get()->zgramInfos();
+  const auto *zgramInfop = zgramInfos.begin();
+  auto frozenOff = seekFrozenZgramOff(zgramInfos, &zgramInfop, zgramId);
+  // The rows hold zgramOffs in increasing order, so the ZgramIds come out sorted too.
+  std::vector<ZgramId> frozen;
+  for (auto referrer : frozenIndex_.get()->metadata().zgramReferredBy().row(frozenOff)) {
+    frozen.push_back(zgramInfos[referrer.raw()].zgramId());
   }
-  if (!kosak::coding::maputils::tryFind(dynamicIndex_.metadata().zgramRefersTo(), zgramId, &dInner)) {
-    dInner = &emptyDinner;
-  }
-
-  auto fp = fInner->begin();
-  auto dp = dInner->begin();
-
-  while (fp != fInner->end() || dp != dInner->end()) {
-    int diff;
-    if (dp == dInner->end()) {
-      // Only in frozen
-      diff = -1;
-    } else if (fp == fInner->end()) {
-      // Only in dynamic
-      diff = 1;
-    } else {
-      // In both
-      diff = 0;
-    }
+  std::vector<DynamicMetadata::zgramRefersTo_t> dynamic;
+  dynamicIndex_.metadata().getReferredBy(zgramId, &dynamic);
+  mergeLinks(frozen, dynamic, result);
+}
 
-    ZgramId refersTo;
-    bool value;
-    if (diff <= 0) {
-      refersTo = *fp;
-      value = true;
-      ++fp;
+void ConsolidatedIndex::getThread(ZgramId zgramId, size_t maxSize,
+    std::vector<ZgramId> *result) const {
+  result->clear();
+  if (maxSize == 0) {
+    return;
+  }
+  const auto &zgramInfos = frozenIndex_.get()->zgramInfos();
+  const auto &fm = frozenIndex_.get()->metadata();
+  const auto &dm = dynamicIndex_.metadata();
+
+  std::set<ZgramId> seen;
+  std::vector<ZgramId> frontier;
+  auto tryVisit = [&](ZgramId id) {
+    if (seen.size() != maxSize && seen.insert(id).second) {
+      frontier.push_back(id);
     }
-    if (diff >= 0) {
-      refersTo = dp->first;
-      value = dp->second;
-      ++dp;
+  };
+  tryVisit(zgramId);
+
+  std::vector<ZgramId> frozen;
+  std::vector<DynamicMetadata::zgramRefersTo_t> dynamic;
+  std::vector<ZgramId> links;
+  for (size_t next = 0; next != frontier.size() && seen.size() != maxSize; ++next) {
+    auto current = frontier[next];
+    const auto *zgramInfop = zgramInfos.begin();
+    auto frozenOff = seekFrozenZgramOff(zgramInfos, &zgramInfop, current);
+
+    const auto &fRefersTo = fm.zgramRefersTo().row(frozenOff);
+    frozen.assign(fRefersTo.begin(), fRefersTo.end());
+    dm.getRefersTo(current, &dynamic);
+    mergeLinks(frozen, dynamic, &links);
+    for (auto id : links) {
+      tryVisit(id);
     }
 
-    if (!value) {
-      continue;
+    getReferredBy(current, &links);
+    for (auto id : links) {
+      tryVisit(id);
     }
-    result->emplace_back(zgramId, refersTo, true);
   }
+  result->assign(seen.begin(), seen.end());
 }
 
 std::string_view ConsolidatedIndex::getZmojis(std::string_view userId) const {
-  const auto &dmz = dynamicIndex().metadata().zmojis();
-  auto dp = dmz.find(userId);
-  if (dp != dmz.end()) {
-    return dp->second;
+  std::string_view dynamicZmojis;
+  if (dynamicIndex().metadata().tryFindZmojis(userId, &dynamicZmojis)) {
+    return dynamicZmojis;
   }
   const auto &fmz = frozenIndex().metadata().zmojis();
   auto fp = fmz.find(userId, frozenIndex().makeLess());
@@ -798,83 +958,65 @@ std::string_view ConsolidatedIndex::getZmojis(std::string_view userId) const {
 }
 
 int64_t ConsolidatedIndex::getReactionCount(std::string_view reaction, ZgramId relativeTo) const {
-  {
-    const auto &dmz = dynamicIndex().metadata().reactionCounts();
-    auto dp = dmz.find(reaction);
-    if (dp != dmz.end()) {
-      auto dInner = dp->second.lower_bound(relativeTo);
-      if (dInner != dp->second.end()) {
-        return dInner->second;
-      }
+  const auto *dmz = dynamicIndex().metadata().findReactionCounts(reaction);
+  if (dmz != nullptr) {
+    auto dInner = dmz->lower_bound(relativeTo);
+    if (dInner != dmz->end()) {
+      return dInner->second;
     }
   }
 
   const auto &fmz = frozenIndex().metadata().reactionCounts();
   auto fp = fmz.find(reaction, frozenIndex().makeLess());
   if (fp != fmz.end()) {
-    auto fInner = fp->second.lower_bound(relativeTo);
-    if (fInner != fp->second.end()) {
-      return fInner->second;
+    // The frozen counts are keyed by zgramOff.
+    const auto &bitmap = fp->second.zgramOffs();
+    uint32_t member;
+    if (bitmap.tryFindNext(lowerBound(relativeTo).raw(), &member)) {
+      return fp->second.countAt(bitmap.rank(member));
     }
   }
   return 0;
 }
 
-namespace {
-size_t getPlusPlusHelper(const FrozenStringPool &fsp, const FrozenMetadata::plusPluses_t &plusPluses,
-    ZgramId zgramId, std::string_view key) {
-  frozenStringRef_t fsr;
-  if (!fsp.tryFind(key, &fsr)) {
-    return 0;
-  }
-  auto ip = plusPluses.find(fsr);
-  if (ip == plusPluses.end()) {
-    return 0;
-  }
-  const auto &vec = ip->second;
-  auto vecp = std::upper_bound(vec.begin(), vec.end(), zgramId);
-  return vecp - vec.begin();
+int64_t ConsolidatedIndex::getPlusPlusCountAfter(ZgramId zgramId, plusPlusKeyId_t key) const {
+  return plusPlusCounter_.countAfter(key, zgramId);
 }
 
-size_t getPlusPlusHelper(const DynamicMetadata::plusPluses_t &plusPluses, ZgramId zgramId,
-    std::string_view key) {
-  auto ip = plusPluses.find(key);
-  if (ip == plusPluses.end()) {
-    return 0;
-  }
-  const auto &vec = ip->second;
-  auto vecp = std::upper_bound(vec.begin(), vec.end(), zgramId);
-  return vecp - vec.begin();
+int64_t ConsolidatedIndex::getPlusPlusCountAfter(ZgramId zgramId, std::string_view key) const {
+  plusPlusKeyId_t keyId;
+  return plusPlusKeys_.tryFind(key, &keyId) ? getPlusPlusCountAfter(zgramId, keyId) : 0;
 }
-}  // namespace
 
-int64_t ConsolidatedIndex::getPlusPlusCountAfter(ZgramId zgramId, std::string_view key) const {
-  const auto &fsp = frozenIndex().stringPool();
-  auto fpRank = getPlusPlusHelper(fsp, frozenIndex().metadata().plusPluses(), zgramId, key);
-  auto fmRank = getPlusPlusHelper(fsp, frozenIndex().metadata().minusMinuses(), zgramId, key);
-  auto dpRank = getPlusPlusHelper(dynamicIndex().metadata().plusPluses(), zgramId, key);
-  auto dmRank = getPlusPlusHelper(dynamicIndex().metadata().minusMinuses(), zgramId, key);
+void ConsolidatedIndex::getPlusPlusCountsAfter(plusPlusKeyId_t key, const ZgramId *zgramIds,
+    size_t size, int64_t *result) const {
+  plusPlusCounter_.countsAfter(key, zgramIds, size, result);
+}
 
-  return int64_t(fpRank) - int64_t(fmRank) + int64_t(dpRank) - int64_t(dmRank);
+void ConsolidatedIndex::getPlusPlusCountsAfter(std::string_view key, const ZgramId *zgramIds,
+    size_t size, int64_t *result) const {
+  plusPlusKeyId_t keyId;
+  if (!plusPlusKeys_.tryFind(key, &keyId)) {
+    std::fill(result, result + size, 0);
+    return;
+  }
+  getPlusPlusCountsAfter(keyId, zgramIds, size, result);
 }
 
-std::set<std::string> ConsolidatedIndex::getPlusPlusKeys(ZgramId zgramId) const {
-  std::set<std::string> result;
-  const auto &fsp = frozenIndex().stringPool();
+void ConsolidatedIndex::getPlusPlusKeys(ZgramId zgramId,
+    std::vector<plusPlusKeyId_t> *result) const {
+  dynamicIndex().metadata().getPlusPlusKeys(zgramId, result);
   const FrozenVector<frozenStringRef_t> *mentions;
   if (frozenIndex().metadata().plusPlusKeys().tryFind(zgramId, &mentions)) {
     for (const auto &fsr : *mentions) {
-      auto sv = fsp.toStringView(fsr);
-      result.insert(std::string(sv));
+      plusPlusKeyId_t keyId;
+      if (plusPlusKeys_.tryFindFrozen(fsr, &keyId)) {
+        result->push_back(keyId);
+      }
     }
   }
-
-  const auto &ppKeys = dynamicIndex().metadata().plusPlusKeys();
-  auto ip = ppKeys.find(zgramId);
-  if (ip  != ppKeys.end()) {
-    result.insert(ip->second.begin(), ip->second.end());
-  }
-  return result;
+  std::sort(result->begin(), result->end());
+  result->erase(std::unique(result->begin(), result->end()), result->end());
 }
 
 bool ConsolidatedIndex::tryDetermineLogged(const MetadataRecord &mr, bool *isLogged,
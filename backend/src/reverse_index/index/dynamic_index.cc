@@ -33,6 +33,7 @@ namespace userMetadata = z2kplus::backend::shared::userMetadata;
 namespace z2kplus::backend::reverse_index::index {
 
 DynamicIndex::DynamicIndex() = default;
+DynamicIndex::DynamicIndex(const FrozenStringPool *frozenPool) : metadata_(frozenPool) {}
 DynamicIndex::DynamicIndex(DynamicTrie &&trie, std::vector<ZgramInfo> &&zgramInfos,
     std::vector<WordInfo> &&wordInfos, DynamicMetadata &&metadata) : trie_(std::move(trie)),
     zgramInfos_(std::move(zgramInfos)), wordInfos_(std::move(wordInfos)),
@@ -187,43 +188,16 @@ bool DynamicIndex::tryAddMetadata(const FrozenIndex &frozenSide,
 
 
 void DynamicIndex::batchUpdatePlusPlusCounts(const ppDeltaMap_t &deltaMap) {
-  std::map<std::string, std::map<ZgramId, int64_t>> transposedMap;
+  std::map<plusPlusKeyId_t, std::map<ZgramId, int64_t>> transposedMap;
   for (const auto &[zgramId, inner]: deltaMap) {
     for (auto [key, count]: inner) {
       transposedMap[key][zgramId] = count;
     }
   }
 
-  // Only works because plusPluses_t and minusMinuses_t are the same type
-  auto addEntries = [](DynamicMetadata::plusPluses_t *which, const std::string &key,
-      ZgramId zgramId, size_t count) {
-    // Find or insert an entry for 'key'. Avoid a string allocation if you can.
-    auto ip = which->find(key);
-    if (ip == which->end()) {
-      ip = which->try_emplace(std::string(key)).first;
-    }
-    // Insert 'countToUse' copies of zgramId
-    auto &vec = ip->second;
-    auto vecp = std::upper_bound(vec.begin(), vec.end(), zgramId);
-    vec.insert(vecp, count, zgramId);
-  };
-
   for (const auto &[key, inner] : transposedMap) {
     for (const auto &[zgramId, count] : inner) {
-      metadata_.plusPlusKeys()[zgramId].insert(key);
-
-      if (count > 0) {
-        addEntries(&metadata_.plusPluses(), key, zgramId, count);
-      } else if (count < 0) {
-        addEntries(&metadata_.minusMinuses(), key, zgramId, -count);
-      } else {
-        // This is a bit of a hack. If count == 0 we still want to to dependency tracking.
-        // So we add a balanced entry to both sides. Technically we would only need to do
-        // this if both plusPluses and minusMinuses are empty, but we don't bother with that
-        // optimization
-        addEntries(&metadata_.plusPluses(), key, zgramId, 1);
-        addEntries(&metadata_.minusMinuses(), key, zgramId, 1);
-      }
+      metadata_.addPlusPlusDelta(key, zgramId, count);
     }
   }
 }
@@ -27,11 +27,11 @@ FrozenIndex::FrozenIndex() = default;
 FrozenIndex::FrozenIndex(const FilePosition<FileKeyKind::Logged> &loggedEnd,
     const FilePosition<FileKeyKind::Unlogged> &unloggedEnd,
     FrozenVector<ZgramInfo> zgramInfos, FrozenVector<WordInfo> wordInfos, FrozenTrie trie,
-    FrozenStringPool stringPool, FrozenMetadata metadata) :
+    FrozenStringPool stringPool, FrozenMetadata metadata, const IndexSectionTable &sections) :
     loggedEnd_(loggedEnd), unloggedEnd_(unloggedEnd),
     zgramInfos_(std::move(zgramInfos)),
     wordInfos_(std::move(wordInfos)), trie_(std::move(trie)), stringPool_(std::move(stringPool)),
-    metadata_(std::move(metadata)) {}
+    metadata_(std::move(metadata)), sections_(sections) {}
 FrozenIndex::FrozenIndex(FrozenIndex &&other) noexcept = default;
 FrozenIndex &FrozenIndex::operator=(FrozenIndex &&other) noexcept = default;
 FrozenIndex::~FrozenIndex() = default;
@@ -44,7 +44,9 @@ std::ostream &operator<<(std::ostream &s, const FrozenIndex &o) {
     "\nzgramInfos: %o"
     "\nwordInfos: %o"
     "\nstringPool: %o"
-    "\nmetadata: %o}",
-    o.loggedEnd_, o.unloggedEnd_, o.trie_, o.zgramInfos_, o.wordInfos_, o.stringPool_, o.metadata_);
+    "\nmetadata: %o"
+    "\nsections: %o}",
+    o.loggedEnd_, o.unloggedEnd_, o.trie_, o.zgramInfos_, o.wordInfos_, o.stringPool_, o.metadata_,
+    o.sections_);
 }
 }  // namespace z2kplus::backend::reverse_index::index
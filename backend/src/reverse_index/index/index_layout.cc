@@ -0,0 +1,166 @@
+// Copyright 2023 The Z2K Plus+ Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "z2kplus/backend/reverse_index/index/index_layout.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <utility>
+#include <vector>
+#include "kosak/coding/coding.h"
+#include "kosak/coding/failures.h"
+
+using kosak::coding::FailFrame;
+using kosak::coding::streamf;
+
+#define HERE KOSAK_CODING_HERE
+
+namespace z2kplus::backend::reverse_index::index {
+namespace {
+std::array<const char *, (size_t)IndexSection::numSections> sectionNames = {
+    "header",
+    "zgramInfos",
+    "trie",
+    "stringPool",
+    "wordInfos",
+    "postings",
+    "metadata",
+    "revisions"
+};
+
+// The page-aligned span that covers [begin, end) of the mapping at 'base'.
+std::pair<char*, size_t> pageSpan(const char *base, const IndexSectionTable::Range &range) {
+  static const auto pageSize = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+  auto start = reinterpret_cast<uintptr_t>(base + range.begin_) & ~(pageSize - 1);
+  auto end = reinterpret_cast<uintptr_t>(base + range.end_);
+  end = (end + pageSize - 1) & ~(pageSize - 1);
+  return std::make_pair(reinterpret_cast<char*>(start), end - start);
+}
+
+void adviseOrWarn(IndexSection section, char *start, size_t size, int advice, const char *what) {
+  if (madvise(start, size, advice) != 0) {
+    warn("madvise(%o) on index section %o failed (ignoring): %o", what, section, strerror(errno));
+  }
+}
+}  // namespace
+
+const char *getName(IndexSection section) {
+  passert(section < IndexSection::numSections);
+  return sectionNames[(size_t)section];
+}
+
+SectionPolicy getPolicy(IndexSection section) {
+  switch (section) {
+    case IndexSection::header:
+    case IndexSection::zgramInfos:
+    case IndexSection::trie:
+    case IndexSection::stringPool:
+      return SectionPolicy::hot;
+    case IndexSection::metadata:
+    case IndexSection::revisions:
+      return SectionPolicy::random;
+    default:
+      // The postings of a matching word, and the WordInfos they refer to, are read in ascending
+      // runs, so readahead pays for itself.
+      return SectionPolicy::normal;
+  }
+}
+
+bool IndexSectionTable::tryValidate(size_t fileSize, const FailFrame &ff) const {
+  uint64_t prevEnd = 0;
+  for (size_t i = 0; i != ranges_.size(); ++i) {
+    const auto &r = ranges_[i];
+    if (r.begin_ < prevEnd || r.end_ < r.begin_ || r.end_ > fileSize) {
+      return ff.failf(HERE, "Section %o has bad range [%o, %o) (previous end %o, file size %o)",
+          (IndexSection)i, r.begin_, r.end_, prevEnd, fileSize);
+    }
+    prevEnd = r.end_;
+  }
+  return true;
+}
+
+void IndexLayout::advise(const char *base, const IndexSectionTable &sections,
+    const Options &options) {
+  for (size_t i = 0; i != (size_t)IndexSection::numSections; ++i) {
+    auto section = (IndexSection)i;
+    const auto &range = sections.range(section);
+    if (range.begin_ == range.end_) {
+      continue;
+    }
+    auto [start, size] = pageSpan(base, range);
+    switch (getPolicy(section)) {
+      case SectionPolicy::hot: {
+        if (options.hugePages_) {
+          adviseOrWarn(section, start, size, MADV_HUGEPAGE, "MADV_HUGEPAGE");
+        }
+        adviseOrWarn(section, start, size, MADV_WILLNEED, "MADV_WILLNEED");
+        if (options.lockHotSet_ && mlock(start, size) != 0) {
+          warn("mlock on index section %o (%o bytes) failed (ignoring): %o", section, size,
+              strerror(errno));
+        }
+        break;
+      }
+      case SectionPolicy::random: {
+        adviseOrWarn(section, start, size, MADV_RANDOM, "MADV_RANDOM");
+        break;
+      }
+      case SectionPolicy::normal: {
+        break;
+      }
+    }
+  }
+}
+
+bool IndexLayout::tryMeasureResidency(const char *base, const IndexSectionTable &sections,
+    std::vector<SectionResidency> *result, const FailFrame &ff) {
+  static const auto pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  result->clear();
+  std::vector<unsigned char> vec;
+  for (size_t i = 0; i != (size_t)IndexSection::numSections; ++i) {
+    auto section = (IndexSection)i;
+    SectionResidency sr;
+    sr.section_ = section;
+    const auto &range = sections.range(section);
+    if (range.begin_ != range.end_) {
+      auto [start, size] = pageSpan(base, range);
+      sr.numPages_ = size / pageSize;
+      vec.resize(sr.numPages_);
+      if (mincore(start, size, vec.data()) != 0) {
+        return ff.failf(HERE, "mincore on index section %o failed: %o", section, strerror(errno));
+      }
+      for (auto v : vec) {
+        sr.numResidentPages_ += v & 1;
+      }
+    }
+    result->push_back(sr);
+  }
+  return true;
+}
+
+std::ostream &operator<<(std::ostream &s, const IndexSectionTable &o) {
+  s << '[';
+  const char *sep = "";
+  for (size_t i = 0; i != o.ranges_.size(); ++i) {
+    streamf(s, "%o%o: [%o, %o)", sep, (IndexSection)i, o.ranges_[i].begin_, o.ranges_[i].end_);
+    sep = ", ";
+  }
+  return s << ']';
+}
+
+std::ostream &operator<<(std::ostream &s, const SectionResidency &o) {
+  return streamf(s, "%o: %o/%o", o.section_, o.numResidentPages_, o.numPages_);
+}
+}  // namespace z2kplus::backend::reverse_index::index
@@ -0,0 +1,105 @@
+// Copyright 2023 The Z2K Plus+ Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "z2kplus/backend/reverse_index/index/metadata_batch.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+using kosak::coding::containers::Slice;
+using z2kplus::backend::shared::MetadataRecord;
+using z2kplus::backend::shared::ZgramCore;
+using z2kplus::backend::shared::ZgramId;
+namespace zgMetadata = z2kplus::backend::shared::zgMetadata;
+
+namespace z2kplus::backend::reverse_index::index {
+MetadataBatch::MetadataBatch() = default;
+MetadataBatch::MetadataBatch(MetadataBatch &&) noexcept = default;
+MetadataBatch &MetadataBatch::operator=(MetadataBatch &&) noexcept = default;
+MetadataBatch::~MetadataBatch() = default;
+
+void MetadataBatch::clear() {
+  zgrams_.clear();
+  reactions_.clear();
+  revisions_.clear();
+  refersTo_.clear();
+  plusPlusKeys_.clear();
+}
+
+bool MetadataBatch::tryFind(ZgramId zgramId, size_t *index) const {
+  auto ip = std::lower_bound(zgrams_.begin(), zgrams_.end(), zgramId,
+      [](const Zgram &zg, ZgramId id) { return zg.zgramId_ < id; });
+  if (ip == zgrams_.end() || ip->zgramId_ != zgramId) {
+    return false;
+  }
+  *index = ip - zgrams_.begin();
+  return true;
+}
+
+auto MetadataBatch::reactions(size_t index) const -> Slice<const Reaction> {
+  return sliceOf(reactions_, index, &Zgram::reactionsEnd_);
+}
+
+auto MetadataBatch::revisions(size_t index) const -> Slice<const Revision> {
+  return sliceOf(revisions_, index, &Zgram::revisionsEnd_);
+}
+
+Slice<const ZgramId> MetadataBatch::refersTo(size_t index) const {
+  return sliceOf(refersTo_, index, &Zgram::refersToEnd_);
+}
+
+auto MetadataBatch::plusPlusKeys(size_t index) const -> Slice<const plusPlusKeyId_t> {
+  return sliceOf(plusPlusKeys_, index, &Zgram::plusPlusKeysEnd_);
+}
+
+void MetadataBatch::appendMetadataRecords(size_t index, std::vector<MetadataRecord> *result) const {
+  auto zgramId = zgrams_[index].zgramId_;
+  for (const auto &rx : reactions(index)) {
+    result->emplace_back(zgMetadata::Reaction(zgramId, std::string(rx.reaction_),
+        std::string(rx.creator_), true));
+  }
+  for (const auto &rev : revisions(index)) {
+    ZgramCore zgc(std::string(rev.instance_), std::string(rev.body_), rev.renderStyle_);
+    result->emplace_back(zgMetadata::ZgramRevision(zgramId, std::move(zgc)));
+  }
+  for (const auto &rt : refersTo(index)) {
+    result->emplace_back(zgMetadata::ZgramRefersTo(zgramId, rt, true));
+  }
+}
+
+void MetadataBatch::finishZgram(ZgramId zgramId) {
+  // Keep the per-zgram plusplus keys sorted and unique, as getPlusPlusKeys does.
+  auto begin = zgrams_.empty() ? 0 : zgrams_.back().plusPlusKeysEnd_;
+  std::sort(plusPlusKeys_.begin() + begin, plusPlusKeys_.end());
+  plusPlusKeys_.erase(std::unique(plusPlusKeys_.begin() + begin, plusPlusKeys_.end()),
+      plusPlusKeys_.end());
+
+  Zgram zg;
+  zg.zgramId_ = zgramId;
+  zg.reactionsEnd_ = reactions_.size();
+  zg.revisionsEnd_ = revisions_.size();
+  zg.refersToEnd_ = refersTo_.size();
+  zg.plusPlusKeysEnd_ = plusPlusKeys_.size();
+  zgrams_.push_back(zg);
+}
+
+template<typename T>
+Slice<const T> MetadataBatch::sliceOf(const std::vector<T> &items, size_t index,
+    uint32_t Zgram::*end) const {
+  auto b = index == 0 ? 0 : zgrams_[index - 1].*end;
+  auto e = zgrams_[index].*end;
+  return {items.data() + b, items.data() + e};
+}
+}  // namespace z2kplus::backend::reverse_index::index
@@ -19,9 +19,9 @@
 #include <utility>
 #include "kosak/coding/coding.h"
 #include "kosak/coding/memory/mapped_file.h"
-#include "z2kplus/backend/factories/log_parser.h"
 #include "z2kplus/backend/files/keys.h"
 #include "z2kplus/backend/shared/zephyrgram.h"
+#include "z2kplus/backend/shared/zgram_view.h"
 #include "z2kplus/backend/util/misc.h"
 
 using kosak::coding::FailFrame;
@@ -29,25 +29,23 @@ using kosak::coding::memory::MappedFile;
 using z2kplus::backend::files::FileKey;
 using z2kplus::backend::files::FileKeyKind;
 using z2kplus::backend::files::IntraFileRange;
-using z2kplus::backend::shared::LogRecord;
 using z2kplus::backend::shared::ZgramId;
-using z2kplus::backend::shared::ZgramCore;
+using z2kplus::backend::shared::ZgramView;
 using z2kplus::backend::shared::Zephyrgram;
 
-using z2kplus::backend::factories::LogParser;
-
 #define HERE KOSAK_CODING_HERE
 
 namespace z2kplus::backend::reverse_index::index {
 ZgramCache::ZgramCache() = default;
-ZgramCache::ZgramCache(size_t capacity) : capacity_(capacity) {}
+ZgramCache::ZgramCache(size_t capacity, size_t prefetchCapacity) : capacity_(capacity),
+    prefetchCapacity_(prefetchCapacity) {}
 ZgramCache::ZgramCache(ZgramCache &&) noexcept = default;
 ZgramCache& ZgramCache::operator=(ZgramCache &&) noexcept = default;
 ZgramCache::~ZgramCache() = default;
 
 bool ZgramCache::tryLookupOrResolve(const PathMaster &pm,
   const std::vector<std::pair<ZgramId, LogLocation>> &locators,
-    std::vector<std::shared_ptr<const Zephyrgram>> *result, const FailFrame &ff) {
+    std::vector<std::shared_ptr<const ZgramView>> *result, const FailFrame &ff) {
   // Do a little extra work to make us append to the result rather than overwrite it.
   auto offset = result->size();
   result->resize(offset + locators.size());
@@ -61,11 +59,18 @@ bool ZgramCache::tryLookupOrResolve(const PathMaster &pm,
     const auto &zgramId = locator.first;
     const auto &location = locator.second;
     const auto &cp = cache_.find(zgramId);
-    if (cp == cache_.end()) {
-      todo.emplace_back(zgramId, location, i);
+    if (cp != cache_.end()) {
+      (*result)[offset + i] = cp->second;
+      continue;
+    }
+    auto pp = prefetched_.find(zgramId);
+    if (pp != prefetched_.end()) {
+      remember(pp->second);
+      (*result)[offset + i] = std::move(pp->second);
+      prefetched_.erase(pp);
       continue;
     }
-    (*result)[offset + i] = cp->second;
+    todo.emplace_back(zgramId, location, i);
   }
   // Sort 'todo' by filekey (to group filekeys together) so that file accesses are more efficient.
   std::sort(todo.begin(), todo.end(), [](const auto &lhs, const auto &rhs) {
@@ -88,24 +93,70 @@ bool ZgramCache::tryLookupOrResolve(const PathMaster &pm,
       return ff.failf(HERE, "What happened? %o vs cf.size %o", location, currentFile.byteSize());
     }
     std::string_view sr(currentFile.get() + location.offset(), location.size());
-    LogRecord lr;
-    if (!LogParser::tryParseLogRecord(sr, &lr, ff.nest(HERE))) {
+    std::shared_ptr<const ZgramView> sharedZg;
+    if (!ZgramView::tryCreateFromLogRecord(sr, &sharedZg, ff.nest(HERE))) {
       return false;
     }
-    auto *zg = std::get_if<Zephyrgram>(&lr.payload());
-    if (zg == nullptr) {
-      return ff.failf(HERE, "Location %o does not refer to a zgram", location);
+    remember(sharedZg);
+    (*result)[offset + index] = std::move(sharedZg);
+  }
+  return true;
+}
+
+void ZgramCache::insertPrefetched(std::shared_ptr<const ZgramView> zgram) {
+  auto zgramId = zgram->zgramId();
+  if (contains(zgramId)) {
+    return;
+  }
+  while (prefetched_.size() >= prefetchCapacity_ && !prefetchOrder_.empty()) {
+    prefetched_.erase(prefetchOrder_.front());
+    prefetchOrder_.pop_front();
+  }
+  if (prefetched_.size() >= prefetchCapacity_) {
+    return;
+  }
+  prefetched_.try_emplace(zgramId, std::move(zgram));
+  prefetchOrder_.push_back(zgramId);
+  // Ids that were consumed by a lookup stay in prefetchOrder_ until they reach the front. Don't let
+  // them pile up.
+  if (prefetchOrder_.size() > 2 * prefetchCapacity_) {
+    std::deque<ZgramId> live;
+    for (const auto &id : prefetchOrder_) {
+      if (prefetched_.find(id) != prefetched_.end()) {
+        live.push_back(id);
+      }
     }
-    auto sharedZg = std::make_shared<Zephyrgram>(std::move(*zg));
-    if (cache_.size() < capacity_) {
-      cache_.try_emplace(zgramId, sharedZg);
-    } else if (!cache_.empty() && cache_.begin()->first < zgramId) {
-      auto node = cache_.extract(cache_.begin());
-      node.key() = sharedZg->zgramId();
-      node.mapped() = sharedZg;
-      cache_.insert(std::move(node));
+    prefetchOrder_.swap(live);
+  }
+}
+
+void ZgramCache::remember(const std::shared_ptr<const ZgramView> &zgram) {
+  auto zgramId = zgram->zgramId();
+  if (cache_.size() < capacity_) {
+    cache_.try_emplace(zgramId, zgram);
+  } else if (!cache_.empty() && cache_.begin()->first < zgramId &&
+      cache_.find(zgramId) == cache_.end()) {
+    auto node = cache_.extract(cache_.begin());
+    node.key() = zgramId;
+    node.mapped() = zgram;
+    cache_.insert(std::move(node));
+  }
+}
+
+bool ZgramCache::tryLookupOrResolve(const PathMaster &pm,
+    const std::vector<std::pair<ZgramId, LogLocation>> &locators,
+    std::vector<std::shared_ptr<const Zephyrgram>> *result, const FailFrame &ff) {
+  std::vector<std::shared_ptr<const ZgramView>> views;
+  if (!tryLookupOrResolve(pm, locators, &views, ff.nest(HERE))) {
+    return false;
+  }
+  result->reserve(result->size() + views.size());
+  for (const auto &view : views) {
+    auto zg = std::make_shared<Zephyrgram>();
+    if (!view->tryDecode(zg.get(), ff.nest(HERE))) {
+      return false;
     }
-    (*result)[offset + index] = std::move(sharedZg);
+    result->push_back(std::move(zg));
   }
   return true;
 }
@@ -14,6 +14,7 @@
 
 #include "z2kplus/backend/reverse_index/iterators/boundary/near.h"
 
+#include <limits>
 #include "kosak/coding/dumping.h"
 #include "z2kplus/backend/reverse_index/iterators/boundary/word_adaptor.h"
 #include "z2kplus/backend/reverse_index/iterators/zgram/popornot.h"
@@ -26,11 +27,11 @@ using kosak::coding::dumpDeref;
 using z2kplus::backend::reverse_index::iterators::zgram::PopOrNot;
 
 namespace {
-class MyState final : public ZgramIteratorState {
+class LockstepState final : public ZgramIteratorState {
 public:
-  MyState(size_t margin, std::unique_ptr<WordStreamer[]> &&streamers,
+  LockstepState(size_t margin, std::unique_ptr<WordStreamer[]> &&streamers,
       size_t numStreamers);
-  ~MyState() final;
+  ~LockstepState() final;
 
   bool getNextResult(const IteratorContext &ctx, zgramRel_t *result, wordRel_t lowerBound);
 
@@ -41,39 +42,111 @@ private:
   std::unique_ptr<WordStreamer[]> streamers_;
   size_t numStreamers_ = 0;
 };
+
+class RarestFirstState final : public ZgramIteratorState {
+public:
+  RarestFirstState(size_t margin, std::vector<const WordIterator*> children,
+      std::vector<std::unique_ptr<WordIteratorState>> childStates, size_t anchorIndex,
+      WordStreamer anchor);
+  ~RarestFirstState() final;
+
+  size_t getMore(const IteratorContext &ctx, zgramRel_t *result, size_t capacity);
+
+private:
+  bool verify(const IteratorContext &ctx, wordRel_t anchorPos);
+  bool verifyExact(const IteratorContext &ctx, wordRel_t anchorPos);
+  bool extendLeft(const IteratorContext &ctx, size_t index, wordRel_t rightPos, wordRel_t fieldBegin);
+  bool extendRight(const IteratorContext &ctx, size_t index, wordRel_t leftPos, wordRel_t fieldEnd);
+
+  size_t margin_ = 0;
+  // In relative order (i.e. reversed, for reverse iteration).
+  std::vector<const WordIterator*> children_;
+  // Seek states for the children. The entry for the anchor is unused.
+  std::vector<std::unique_ptr<WordIteratorState>> childStates_;
+  // The index of the rarest child. That child is streamed; the others are only seeked.
+  size_t anchorIndex_ = 0;
+  WordStreamer anchor_;
+};
 }  // namespace
 
 // Optimizations:
 // * The empty adjacency list matches every zgram
 // * The adjacency list with one word in it can be more simply handled by WordAdaptor.
 std::unique_ptr<ZgramIterator> Near::create(size_t margin,
-    std::vector<std::unique_ptr<WordIterator>> &&children) {
+    std::vector<std::unique_ptr<WordIterator>> &&children, Strategy strategy) {
   if (children.empty()) {
     return PopOrNot::create(FieldMask::all, FieldMask::all);
   }
   if (children.size() == 1) {
     return WordAdaptor::create(std::move(children[0]));
   }
-  return std::make_unique<Near>(Private(), margin, std::move(children));
+  return std::make_unique<Near>(Private(), margin, std::move(children), strategy);
 }
 
-Near::Near(Private, size_t margin, std::vector<std::unique_ptr<WordIterator>> children) :
-  margin_(margin), children_(std::move(children)) {}
+Near::Near(Private, size_t margin, std::vector<std::unique_ptr<WordIterator>> children,
+    Strategy strategy) : margin_(margin), children_(std::move(children)), strategy_(strategy) {}
 
 Near::~Near() = default;
 
 std::unique_ptr<ZgramIteratorState> Near::createState(const IteratorContext &ctx) const {
-  auto numStreamers = children_.size();
-  auto streamers = std::make_unique<WordStreamer[]>(numStreamers);
-  for (size_t i = 0; i < numStreamers; ++i) {
+  auto numChildren = children_.size();
+  const auto &plan = getPlan(ctx.ci());
+  if (plan.rarestFirst_) {
+    std::vector<const WordIterator*> children;
+    for (const auto &c : children_) {
+      children.push_back(c.get());
+    }
+    auto anchorIndex = plan.anchorIndex_;
+    if (!ctx.forward()) {
+      std::reverse(children.begin(), children.end());
+      anchorIndex = numChildren - 1 - anchorIndex;
+    }
+    std::vector<std::unique_ptr<WordIteratorState>> childStates;
+    for (const auto *c : children) {
+      childStates.push_back(c->createState(ctx));
+    }
+    WordStreamer anchor(children[anchorIndex], std::move(childStates[anchorIndex]));
+    return std::make_unique<RarestFirstState>(margin_, std::move(children), std::move(childStates),
+        anchorIndex, std::move(anchor));
+  }
+
+  auto streamers = std::make_unique<WordStreamer[]>(numChildren);
+  for (size_t i = 0; i < numChildren; ++i) {
     const auto &c = children_[i];
     auto childState = c->createState(ctx);
     streamers[i] = WordStreamer(c.get(), std::move(childState));
   }
   if (!ctx.forward()) {
-    std::reverse(streamers.get(), streamers.get() + numStreamers);
+    std::reverse(streamers.get(), streamers.get() + numChildren);
   }
-  return std::make_unique<MyState>(margin_, std::move(streamers), children_.size());
+  return std::make_unique<LockstepState>(margin_, std::move(streamers), numChildren);
+}
+
+const Near::Plan &Near::getPlan(const ConsolidatedIndex &ci) const {
+  if (plan_.generation_ == ci.generation()) {
+    return plan_;
+  }
+  auto numChildren = children_.size();
+  size_t anchorIndex = 0;
+  size_t anchorSize = std::numeric_limits<size_t>::max();
+  size_t totalSize = 0;
+  if (strategy_ != Strategy::Lockstep) {
+    for (size_t i = 0; i < numChildren; ++i) {
+      auto size = children_[i]->estimateSize(ci);
+      totalSize += size;
+      if (size < anchorSize) {
+        anchorIndex = i;
+        anchorSize = size;
+      }
+    }
+  }
+  plan_.generation_ = ci.generation();
+  // Rarest-first does a handful of seeks per anchor word, each of which is more expensive than
+  // streaming past a word. It only pays off when the anchor is rare compared to the others.
+  plan_.rarestFirst_ = strategy_ == Strategy::RarestFirst ||
+      (strategy_ == Strategy::Auto && anchorSize * (numChildren + 1) <= totalSize);
+  plan_.anchorIndex_ = anchorIndex;
+  return plan_;
 }
 
 // The definition is as follows. We have N children (N >= 2) and we want to get them all to be
@@ -113,23 +186,43 @@ std::unique_ptr<ZgramIteratorState> Near::createState(const IteratorContext &ctx
 //    zgram.
 size_t Near::getMore(const IteratorContext &ctx, ZgramIteratorState *state, zgramRel_t lowerBound,
     zgramRel_t *result, size_t capacity) const {
-  auto *ms = dynamic_cast<MyState *>(state);
-  if (!ms->updateNextStart(ctx, lowerBound, capacity)) {
+  if (!state->updateNextStart(ctx, lowerBound, capacity)) {
     return 0;
   }
-  return ms->getMore(ctx, result, capacity);
+  if (auto *rs = dynamic_cast<RarestFirstState *>(state); rs != nullptr) {
+    return rs->getMore(ctx, result, capacity);
+  }
+  return dynamic_cast<LockstepState *>(state)->getMore(ctx, result, capacity);
+}
+
+// A Near can yield no more zgrams than its rarest child. The lockstep evaluation walks every
+// child's word list; the rarest-first evaluation walks the rarest list and does one or more seeks
+// into each of the other children for every word on it.
+PlanEstimate Near::estimate(const ConsolidatedIndex &ci) const {
+  size_t size = ci.zgramInfoSize();
+  size_t sum = 0;
+  for (const auto &child : children_) {
+    auto childSize = child->estimateSize(ci);
+    size = std::min(size, childSize);
+    sum += childSize;
+  }
+  if (strategy_ == Strategy::Lockstep) {
+    return {size, sum};
+  }
+  return {size, std::min(sum, size * (children_.size() + 1))};
 }
 
 void Near::dump(std::ostream &s) const {
   streamf(s, "Near(%o, %o)", margin_, dumpDeref(children_.begin(), children_.end(), "[", "]", ", "));
 }
 
-MyState::MyState(size_t margin, std::unique_ptr<WordStreamer[]> &&streamers,
+namespace {
+LockstepState::LockstepState(size_t margin, std::unique_ptr<WordStreamer[]> &&streamers,
     size_t numStreamers) : margin_(margin),
     streamers_(std::move(streamers)), numStreamers_(numStreamers) {}
-MyState::~MyState() = default;
+LockstepState::~LockstepState() = default;
 
-size_t MyState::getMore(const IteratorContext &ctx, zgramRel_t *result, size_t capacity) {
+size_t LockstepState::getMore(const IteratorContext &ctx, zgramRel_t *result, size_t capacity) {
   const auto &ci = ctx.ci();
   auto bounds = ctx.getIndexZgBoundsRel();
   for (size_t i = 0; i < capacity; ++i) {
@@ -138,7 +231,7 @@ size_t MyState::getMore(const IteratorContext &ctx, zgramRel_t *result, size_t c
     }
     auto wordLowerBound = ctx.getWordBoundsRel(ci.getZgramInfo(ctx.relToOff(nextStart_))).first;
     zgramRel_t zgr;
-    if (!getNextResult(ctx, &zgr, wordLowerBound)) {
+    if (!getNextResult(ctx, &zgr, wordLowerBound) || ctx.outOfBudget()) {
       return i;
     }
     result[i] = zgr;
@@ -147,7 +240,7 @@ size_t MyState::getMore(const IteratorContext &ctx, zgramRel_t *result, size_t c
   return capacity;
 }
 
-bool MyState::getNextResult(const IteratorContext &ctx, zgramRel_t *result,
+bool LockstepState::getNextResult(const IteratorContext &ctx, zgramRel_t *result,
     wordRel_t wordLowerBound) {
   passert(numStreamers_ >= 2);
   wordRel_t positions[numStreamers_];
@@ -204,6 +297,12 @@ bool MyState::getNextResult(const IteratorContext &ctx, zgramRel_t *result,
         // Overshot. Tell the method to keep trying.
         return EnforceResult::Continue;
       }
+      // The children to our left need to be measured against where we are now. We may also have
+      // backed into the previous field.
+      positions[lIndex] = newRel;
+      if (ctx.ci().getWordInfo(ctx.relToOff(newRel)) != ctx.ci().getWordInfo(ctx.relToOff(rpos))) {
+        return EnforceResult::Continue;
+      }
     }
 
     return EnforceResult::Valid;
@@ -248,5 +347,117 @@ bool MyState::getNextResult(const IteratorContext &ctx, zgramRel_t *result,
     notreached;
   }
 }
-}  // namespace z2kplus::backend::reverse_index::iterators::boundary
 
+RarestFirstState::RarestFirstState(size_t margin, std::vector<const WordIterator*> children,
+    std::vector<std::unique_ptr<WordIteratorState>> childStates, size_t anchorIndex,
+    WordStreamer anchor) : margin_(margin), children_(std::move(children)),
+    childStates_(std::move(childStates)), anchorIndex_(anchorIndex), anchor_(std::move(anchor)) {}
+RarestFirstState::~RarestFirstState() = default;
+
+// Stream the anchor's words, starting at the first word of the 'nextStart_' zgram. For each one,
+// try to place the remaining children around it. On success the whole zgram matches, so skip to the
+// next one.
+size_t RarestFirstState::getMore(const IteratorContext &ctx, zgramRel_t *result, size_t capacity) {
+  const auto &ci = ctx.ci();
+  auto bounds = ctx.getIndexZgBoundsRel();
+  size_t i = 0;
+  while (i != capacity && nextStart_ != bounds.second) {
+    auto wordLowerBound = ctx.getWordBoundsRel(ci.getZgramInfo(ctx.relToOff(nextStart_))).first;
+    wordRel_t anchorPos;
+    while (true) {
+      if (!anchor_.tryGetOrAdvance(ctx, wordLowerBound, &anchorPos)) {
+        return i;
+      }
+      auto verified = verify(ctx, anchorPos);
+      // Failed seeks look like non-matches, so don't trust anything computed after a trip.
+      if (ctx.outOfBudget()) {
+        return i;
+      }
+      if (verified) {
+        break;
+      }
+      // Every zgram before this anchor's has run out of anchors, so none of them match.
+      nextStart_ = ctx.offToRel(ci.getWordInfo(ctx.relToOff(anchorPos)).zgramOff());
+      wordLowerBound = anchorPos.addRaw(1);
+    }
+    auto zgr = ctx.offToRel(ci.getWordInfo(ctx.relToOff(anchorPos)).zgramOff());
+    result[i++] = zgr;
+    nextStart_ = zgr.addRaw(1);
+  }
+  return i;
+}
+
+bool RarestFirstState::verify(const IteratorContext &ctx, wordRel_t anchorPos) {
+  if (margin_ == 1) {
+    return verifyExact(ctx, anchorPos);
+  }
+  const auto &ci = ctx.ci();
+  const auto &wi = ci.getWordInfo(ctx.relToOff(anchorPos));
+  auto fieldBounds = ctx.getFieldBoundsRel(ci.getZgramInfo(wi.zgramOff()), wi.fieldTag());
+  // Once the anchor is fixed, the two sides are independent of each other.
+  return (anchorIndex_ == 0 || extendLeft(ctx, anchorIndex_ - 1, anchorPos, fieldBounds.first)) &&
+      extendRight(ctx, anchorIndex_ + 1, anchorPos, fieldBounds.second);
+}
+
+// Exact phrase: every child has exactly one possible position, so there is nothing to search.
+bool RarestFirstState::verifyExact(const IteratorContext &ctx, wordRel_t anchorPos) {
+  const auto &ci = ctx.ci();
+  const auto &wi = ci.getWordInfo(ctx.relToOff(anchorPos));
+  auto fieldBounds = ctx.getFieldBoundsRel(ci.getZgramInfo(wi.zgramOff()), wi.fieldTag());
+  if (anchorPos.raw() - fieldBounds.first.raw() < anchorIndex_ ||
+      fieldBounds.second.raw() - anchorPos.raw() < children_.size() - anchorIndex_) {
+    // The phrase doesn't fit in the field.
+    return false;
+  }
+  auto start = anchorPos.subtractRaw(anchorIndex_);
+  for (size_t i = 0; i < children_.size(); ++i) {
+    if (i == anchorIndex_) {
+      continue;
+    }
+    auto target = start.addRaw(i);
+    wordRel_t found;
+    if (!children_[i]->trySeek(ctx, childStates_[i].get(), target, &found) || found != target) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Place child 'index' (and, recursively, the children to its left) within 'margin_' words before
+// 'rightPos', without leaving the field.
+bool RarestFirstState::extendLeft(const IteratorContext &ctx, size_t index, wordRel_t rightPos,
+    wordRel_t fieldBegin) {
+  auto lo = rightPos.raw() - fieldBegin.raw() > margin_ ? rightPos.subtractRaw(margin_) : fieldBegin;
+  const auto *child = children_[index];
+  auto *childState = childStates_[index].get();
+  wordRel_t pos;
+  for (auto target = lo; child->trySeek(ctx, childState, target, &pos) && pos < rightPos;
+      target = pos.addRaw(1)) {
+    if (index == 0 || extendLeft(ctx, index - 1, pos, fieldBegin)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Place child 'index' (and, recursively, the children to its right) within 'margin_' words after
+// 'leftPos', without leaving the field.
+bool RarestFirstState::extendRight(const IteratorContext &ctx, size_t index, wordRel_t leftPos,
+    wordRel_t fieldEnd) {
+  if (index == children_.size()) {
+    return true;
+  }
+  auto hi = std::min(leftPos.addRaw(margin_), fieldEnd.subtractRaw(1));
+  const auto *child = children_[index];
+  auto *childState = childStates_[index].get();
+  wordRel_t pos;
+  for (auto target = leftPos.addRaw(1); child->trySeek(ctx, childState, target, &pos) && pos <= hi;
+      target = pos.addRaw(1)) {
+    if (extendRight(ctx, index + 1, pos, fieldEnd)) {
+      return true;
+    }
+  }
+  return false;
+}
+}  // namespace
+}  // namespace z2kplus::backend::reverse_index::iterators::boundary
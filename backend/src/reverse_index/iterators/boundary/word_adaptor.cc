@@ -65,6 +65,11 @@ size_t WordAdaptor::getMore(const IteratorContext &ctx, ZgramIteratorState *stat
   return ms->getMore(ctx, child_.get(), lowerBound, result, capacity);
 }
 
+PlanEstimate WordAdaptor::estimate(const ConsolidatedIndex &ci) const {
+  auto words = child_->estimateSize(ci);
+  return {std::min(words, ci.zgramInfoSize()), words};
+}
+
 void WordAdaptor::dump(std::ostream &s) const {
   streamf(s, "Adapt(%o)", *child_);
 }
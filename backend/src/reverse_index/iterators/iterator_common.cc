@@ -23,6 +23,30 @@ using kosak::coding::streamf;
 
 namespace z2kplus::backend::reverse_index::iterators {
 
+QueryBudget::QueryBudget(std::chrono::steady_clock::time_point deadline, size_t maxPostings) :
+    deadline_(deadline), maxPostings_(maxPostings) {}
+QueryBudget::~QueryBudget() = default;
+
+bool QueryBudget::exhausted() {
+  if (tripped_) {
+    return true;
+  }
+  if (postingsTouched_ > maxPostings_) {
+    tripped_ = true;
+    return true;
+  }
+  if (++pollCount_ % pollInterval != 0) {
+    return false;
+  }
+  tripped_ = std::chrono::steady_clock::now() >= deadline_;
+  return tripped_;
+}
+
+std::ostream &operator<<(std::ostream &s, const QueryBudget &o) {
+  return streamf(s, "[tripped=%o, postings=%o, trieNodes=%o]", o.tripped_, o.postingsTouched_,
+      o.trieNodesMatched_);
+}
+
 std::pair<wordRel_t, wordRel_t> IteratorContext::getFieldBoundsRel(const ZgramInfo &zgInfo,
     FieldTag fieldTag) const {
   // paranoia
@@ -88,6 +112,12 @@ bool WordIteratorState::updateNextStart(const IteratorContext &ctx, wordRel_t lo
 
 ZgramIterator::~ZgramIterator() = default;
 
+bool WordIterator::trySeek(const IteratorContext &ctx, WordIteratorState */*state*/, wordRel_t target,
+    wordRel_t *result) const {
+  auto temp = createState(ctx);
+  return getMore(ctx, temp.get(), target, result, 1) != 0;
+}
+
 // This method is biased towards finding the lower bound in the next few items
 namespace {
 template<typename Iterator, typename Key>
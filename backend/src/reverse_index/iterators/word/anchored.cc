@@ -71,6 +71,17 @@ size_t Anchored::getMore(const IteratorContext &ctx, WordIteratorState *state, w
   }
 }
 
+bool Anchored::trySeek(const IteratorContext &ctx, WordIteratorState *state, wordRel_t target,
+    wordRel_t *result) const {
+  while (child_->trySeek(ctx, state, target, result)) {
+    if (applyFilter(ctx, state, result, 1) != 0) {
+      return true;
+    }
+    target = result->addRaw(1);
+  }
+  return false;
+}
+
 size_t Anchored::applyFilter(const IteratorContext &ctx, WordIteratorState *state,
     wordRel_t *result, size_t size) const {
   // the src and dest buffers overlap
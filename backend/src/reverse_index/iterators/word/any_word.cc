@@ -52,6 +52,23 @@ size_t AnyWord::getMore(const IteratorContext &ctx, WordIteratorState *state, wo
   return ms->getMore(ctx, fieldMask_, result, capacity);
 }
 
+bool AnyWord::trySeek(const IteratorContext &ctx, WordIteratorState */*state*/, wordRel_t target,
+    wordRel_t *result) const {
+  if (fieldMask_ == FieldMask::none) {
+    return false;
+  }
+  auto wordEnd = ctx.getIndexWordBoundsRel().second;
+  const auto &ci = ctx.ci();
+  for (auto current = target; current < wordEnd; current = current.addRaw(1)) {
+    const auto &wi = ci.getWordInfo(ctx.relToOff(current));
+    if (IteratorUtils::MaskContains(fieldMask_, wi.fieldTag())) {
+      *result = current;
+      return true;
+    }
+  }
+  return false;
+}
+
 void AnyWord::dump(std::ostream &s) const {
   streamf(s, "AnyWord(%o)", fieldMask_);
 }
@@ -20,6 +20,7 @@
 #include "kosak/coding/merger.h"
 #include "z2kplus/backend/reverse_index/iterators/word/any_word.h"
 #include "z2kplus/backend/reverse_index/index/consolidated_index.h"
+#include "z2kplus/backend/shared/magic_constants.h"
 #include "z2kplus/backend/shared/zephyrgram.h"
 #include "z2kplus/backend/util/automaton/automaton.h"
 
@@ -30,10 +31,17 @@ using kosak::coding::merger::Merger;
 using z2kplus::backend::reverse_index::index::ConsolidatedIndex;
 using z2kplus::backend::util::automaton::FiniteAutomaton;
 
+namespace magicConstants = z2kplus::backend::shared::magicConstants;
+
 namespace {
+typedef std::vector<std::pair<const wordOff_t *, const wordOff_t *>> spans_t;
+
 struct MyState : public WordIteratorState {
-  size_t getMore(const IteratorContext &ctx, FieldMask fieldMask,
-      const FiniteAutomaton &dfa, wordRel_t *result, size_t capacity);
+  size_t getMore(const IteratorContext &ctx, FieldMask fieldMask, const spans_t &frozenSpans,
+      const spans_t &dynamicSpans, wordRel_t *result, size_t capacity);
+
+  bool trySeek(const IteratorContext &ctx, FieldMask fieldMask, const spans_t &frozenSpans,
+      const spans_t &dynamicSpans, wordRel_t target, wordRel_t *result);
 };
 }  // namespace
 
@@ -93,10 +101,67 @@ size_t Pattern::getMore(const IteratorContext &ctx, WordIteratorState *state, wo
     return 0;
   }
   auto *ms = dynamic_cast<MyState*>(state);
-  if (!ms->updateNextStart(ctx, lowerBound, capacity)) {
+  if (!ms->updateNextStart(ctx, lowerBound, capacity) || ctx.outOfBudget() ||
+      !tryRefreshMatches(ctx)) {
+    return 0;
+  }
+  return ms->getMore(ctx, fieldMask_, matches_.frozenSpans_, matches_.dynamicSpans_, result,
+      capacity);
+}
+
+bool Pattern::trySeek(const IteratorContext &ctx, WordIteratorState *state, wordRel_t target,
+    wordRel_t *result) const {
+  if (fieldMask_ == FieldMask::none || ctx.outOfBudget() || !tryRefreshMatches(ctx)) {
+    return false;
+  }
+  auto *ms = dynamic_cast<MyState*>(state);
+  return ms->trySeek(ctx, fieldMask_, matches_.frozenSpans_, matches_.dynamicSpans_, target,
+      result);
+}
+
+// The trie counts occurrences in all fields, so this is an upper bound when 'fieldMask_' is narrower.
+// This runs for every Pattern when a query is planned, outside of any query budget, so a pattern
+// that would take a long walk of the trie (like *foo) just gets the trivial bound instead.
+size_t Pattern::estimateSize(const ConsolidatedIndex &ci) const {
+  if (fieldMask_ == FieldMask::none) {
     return 0;
   }
-  return ms->getMore(ctx, fieldMask_, dfa_, result, capacity);
+  size_t result;
+  if (!ci.tryCountMatching(dfa_, magicConstants::maxEstimateTrieNodes, &result)) {
+    return ci.wordInfoSize();
+  }
+  return result;
+}
+
+bool Pattern::tryRefreshMatches(const IteratorContext &ctx) const {
+  const auto &ci = ctx.ci();
+  auto &m = matches_;
+  if (m.generation_ != ci.generation()) {
+    m = Matches();
+    m.generation_ = ci.generation();
+    m.dynamicWordSize_ = ci.wordInfoSize();
+  } else if (m.dynamicWordSize_ != ci.wordInfoSize()) {
+    // Words have been added to the dynamic index since we last looked. The frozen spans are still
+    // good, but the dynamic trie needs to be walked again from the top.
+    m.dynamicSpans_.clear();
+    m.dynamicWordSize_ = ci.wordInfoSize();
+    if (m.position_.inDynamic_) {
+      m.position_.path_.clear();
+      m.done_ = false;
+    }
+  }
+  if (m.done_) {
+    return true;
+  }
+  auto outOfBudget = [&ctx]() { return ctx.outOfBudget(); };
+  auto cb = [&m](const wordOff_t *begin, const wordOff_t *end) {
+    if (begin != end) {
+      auto &spans = m.position_.inDynamic_ ? m.dynamicSpans_ : m.frozenSpans_;
+      spans.emplace_back(begin, end);
+    }
+  };
+  m.done_ = ci.tryFindMatching(dfa_, &outOfBudget, &m.position_, &cb);
+  return m.done_;
 }
 
 void Pattern::dump(std::ostream &s) const {
@@ -105,20 +170,61 @@ void Pattern::dump(std::ostream &s) const {
 
 namespace {
 size_t MyState::getMore(const IteratorContext &ctx, FieldMask fieldMask,
-    const FiniteAutomaton &dfa, wordRel_t *result, size_t capacity) {
+    const spans_t &frozenSpans, const spans_t &dynamicSpans, wordRel_t *result, size_t capacity) {
   auto nextStartOff = ctx.relToOff(nextStart_);
   MyCallback cb(ctx, fieldMask, nextStartOff, result, capacity);
-  ctx.ci().findMatching(dfa, &cb);
+  for (const auto *spans : {&frozenSpans, &dynamicSpans}) {
+    for (const auto &[begin, end] : *spans) {
+      cb(begin, end);
+    }
+  }
   auto newValue = cb.finish();
   nextStart_ = newValue;
   return cb.size();
 }
 
+// Binary search each matching posting list for the first eligible word at or after 'target', and
+// keep the smallest.
+bool MyState::trySeek(const IteratorContext &ctx, FieldMask fieldMask,
+    const spans_t &frozenSpans, const spans_t &dynamicSpans, wordRel_t target, wordRel_t *result) {
+  ctx.notePostings(frozenSpans.size() + dynamicSpans.size());
+  const auto &ci = ctx.ci();
+  auto targetOff = ctx.relToOff(target);
+  bool found = false;
+  auto accept = [&](wordOff_t wordOff) {
+    auto wordRel = ctx.offToRel(wordOff);
+    if (found && wordRel >= *result) {
+      // Neither this word nor any later one in this list can improve on what we have.
+      return true;
+    }
+    if (!IteratorUtils::MaskContains(fieldMask, ci.getWordInfo(wordOff).fieldTag())) {
+      return false;
+    }
+    *result = wordRel;
+    found = true;
+    return true;
+  };
+  for (const auto *spans : {&frozenSpans, &dynamicSpans}) {
+    for (const auto &[begin, end] : *spans) {
+      if (ctx.forward()) {
+        for (auto *p = std::lower_bound(begin, end, targetOff); p != end && !accept(*p); ++p) {
+        }
+      } else {
+        for (auto *p = std::upper_bound(begin, end, targetOff); p != begin && !accept(p[-1]);
+            --p) {
+        }
+      }
+    }
+  }
+  return found;
+}
+
 MyCallback::MyCallback(const IteratorContext &ctx, FieldMask fieldMask,
     wordOff_t nextStartOff, wordRel_t *buffer, size_t capacity) : ctx_(ctx), fieldMask_(fieldMask),
     nextStartOff_(nextStartOff), buffer_(buffer), capacity_(capacity), size_(0) {}
 
 void MyCallback::operator()(const wordOff_t *begin, const wordOff_t *end) {
+  ctx_.notePostings(end - begin);
   if (begin == end) {
     return;
   }
@@ -89,9 +89,14 @@ size_t And::getMore(const IteratorContext &ctx, ZgramIteratorState *state, zgram
     return 0;
   }
   for (size_t i = 0; i < capacity; ++i) {
+    // A child that ran out of budget looks exhausted, so after a trip a failure means nothing. But
+    // a candidate is real even then, because every child produced it.
     if (!ms->getNextResult(ctx, &result[i])) {
       return i;
     }
+    if (ctx.outOfBudget()) {
+      return i + 1;
+    }
   }
   return capacity;
 }
@@ -101,6 +106,11 @@ bool And::tryReleaseAndChildren(std::vector<std::unique_ptr<ZgramIterator>> *res
   return true;
 }
 
+bool And::isSensitiveToMetadata() const {
+  return std::any_of(children_.begin(), children_.end(),
+      [](const std::unique_ptr<ZgramIterator> &child) { return child->isSensitiveToMetadata(); });
+}
+
 void And::dump(std::ostream &s) const {
   streamf(s, "And(%o)", dumpDeref(children_.begin(), children_.end(), "[", "]", ", "));
 }
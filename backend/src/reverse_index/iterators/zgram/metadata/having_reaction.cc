@@ -14,11 +14,11 @@
 
 #include "z2kplus/backend/reverse_index/iterators/zgram/metadata/having_reaction.h"
 
+#include <iterator>
 #include <map>
 #include <memory>
 #include <utility>
 
-#include "kosak/coding/map_utils.h"
 #include "z2kplus/backend/reverse_index/iterators/iterator_common.h"
 #include "z2kplus/backend/shared/zephyrgram.h"
 #include "z2kplus/backend/util/misc.h"
@@ -26,12 +26,11 @@
 
 namespace z2kplus::backend::reverse_index::iterators::zgram::metadata {
 
-using kosak::coding::maputils::tryFind;
-using kosak::coding::merger::Merger;
 using kosak::coding::streamf;
 using z2kplus::backend::shared::ZgramId;
 using z2kplus::backend::reverse_index::metadata::DynamicMetadata;
 using z2kplus::backend::reverse_index::metadata::FrozenMetadata;
+using z2kplus::backend::reverse_index::metadata::FrozenReactionCounts;
 
 namespace {
 struct MyState final : public ZgramIteratorState {
@@ -65,136 +64,130 @@ size_t HavingReaction::getMore(const IteratorContext &ctx, ZgramIteratorState *s
   return ms->getMore(ctx, result, capacity);
 }
 
+PlanEstimate HavingReaction::estimate(const ConsolidatedIndex &ci) const {
+  const auto &fi = ci.frozenIndex();
+  const FrozenReactionCounts *fInner;
+  size_t size = 0;
+  if (fi.metadata().reactionCounts().tryFind(reaction_, &fInner, fi.makeLess())) {
+    size += fInner->size();
+  }
+  const auto *dInner = ci.dynamicIndex().metadata().findReactionCounts(reaction_);
+  if (dInner != nullptr) {
+    size += dInner->size();
+  }
+  return {size, size};
+}
+
 void HavingReaction::dump(std::ostream &s) const {
   streamf(s, "HavingReaction(%o)", reaction_);
 }
 
 namespace {
-template<typename Iter>
-struct advancer_t {
-  advancer_t(bool forward, Iter begin, Iter end) : forward_(forward), begin_(begin), end_(end) {}
+// Walks the frozen bitmap and the dynamic counts together, in the direction of 'ctx', starting at
+// 'startOff'. The frozen side is already keyed by zgramOff; the dynamic side is keyed by ZgramId
+// and has to be looked up. A dynamic count for a frozen zgram is a delta on top of the frozen
+// count, so where both sides have the same zgram we emit it only if the sum is nonzero.
+template<typename DITER>
+size_t mergeHelper(const IteratorContext &ctx, const FrozenReactionCounts *fCounts,
+    uint32_t startOff, DITER dCurrent, DITER dEnd, zgramRel_t *result, size_t capacity) {
+  const auto &ci = ctx.ci();
+  const bool fwd = ctx.forward();
+  auto before = [fwd](uint32_t lhs, uint32_t rhs) {
+    return fwd ? lhs < rhs : lhs > rhs;
+  };
 
-  Iter operator()(Iter ip) const {
-    if (forward_) {
-      return std::next(ip);
-    }
-    if (ip == begin_) {
-      return end_;
+  // The frozen member at or beyond 'off' in our direction, and its rank, which we then maintain
+  // incrementally rather than recomputing.
+  uint32_t fOff = 0;
+  size_t fRank = 0;
+  bool haveF = false;
+  if (fCounts != nullptr) {
+    const auto &bitmap = fCounts->zgramOffs();
+    haveF = fwd ? bitmap.tryFindNext(startOff, &fOff) : bitmap.tryFindPrev(startOff, &fOff);
+    if (haveF) {
+      fRank = bitmap.rank(fOff);
     }
-    return std::prev(ip);
   }
+  auto advanceF = [&]() {
+    const auto &bitmap = fCounts->zgramOffs();
+    if (fwd) {
+      haveF = fOff != UINT32_MAX && bitmap.tryFindNext(fOff + 1, &fOff);
+      ++fRank;
+    } else {
+      haveF = fOff != 0 && bitmap.tryFindPrev(fOff - 1, &fOff);
+      --fRank;
+    }
+  };
 
-  bool forward_;
-  Iter begin_;
-  Iter end_;
-};
+  // Dynamic entries for zgrams that aren't in the index are skipped.
+  uint32_t dOff = 0;
+  auto tryResolveD = [&]() {
+    for (; dCurrent != dEnd; ++dCurrent) {
+      zgramOff_t zgOff;
+      if (ci.tryFind(dCurrent->first, &zgOff)) {
+        dOff = zgOff.raw();
+        return true;
+      }
+    }
+    return false;
+  };
+  bool haveD = tryResolveD();
+
+  size_t numItems = 0;
+  while (numItems != capacity && (haveF || haveD)) {
+    auto takeF = haveF && (!haveD || !before(dOff, fOff));
+    auto takeD = haveD && (!haveF || !before(fOff, dOff));
+    auto off = takeF ? fOff : dOff;
+    int64_t total = 0;
+    if (takeF) {
+      total += fCounts->countAt(fRank);
+      advanceF();
+    }
+    if (takeD) {
+      total += dCurrent->second;
+      ++dCurrent;
+      haveD = tryResolveD();
+    }
+    if (total != 0) {
+      result[numItems++] = ctx.offToRel(zgramOff_t(off));
+    }
+  }
+  return numItems;
+}
 
 size_t MyState::getMore(const IteratorContext &ctx, zgramRel_t *result, size_t capacity) {
-  typedef FrozenMetadata::reactionCounts_t::mapped_type fInner_t;
-  typedef DynamicMetadata::reactionCounts_t::mapped_type dInner_t;
-  fInner_t fEmpty;
-  dInner_t  dEmpty;
-  const fInner_t *fInnerToUse;
-  const dInner_t *dInnerToUse;
+  typedef DynamicMetadata::reactionCounts_t dInner_t;
+  dInner_t dEmpty;
   const auto &ci = ctx.ci();
   const auto &fi = ci.frozenIndex();
-  if (!fi.metadata().reactionCounts().tryFind(owner_->reaction(), &fInnerToUse, fi.makeLess())) {
-    fInnerToUse = &fEmpty;
+  const FrozenReactionCounts *fCounts;
+  if (!fi.metadata().reactionCounts().tryFind(owner_->reaction(), &fCounts, fi.makeLess())) {
+    fCounts = nullptr;
   }
-  if (!tryFind(ci.dynamicIndex().metadata().reactionCounts(), owner_->reaction(), &dInnerToUse)) {
-    dInnerToUse = &dEmpty;
+  const auto *dCounts = ci.dynamicIndex().metadata().findReactionCounts(owner_->reaction());
+  if (dCounts == nullptr) {
+    dCounts = &dEmpty;
   }
 
-  auto nextZgramId = ci.getZgramInfo(ctx.relToOff(this->nextStart_)).zgramId();
+  auto startOff = ctx.relToOff(this->nextStart_).raw();
+  auto startZgramId = ci.getZgramInfo(zgramOff_t(startOff)).zgramId();
 
-  // The trick in this code is that we are going to try to do use the same code to iterate either
-  // forward or backward, rather than two versions, one of which would use forward iterators and
-  // the other of which would use reverse iterators.
-  //
-  // Since std::map has bidirectional iterators, this should be easy enough: you iterate backwards
-  // starting at std::prev(end) and ending at a point one beyond begin. Conceptually you would
-  // use a sentinel like std::prev(begin) but such a thing is invalid. What we do is define our
-  // own version of prev, where std::prev(begin) is defined to be end.
-  auto fRange = fInnerToUse->equal_range(nextZgramId);
-  auto dRange = dInnerToUse->equal_range(nextZgramId);
-
-  // If going forward, the next place to look is (fRange or dRange).begin
-  // If going backward, the next place to look is prev((fRange or dRange).end)
-
-  // The other clever trick is, if going backwards, we define prev(begin) == end.
-  // This way our termination condition is simple -- we can compare to 'end' regardless of the
-  // direction we are going.
-
-  advancer_t<fInner_t::const_iterator> fAdvancer(ctx.forward(), fInnerToUse->begin(), fInnerToUse->end());
-  advancer_t<dInner_t::const_iterator> dAdvancer(ctx.forward(), dInnerToUse->begin(), dInnerToUse->end());
-
-  fInner_t::const_iterator fCurrent, fEnd;
-  dInner_t::const_iterator dCurrent, dEnd;
+  // Going forward we want the dynamic entries at or after 'startZgramId'; going backward we want
+  // the ones at or before it, in reverse order.
+  size_t numItems;
   if (ctx.forward()) {
-    // For f, the range we need to process is [fRange.first, fInnerToUse.end)
-    // Likewise for d.
-    fCurrent = fRange.first;
-    dCurrent = dRange.first;
-
-    fEnd = fInnerToUse->end();
-    dEnd = dInnerToUse->end();
+    numItems = mergeHelper(ctx, fCounts, startOff, dCounts->lower_bound(startZgramId),
+        dCounts->end(), result, capacity);
   } else {
-    // Wrapping our heads around the concept of using the iterators to go backwards:
-    // For f, the range we need to process is [prev(fRange.second), prev(fInnerToUse->begin)
-    // Likewise for d.
-    // But this is with the proviso that our "prev" code wraps around at
-    // the very beginning of the map... in other words it defines prev(map.begin()) as map.end().
-    fCurrent = fAdvancer(fRange.second);
-    dCurrent = dAdvancer(dRange.second);
-
-    fEnd = fAdvancer(fInnerToUse->begin());
-    dEnd = dAdvancer(dInnerToUse->begin());
-  }
-
-  auto *outputCurrent = result;
-  const auto *outputEnd = result + capacity;
-
-  const bool fwd = ctx.forward();
-  auto compare = [fwd](const ZgramId &lhs, const ZgramId &rhs) {
-    return fwd ? lhs.compare(rhs) : rhs.compare(lhs);
-  };
-
-  auto maybeEmit = [&ctx, &outputCurrent](const ZgramId &zgramId, int32_t total) {
-    zgramOff_t zgOff;
-    if (total != 0 && ctx.ci().tryFind(zgramId, &zgOff)) {
-      *outputCurrent++ = ctx.offToRel(zgOff);
-    }
-  };
-
-  while (fCurrent != fEnd && dCurrent != dEnd && outputCurrent != outputEnd) {
-    auto cmp = compare(fCurrent->first, dCurrent->first);
-    if (cmp < 0) {
-      maybeEmit(fCurrent->first, fCurrent->second);
-    } else {
-      // if cmp == 0 or > 0
-      maybeEmit(dCurrent->first, dCurrent->second);
-      dCurrent = dAdvancer(dCurrent);
-    }
-    if (cmp <= 0) {
-      fCurrent = fAdvancer(fCurrent);
-    }
-  }
-
-  while (fCurrent != fEnd && outputCurrent != outputEnd) {
-    maybeEmit(fCurrent->first, fCurrent->second);
-    fCurrent = fAdvancer(fCurrent);
-  }
-
-  while (dCurrent != dEnd && outputCurrent != outputEnd) {
-    maybeEmit(dCurrent->first, dCurrent->second);
-    dCurrent = dAdvancer(dCurrent);
+    numItems = mergeHelper(ctx, fCounts, startOff,
+        std::make_reverse_iterator(dCounts->upper_bound(startZgramId)), dCounts->rend(), result,
+        capacity);
   }
 
-  auto numItems = outputCurrent - result;
   if (numItems == 0) {
     nextStart_ = ctx.getIndexZgBoundsRel().second;
   } else {
-    nextStart_ = outputCurrent[-1].addRaw(1);
+    nextStart_ = result[numItems - 1].addRaw(1);
   }
   return numItems;
 }
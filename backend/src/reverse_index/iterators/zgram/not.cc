@@ -73,6 +73,10 @@ size_t MyState::getMore(const IteratorContext &ctx, zgramRel_t *result, size_t c
       if (streamer_.tryGetOrAdvance(ctx, nextStart_, &temp)) {
         lastChildHit_ = temp;
       }
+      // If the budget tripped, the child may have falsely reported exhaustion.
+      if (ctx.outOfBudget()) {
+        return i;
+      }
     }
     while (true) {
       if (i == capacity || nextStart_ == zgEnd) {
@@ -14,6 +14,7 @@
 
 #include "z2kplus/backend/reverse_index/iterators/zgram/or.h"
 
+#include <algorithm>
 #include "kosak/coding/dumping.h"
 #include "z2kplus/backend/reverse_index/iterators/zgram/popornot.h"
 #include "z2kplus/backend/util/misc.h"
@@ -65,10 +66,6 @@ std::unique_ptr<ZgramIterator> Or::create(std::vector<std::unique_ptr<ZgramItera
   if (result.size() == 1) {
     return std::move(result[0]);
   }
-//  bool sensitive = result.end() != std::find_if(result.begin(), result.end(),
-//    [](const unique_ptr<ZgramIterator> &uz) {
-//      return uz->isSensitiveToMetadata();
-//    });
   result.shrink_to_fit();
   return std::make_unique<Or>(Private(), std::move(result));
 }
@@ -98,13 +95,19 @@ size_t Or::getMore(const IteratorContext &ctx, ZgramIteratorState *state, zgramR
     return 0;
   }
   for (size_t i = 0; i < capacity; ++i) {
-    if (!ms->getNextResult(ctx, &result[i])) {
+    // If the budget tripped while we were working, a child may have falsely reported exhaustion.
+    if (!ms->getNextResult(ctx, &result[i]) || ctx.outOfBudget()) {
       return i;
     }
   }
   return capacity;
 }
 
+bool Or::isSensitiveToMetadata() const {
+  return std::any_of(children_.begin(), children_.end(),
+      [](const std::unique_ptr<ZgramIterator> &child) { return child->isSensitiveToMetadata(); });
+}
+
 void Or::dump(std::ostream &s) const {
   streamf(s, "Or(%o)", dumpDeref(children_.begin(), children_.end(), "[", "]", ", "));
 }
@@ -127,7 +130,8 @@ bool MyState::getNextResult(const IteratorContext &ctx, zgramRel_t *result) {
       minValue = thisValue;
     }
   }
-  if (!minValue.has_value()) {
+  // After a trip, a child that claimed exhaustion may have been hiding a smaller value.
+  if (!minValue.has_value() || ctx.outOfBudget()) {
     return false;
   }
   *result = *minValue;
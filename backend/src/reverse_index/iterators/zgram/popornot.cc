@@ -73,7 +73,8 @@ size_t PopOrNot::getMore(const IteratorContext &ctx, ZgramIteratorState *state,
   }
   auto zgEnd = ctx.getIndexZgBoundsRel().second;
   for (size_t i = 0; i < capacity; ++i) {
-    if (!ms->getNextResult(ctx, zgEnd, &result[i])) {
+    // Check the budget first: getNextResult steps past what it returns.
+    if (ctx.outOfBudget() || !ms->getNextResult(ctx, zgEnd, &result[i])) {
       return i;
     }
   }
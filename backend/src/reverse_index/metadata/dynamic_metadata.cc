@@ -14,12 +14,16 @@
 
 #include "z2kplus/backend/reverse_index/metadata/dynamic_metadata.h"
 
-#include "kosak/coding/map_utils.h"
+#include <algorithm>
+#include <string_view>
+#include <tuple>
+#include <vector>
 #include "z2kplus/backend/reverse_index/index/frozen_index.h"
 
-using kosak::coding::maputils::tryFind;
 using z2kplus::backend::reverse_index::index::FrozenIndex;
+using z2kplus::backend::shared::RenderStyle;
 using z2kplus::backend::shared::ZgramId;
+using z2kplus::backend::util::frozen::FrozenStringPool;
 namespace userMetadata = z2kplus::backend::shared::userMetadata;
 namespace zgMetadata = z2kplus::backend::shared::zgMetadata;
 
@@ -30,6 +34,7 @@ bool lookupHelper(const FrozenIndex &frozenIndex, const DynamicMetadata &dynamic
 }  // namespace
 
 DynamicMetadata::DynamicMetadata() = default;
+DynamicMetadata::DynamicMetadata(const FrozenStringPool *frozenPool) : strings_(frozenPool) {}
 DynamicMetadata::DynamicMetadata(DynamicMetadata &&other) noexcept = default;
 DynamicMetadata &DynamicMetadata::operator=(DynamicMetadata &&other) noexcept = default;
 DynamicMetadata::~DynamicMetadata() = default;
@@ -41,30 +46,239 @@ bool DynamicMetadata::tryAddHelper(const FrozenIndex &lhs,
     // no change
     return true;
   }
-  reactions_[o.zgramId()][o.reaction()][o.creator()] = o.value();
+  auto reactionId = strings_.intern(o.reaction());
+  auto creatorId = strings_.intern(o.creator());
+  auto *slot = findOrCreateSlot(o.zgramId());
+  bool found = false;
+  for (auto i = slot->reactions_; i != noRecord; i = reactions_[i].next_) {
+    auto &rec = reactions_[i];
+    if (rec.reaction_ == reactionId && rec.creator_ == creatorId) {
+      rec.value_ = o.value();
+      found = true;
+      break;
+    }
+  }
+  if (!found) {
+    reactions_.push_back(ReactionRecord{reactionId, creatorId, o.value(), slot->reactions_});
+    slot->reactions_ = reactions_.size() - 1;
+  }
+
+  bool inserted;
+  auto countsIndex = reactionCountsIndex_.findOrInsert(reactionId, reactionCounts_.size(), &inserted);
+  if (inserted) {
+    reactionCounts_.emplace_back();
+  }
   auto delta = o.value() ? 1 : -1;
-  reactionCounts_[o.reaction()][o.zgramId()] += delta;
+  reactionCounts_[countsIndex][o.zgramId()] += delta;
   return true;
 }
 
 bool DynamicMetadata::tryAddHelper(const FrozenIndex &/*lhs*/,
     const zgMetadata::ZgramRevision &o, const FailFrame &/*ff*/) {
-  zgramRevisions_[o.zgramId()].push_back(o.zgc());
+  const auto &zgc = o.zgc();
+  RevisionRecord rec{strings_.intern(zgc.instance()), strings_.intern(zgc.body()),
+      zgc.renderStyle(), noRecord};
+  auto *slot = findOrCreateSlot(o.zgramId());
+  revisions_.push_back(rec);
+  uint32_t index = revisions_.size() - 1;
+  // Revisions are appended at the tail, because their order matters.
+  if (slot->revisionsTail_ == noRecord) {
+    slot->revisionsHead_ = index;
+  } else {
+    revisions_[slot->revisionsTail_].next_ = index;
+  }
+  slot->revisionsTail_ = index;
   return true;
 }
 
 bool DynamicMetadata::tryAddHelper(const FrozenIndex &/*lhs*/, const zgMetadata::ZgramRefersTo &o,
     const FailFrame &/*ff*/) {
-  zgramRefersTo_[o.zgramId()][o.refersTo()] = o.value();
+  auto *slot = findOrCreateSlot(o.zgramId());
+  for (auto i = slot->refersTo_; i != noRecord; i = refersTo_[i].next_) {
+    if (refersTo_[i].refersTo_ == o.refersTo()) {
+      refersTo_[i].value_ = o.value();
+      return true;
+    }
+  }
+  refersTo_.push_back(RefersToRecord{o.refersTo(), o.value(), slot->refersTo_});
+  uint32_t index = refersTo_.size() - 1;
+  slot->refersTo_ = index;
+  // This may move the slots, so 'slot' is dead from here on.
+  auto *targetSlot = findOrCreateSlot(o.refersTo());
+  referredBy_.push_back(ReferredByRecord{o.zgramId(), index, targetSlot->referredBy_});
+  targetSlot->referredBy_ = referredBy_.size() - 1;
   return true;
 }
 
 bool DynamicMetadata::tryAddHelper(const FrozenIndex &/*lhs*/,
     const userMetadata::Zmojis &o, const FailFrame &/*ff*/) {
-  zmojis_.insert_or_assign(o.userId(), o.zmojis());
+  zmojis_.insertOrAssign(strings_.intern(o.userId()), strings_.intern(o.zmojis()));
   return true;
 }
 
+void DynamicMetadata::addPlusPlusDelta(keyId_t keyId, ZgramId zgramId, int64_t count) {
+  auto *slot = findOrCreateSlot(zgramId);
+  bool haveKey = false;
+  for (auto i = slot->plusPlusKeys_; i != noRecord; i = plusPlusKeys_[i].next_) {
+    if (plusPlusKeys_[i].key_ == keyId) {
+      haveKey = true;
+      break;
+    }
+  }
+  if (!haveKey) {
+    plusPlusKeys_.push_back(PlusPlusKeyRecord{keyId, slot->plusPlusKeys_});
+    slot->plusPlusKeys_ = plusPlusKeys_.size() - 1;
+  }
+
+  bool inserted;
+  auto entriesIndex = plusPlusIndex_.findOrInsert(keyId, plusPlusEntries_.size(), &inserted);
+  if (inserted) {
+    plusPlusEntries_.emplace_back();
+  }
+  auto &entries = plusPlusEntries_[entriesIndex];
+
+  // Insert 'n' copies of zgramId, keeping 'vec' sorted.
+  auto addEntries = [zgramId](std::vector<ZgramId> *vec, size_t n) {
+    auto vecp = std::upper_bound(vec->begin(), vec->end(), zgramId);
+    vec->insert(vecp, n, zgramId);
+  };
+  if (count > 0) {
+    addEntries(&entries.pluses_, count);
+  } else if (count < 0) {
+    addEntries(&entries.minuses_, -count);
+  } else {
+    // This is a bit of a hack. If count == 0 we still want to to dependency tracking.
+    // So we add a balanced entry to both sides. Technically we would only need to do
+    // this if both plusPluses and minusMinuses are empty, but we don't bother with that
+    // optimization
+    addEntries(&entries.pluses_, 1);
+    addEntries(&entries.minuses_, 1);
+  }
+}
+
+bool DynamicMetadata::tryFindReaction(ZgramId zgramId, std::string_view reaction,
+    std::string_view creator, bool *value) const {
+  const auto *slot = findSlot(zgramId);
+  stringId_t reactionId, creatorId;
+  if (slot == nullptr || !strings_.tryFind(reaction, &reactionId) ||
+      !strings_.tryFind(creator, &creatorId)) {
+    return false;
+  }
+  for (auto i = slot->reactions_; i != noRecord; i = reactions_[i].next_) {
+    const auto &rec = reactions_[i];
+    if (rec.reaction_ == reactionId && rec.creator_ == creatorId) {
+      *value = rec.value_;
+      return true;
+    }
+  }
+  return false;
+}
+
+void DynamicMetadata::getReactions(ZgramId zgramId, std::vector<reaction_t> *result) const {
+  result->clear();
+  const auto *slot = findSlot(zgramId);
+  if (slot == nullptr) {
+    return;
+  }
+  for (auto i = slot->reactions_; i != noRecord; i = reactions_[i].next_) {
+    const auto &rec = reactions_[i];
+    result->emplace_back(strings_.toStringView(rec.reaction_), strings_.toStringView(rec.creator_),
+        rec.value_);
+  }
+  std::sort(result->begin(), result->end());
+}
+
+auto DynamicMetadata::findReactionCounts(std::string_view reaction) const -> const reactionCounts_t * {
+  stringId_t reactionId;
+  if (!strings_.tryFind(reaction, &reactionId)) {
+    return nullptr;
+  }
+  const auto *index = reactionCountsIndex_.tryFind(reactionId);
+  return index != nullptr ? &reactionCounts_[*index] : nullptr;
+}
+
+void DynamicMetadata::getZgramRevisions(ZgramId zgramId,
+    std::vector<zgramRevision_t> *result) const {
+  result->clear();
+  const auto *slot = findSlot(zgramId);
+  if (slot == nullptr) {
+    return;
+  }
+  for (auto i = slot->revisionsHead_; i != noRecord; i = revisions_[i].next_) {
+    const auto &rec = revisions_[i];
+    result->emplace_back(strings_.toStringView(rec.instance_), strings_.toStringView(rec.body_),
+        rec.renderStyle_);
+  }
+}
+
+void DynamicMetadata::getRefersTo(ZgramId zgramId, std::vector<zgramRefersTo_t> *result) const {
+  result->clear();
+  const auto *slot = findSlot(zgramId);
+  if (slot == nullptr) {
+    return;
+  }
+  for (auto i = slot->refersTo_; i != noRecord; i = refersTo_[i].next_) {
+    result->emplace_back(refersTo_[i].refersTo_, refersTo_[i].value_);
+  }
+  std::sort(result->begin(), result->end());
+}
+
+void DynamicMetadata::getReferredBy(ZgramId zgramId, std::vector<zgramRefersTo_t> *result) const {
+  result->clear();
+  const auto *slot = findSlot(zgramId);
+  if (slot == nullptr) {
+    return;
+  }
+  for (auto i = slot->referredBy_; i != noRecord; i = referredBy_[i].next_) {
+    const auto &rec = referredBy_[i];
+    result->emplace_back(rec.referrer_, refersTo_[rec.refersTo_].value_);
+  }
+  std::sort(result->begin(), result->end());
+}
+
+bool DynamicMetadata::tryFindZmojis(std::string_view userId, std::string_view *result) const {
+  stringId_t userIdId;
+  if (!strings_.tryFind(userId, &userIdId)) {
+    return false;
+  }
+  const auto *zmojisId = zmojis_.tryFind(userIdId);
+  if (zmojisId == nullptr) {
+    return false;
+  }
+  *result = strings_.toStringView(*zmojisId);
+  return true;
+}
+
+auto DynamicMetadata::findPlusPlusEntries(keyId_t key) const -> const PlusPlusEntries * {
+  const auto *index = plusPlusIndex_.tryFind(key);
+  return index != nullptr ? &plusPlusEntries_[*index] : nullptr;
+}
+
+void DynamicMetadata::getPlusPlusKeys(ZgramId zgramId, std::vector<keyId_t> *result) const {
+  result->clear();
+  const auto *slot = findSlot(zgramId);
+  if (slot == nullptr) {
+    return;
+  }
+  for (auto i = slot->plusPlusKeys_; i != noRecord; i = plusPlusKeys_[i].next_) {
+    result->push_back(plusPlusKeys_[i].key_);
+  }
+}
+
+auto DynamicMetadata::findSlot(ZgramId zgramId) const -> const ZgramSlot * {
+  const auto *index = slotIndex_.tryFind(zgramId.raw());
+  return index != nullptr ? &slots_[*index] : nullptr;
+}
+
+auto DynamicMetadata::findOrCreateSlot(ZgramId zgramId) -> ZgramSlot * {
+  bool inserted;
+  auto index = slotIndex_.findOrInsert(zgramId.raw(), slots_.size(), &inserted);
+  if (inserted) {
+    slots_.emplace_back();
+  }
+  return &slots_[index];
+}
+
 std::ostream &operator<<(std::ostream &s, const DynamicMetadata &o) {
   return s << "DynamicMetadata!!!\n";
 }
@@ -73,13 +287,9 @@ namespace {
 bool lookupHelper(const FrozenIndex &frozenIndex, const DynamicMetadata &dynamic,
     const ZgramId &zgramId, const std::string &reaction, const std::string &creator) {
   // If it's in the dynamic metadata, then that value (true or false) dominates
-  const DynamicMetadata::reactions_t::mapped_type *dInner1;
-  const DynamicMetadata::reactions_t::mapped_type::mapped_type *dInner2;
-  const bool *result;
-  if (tryFind(dynamic.reactions(), zgramId, &dInner1) &&
-    tryFind(*dInner1, reaction, &dInner2) &&
-    tryFind(*dInner2, creator, &result)) {
-    return *result;
+  bool result;
+  if (dynamic.tryFindReaction(zgramId, reaction, creator, &result)) {
+    return result;
   }
 
   // Otherwise look to the frozen metadata
@@ -16,8 +16,25 @@
 
 using z2kplus::backend::shared::ZgramId;
 using kosak::coding::limit;
+using kosak::coding::streamf;
 
 namespace z2kplus::backend::reverse_index::metadata {
+FrozenReactionCounts::FrozenReactionCounts(FrozenReactionCounts &&other) noexcept = default;
+FrozenReactionCounts &FrozenReactionCounts::operator=(FrozenReactionCounts &&other) noexcept = default;
+FrozenReactionCounts::~FrozenReactionCounts() = default;
+
+std::ostream &operator<<(std::ostream &s, const FrozenReactionCounts &o) {
+  return streamf(s, "{zgramOffs=%o, counts=%o}", o.zgramOffs_, o.counts_);
+}
+
+FrozenPlusPlusCounts::FrozenPlusPlusCounts(FrozenPlusPlusCounts &&other) noexcept = default;
+FrozenPlusPlusCounts &FrozenPlusPlusCounts::operator=(FrozenPlusPlusCounts &&other) noexcept = default;
+FrozenPlusPlusCounts::~FrozenPlusPlusCounts() = default;
+
+std::ostream &operator<<(std::ostream &s, const FrozenPlusPlusCounts &o) {
+  return streamf(s, "{zgramIds=%o, cumulative=%o}", o.zgramIds_, o.cumulative_);
+}
+
 FrozenMetadata::FrozenMetadata() = default;
 FrozenMetadata::FrozenMetadata(FrozenMetadata &&other) noexcept = default;
 FrozenMetadata &FrozenMetadata::operator=(FrozenMetadata &&other) noexcept = default;
@@ -0,0 +1,85 @@
+// Copyright 2023 The Z2K Plus+ Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "z2kplus/backend/reverse_index/metadata/id_table.h"
+
+#include "kosak/coding/coding.h"
+#include "kosak/coding/failures.h"
+#include "z2kplus/backend/shared/magic_constants.h"
+
+using kosak::coding::FailRoot;
+
+#define HERE KOSAK_CODING_HERE
+
+namespace magicConstants = z2kplus::backend::shared::magicConstants;
+
+namespace z2kplus::backend::reverse_index::metadata {
+IdTable::IdTable() = default;
+IdTable::IdTable(IdTable &&) noexcept = default;
+IdTable &IdTable::operator=(IdTable &&) noexcept = default;
+IdTable::~IdTable() = default;
+
+const uint32_t *IdTable::tryFind(uint64_t key) const {
+  const auto *entry = table_.tryFind(key);
+  return entry != nullptr ? &entry->value_ : nullptr;
+}
+
+uint32_t IdTable::findOrInsert(uint64_t key, uint32_t valueIfAbsent, bool *inserted) {
+  auto *entry = findOrInsertEntry(key, inserted);
+  if (*inserted) {
+    entry->value_ = valueIfAbsent;
+  }
+  return entry->value_;
+}
+
+void IdTable::insertOrAssign(uint64_t key, uint32_t value) {
+  bool inserted;
+  findOrInsertEntry(key, &inserted)->value_ = value;
+}
+
+IdTable::Entry *IdTable::findOrInsertEntry(uint64_t key, bool *inserted) {
+  // We don't give the table a MemoryTracker, so the only way these can fail is by running out of
+  // memory outright.
+  FailRoot fr;
+  if (table_.capacity() == 0 &&
+      !decltype(table_)::tryCreate(magicConstants::idTableInitialBuckets, 0.5, 2, 0, nullptr,
+          &table_, fr.nest(HERE))) {
+    crash("Failed to create IdTable: %o", fr);
+  }
+  auto slot = table_.findSlot(key);
+  *inserted = !slot.found();
+  if (*inserted) {
+    *slot.entry() = Entry{key, 0, true};
+    auto oldCapacity = table_.capacity();
+    if (!table_.tryFinishInsert(&slot, fr.nest(HERE))) {
+      crash("Failed to grow IdTable: %o", fr);
+    }
+    if (table_.capacity() != oldCapacity) {
+      // The rehash moved the entries.
+      slot = table_.findSlot(key);
+    }
+  }
+  return slot.entry();
+}
+
+std::pair<size_t, size_t> IdTable::Utils::hash(uint64_t key) {
+  // Two independent mixes (from splitmix64 and murmur3's finalizer), one for the starting index
+  // and one for the probe stride.
+  auto a = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  a ^= a >> 31;
+  auto b = (key ^ (key >> 33)) * 0xff51afd7ed558ccdULL;
+  b ^= b >> 33;
+  return {a, b};
+}
+}  // namespace z2kplus::backend::reverse_index::metadata
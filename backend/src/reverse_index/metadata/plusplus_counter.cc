@@ -0,0 +1,141 @@
+// Copyright 2023 The Z2K Plus+ Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "z2kplus/backend/reverse_index/metadata/plusplus_counter.h"
+
+#include <algorithm>
+#include <map>
+#include <vector>
+#include "kosak/coding/coding.h"
+
+using kosak::coding::streamf;
+using z2kplus::backend::shared::ZgramId;
+
+namespace z2kplus::backend::reverse_index::metadata {
+namespace {
+// The running total as of 'zgramId', given the sorted ids and their totals. Searches from 'hint',
+// which it leaves where the search ended, so that sorted probes can each start where the last one
+// left off.
+int64_t totalAsOf(const ZgramId *begin, const ZgramId *end, const int64_t *cumulative,
+    ZgramId zgramId, const ZgramId **hint) {
+  *hint = std::upper_bound(*hint, end, zgramId);
+  return *hint == begin ? 0 : cumulative[*hint - begin - 1];
+}
+}  // namespace
+
+PlusPlusCounter PlusPlusCounter::createFromFrozen(const FrozenMetadata &metadata,
+    const PlusPlusKeyDictionary &keys) {
+  PlusPlusCounter result;
+  result.frozen_.resize(keys.numFrozen(), nullptr);
+  for (const auto &[fsr, counts] : metadata.plusPlusCounts()) {
+    keyId_t key;
+    auto found = keys.tryFindFrozen(fsr, &key);
+    passert(found, fsr);
+    result.frozen_[key] = &counts;
+  }
+  return result;
+}
+
+PlusPlusCounter::PlusPlusCounter() = default;
+PlusPlusCounter::PlusPlusCounter(PlusPlusCounter &&) noexcept = default;
+PlusPlusCounter &PlusPlusCounter::operator=(PlusPlusCounter &&) noexcept = default;
+PlusPlusCounter::~PlusPlusCounter() = default;
+
+void PlusPlusCounter::add(keyId_t key, ZgramId zgramId, int64_t delta) {
+  if (delta == 0) {
+    return;
+  }
+  tails_[key].add(zgramId, delta);
+}
+
+int64_t PlusPlusCounter::countAfter(keyId_t key, ZgramId zgramId) const {
+  int64_t result = 0;
+  if (const auto *frozen = findFrozen(key); frozen != nullptr) {
+    const auto &ids = frozen->zgramIds();
+    const auto *hint = ids.begin();
+    result += totalAsOf(ids.begin(), ids.end(), frozen->cumulative().begin(), zgramId, &hint);
+  }
+  if (const auto *tail = findTail(key); tail != nullptr) {
+    result += tail->countAfter(zgramId);
+  }
+  return result;
+}
+
+void PlusPlusCounter::countsAfter(keyId_t key, const ZgramId *zgramIds, size_t size,
+    int64_t *result) const {
+  std::fill(result, result + size, 0);
+  if (const auto *frozen = findFrozen(key); frozen != nullptr) {
+    const auto &ids = frozen->zgramIds();
+    const auto *hint = ids.begin();
+    for (size_t i = 0; i != size; ++i) {
+      result[i] += totalAsOf(ids.begin(), ids.end(), frozen->cumulative().begin(), zgramIds[i],
+          &hint);
+    }
+  }
+  if (const auto *tail = findTail(key); tail != nullptr) {
+    tail->addCountsAfter(zgramIds, size, result);
+  }
+}
+
+const FrozenPlusPlusCounts *PlusPlusCounter::findFrozen(keyId_t key) const {
+  return key < frozen_.size() ? frozen_[key] : nullptr;
+}
+
+const PlusPlusCounter::Tail *PlusPlusCounter::findTail(keyId_t key) const {
+  auto ip = tails_.find(key);
+  return ip != tails_.end() ? &ip->second : nullptr;
+}
+
+void PlusPlusCounter::Tail::add(ZgramId zgramId, int64_t delta) {
+  if (zgramIds_.empty() || zgramIds_.back() < zgramId) {
+    zgramIds_.push_back(zgramId);
+    cumulative_.push_back((cumulative_.empty() ? 0 : cumulative_.back()) + delta);
+    return;
+  }
+  if (zgramIds_.back() == zgramId) {
+    cumulative_.back() += delta;
+    return;
+  }
+  late_[zgramId] += delta;
+}
+
+int64_t PlusPlusCounter::Tail::countAfter(ZgramId zgramId) const {
+  const auto *hint = zgramIds_.data();
+  auto result = totalAsOf(zgramIds_.data(), zgramIds_.data() + zgramIds_.size(),
+      cumulative_.data(), zgramId, &hint);
+  for (auto ip = late_.begin(); ip != late_.end() && ip->first <= zgramId; ++ip) {
+    result += ip->second;
+  }
+  return result;
+}
+
+void PlusPlusCounter::Tail::addCountsAfter(const ZgramId *zgramIds, size_t size,
+    int64_t *result) const {
+  const auto *hint = zgramIds_.data();
+  auto lp = late_.begin();
+  int64_t lateTotal = 0;
+  for (size_t i = 0; i != size; ++i) {
+    for (; lp != late_.end() && lp->first <= zgramIds[i]; ++lp) {
+      lateTotal += lp->second;
+    }
+    result[i] += lateTotal + totalAsOf(zgramIds_.data(), zgramIds_.data() + zgramIds_.size(),
+        cumulative_.data(), zgramIds[i], &hint);
+  }
+}
+
+std::ostream &operator<<(std::ostream &s, const PlusPlusCounter &o) {
+  return streamf(s, "PlusPlusCounter(%o frozen keys, %o dynamic keys)", o.frozen_.size(),
+      o.tails_.size());
+}
+}  // namespace z2kplus::backend::reverse_index::metadata
@@ -0,0 +1,104 @@
+// Copyright 2023 The Z2K Plus+ Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "z2kplus/backend/reverse_index/metadata/plusplus_key_dictionary.h"
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "kosak/coding/coding.h"
+
+using kosak::coding::streamf;
+using z2kplus::backend::util::frozen::FrozenStringPool;
+using z2kplus::backend::util::frozen::frozenStringRef_t;
+
+namespace z2kplus::backend::reverse_index::metadata {
+PlusPlusKeyDictionary PlusPlusKeyDictionary::createFromFrozen(const FrozenMetadata &metadata,
+    const FrozenStringPool *stringPool) {
+  PlusPlusKeyDictionary result;
+  result.stringPool_ = stringPool;
+  auto &keys = result.frozenKeys_;
+  for (const auto &entry : metadata.plusPluses()) {
+    keys.push_back(entry.first);
+  }
+  for (const auto &entry : metadata.minusMinuses()) {
+    keys.push_back(entry.first);
+  }
+  for (const auto &entry : metadata.plusPlusKeys()) {
+    keys.insert(keys.end(), entry.second.begin(), entry.second.end());
+  }
+  std::sort(keys.begin(), keys.end());
+  keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+  return result;
+}
+
+PlusPlusKeyDictionary::PlusPlusKeyDictionary() = default;
+PlusPlusKeyDictionary::PlusPlusKeyDictionary(PlusPlusKeyDictionary &&) noexcept = default;
+PlusPlusKeyDictionary &PlusPlusKeyDictionary::operator=(PlusPlusKeyDictionary &&) noexcept = default;
+PlusPlusKeyDictionary::~PlusPlusKeyDictionary() = default;
+
+auto PlusPlusKeyDictionary::intern(std::string_view key) -> keyId_t {
+  keyId_t id;
+  if (tryFind(key, &id)) {
+    return id;
+  }
+  id = size();
+  auto ip = dynamicIds_.try_emplace(std::string(key), id).first;
+  dynamicKeys_.push_back(ip->first);
+  return id;
+}
+
+bool PlusPlusKeyDictionary::tryFind(std::string_view key, keyId_t *result) const {
+  frozenStringRef_t fsr;
+  if (stringPool_ != nullptr && stringPool_->tryFind(key, &fsr) && tryFindFrozen(fsr, result)) {
+    return true;
+  }
+  auto ip = dynamicIds_.find(key);
+  if (ip == dynamicIds_.end()) {
+    return false;
+  }
+  *result = ip->second;
+  return true;
+}
+
+bool PlusPlusKeyDictionary::tryFindFrozen(frozenStringRef_t fsr, keyId_t *result) const {
+  auto ip = std::lower_bound(frozenKeys_.begin(), frozenKeys_.end(), fsr);
+  if (ip == frozenKeys_.end() || *ip != fsr) {
+    return false;
+  }
+  *result = ip - frozenKeys_.begin();
+  return true;
+}
+
+bool PlusPlusKeyDictionary::tryGetFrozenRef(keyId_t id, frozenStringRef_t *result) const {
+  if (id >= frozenKeys_.size()) {
+    return false;
+  }
+  *result = frozenKeys_[id];
+  return true;
+}
+
+std::string_view PlusPlusKeyDictionary::toStringView(keyId_t id) const {
+  if (id < frozenKeys_.size()) {
+    return stringPool_->toStringView(frozenKeys_[id]);
+  }
+  return dynamicKeys_[id - frozenKeys_.size()];
+}
+
+std::ostream &operator<<(std::ostream &s, const PlusPlusKeyDictionary &o) {
+  return streamf(s, "PlusPlusKeyDictionary(%o frozen, %o dynamic)", o.frozenKeys_.size(),
+      o.dynamicKeys_.size());
+}
+}  // namespace z2kplus::backend::reverse_index::metadata
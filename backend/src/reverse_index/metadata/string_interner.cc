@@ -0,0 +1,111 @@
+// Copyright 2023 The Z2K Plus+ Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "z2kplus/backend/reverse_index/metadata/string_interner.h"
+
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string_view>
+#include "kosak/coding/coding.h"
+#include "kosak/coding/failures.h"
+#include "z2kplus/backend/shared/magic_constants.h"
+
+using kosak::coding::FailRoot;
+using z2kplus::backend::util::frozen::FrozenStringPool;
+using z2kplus::backend::util::frozen::frozenStringRef_t;
+
+#define HERE KOSAK_CODING_HERE
+
+namespace magicConstants = z2kplus::backend::shared::magicConstants;
+
+namespace z2kplus::backend::reverse_index::metadata {
+StringInterner::StringInterner() = default;
+StringInterner::StringInterner(const FrozenStringPool *frozenPool) : frozenPool_(frozenPool),
+    frozenSize_(frozenPool != nullptr ? frozenPool->size() : 0) {}
+StringInterner::StringInterner(StringInterner &&) noexcept = default;
+StringInterner &StringInterner::operator=(StringInterner &&) noexcept = default;
+StringInterner::~StringInterner() = default;
+
+auto StringInterner::intern(std::string_view s) -> stringId_t {
+  stringId_t result;
+  if (tryFind(s, &result)) {
+    return result;
+  }
+  // As in IdTable, without a MemoryTracker these can only fail by running out of memory outright.
+  FailRoot fr;
+  if (lookup_.capacity() == 0 &&
+      !decltype(lookup_)::tryCreate(magicConstants::idTableInitialBuckets, 0.5, 2, 0, nullptr,
+          &lookup_, fr.nest(HERE))) {
+    crash("Failed to create StringInterner: %o", fr);
+  }
+  auto copy = copyToArena(s);
+  result = frozenSize_ + dynamicStrings_.size();
+  dynamicStrings_.push_back(copy);
+  auto slot = lookup_.findSlot(copy);
+  *slot.entry() = Entry{copy.data(), static_cast<uint32_t>(copy.size()), result};
+  if (!lookup_.tryFinishInsert(&slot, fr.nest(HERE))) {
+    crash("Failed to grow StringInterner: %o", fr);
+  }
+  return result;
+}
+
+bool StringInterner::tryFind(std::string_view s, stringId_t *result) const {
+  frozenStringRef_t fsr;
+  if (frozenPool_ != nullptr && frozenPool_->tryFind(s, &fsr)) {
+    *result = fsr.raw();
+    return true;
+  }
+  const auto *entry = lookup_.tryFind(s);
+  if (entry == nullptr) {
+    return false;
+  }
+  *result = entry->id_;
+  return true;
+}
+
+std::string_view StringInterner::toStringView(stringId_t id) const {
+  if (id < frozenSize_) {
+    return frozenPool_->toStringView(frozenStringRef_t(id));
+  }
+  return dynamicStrings_[id - frozenSize_];
+}
+
+std::string_view StringInterner::copyToArena(std::string_view s) {
+  if (s.size() > chunkRemaining_) {
+    // Oversized strings get a chunk of their own, so that they don't waste the rest of the current
+    // chunk.
+    auto chunkSize = std::max(s.size(), magicConstants::stringArenaChunkSize);
+    chunks_.push_back(std::make_unique<char[]>(chunkSize));
+    if (s.size() >= magicConstants::stringArenaChunkSize) {
+      std::memcpy(chunks_.back().get(), s.data(), s.size());
+      return {chunks_.back().get(), s.size()};
+    }
+    chunkCurrent_ = chunks_.back().get();
+    chunkRemaining_ = chunkSize;
+  }
+  std::memcpy(chunkCurrent_, s.data(), s.size());
+  std::string_view result(chunkCurrent_, s.size());
+  chunkCurrent_ += s.size();
+  chunkRemaining_ -= s.size();
+  return result;
+}
+
+std::pair<size_t, size_t> StringInterner::Utils::hash(std::string_view key) {
+  auto h = std::hash<std::string_view>()(key);
+  // The probe stride is a remix of the same hash.
+  auto stride = (h ^ (h >> 33)) * 0xff51afd7ed558ccdULL;
+  return {h, stride ^ (stride >> 33)};
+}
+}  // namespace z2kplus::backend::reverse_index::metadata
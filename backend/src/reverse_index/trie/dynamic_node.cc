@@ -125,19 +125,25 @@ void DynamicNode::dump(std::ostream &s, std::u32string *prefix) const {
   s << "[DynamicNode::dump not implemented]\n";
 }
 
-void DynamicNode::findMatchingHelper(const DFANode *dfaNode,
+// Same scheme as FrozenNodeView::tryFindMatching.
+bool DynamicNode::tryFindMatchingHelper(const DFANode *dfaNode, const Delegate<bool> &outOfBudget,
+    std::vector<uint32_t> *path, size_t depth,
     const Delegate<void, const wordOff_t *, const wordOff_t *> &callback) const {
+  auto resuming = path->size() != depth;
+  if (!resuming && outOfBudget()) {
+    return false;
+  }
   const auto *dfaToUse = dfaNode->tryAdvance(prefix_);
   if (dfaToUse == nullptr) {
-    return;
+    return true;
   }
 
-  if (!wordsHere_.empty() && dfaToUse->accepting()) {
+  if (!resuming && !wordsHere_.empty() && dfaToUse->accepting()) {
     callback(&*wordsHere_.begin(), &*wordsHere_.end());
   }
 
   if (transitions_.empty()) {
-    return;
+    return true;
   }
 
   auto size = transitions_.size();
@@ -152,13 +158,20 @@ void DynamicNode::findMatchingHelper(const DFANode *dfaNode,
   }
   std::u32string_view sv(transitionKeys, size);
   dfaToUse->tryAdvanceMulti(sv, childDfas);
-  for (size_t i = 0; i < size; ++i) {
+  for (size_t i = resuming ? (*path)[depth] : 0; i < size; ++i) {
     const auto *childDfa = childDfas[i];
     if (childDfa == nullptr) {
       continue;
     }
-    childps[i]->findMatchingHelper(childDfa, callback);
+    if (path->size() == depth) {
+      path->push_back(i);
+    }
+    if (!childps[i]->tryFindMatchingHelper(childDfa, outOfBudget, path, depth + 1, callback)) {
+      return false;
+    }
+    path->pop_back();
   }
+  return true;
 }
 
 bool DynamicNode::isPlaceholder() const {
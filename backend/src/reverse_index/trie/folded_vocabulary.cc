@@ -0,0 +1,53 @@
+// Copyright 2023 The Z2K Plus+ Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "z2kplus/backend/reverse_index/trie/folded_vocabulary.h"
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include "kosak/coding/coding.h"
+#include "z2kplus/backend/util/automaton/fuzzy_unicode.h"
+
+using kosak::coding::Delegate;
+using kosak::coding::streamf;
+using z2kplus::backend::util::automaton::foldLookalike;
+
+namespace z2kplus::backend::reverse_index::trie {
+void FoldedVocabulary::fold(std::u32string_view word, std::u32string *result) {
+  for (auto ch : word) {
+    result->push_back(foldLookalike(ch));
+  }
+}
+
+FoldedVocabulary::FoldedVocabulary() = default;
+FoldedVocabulary::FoldedVocabulary(FrozenVector<char32_t> text, FrozenVector<Entry> entries) :
+    text_(std::move(text)), entries_(std::move(entries)) {}
+FoldedVocabulary::FoldedVocabulary(FoldedVocabulary &&) noexcept = default;
+FoldedVocabulary &FoldedVocabulary::operator=(FoldedVocabulary &&) noexcept = default;
+FoldedVocabulary::~FoldedVocabulary() = default;
+
+void FoldedVocabulary::findOriginals(std::u32string_view key,
+    const Delegate<void, std::u32string_view> &callback) const {
+  auto ip = std::lower_bound(entries_.begin(), entries_.end(), key,
+      [this](const Entry &e, std::u32string_view k) { return keyOf(e) < k; });
+  for (; ip != entries_.end() && keyOf(*ip) == key; ++ip) {
+    callback(wordOf(*ip));
+  }
+}
+
+std::ostream &operator<<(std::ostream &s, const FoldedVocabulary &o) {
+  return streamf(s, "FoldedVocabulary(%o entries, %o chars)", o.entries_.size(), o.text_.size());
+}
+}  // namespace z2kplus::backend::reverse_index::trie
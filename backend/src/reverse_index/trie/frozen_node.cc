@@ -24,7 +24,6 @@
 namespace z2kplus::backend::reverse_index::trie {
 
 using kosak::coding::FailFrame;
-using kosak::coding::bit_cast;
 using kosak::coding::Delegate;
 using kosak::coding::Hexer;
 using kosak::coding::streamf;
@@ -40,18 +39,20 @@ class FrozenNodeView {
   template<typename T>
   using RelativePtr = z2kplus::backend::util::RelativePtr<T>;
 public:
-  explicit FrozenNodeView(const FrozenNode *fn);
+  FrozenNodeView(const FrozenNode *fn, const wordOff_t *postings);
 
   bool tryFind(std::u32string_view probe,
       std::pair<const wordOff_t *, const wordOff_t *> *result) const;
 
-  void findMatching(const DFANode *node,
+  bool tryFindMatching(const DFANode *node, const Delegate<bool> &outOfBudget,
+      std::vector<uint32_t> *path, size_t depth,
       const Delegate<void, const wordOff_t *, const wordOff_t *> &callback) const;
 
   bool tryDump(std::ostream &s, std::string *debugReadable, const FailFrame &ff);
 
 private:
   const FrozenNode *self_ = nullptr;
+  const wordOff_t *postings_ = nullptr;
   std::u32string_view prefix_;
   const wordOff_t *wordsHere_ = nullptr;
   size_t numWordsHere_ = 0;
@@ -60,36 +61,37 @@ private:
 };
 }  // namespace
 
-bool FrozenNode::tryFind(std::u32string_view probe,
+bool FrozenNode::tryFind(const wordOff_t *postings, std::u32string_view probe,
     std::pair<const wordOff_t *, const wordOff_t *> *result) const {
-  FrozenNodeView fnv(this);
+  FrozenNodeView fnv(this, postings);
   return fnv.tryFind(probe, result);
 }
 
-void FrozenNode::findMatching(const FiniteAutomaton &dfa,
+bool FrozenNode::tryFindMatching(const wordOff_t *postings, const FiniteAutomaton &dfa,
+    const Delegate<bool> &outOfBudget, std::vector<uint32_t> *path,
     const Delegate<void, const wordOff_t *, const wordOff_t *> &callback) const {
-  FrozenNodeView fnv(this);
-  fnv.findMatching(dfa.start(), callback);
+  FrozenNodeView fnv(this, postings);
+  return fnv.tryFindMatching(dfa.start(), outOfBudget, path, 0, callback);
 }
 
-bool FrozenNode::tryDump(std::ostream &s, std::string *debugReadable, const FailFrame &ff) const {
-  FrozenNodeView fnv(this);
+bool FrozenNode::tryDump(const wordOff_t *postings, std::ostream &s, std::string *debugReadable,
+    const FailFrame &ff) const {
+  FrozenNodeView fnv(this, postings);
   return fnv.tryDump(s, debugReadable, ff.nest(HERE));
 }
 
 namespace {
-FrozenNodeView::FrozenNodeView(const FrozenNode *fn) : self_(fn) {
+FrozenNodeView::FrozenNodeView(const FrozenNode *fn, const wordOff_t *postings) : self_(fn),
+    postings_(postings) {
   const auto *prefixBegin = fn->prefix_;
   const auto *prefixEnd = prefixBegin + fn->prefixSize_;
-  const auto *wordsBegin = bit_cast<const wordOff_t*>(prefixEnd);
-  const auto *wordsEnd = wordsBegin + fn->numWordsHere_;
-  const auto *transitionKeysBegin = bit_cast<const char32_t*>(wordsEnd);
+  const auto *transitionKeysBegin = prefixEnd;
   const auto *transitionKeysEnd = transitionKeysBegin + fn->numTransitions_;
   auto paddingEnd = (reinterpret_cast<uintptr_t>(transitionKeysEnd) + 7) & ~uintptr_t(7);
   const auto *transitionsBegin = reinterpret_cast<RelativePtr<FrozenNode>*>(paddingEnd);
 
   prefix_ = std::u32string_view(prefixBegin, fn->prefixSize_);
-  wordsHere_ = wordsBegin;
+  wordsHere_ = fn->numWordsHere_ == 0 ? nullptr : postings + fn->firstWordHere_;
   numWordsHere_ = fn->numWordsHere_;
   transitionKeys_ = std::u32string_view(transitionKeysBegin, fn->numTransitions_);
   transitions_ = transitionsBegin;
@@ -114,35 +116,49 @@ bool FrozenNodeView::tryFind(std::u32string_view probe,
     return false;
   }
   auto index = er.first - transitionKeys_.begin();
-  FrozenNodeView child(transitions_[index].get());
+  FrozenNodeView child(transitions_[index].get(), postings_);
   return child.tryFind(residual.substr(1), result);
 }
 
-void FrozenNodeView::findMatching(const DFANode *dfaNode,
+// '(*path)[0, depth)' leads to this node. If '*path' goes further than that, an earlier walk
+// already visited this node and stopped somewhere below it, at the child '(*path)[depth]'.
+bool FrozenNodeView::tryFindMatching(const DFANode *dfaNode, const Delegate<bool> &outOfBudget,
+    std::vector<uint32_t> *path, size_t depth,
     const Delegate<void, const wordOff_t *, const wordOff_t *> &callback) const {
+  auto resuming = path->size() != depth;
+  if (!resuming && outOfBudget()) {
+    return false;
+  }
   const auto *dfaToUse = dfaNode->tryAdvance(prefix_);
   if (dfaToUse == nullptr) {
-    return;
+    return true;
   }
 
-  if (numWordsHere_ != 0 && dfaToUse->accepting()) {
+  if (!resuming && numWordsHere_ != 0 && dfaToUse->accepting()) {
     callback(wordsHere_, wordsHere_ + numWordsHere_);
   }
 
   if (transitionKeys_.empty()) {
-    return;
+    return true;
   }
 
   const DFANode *childDfas[transitionKeys_.size()];
   dfaToUse->tryAdvanceMulti(transitionKeys_, childDfas);
-  for (size_t i = 0; i < transitionKeys_.size(); ++i) {
+  for (size_t i = resuming ? (*path)[depth] : 0; i < transitionKeys_.size(); ++i) {
     const auto *childDfa = childDfas[i];
     if (childDfa == nullptr) {
       continue;
     }
-    FrozenNodeView child(transitions_[i].get());
-    child.findMatching(childDfa, callback);
+    if (path->size() == depth) {
+      path->push_back(i);
+    }
+    FrozenNodeView child(transitions_[i].get(), postings_);
+    if (!child.tryFindMatching(childDfa, outOfBudget, path, depth + 1, callback)) {
+      return false;
+    }
+    path->pop_back();
   }
+  return true;
 }
 
 bool FrozenNodeView::tryDump(std::ostream &s, std::string *debugReadable,
@@ -176,7 +192,7 @@ bool FrozenNodeView::tryDump(std::ostream &s, std::string *debugReadable,
       return false;
     }
     s << '\n';
-    if (!transition->tryDump(s, debugReadable, ff.nest(HERE))) {
+    if (!transition->tryDump(postings_, s, debugReadable, ff.nest(HERE))) {
       return false;
     }
     debugReadable->erase(innerSave);
@@ -14,18 +14,54 @@
 
 #include "z2kplus/backend/reverse_index/trie/frozen_trie.h"
 
+
+using kosak::coding::Delegate;
 using kosak::coding::FailFrame;
 using kosak::coding::FailRoot;
 
 #define HERE KOSAK_CODING_HERE
 
 namespace z2kplus::backend::reverse_index::trie {
+bool FrozenTrie::tryFindMatching(const FiniteAutomaton &dfa, const Delegate<bool> &outOfBudget,
+    std::vector<uint32_t> *path,
+    const Delegate<void, const wordOff_t *, const wordOff_t *> &callback) const {
+  const auto *probes = dfa.foldedProbes();
+  if (probes == nullptr) {
+    return root_.get()->tryFindMatching(postings_.get(), dfa, outOfBudget, path, callback);
+  }
+  // Every word the DFA accepts folds to one of the probes, but not every word that folds to a probe
+  // is accepted (for example, a lookalike that resembles two different letters), so each candidate
+  // is confirmed against the DFA. A word is either equal to its folded form (and so is a probe) or
+  // it is stored in 'folded_' (under exactly one probe), so nothing is reported twice.
+  auto tryWord = [this, &dfa, &callback](std::u32string_view word) {
+    const auto *node = dfa.start()->tryAdvance(word);
+    if (node == nullptr || !node->accepting()) {
+      return;
+    }
+    std::pair<const wordOff_t *, const wordOff_t *> postings;
+    if (tryFind(word, &postings)) {
+      callback(postings.first, postings.second);
+    }
+  };
+  for (size_t i = path->empty() ? 0 : (*path)[0]; i != probes->size(); ++i) {
+    if (outOfBudget()) {
+      path->assign(1, i);
+      return false;
+    }
+    const auto &probe = (*probes)[i];
+    tryWord(probe);
+    folded_.findOriginals(probe, &tryWord);
+  }
+  path->clear();
+  return true;
+}
+
 std::ostream &operator<<(std::ostream &s, const FrozenTrie &o) {
   FailRoot fr;
   std::string charStorage;
-  if (!o.root_.get()->tryDump(s, &charStorage, fr.nest(HERE))) {
+  if (!o.root_.get()->tryDump(o.postings_.get(), s, &charStorage, fr.nest(HERE))) {
     s << "FAILURE: " << fr;
   }
-  return s;
+  return s << '\n' << o.folded_;
 }
 }  // namespace z2kplus::backend::reverse_index::trie
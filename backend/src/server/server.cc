@@ -22,6 +22,7 @@
 #include "z2kplus/backend/communicator/communicator.h"
 #include "z2kplus/backend/communicator/session.h"
 #include "z2kplus/backend/shared/magic_constants.h"
+#include "z2kplus/backend/reverse_index/builder/build_governor.h"
 #include "z2kplus/backend/reverse_index/builder/index_builder.h"
 #include "z2kplus/backend/util/misc.h"
 
@@ -44,6 +45,8 @@ using z2kplus::backend::files::FileKey;
 using z2kplus::backend::files::FileKeyKind;
 using z2kplus::backend::files::FilePosition;
 using z2kplus::backend::files::InterFileRange;
+using kosak::coding::memory::WriteThrottle;
+using z2kplus::backend::reverse_index::builder::BuildGovernor;
 using z2kplus::backend::reverse_index::builder::IndexBuilder;
 using z2kplus::backend::reverse_index::iterators::ZgramIterator;
 using z2kplus::backend::shared::Profile;
@@ -131,6 +134,8 @@ struct Server::ReindexingState {
   std::shared_ptr<MessageBuffer<SessionAndDRequest>> todo_;
   InterFileRange<FileKeyKind::Logged> loggedRange_;
   InterFileRange<FileKeyKind::Unlogged> unloggedRange_;
+  // Keeps the build out of the server's way. The server reports its load here.
+  BuildGovernor governor_;
   std::atomic<bool> done_ = false;
   std::thread activeThread_;
   std::string error_;
@@ -199,12 +204,25 @@ bool Server::tryRunForever(const FailFrame &ff) {
     }
 
     auto now = std::chrono::system_clock::now();
+    auto queueDepth = incomingBuffer.size();
+    auto batchStart = std::chrono::steady_clock::now();
     std::vector<std::string> statusMessages;
-    if (!tryProcessRequests(now, std::move(incomingBuffer), ff.nest(HERE)) ||
-        !tryManageReindexing(now, &statusMessages, ff.nest(HERE)) ||
+    if (!tryProcessRequests(now, std::move(incomingBuffer), ff.nest(HERE))) {
+      return false;
+    }
+    if (reindexingState_ != nullptr) {
+      // Let a background reindex know if it is getting in our way.
+      auto latency = std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - batchStart);
+      reindexingState_->governor_.reportServerLoad(latency, queueDepth);
+    }
+    if (!tryManageReindexing(now, &statusMessages, ff.nest(HERE)) ||
         !tryManagePurging(now, &statusMessages, ff.nest(HERE))) {
       return false;
     }
+    // The responses are on their way, so this is a good time to read ahead for clients who are
+    // paging through the archive.
+    coordinator_.prefetch();
 
     // Let's disable status messages for now. They are distracting.
     if (false) {
@@ -336,9 +354,10 @@ bool Server::tryManageReindexing(std::chrono::system_clock::time_point now,
   // ...it's done, and successful.
   nextReindexingTime_ = now + magicConstants::reindexingInterval;
 
-  const char *message = "Reindexing complete! Hopefully nothing broke.";
+  auto message = stringf("Reindexing complete! Hopefully nothing broke. Throttling: %o",
+      rs->governor_.metrics());
   warn("%o", message);
-  statusMessages->emplace_back(message);
+  statusMessages->push_back(std::move(message));
   return coordinator_.tryResetIndex(now, ff.nest(HERE)) &&
       rs->tryCleanup(ff.nest(HERE));
 }
@@ -470,7 +489,7 @@ Server::ReindexingState::ReindexingState(std::shared_ptr<PathMaster> pm,
     const InterFileRange<FileKeyKind::Logged> &loggedRange,
     const InterFileRange<FileKeyKind::Unlogged> &unloggedRange) : pm_(std::move(pm)),
     todo_(std::move(todo)), loggedRange_(loggedRange), unloggedRange_(unloggedRange),
-    done_(false) {}
+    governor_(BuildGovernor::defaultOptions()), done_(false) {}
 
 void Server::ReindexingState::run(std::shared_ptr<ReindexingState> self) {
   std::cerr << "Reindexing thread starting\n";
@@ -486,11 +505,15 @@ void Server::ReindexingState::run(std::shared_ptr<ReindexingState> self) {
 }
 
 bool Server::ReindexingState::tryRunHelper(const FailFrame &ff) {
-  if (!IndexBuilder::tryClearScratchDirectory(*pm_, ff.nest(HERE)) ||
+  // Everything below, including the builder's worker threads and sorts, runs at the lowered
+  // priority and writes through the governor.
+  WriteThrottle::Scope throttleScope(&governor_);
+  if (!governor_.tryLowerCurrentThreadPriority(ff.nest(HERE)) ||
       !IndexBuilder::tryBuild(*pm_, loggedRange_, unloggedRange_, ff.nest(HERE)) ||
       !pm_->tryPublishBuild(ff.nest(HERE))) {
     return false;
   }
+  streamf(std::cerr, "Reindexing throttle: %o\n", governor_.metrics());
   return true;
 }
 
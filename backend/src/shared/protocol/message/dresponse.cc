@@ -51,7 +51,7 @@ std::ostream &operator<<(std::ostream &s, const AckSubscribe &o) {
 DEFINE_TYPICAL_JSON(AckSubscribe, valid_, humanReadableError_, estimates_);
 
 AckMoreZgrams::AckMoreZgrams() = default;
-AckMoreZgrams::AckMoreZgrams(bool forBackside, std::vector<std::shared_ptr<const Zephyrgram>> zgrams,
+AckMoreZgrams::AckMoreZgrams(bool forBackside, std::vector<std::shared_ptr<const ZgramView>> zgrams,
     Estimates estimates) :
     forBackside_(forBackside), zgrams_(std::move(zgrams)), estimates_(std::move(estimates)) {}
 AckMoreZgrams::AckMoreZgrams(AckMoreZgrams &&other) noexcept = default;
@@ -88,7 +88,7 @@ std::ostream &operator<<(std::ostream &s, const MetadataUpdate &o) {
 DEFINE_TYPICAL_JSON(MetadataUpdate, metadata_);
 
 AckSpecificZgrams::AckSpecificZgrams() = default;
-AckSpecificZgrams::AckSpecificZgrams(std::vector<std::shared_ptr<const Zephyrgram>> zgrams) :
+AckSpecificZgrams::AckSpecificZgrams(std::vector<std::shared_ptr<const ZgramView>> zgrams) :
     zgrams_(std::move(zgrams)) {}
 AckSpecificZgrams::AckSpecificZgrams(AckSpecificZgrams &&other) noexcept = default;
 AckSpecificZgrams &AckSpecificZgrams::operator=(AckSpecificZgrams &&other) noexcept = default;
@@ -0,0 +1,146 @@
+// Copyright 2023 The Z2K Plus+ Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "z2kplus/backend/shared/zgram_view.h"
+
+#include <limits>
+#include <memory>
+#include <string>
+#include <string_view>
+#include "kosak/coding/coding.h"
+#include "kosak/coding/failures.h"
+#include "kosak/coding/myjson.h"
+#include "z2kplus/backend/shared/zephyrgram.h"
+#include "z2kplus/backend/util/json_scanner.h"
+
+using kosak::coding::FailFrame;
+using kosak::coding::ParseContext;
+using kosak::coding::tryParseJson;
+using z2kplus::backend::util::JsonScanner;
+
+#define HERE KOSAK_CODING_HERE
+
+namespace z2kplus::backend::shared {
+namespace {
+// Parses (and validates) a JSON string, but only keeps track of where it lives relative to 'base'.
+bool tryParseSpan(ParseContext *ctx, const char *base, std::string *scratch, ZgramView::Span *span,
+    const FailFrame &ff) {
+  ctx->consumeWhitespace();
+  auto begin = static_cast<size_t>(ctx->current() - base);
+  // The common case is a string without escapes, where finding the closing quote is all the
+  // validation there is to do. Otherwise, decode it (and throw the result away) to validate it.
+  std::string_view contents;
+  bool hasEscapes = true;
+  const char *next = nullptr;
+  if (ctx->current() != ctx->end() && *ctx->current() == '"') {
+    next = JsonScanner::scanString(ctx->current() + 1, ctx->end(), &contents, &hasEscapes);
+  }
+  if (next != nullptr && !hasEscapes) {
+    ctx->setCurrent(next);
+  } else {
+    scratch->clear();
+    if (!tryParseJson(ctx, scratch, ff.nest(HERE))) {
+      return false;
+    }
+  }
+  auto end = static_cast<size_t>(ctx->current() - base);
+  if (end > std::numeric_limits<uint32_t>::max()) {
+    return ff.failf(HERE, "Zgram text is too large (%o bytes)", end);
+  }
+  span->begin_ = begin;
+  span->end_ = end;
+  return true;
+}
+}  // namespace
+
+bool ZgramView::tryCreateFromLogRecord(std::string_view logRecord,
+    std::shared_ptr<const ZgramView> *result, const FailFrame &ff) {
+  // A log record is a LogRecord (a one-element tuple) holding a logRecordPayload_t variant, which
+  // is encoded as [tag, value].
+  ParseContext ctx(logRecord);
+  auto borrowed = ctx.borrowBufferString();
+  auto &tag = borrowed.str();
+  if (!ctx.tryConsumeChar('[', ff.nest(HERE)) ||
+      !ctx.tryConsumeChar('[', ff.nest(HERE)) ||
+      !tryParseJson(&ctx, &tag, ff.nest(HERE)) ||
+      !ctx.tryConsumeChar(',', ff.nest(HERE))) {
+    return false;
+  }
+  if (tag != LogRecordPayloadHolder::variantTags[0]) {
+    return ff.failf(HERE, "Log record is not a zgram (its tag is %o)", tag);
+  }
+  auto zgv = std::make_shared<ZgramView>();
+  if (!tryParseJson(&ctx, zgv.get(), ff.nest(HERE)) ||
+      !ctx.tryConsumeChar(']', ff.nest(HERE)) ||
+      !ctx.tryConsumeChar(']', ff.nest(HERE))) {
+    return false;
+  }
+  *result = std::move(zgv);
+  return true;
+}
+
+ZgramView::ZgramView() = default;
+ZgramView::ZgramView(ZgramView &&) noexcept = default;
+ZgramView &ZgramView::operator=(ZgramView &&) noexcept = default;
+ZgramView::~ZgramView() = default;
+
+bool ZgramView::tryDecode(Zephyrgram *result, const FailFrame &ff) const {
+  ParseContext ctx(json_);
+  return tryParseJson(&ctx, result, ff.nest(HERE));
+}
+
+bool ZgramView::tryParseFields(ParseContext *ctx, const char *base, const FailFrame &ff) {
+  // Same layout as DEFINE_TYPICAL_JSON(Zephyrgram, ...) and DEFINE_TYPICAL_JSON(ZgramCore, ...).
+  auto borrowed = ctx->borrowBufferString();
+  auto &scratch = borrowed.str();
+  return ctx->tryConsumeChar('[', ff.nest(HERE)) &&
+      tryParseJson(ctx, &zgramId_, ff.nest(HERE)) &&
+      ctx->tryConsumeChar(',', ff.nest(HERE)) &&
+      tryParseJson(ctx, &timesecs_, ff.nest(HERE)) &&
+      ctx->tryConsumeChar(',', ff.nest(HERE)) &&
+      tryParseSpan(ctx, base, &scratch, &sender_, ff.nest(HERE)) &&
+      ctx->tryConsumeChar(',', ff.nest(HERE)) &&
+      tryParseSpan(ctx, base, &scratch, &signature_, ff.nest(HERE)) &&
+      ctx->tryConsumeChar(',', ff.nest(HERE)) &&
+      tryParseJson(ctx, &isLogged_, ff.nest(HERE)) &&
+      ctx->tryConsumeChar(',', ff.nest(HERE)) &&
+      ctx->tryConsumeChar('[', ff.nest(HERE)) &&
+      tryParseSpan(ctx, base, &scratch, &instance_, ff.nest(HERE)) &&
+      ctx->tryConsumeChar(',', ff.nest(HERE)) &&
+      tryParseSpan(ctx, base, &scratch, &body_, ff.nest(HERE)) &&
+      ctx->tryConsumeChar(',', ff.nest(HERE)) &&
+      tryParseJson(ctx, &renderStyle_, ff.nest(HERE)) &&
+      ctx->tryConsumeChar(']', ff.nest(HERE)) &&
+      ctx->tryConsumeChar(']', ff.nest(HERE));
+}
+
+bool tryAppendJson(const ZgramView &o, std::string *result, const FailFrame &/*ff*/) {
+  result->append(o.json_);
+  return true;
+}
+
+bool tryParseJson(ParseContext *ctx, ZgramView *result, const FailFrame &ff) {
+  ctx->consumeWhitespace();
+  const auto *begin = ctx->current();
+  if (!result->tryParseFields(ctx, begin, ff.nest(HERE))) {
+    return false;
+  }
+  result->json_.assign(begin, ctx->current());
+  return true;
+}
+
+std::ostream &operator<<(std::ostream &s, const ZgramView &o) {
+  return s << o.json_;
+}
+}  // namespace z2kplus::backend::shared
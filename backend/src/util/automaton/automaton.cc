@@ -197,12 +197,56 @@ FiniteAutomaton::FiniteAutomaton(const PatternChar *begin, size_t patternSize,
   auto [dfaNodes, start] = converter.finish();
   nodes_ = std::move(dfaNodes);
   start_ = start;
+  computeFoldedProbes(begin, patternSize);
 }
 FiniteAutomaton::FiniteAutomaton() = default;
 FiniteAutomaton::FiniteAutomaton(FiniteAutomaton &&) noexcept = default;
 FiniteAutomaton &FiniteAutomaton::operator=(FiniteAutomaton &&) noexcept = default;
 FiniteAutomaton::~FiniteAutomaton() = default;
 
+void FiniteAutomaton::computeFoldedProbes(const PatternChar *begin, size_t patternSize) {
+  // The probes are the cartesian product of the foldings allowed at each position.
+  std::vector<std::u32string> probes = {std::u32string()};
+  std::vector<std::u32string> next;
+  bool sawLoose = false;
+  for (const auto *pc = begin; pc != begin + patternSize; ++pc) {
+    std::u32string single;
+    std::u32string_view alternatives;
+    switch (pc->type()) {
+      case internal::CharType::Exact: {
+        single.push_back(foldLookalike(pc->ch()));
+        alternatives = single;
+        break;
+      }
+      case internal::CharType::Loose: {
+        sawLoose = true;
+        alternatives = getLooseFoldings(static_cast<char>(pc->ch()));
+        break;
+      }
+      default:
+        // Wildcards don't fold to anything finite.
+        return;
+    }
+    if (probes.size() * alternatives.size() > maxFoldedProbes) {
+      return;
+    }
+    next.clear();
+    for (const auto &probe : probes) {
+      for (auto ch : alternatives) {
+        next.push_back(probe);
+        next.back().push_back(ch);
+      }
+    }
+    probes.swap(next);
+  }
+  // An all-Exact pattern is already a single cheap walk down the trie.
+  if (!sawLoose) {
+    return;
+  }
+  foldedProbes_ = std::move(probes);
+  hasFoldedProbes_ = true;
+}
+
 std::ostream &operator<<(std::ostream &s, const FiniteAutomaton &o) {
   std::set<const DFANode *> beenHere;
   FailRoot fr;
@@ -14,11 +14,21 @@
 
 #include "z2kplus/backend/util/automaton/fuzzy_unicode.h"
 
+#include <algorithm>
+#include <array>
+#include <string>
 #include <string_view>
+#include <utility>
+#include <vector>
 #include "kosak/coding/coding.h"
+#include "kosak/coding/failures.h"
+#include "kosak/coding/text/conversions.h"
 
 namespace z2kplus::backend::util::automaton {
 
+using kosak::coding::FailRoot;
+using kosak::coding::text::tryConvertUtf8ToUtf32;
+
 namespace {
 // Credits:
 //   Unicode generator: http://qaz.wtf/u/convert.cgi?text=Cinnabon
@@ -51,6 +61,25 @@ std::string_view rawExpansions[] = {
   "ⓨ🅨ｙ𝐲𝖞𝒚𝔂𝕪𝚢𝗒𝘆𝙮𝘺⒴🇾🅈🆈󠁹ӳﾘץуЎሃ𝔶ÿɏʸʎⓎＹ𝐘𝖄𝒀𝓨𝕐𝚈𝖸𝗬𝙔𝘠󠁙ӲЧ𝔜ŸɎ",
   "ⓩ🅩ｚ𝐳𝖟𝒛𝔃𝕫𝚣𝗓𝘇𝙯𝘻⒵🇿🅉🆉󠁺ź乙չጊ𝔷żᴢƶᶻⓏＺ𝐙𝖅𝒁𝓩ℤ𝚉𝖹𝗭𝙕𝘡󠁚ŹℨŻƵ"
 };
+
+// Built once, from rawExpansions.
+class FoldTables {
+public:
+  FoldTables();
+
+  char32_t fold(char32_t ch) const;
+  std::u32string_view looseFoldings(char ch) const { return looseFoldings_[ch - 'a']; }
+
+private:
+  // Sorted by the first element.
+  std::vector<std::pair<char32_t, char32_t>> folds_;
+  std::array<std::u32string, 26> looseFoldings_;
+};
+
+const FoldTables &getFoldTables() {
+  static const FoldTables tables;
+  return tables;
+}
 }  // namespace
 
 std::string_view getFuzzyEquivalents(char ch) {
@@ -61,4 +90,67 @@ std::string_view getFuzzyEquivalents(char ch) {
   }
   return empty;
 }
+
+char32_t foldLookalike(char32_t ch) {
+  if (ch >= 'a' && ch <= 'z') {
+    return ch;
+  }
+  if (ch >= 'A' && ch <= 'Z') {
+    return ch - 'A' + 'a';
+  }
+  if (ch < 0x80) {
+    return ch;
+  }
+  return getFoldTables().fold(ch);
+}
+
+std::u32string_view getLooseFoldings(char ch) {
+  if (ch < 'a' || ch > 'z') {
+    return {};
+  }
+  return getFoldTables().looseFoldings(ch);
+}
+
+namespace {
+FoldTables::FoldTables() {
+  static_assert(STATIC_ARRAYSIZE(rawExpansions) == 26);
+  FailRoot fr;
+  std::u32string expansions;
+  for (size_t i = 0; i < 26; ++i) {
+    expansions.clear();
+    if (!tryConvertUtf8ToUtf32(rawExpansions[i], &expansions, fr.nest(KOSAK_CODING_HERE))) {
+      crash("Impossible: failed on UTF-8 conversion %o", fr);
+    }
+    for (auto ch : expansions) {
+      folds_.emplace_back(ch, 'a' + i);
+    }
+  }
+  // stable_sort so that a character resembling several letters folds to the first of them.
+  std::stable_sort(folds_.begin(), folds_.end(),
+      [](const auto &lhs, const auto &rhs) { return lhs.first < rhs.first; });
+  folds_.erase(std::unique(folds_.begin(), folds_.end(),
+      [](const auto &lhs, const auto &rhs) { return lhs.first == rhs.first; }), folds_.end());
+
+  // A Loose letter matches itself, its uppercase sibling, and its expansions.
+  for (size_t i = 0; i < 26; ++i) {
+    auto &lf = looseFoldings_[i];
+    lf.push_back('a' + i);
+    expansions.clear();
+    if (!tryConvertUtf8ToUtf32(rawExpansions[i], &expansions, fr.nest(KOSAK_CODING_HERE))) {
+      crash("Impossible: failed on UTF-8 conversion %o", fr);
+    }
+    for (auto ch : expansions) {
+      lf.push_back(fold(ch));
+    }
+    std::sort(lf.begin(), lf.end());
+    lf.erase(std::unique(lf.begin(), lf.end()), lf.end());
+  }
+}
+
+char32_t FoldTables::fold(char32_t ch) const {
+  auto ip = std::lower_bound(folds_.begin(), folds_.end(), ch,
+      [](const auto &entry, char32_t key) { return entry.first < key; });
+  return ip != folds_.end() && ip->first == ch ? ip->second : ch;
+}
+}  // namespace
 }  // namespace z2kplus::backend::util::automaton
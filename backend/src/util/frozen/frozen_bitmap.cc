@@ -0,0 +1,170 @@
+// Copyright 2023 The Z2K Plus+ Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "z2kplus/backend/util/frozen/frozen_bitmap.h"
+
+#include <algorithm>
+#include "kosak/coding/bits.h"
+#include "kosak/coding/coding.h"
+
+using kosak::coding::streamf;
+
+namespace bits = kosak::coding::bits;
+
+namespace z2kplus::backend::util::frozen {
+FrozenBitmap::FrozenBitmap(FrozenBitmap &&other) noexcept = default;
+FrozenBitmap &FrozenBitmap::operator=(FrozenBitmap &&other) noexcept = default;
+
+size_t FrozenBitmap::size() const {
+  if (containers_.empty()) {
+    return 0;
+  }
+  const auto &last = *(containers_.end() - 1);
+  return last.rankBefore_ + last.cardinality_;
+}
+
+bool FrozenBitmap::tryFindNext(uint32_t value, uint32_t *result) const {
+  auto high = static_cast<uint16_t>(value >> 16);
+  auto low = value & 0xffff;
+  for (const auto *cp = lowerBound(high); cp != containers_.end(); ++cp) {
+    // Only the container for 'high' itself needs to honor 'low'. Later ones start at 0.
+    uint16_t found;
+    if (tryFindNextInContainer(*cp, cp->high_ == high ? low : 0, &found)) {
+      *result = (static_cast<uint32_t>(cp->high_) << 16) | found;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool FrozenBitmap::tryFindPrev(uint32_t value, uint32_t *result) const {
+  auto high = static_cast<uint16_t>(value >> 16);
+  auto low = value & 0xffff;
+  // One past the last container whose high_ <= 'high'.
+  const auto *cp = lowerBound(high);
+  if (cp != containers_.end() && cp->high_ == high) {
+    ++cp;
+  }
+  while (cp != containers_.begin()) {
+    --cp;
+    uint16_t found;
+    if (tryFindPrevInContainer(*cp, cp->high_ == high ? low : 0xffff, &found)) {
+      *result = (static_cast<uint32_t>(cp->high_) << 16) | found;
+      return true;
+    }
+  }
+  return false;
+}
+
+size_t FrozenBitmap::rank(uint32_t value) const {
+  auto high = static_cast<uint16_t>(value >> 16);
+  const auto *cp = lowerBound(high);
+  if (cp == containers_.end()) {
+    return size();
+  }
+  if (cp->high_ != high) {
+    return cp->rankBefore_;
+  }
+  return cp->rankBefore_ + rankInContainer(*cp, value & 0xffff);
+}
+
+bool FrozenBitmap::contains(uint32_t value) const {
+  uint32_t next;
+  return tryFindNext(value, &next) && next == value;
+}
+
+auto FrozenBitmap::lowerBound(uint16_t high) const -> const Container * {
+  return std::lower_bound(containers_.begin(), containers_.end(), high,
+      [](const Container &c, uint16_t h) { return c.high_ < h; });
+}
+
+bool FrozenBitmap::tryFindNextInContainer(const Container &c, uint32_t low,
+    uint16_t *result) const {
+  if (!c.isBitset_) {
+    const auto *begin = arrays_.begin() + c.offset_;
+    const auto *end = begin + c.cardinality_;
+    const auto *ip = std::lower_bound(begin, end, low);
+    if (ip == end) {
+      return false;
+    }
+    *result = *ip;
+    return true;
+  }
+  const auto *words = bitsets_.begin() + c.offset_;
+  auto wordIndex = low / 64;
+  // Mask off the bits below 'low' in the first word.
+  auto word = words[wordIndex] & (~uint64_t(0) << (low % 64));
+  while (true) {
+    if (word != 0) {
+      *result = wordIndex * 64 + bits::findFirstSet(word);
+      return true;
+    }
+    if (++wordIndex == wordsPerBitset) {
+      return false;
+    }
+    word = words[wordIndex];
+  }
+}
+
+bool FrozenBitmap::tryFindPrevInContainer(const Container &c, uint32_t low,
+    uint16_t *result) const {
+  if (!c.isBitset_) {
+    const auto *begin = arrays_.begin() + c.offset_;
+    const auto *end = begin + c.cardinality_;
+    const auto *ip = std::upper_bound(begin, end, low);
+    if (ip == begin) {
+      return false;
+    }
+    *result = ip[-1];
+    return true;
+  }
+  const auto *words = bitsets_.begin() + c.offset_;
+  auto wordIndex = low / 64;
+  // Mask off the bits above 'low' in the first word.
+  auto shift = 63 - (low % 64);
+  auto word = words[wordIndex] & (~uint64_t(0) >> shift);
+  while (true) {
+    if (word != 0) {
+      *result = wordIndex * 64 + bits::findLastSet(word);
+      return true;
+    }
+    if (wordIndex-- == 0) {
+      return false;
+    }
+    word = words[wordIndex];
+  }
+}
+
+size_t FrozenBitmap::rankInContainer(const Container &c, uint32_t low) const {
+  if (!c.isBitset_) {
+    const auto *begin = arrays_.begin() + c.offset_;
+    const auto *end = begin + c.cardinality_;
+    return std::lower_bound(begin, end, low) - begin;
+  }
+  const auto *words = bitsets_.begin() + c.offset_;
+  size_t result = 0;
+  auto wordIndex = low / 64;
+  for (size_t i = 0; i != wordIndex; ++i) {
+    result += bits::popcount(words[i]);
+  }
+  if (low % 64 != 0) {
+    result += bits::popcount(words[wordIndex] & (~uint64_t(0) >> (64 - low % 64)));
+  }
+  return result;
+}
+
+std::ostream &operator<<(std::ostream &s, const FrozenBitmap &o) {
+  return streamf(s, "FrozenBitmap(size=%o, containers=%o)", o.size(), o.containers_.size());
+}
+}  // namespace z2kplus::backend::util::frozen
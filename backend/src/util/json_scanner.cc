@@ -0,0 +1,121 @@
+// Copyright 2023 The Z2K Plus+ Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "z2kplus/backend/util/json_scanner.h"
+
+#include <cstdint>
+#include <string_view>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace z2kplus::backend::util {
+namespace {
+// The characters that end the plain part of a JSON string: a quote, a backslash, or a control
+// character (which JSON requires to be escaped).
+constexpr unsigned char maxControl = 0x1f;
+
+const char *findScalar(const char *begin, const char *end) {
+  for (; begin != end; ++begin) {
+    if (*begin == '"' || *begin == '\\' || static_cast<unsigned char>(*begin) <= maxControl) {
+      break;
+    }
+  }
+  return begin;
+}
+
+#if defined(__x86_64__)
+const char *findSse2(const char *begin, const char *end) {
+  const auto quotes = _mm_set1_epi8('"');
+  const auto backslashes = _mm_set1_epi8('\\');
+  const auto controls = _mm_set1_epi8(maxControl);
+  while (end - begin >= 16) {
+    auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+    // There is no unsigned compare, but max(ch, maxControl) == maxControl exactly when ch is a
+    // control character.
+    auto isControl = _mm_cmpeq_epi8(_mm_max_epu8(chunk, controls), controls);
+    auto hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, quotes),
+        _mm_cmpeq_epi8(chunk, backslashes)), isControl);
+    auto mask = static_cast<uint32_t>(_mm_movemask_epi8(hits));
+    if (mask != 0) {
+      return begin + __builtin_ctz(mask);
+    }
+    begin += 16;
+  }
+  return findScalar(begin, end);
+}
+
+__attribute__((target("avx2")))
+const char *findAvx2(const char *begin, const char *end) {
+  const auto quotes = _mm256_set1_epi8('"');
+  const auto backslashes = _mm256_set1_epi8('\\');
+  const auto controls = _mm256_set1_epi8(maxControl);
+  while (end - begin >= 32) {
+    auto chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+    auto isControl = _mm256_cmpeq_epi8(_mm256_max_epu8(chunk, controls), controls);
+    auto hits = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, quotes),
+        _mm256_cmpeq_epi8(chunk, backslashes)), isControl);
+    auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(hits));
+    if (mask != 0) {
+      return begin + __builtin_ctz(mask);
+    }
+    begin += 32;
+  }
+  return findSse2(begin, end);
+}
+
+typedef const char *(*finder_t)(const char *, const char *);
+finder_t chooseFinder() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") ? &findAvx2 : &findSse2;
+}
+#endif
+}  // namespace
+
+const char *JsonScanner::findSpecial(const char *begin, const char *end) {
+#if defined(__x86_64__)
+  static const finder_t finder = chooseFinder();
+  return finder(begin, end);
+#else
+  return findScalar(begin, end);
+#endif
+}
+
+const char *JsonScanner::scanString(const char *begin, const char *end,
+    std::string_view *contents, bool *hasEscapes) {
+  *hasEscapes = false;
+  const auto *current = begin;
+  while (true) {
+    current = findSpecial(current, end);
+    if (current == end) {
+      return nullptr;
+    }
+    if (*current == '"') {
+      *contents = std::string_view(begin, current - begin);
+      return current + 1;
+    }
+    if (*current != '\\') {
+      // A raw control character, which isn't valid JSON. Let the caller's slow path decide.
+      return nullptr;
+    }
+    // A backslash: skip it and the character it escapes. The hex digits of a unicode escape are
+    // neither quotes nor backslashes, so the scan steps over them by itself.
+    *hasEscapes = true;
+    current += 2;
+    if (current > end) {
+      return nullptr;
+    }
+  }
+}
+}  // namespace z2kplus::backend::util
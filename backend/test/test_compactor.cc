@@ -0,0 +1,202 @@
+// Copyright 2023 The Z2K Plus+ Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string>
+#include <vector>
+#include "catch/catch.hpp"
+#include "kosak/coding/coding.h"
+#include "kosak/coding/failures.h"
+#include "kosak/coding/unix.h"
+#include "z2kplus/backend/files/compactor.h"
+#include "z2kplus/backend/files/path_master.h"
+#include "z2kplus/backend/test/util/test_util.h"
+
+using kosak::coding::FailFrame;
+using kosak::coding::FailRoot;
+using z2kplus::backend::files::CompactedFile;
+using z2kplus::backend::files::Compactor;
+using z2kplus::backend::files::CompactorManifest;
+using z2kplus::backend::files::CompactorStats;
+using z2kplus::backend::files::PathMaster;
+using z2kplus::backend::test::util::TestUtil;
+
+namespace nsunix = kosak::coding::nsunix;
+
+#define HERE KOSAK_CODING_HERE
+
+namespace z2kplus::backend::test {
+namespace {
+bool tryGetRoot(std::string *result, const FailFrame &ff);
+
+const char part0[] = "" // to help CLion align the next line
+  R"([["z",[[0],946703313,"kosak","Corey Kosak",true,["test","Hello this is kosak","d"]]]])" "\n";
+// No trailing newline: the compactor supplies one.
+const char part1[] = "" // to help CLion align the next line
+  R"([["z",[[1],946703314,"kosh","Kosh",true,["test","You are not ready","d"]]]])" "\n"
+  R"([["m",[["zgrev",[[0],["test","I am Kosh","d"]]]]]])";
+const char part2[] = "" // to help CLion align the next line
+  R"([["z",[[2],946703315,"simon","Simon",true,["test","kosak++","d"]]]])" "\n";
+}  // namespace
+
+TEST_CASE("compactor: manifest drops a torn line and keeps the rest", "[compactor]") {
+  FailRoot fr;
+  std::string root;
+  if (!tryGetRoot(&root, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+  auto manifestName = root + "compactor_manifest";
+  const char text[] =
+      "10 abc 2 key0 /logs/day0\n"
+      "20 def 3 key1 /logs/day1\n"
+      // A later line for the same file wins.
+      "30 ghi 4 key2 /logs/day0\n"
+      // Cut off by the interruption.
+      "40 jkl 5 key3 /lo";
+  CompactorManifest manifest;
+  if (!nsunix::tryWriteAll(manifestName, text, fr.nest(HERE)) ||
+      !manifest.tryOpen(manifestName, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+  const auto *day0 = manifest.find("/logs/day0");
+  const auto *day1 = manifest.find("/logs/day1");
+  REQUIRE(day0 != nullptr);
+  REQUIRE(day1 != nullptr);
+  CHECK(day0->size_ == 30);
+  CHECK(day0->checksum_ == "ghi");
+  CHECK(day0->numRecords_ == 4);
+  CHECK(day0->sourceKey_ == "key2");
+  CHECK(day1->size_ == 20);
+  CHECK(day1->sourceKey_ == "key1");
+  CHECK(manifest.find("/logs/day2") == nullptr);
+  CHECK(manifest.find("/lo") == nullptr);
+
+  // The torn line is gone from the file, and appends go after the last whole line.
+  CompactedFile day3{50, "mno", 6, "key4"};
+  std::string contents;
+  if (!manifest.tryAppend("/logs/day3", day3, fr.nest(HERE)) ||
+      !nsunix::tryReadAll(manifestName, &contents, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+  CHECK(contents ==
+      "10 abc 2 key0 /logs/day0\n"
+      "20 def 3 key1 /logs/day1\n"
+      "30 ghi 4 key2 /logs/day0\n"
+      "50 mno 6 key4 /logs/day3\n");
+
+  CompactorManifest reopened;
+  if (!reopened.tryOpen(manifestName, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+  const auto *reopenedDay3 = reopened.find("/logs/day3");
+  REQUIRE(reopenedDay3 != nullptr);
+  CHECK(*reopenedDay3 == day3);
+}
+
+TEST_CASE("compactor: malformed manifest line is an error", "[compactor]") {
+  FailRoot fr;
+  std::string root;
+  if (!tryGetRoot(&root, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+  auto manifestName = root + "compactor_manifest";
+  if (!nsunix::tryWriteAll(manifestName, "10 abc two key0 /logs/day0\n", fr.nest(HERE))) {
+    FAIL(fr);
+  }
+  CompactorManifest manifest;
+  FailRoot expected(true);
+  CHECK(!manifest.tryOpen(manifestName, expected.nest(HERE)));
+}
+
+TEST_CASE("compactor: verifies, resumes, and redoes changed days", "[compactor]") {
+  FailRoot fr;
+  std::string root;
+  if (!tryGetRoot(&root, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+  auto manifestName = root + "compactor_manifest";
+  auto destName = root + "20000101.logged";
+  std::vector<std::string> srcNames = {destName + ".000", destName + ".001"};
+  auto tryCompact = [&](CompactorStats *stats, const FailFrame &ff) {
+    CompactorManifest manifest;
+    return manifest.tryOpen(manifestName, ff.nest(HERE)) &&
+        Compactor::tryCompactDay(srcNames, destName, true, &manifest, stats, ff.nest(HERE));
+  };
+
+  std::string compacted;
+  CompactorStats first;
+  if (!nsunix::tryWriteAll(srcNames[0], part0, fr.nest(HERE)) ||
+      !nsunix::tryWriteAll(srcNames[1], part1, fr.nest(HERE)) ||
+      !tryCompact(&first, fr.nest(HERE)) ||
+      !nsunix::tryReadAll(destName, &compacted, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+  CHECK(compacted == std::string(part0) + part1 + "\n");
+  CHECK(first.numResumed_ == 0);
+  CHECK(first.numRecords_ == 3);
+
+  // A second run finds the day done.
+  CompactorStats second;
+  if (!tryCompact(&second, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+  CHECK(second.numResumed_ == 1);
+  CHECK(second.numRecords_ == 3);
+
+  // A damaged output is redone.
+  CompactorStats damaged;
+  std::string repaired;
+  if (!nsunix::tryWriteAll(destName, "garbage\n", fr.nest(HERE)) ||
+      !tryCompact(&damaged, fr.nest(HERE)) ||
+      !nsunix::tryReadAll(destName, &repaired, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+  CHECK(damaged.numResumed_ == 0);
+  CHECK(repaired == compacted);
+
+  // So is a day that gained a part.
+  srcNames.push_back(destName + ".002");
+  CompactorStats grown;
+  std::string regrown;
+  if (!nsunix::tryWriteAll(srcNames[2], part2, fr.nest(HERE)) ||
+      !tryCompact(&grown, fr.nest(HERE)) ||
+      !nsunix::tryReadAll(destName, &regrown, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+  CHECK(grown.numResumed_ == 0);
+  CHECK(grown.numRecords_ == 4);
+  CHECK(regrown == compacted + part2);
+
+  // Out-of-order zgrams fail verification, and the day is left as it was.
+  CompactorStats unordered;
+  std::string unchanged;
+  srcNames = {destName + ".002", destName + ".000"};
+  FailRoot expected(true);
+  CHECK(!tryCompact(&unordered, expected.nest(HERE)));
+  if (!nsunix::tryReadAll(destName, &unchanged, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+  CHECK(unchanged == regrown);
+}
+
+namespace {
+bool tryGetRoot(std::string *result, const FailFrame &ff) {
+  std::shared_ptr<PathMaster> pm;
+  if (!TestUtil::tryGetPathMaster("compactor", &pm, ff.nest(HERE))) {
+    return false;
+  }
+  *result = pm->scratchRoot();
+  return true;
+}
+}  // namespace
+}  // namespace z2kplus::backend::test
@@ -21,24 +21,45 @@
 #include "kosak/coding/failures.h"
 #include "z2kplus/backend/communicator/communicator.h"
 #include "z2kplus/backend/coordinator/coordinator.h"
+#include "z2kplus/backend/coordinator/query_cache.h"
 #include "z2kplus/backend/coordinator/subscription.h"
 #include "z2kplus/backend/files/path_master.h"
+#include "z2kplus/backend/reverse_index/fields.h"
 #include "z2kplus/backend/reverse_index/index/consolidated_index.h"
+#include "z2kplus/backend/reverse_index/iterators/boundary/word_adaptor.h"
+#include "z2kplus/backend/reverse_index/iterators/word/pattern.h"
+#include "z2kplus/backend/reverse_index/iterators/zgram/and.h"
+#include "z2kplus/backend/reverse_index/iterators/zgram/metadata/having_reaction.h"
+#include "z2kplus/backend/reverse_index/iterators/zgram/not.h"
 #include "z2kplus/backend/shared/protocol/message/dresponse.h"
 #include "z2kplus/backend/shared/profile.h"
 #include "z2kplus/backend/shared/zephyrgram.h"
 #include "z2kplus/backend/test/util/test_util.h"
+#include "z2kplus/backend/util/automaton/automaton.h"
 
 using kosak::coding::FailFrame;
 using kosak::coding::FailRoot;
 using kosak::coding::ParseContext;
+using kosak::coding::toString;
 using kosak::coding::Unit;
 using z2kplus::backend::coordinator::Coordinator;
+using z2kplus::backend::coordinator::QueryCache;
+using z2kplus::backend::coordinator::internal::CachedQueryEntry;
+using z2kplus::backend::coordinator::internal::RunList;
 using z2kplus::backend::server::Server;
 using z2kplus::backend::coordinator::Subscription;
 using z2kplus::backend::communicator::Communicator;
 using z2kplus::backend::files::PathMaster;
+using z2kplus::backend::reverse_index::FieldMask;
 using z2kplus::backend::reverse_index::index::ConsolidatedIndex;
+using z2kplus::backend::reverse_index::iterators::And;
+using z2kplus::backend::reverse_index::iterators::IteratorContext;
+using z2kplus::backend::reverse_index::iterators::Not;
+using z2kplus::backend::reverse_index::iterators::QueryBudget;
+using z2kplus::backend::reverse_index::iterators::ZgramIterator;
+using z2kplus::backend::reverse_index::iterators::boundary::WordAdaptor;
+using z2kplus::backend::reverse_index::iterators::word::Pattern;
+using z2kplus::backend::reverse_index::iterators::zgram::metadata::HavingReaction;
 using z2kplus::backend::shared::protocol::message::DRequest;
 using z2kplus::backend::shared::protocol::message::DResponse;
 using z2kplus::backend::shared::MetadataRecord;
@@ -51,6 +72,7 @@ using z2kplus::backend::shared::protocol::Estimates;
 using z2kplus::backend::util::BlockingQueue;
 using z2kplus::backend::util::MySocket;
 using z2kplus::backend::test::util::TestUtil;
+using z2kplus::backend::util::automaton::FiniteAutomaton;
 namespace nsunix = kosak::coding::nsunix;
 namespace drequests = z2kplus::backend::shared::protocol::message::drequests;
 namespace dresponses = z2kplus::backend::shared::protocol::message::dresponses;
@@ -172,6 +194,164 @@ TEST_CASE("coordinator: post a zgram with a reply-to", "[coordinator]") {
   }
 }
 
+// Paging a side in small steps, with read-ahead running between requests, yields exactly the same
+// zgrams in the same order as fetching everything at once.
+TEST_CASE("coordinator: prefetch does not change results", "[coordinator]") {
+  FailRoot fr;
+  auto pageThrough = [&fr](size_t pageSize, bool withPrefetch, std::vector<ZgramId> *result) {
+    drequests::Subscribe subReq("", SearchOrigin(ZgramId(60)), 10, 25);
+    ConsolidatedIndex ci;
+    Reactor rx;
+    auto profile = std::make_shared<Profile>("kosak", "Corey Kosak");
+    if (!tryGetPathMaster(&rx.pm_, fr.nest(HERE)) ||
+        !TestUtil::trySetupConsolidatedIndex(rx.pm_, &ci, fr.nest(HERE)) ||
+        !Coordinator::tryCreate(rx.pm_, std::move(ci), &rx.c_, fr.nest(HERE))) {
+      FAIL(fr);
+    }
+    std::vector<Coordinator::response_t> responses;
+    rx.c_.subscribe(std::move(profile), std::move(subReq), &responses, &rx.sub_);
+    rx.processResponses(&responses);
+    REQUIRE(rx.valid_);
+    while (!(rx.estimates_.front().count() == 0 && rx.estimates_.front().exact())) {
+      responses.clear();
+      drequests::GetMoreZgrams getMore(false, pageSize);
+      rx.c_.getMoreZgrams(rx.sub_.get(), std::move(getMore), &responses);
+      rx.processResponses(&responses);
+      if (withPrefetch) {
+        rx.c_.prefetch();
+      }
+    }
+    *result = std::move(rx.newIds_);
+  };
+
+  std::vector<ZgramId> expected;
+  std::vector<ZgramId> actual;
+  pageThrough(1000, false, &expected);
+  pageThrough(3, true, &actual);
+  CHECK(!expected.empty());
+  CHECK(expected == actual);
+}
+
+// Two subscriptions to the same query share one cache entry, and serve the same results as the
+// uncached query in both directions, whether or not the entry has been extended. Metadata-sensitive queries bypass the cache. The entry goes
+// away with the last subscription that uses it.
+TEST_CASE("coordinator: query cache", "[coordinator]") {
+  FailRoot fr;
+  std::shared_ptr<PathMaster> pm;
+  ConsolidatedIndex ci;
+  FiniteAutomaton dfa1;
+  FiniteAutomaton dfa2;
+  if (!tryGetPathMaster(&pm, fr.nest(HERE)) ||
+      !TestUtil::trySetupConsolidatedIndex(pm, &ci, fr.nest(HERE)) ||
+      !TestUtil::tryMakeDfa("kosak", &dfa1, fr.nest(HERE)) ||
+      !TestUtil::tryMakeDfa("kosak", &dfa2, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+
+  QueryCache cache;
+  auto makeNotKosak = [](FiniteAutomaton &&dfa) {
+    return Not::create(WordAdaptor::create(Pattern::create(std::move(dfa), FieldMask::all)));
+  };
+  auto cached1 = cache.lookupOrInsert(makeNotKosak(std::move(dfa1)));
+  auto cached2 = cache.lookupOrInsert(makeNotKosak(std::move(dfa2)));
+  CHECK(cache.size() == 1);
+
+  // Nothing has extended the entry yet, so these are served by the live query.
+  if (!TestUtil::fourWaySearchTest("first", ci, cached1.get(), 4, {2, 21, 40, 41, 42, 52}, fr.nest(HERE)) ||
+      !TestUtil::fourWaySearchTest("second", ci, cached2.get(), 4, {2, 21, 40, 41, 42, 52}, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+  // And these by the runs.
+  cache.extend(ci);
+  if (!TestUtil::fourWaySearchTest("extended", ci, cached1.get(), 4, {2, 21, 40, 41, 42, 52},
+      fr.nest(HERE))) {
+    FAIL(fr);
+  }
+
+  auto uncached = cache.lookupOrInsert(HavingReaction::create("👎"));
+  CHECK(cache.size() == 1);
+  CHECK(toString(*uncached) == "HavingReaction(👎)");
+
+  cached1.reset();
+  CHECK(cache.size() == 1);
+  cached2.reset();
+  CHECK(cache.size() == 0);
+}
+
+// Extend an entry for "sender:kosak and sender:simon", which matches nothing, under a postings
+// budget that trips partway through the scan. With no matches to go by, the entry has to resume
+// from where the tripped scan got to, or it would start over at zero every time and never finish.
+TEST_CASE("coordinator: budgeted query cache entry makes progress", "[coordinator]") {
+  FailRoot fr;
+  std::shared_ptr<PathMaster> pm;
+  ConsolidatedIndex ci;
+  FiniteAutomaton kosakDfa;
+  FiniteAutomaton simonDfa;
+  if (!tryGetPathMaster(&pm, fr.nest(HERE)) ||
+      !TestUtil::trySetupConsolidatedIndex(pm, &ci, fr.nest(HERE)) ||
+      !TestUtil::tryMakeDfa("kosak", &kosakDfa, fr.nest(HERE)) ||
+      !TestUtil::tryMakeDfa("simon", &simonDfa, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+  std::vector<std::unique_ptr<ZgramIterator>> children;
+  children.push_back(WordAdaptor::create(Pattern::create(std::move(kosakDfa), FieldMask::sender)));
+  children.push_back(WordAdaptor::create(Pattern::create(std::move(simonDfa), FieldMask::sender)));
+  CachedQueryEntry entry(And::create(std::move(children)));
+
+  // Enough for both patterns' first chunks, but not for a second look at them.
+  constexpr size_t maxPostings = 51;
+  auto end = ci.zgramEndOff().raw();
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::hours(1);
+  size_t numTrips = 0;
+  while (entry.evaluatedEnd() != end && numTrips != end) {
+    QueryBudget budget(deadline, maxPostings);
+    entry.extend(IteratorContext(ci, true, &budget));
+    if (budget.tripped()) {
+      ++numTrips;
+    }
+  }
+  CHECK(numTrips != 0);
+  CHECK(entry.evaluatedEnd() == end);
+  CHECK(entry.runs().numBlocks() == 0);
+}
+
+// The delta-encoded runs decode to what went in, across block boundaries and with gaps too big for
+// one varint byte.
+TEST_CASE("coordinator: query cache runs round-trip", "[coordinator]") {
+  std::vector<RunList::run_t> expected;
+  uint32_t next = 0;
+  for (size_t i = 0; i != 3 * RunList::runsPerBlock + 5; ++i) {
+    auto gap = i % 3 == 0 ? 1000000 : (uint32_t)(i % 7) + 1;
+    auto length = i % 4 == 0 ? 300 : (uint32_t)(i % 5) + 1;
+    // The first run starts at zero.
+    auto first = i == 0 ? 0 : next + gap;
+    expected.emplace_back(first, first + length);
+    next = first + length;
+  }
+
+  RunList runs;
+  for (const auto &run : expected) {
+    for (auto o = run.first; o != run.second; ++o) {
+      runs.append(o);
+    }
+  }
+
+  auto numBlocks = (expected.size() + RunList::runsPerBlock - 1) / RunList::runsPerBlock;
+  CHECK(runs.numBlocks() == numBlocks);
+  std::vector<RunList::run_t> actual;
+  RunList::run_t block[RunList::runsPerBlock];
+  for (size_t b = 0; b != runs.numBlocks(); ++b) {
+    auto numRuns = runs.decodeBlock(b, block);
+    actual.insert(actual.end(), block, block + numRuns);
+  }
+  CHECK(expected == actual);
+
+  CHECK(runs.countBlocksStartingAtOrBefore(0) == 1);
+  CHECK(runs.countBlocksStartingAtOrBefore(expected[RunList::runsPerBlock].first - 1) == 1);
+  CHECK(runs.countBlocksStartingAtOrBefore(expected[RunList::runsPerBlock].first) == 2);
+  CHECK(runs.countBlocksStartingAtOrBefore(expected.back().second) == numBlocks);
+}
+
 namespace {
 bool tryGetPathMaster(std::shared_ptr<PathMaster> *result, const FailFrame &ff) {
   return TestUtil::tryGetPathMaster("coordinator", result, ff.nest(HERE));
@@ -12,6 +12,7 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
 #include <list>
 #include <string>
 #include <vector>
@@ -21,6 +22,7 @@
 #include "kosak/coding/text/conversions.h"
 #include "z2kplus/backend/files/keys.h"
 #include "z2kplus/backend/queryparsing/util.h"
+#include "z2kplus/backend/reverse_index/trie/folded_vocabulary.h"
 #include "z2kplus/backend/util/automaton/automaton.h"
 #include "z2kplus/backend/util/misc.h"
 #include "z2kplus/backend/test/util/test_util.h"
@@ -34,6 +36,7 @@ using z2kplus::backend::files::PathMaster;
 using z2kplus::backend::queryparsing::WordSplitter;
 using z2kplus::backend::reverse_index::FieldMask;
 using z2kplus::backend::reverse_index::WordInfo;
+using z2kplus::backend::reverse_index::trie::FoldedVocabulary;
 using z2kplus::backend::util::automaton::FiniteAutomaton;
 using z2kplus::backend::util::automaton::PatternChar;
 using z2kplus::backend::test::util::TestUtil;
@@ -209,6 +212,44 @@ TEST_CASE("dfa: *cinn*bon*","[dfa]") {
   checkDFA("*cinn*bon*", cinnabonChallenges.data(), expectedResults.data(), cinnabonChallenges.size());
 }
 
+// Every word that the DFA accepts must fold to one of its probes.
+TEST_CASE("dfa: folded probes cover cinnabon","[dfa]") {
+  FailRoot fr;
+  FiniteAutomaton dfa;
+  if (!TestUtil::tryMakeDfa("cinnabon", &dfa, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+  const auto *probes = dfa.foldedProbes();
+  REQUIRE(probes != nullptr);
+  CHECK(std::find(probes->begin(), probes->end(), U"cinnabon") != probes->end());
+
+  ReusableString32 rs32;
+  std::u32string folded;
+  for (const auto *challenge : cinnabonChallenges) {
+    auto sv32 = TestUtil::friendlyReset(&rs32, challenge);
+    const auto *node = dfa.start()->tryAdvance(sv32);
+    if (node == nullptr || !node->accepting()) {
+      continue;
+    }
+    folded.clear();
+    FoldedVocabulary::fold(sv32, &folded);
+    INFO("Failed check on " << challenge);
+    CHECK(std::find(probes->begin(), probes->end(), folded) != probes->end());
+  }
+}
+
+TEST_CASE("dfa: wildcards and exact patterns have no folded probes","[dfa]") {
+  FailRoot fr;
+  FiniteAutomaton wild;
+  FiniteAutomaton exact;
+  if (!TestUtil::tryMakeDfa("cinn?bon", &wild, fr.nest(HERE)) ||
+      !TestUtil::tryMakeDfa(R"(\x\y\z)", &exact, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+  CHECK(wild.foldedProbes() == nullptr);
+  CHECK(exact.foldedProbes() == nullptr);
+}
+
 static void testAcceptEverything(std::string_view pattern, bool expectedResult) {
   FailRoot fr;
   FiniteAutomaton dfa;
@@ -12,22 +12,35 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <fcntl.h>
+#include <sys/stat.h>
 #include <cstdint>
 #include <list>
+#include <map>
 #include <string>
+#include <thread>
 #include "catch/catch.hpp"
 #include "kosak/coding/coding.h"
 #include "kosak/coding/containers/slice.h"
+#include "kosak/coding/memory/buffered_writer.h"
 #include "kosak/coding/memory/mapped_file.h"
 #include "kosak/coding/text/conversions.h"
 #include "kosak/coding/unix.h"
 #include "z2kplus/backend/factories/log_parser.h"
 #include "z2kplus/backend/files/path_master.h"
+#include "z2kplus/backend/reverse_index/builder/build_governor.h"
+#include "z2kplus/backend/reverse_index/builder/build_memory_tracker.h"
+#include "z2kplus/backend/reverse_index/builder/common.h"
 #include "z2kplus/backend/reverse_index/builder/index_builder.h"
+#include "z2kplus/backend/reverse_index/builder/index_file_writer.h"
+#include "z2kplus/backend/reverse_index/builder/stage_manifest.h"
+#include "z2kplus/backend/reverse_index/builder/trie_entries.h"
 #include "z2kplus/backend/reverse_index/index/dynamic_index.h"
 #include "z2kplus/backend/reverse_index/index/frozen_index.h"
+#include "z2kplus/backend/reverse_index/index/index_layout.h"
 #include "z2kplus/backend/reverse_index/trie/dynamic_trie.h"
 #include "z2kplus/backend/reverse_index/types.h"
+#include "z2kplus/backend/shared/magic_constants.h"
 #include "z2kplus/backend/shared/zephyrgram.h"
 #include "z2kplus/backend/shared/protocol/misc.h"
 #include "z2kplus/backend/util/misc.h"
@@ -36,7 +49,10 @@
 using kosak::coding::containers::asSlice;
 using kosak::coding::FailFrame;
 using kosak::coding::FailRoot;
+using kosak::coding::memory::BufferedWriter;
 using kosak::coding::memory::MappedFile;
+using kosak::coding::memory::WriteThrottle;
+using kosak::coding::nsunix::FileCloser;
 using kosak::coding::text::ReusableString32;
 using z2kplus::backend::factories::LogParser;
 using z2kplus::backend::files::FileKey;
@@ -48,10 +64,23 @@ using z2kplus::backend::files::PathMaster;
 using z2kplus::backend::shared::LogRecord;
 using z2kplus::backend::shared::ZgramId;
 using z2kplus::backend::shared::Zephyrgram;
+using z2kplus::backend::reverse_index::builder::BuildGovernor;
+using z2kplus::backend::reverse_index::builder::BuildMemoryTracker;
 using z2kplus::backend::reverse_index::builder::IndexBuilder;
+using z2kplus::backend::reverse_index::builder::IndexFileWriter;
+using z2kplus::backend::reverse_index::builder::MemoryReservation;
+using z2kplus::backend::reverse_index::builder::SimpleAllocator;
+using z2kplus::backend::reverse_index::builder::StageManifest;
+using z2kplus::backend::reverse_index::builder::TrieEntriesReader;
+using z2kplus::backend::reverse_index::builder::TrieEntriesWriter;
+using z2kplus::backend::reverse_index::builder::TrieEntry;
 using z2kplus::backend::reverse_index::index::ConsolidatedIndex;
 using z2kplus::backend::reverse_index::index::DynamicIndex;
 using z2kplus::backend::reverse_index::index::FrozenIndex;
+using z2kplus::backend::reverse_index::index::IndexLayout;
+using z2kplus::backend::reverse_index::index::IndexSection;
+using z2kplus::backend::reverse_index::index::SectionPolicy;
+using z2kplus::backend::reverse_index::index::SectionResidency;
 using z2kplus::backend::reverse_index::FieldMask;
 using z2kplus::backend::reverse_index::WordInfo;
 using z2kplus::backend::reverse_index::iterators::WordIterator;
@@ -62,6 +91,8 @@ using z2kplus::backend::reverse_index::wordOff_t;
 using z2kplus::backend::test::util::TestUtil;
 using z2kplus::backend::util::automaton::FiniteAutomaton;
 
+namespace filenames = z2kplus::backend::shared::magicConstants::filenames;
+namespace magicConstants = z2kplus::backend::shared::magicConstants;
 namespace nsunix = kosak::coding::nsunix;
 namespace indexBuilder = z2kplus::backend::reverse_index::builder;
 
@@ -81,6 +112,16 @@ const char simpleText1[] = "" // to help CLion align the next line
   R"([["z",[[1],946703314,"kosh","Kosh",true,["test","You are not ready","d"]]]])" "\n"
   // body revision of zgram 0
   R"([["m",[["zgrev",[[0],["test","I am Kosh","d"]]]]]])" "\n";
+
+auto simpleUnloggedKey1 = FileKey<FileKeyKind::Unlogged>::createUnsafe(2000, 1, 2, false);
+const char simpleUnloggedText1[] = "" // to help CLion align the next line
+  R"([["z",[[2],946703315,"kosak","Corey Kosak",false,["test","kosh++ is unlogged","d"]]]])" "\n";
+
+auto simpleKey2 = FileKey<FileKeyKind::Logged>::createUnsafe(2000, 1, 3, true);
+const char simpleText2[] = "" // to help CLion align the next line
+  R"([["z",[[3],946789715,"simon","Simon",true,["test","kosak++ kosh--","d"]]]])" "\n"
+  R"([["m",[["rx",[[3],"👍","kosak",true]]]]])" "\n"
+  R"([["z",[[4],946789716,"kosak","Corey Kosak",true,["test","Kosh says hi","d"]]]])" "\n";
 }  // namespace
 
 TEST_CASE("index_construction: Probe Dynamic Trie", "[index_construction]") {
@@ -180,6 +221,501 @@ TEST_CASE("index_construction: Build Frozen Index partial file", "[index_constru
   REQUIRE(9 == result.first->raw());
 }
 
+// Sections are in order, page-aligned, and the cold group starts on a hugepage boundary. The
+// structures the FrozenIndex points to live inside their own sections.
+TEST_CASE("index_construction: Frozen Index section layout", "[index_construction]") {
+  FailRoot fr;
+  std::shared_ptr<PathMaster> pm;
+  MappedFile<FrozenIndex> mf;
+  if (!tryGetPathMaster(&pm, fr.nest(HERE)) ||
+      !TestUtil::tryPopulateFile(*pm, simpleKey0, simpleText0, fr.nest(HERE)) ||
+      !TestUtil::tryPopulateFile(*pm, simpleKey1, simpleText1, fr.nest(HERE)) ||
+      !IndexBuilder::tryBuild(*pm,
+          InterFileRange<FileKeyKind::Logged>::everything,
+          InterFileRange<FileKeyKind::Unlogged>::everything, fr.nest(HERE)) ||
+      !pm->tryPublishBuild(fr.nest(HERE)) ||
+      !mf.tryMap(pm->getIndexPath(), false, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+  const auto *index = mf.get();
+  const auto &sections = index->sections();
+  INFO(sections);
+  if (!sections.tryValidate(mf.byteSize(), fr.nest(HERE))) {
+    FAIL(fr);
+  }
+  for (size_t i = 0; i != (size_t)IndexSection::numSections; ++i) {
+    CHECK(sections.range((IndexSection)i).begin_ % magicConstants::indexSectionAlignment == 0);
+  }
+  CHECK(sections.range(IndexSection::header).begin_ == 0);
+  CHECK(sections.range(IndexSection::wordInfos).begin_ % magicConstants::indexHotGroupAlignment == 0);
+
+  const auto *base = reinterpret_cast<const char*>(index);
+  auto inSection = [&](IndexSection section, const void *p) {
+    auto offset = static_cast<const char*>(p) - base;
+    const auto &r = sections.range(section);
+    return r.begin_ <= (uint64_t)offset && (uint64_t)offset < r.end_;
+  };
+  CHECK(inSection(IndexSection::zgramInfos, index->zgramInfos().data()));
+  CHECK(inSection(IndexSection::wordInfos, index->wordInfos().data()));
+  // The trie's nodes are hot, but its postings are not.
+  CHECK(inSection(IndexSection::postings, index->trie().postings()));
+  CHECK(getPolicy(IndexSection::trie) == SectionPolicy::hot);
+  CHECK(getPolicy(IndexSection::postings) == SectionPolicy::normal);
+
+  IndexLayout::advise(base, sections, IndexLayout::Options());
+  std::vector<SectionResidency> residency;
+  if (!IndexLayout::tryMeasureResidency(base, sections, &residency, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+  REQUIRE(residency.size() == (size_t)IndexSection::numSections);
+  // We just wrote the file, so the header is certainly in memory.
+  CHECK(residency[(size_t)IndexSection::header].numPages_ == 1);
+  CHECK(residency[(size_t)IndexSection::header].numResidentPages_ == 1);
+}
+
+// The index doesn't depend on how the logs are chunked, on how many threads process the chunks, or
+// on how often the digesters spill their trie postings.
+TEST_CASE("index_construction: Frozen Index is independent of parallelism", "[index_construction]") {
+  FailRoot fr;
+  std::shared_ptr<PathMaster> pm;
+  if (!tryGetPathMaster(&pm, fr.nest(HERE)) ||
+      !TestUtil::tryPopulateFile(*pm, simpleKey0, simpleText0, fr.nest(HERE)) ||
+      !TestUtil::tryPopulateFile(*pm, simpleKey1, simpleText1, fr.nest(HERE)) ||
+      !TestUtil::tryPopulateFile(*pm, simpleUnloggedKey1, simpleUnloggedText1, fr.nest(HERE)) ||
+      !TestUtil::tryPopulateFile(*pm, simpleKey2, simpleText2, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+  auto tryBuild = [&pm](size_t chunkSize, size_t numThreads, size_t trieEntriesBudget,
+      size_t memoryBudget, std::string *result, const FailFrame &ff) {
+    IndexBuilder::Options options;
+    options.chunkSize_ = chunkSize;
+    options.numThreads_ = numThreads;
+    options.trieEntriesBudget_ = trieEntriesBudget;
+    options.memoryBudget_ = memoryBudget;
+    // Otherwise the later builds would just reuse the earlier ones' chunks.
+    options.useDigestCache_ = false;
+    MappedFile<char> mf;
+    if (!IndexBuilder::tryClearScratchDirectory(*pm, ff.nest(HERE)) ||
+        !IndexBuilder::tryBuild(*pm,
+            InterFileRange<FileKeyKind::Logged>::everything,
+            InterFileRange<FileKeyKind::Unlogged>::everything, options, ff.nest(HERE)) ||
+        !mf.tryMap(pm->getScratchIndexPath(), false, ff.nest(HERE))) {
+      return false;
+    }
+    result->assign(mf.get(), mf.byteSize());
+    return true;
+  };
+
+  const auto budget = magicConstants::trieEntriesBudget;
+  const auto memory = magicConstants::indexBuilderMemoryBudget;
+  std::string oneChunk;
+  std::string manyChunksOneThread;
+  std::string manyChunksManyThreads;
+  // A budget this small spills a run for every word.
+  std::string manyRuns;
+  // So does a memory budget this small, which also forces one thread and minimal sort buffers.
+  std::string starved;
+  if (!tryBuild(magicConstants::indexBuilderChunkSize, 1, budget, memory, &oneChunk,
+          fr.nest(HERE)) ||
+      !tryBuild(1, 1, budget, memory, &manyChunksOneThread, fr.nest(HERE)) ||
+      !tryBuild(1, 3, budget, memory, &manyChunksManyThreads, fr.nest(HERE)) ||
+      !tryBuild(1, 3, 1, memory, &manyRuns, fr.nest(HERE)) ||
+      !tryBuild(1, 3, budget, 1, &starved, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+  CHECK(!oneChunk.empty());
+  CHECK(oneChunk == manyChunksOneThread);
+  CHECK(oneChunk == manyChunksManyThreads);
+  CHECK(oneChunk == manyRuns);
+  CHECK(oneChunk == starved);
+}
+
+// A build that reuses cached chunks makes the same index as one that starts from scratch, and
+// only the chunks whose input changed are split and digested again.
+TEST_CASE("index_construction: digest cache", "[index_construction]") {
+  FailRoot fr;
+  std::shared_ptr<PathMaster> pm;
+  if (!tryGetPathMaster(&pm, fr.nest(HERE)) ||
+      !TestUtil::tryPopulateFile(*pm, simpleKey0, simpleText0, fr.nest(HERE)) ||
+      !TestUtil::tryPopulateFile(*pm, simpleKey1, simpleText1, fr.nest(HERE)) ||
+      !TestUtil::tryPopulateFile(*pm, simpleUnloggedKey1, simpleUnloggedText1, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+  auto tryBuild = [&pm](bool useDigestCache, std::string *result, const FailFrame &ff) {
+    IndexBuilder::Options options;
+    // One chunk per day.
+    options.chunkSize_ = 1;
+    options.useDigestCache_ = useDigestCache;
+    MappedFile<char> mf;
+    if (!IndexBuilder::tryClearScratchDirectory(*pm, ff.nest(HERE)) ||
+        !IndexBuilder::tryBuild(*pm,
+            InterFileRange<FileKeyKind::Logged>::everything,
+            InterFileRange<FileKeyKind::Unlogged>::everything, options, ff.nest(HERE)) ||
+        !mf.tryMap(pm->getScratchIndexPath(), false, ff.nest(HERE))) {
+      return false;
+    }
+    result->assign(mf.get(), mf.byteSize());
+    return true;
+  };
+  // An entry that is reused keeps its inodes; one that is stored again gets new ones.
+  auto tryGetCacheInodes = [&pm](std::map<std::string, ino_t> *result, const FailFrame &ff) {
+    result->clear();
+    auto cb = [result](std::string_view fullPath, bool isDir, const FailFrame &ff2) {
+      if (isDir) {
+        return true;
+      }
+      std::string path(fullPath);
+      struct stat st = {};
+      if (stat(path.c_str(), &st) != 0) {
+        return ff2.failf(HERE, "Can't stat %o", path);
+      }
+      (*result)[std::move(path)] = st.st_ino;
+      return true;
+    };
+    return nsunix::tryEnumerateFilesAndDirsRecursively(pm->digestCacheRoot(), &cb, ff.nest(HERE));
+  };
+
+  std::string uncached;
+  std::string cold;
+  std::string warm;
+  std::map<std::string, ino_t> coldInodes;
+  std::map<std::string, ino_t> warmInodes;
+  if (!tryBuild(false, &uncached, fr.nest(HERE)) ||
+      !tryBuild(true, &cold, fr.nest(HERE)) ||
+      !tryGetCacheInodes(&coldInodes, fr.nest(HERE)) ||
+      !tryBuild(true, &warm, fr.nest(HERE)) ||
+      !tryGetCacheInodes(&warmInodes, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+  CHECK(!uncached.empty());
+  CHECK(uncached == cold);
+  CHECK(uncached == warm);
+  CHECK(!coldInodes.empty());
+  CHECK(coldInodes == warmInodes);
+
+  // A new day: the old days' chunks are reused, and the new one is added.
+  std::string incremental;
+  std::string fresh;
+  std::map<std::string, ino_t> incrementalInodes;
+  if (!TestUtil::tryPopulateFile(*pm, simpleKey2, simpleText2, fr.nest(HERE)) ||
+      !tryBuild(true, &incremental, fr.nest(HERE)) ||
+      !tryGetCacheInodes(&incrementalInodes, fr.nest(HERE)) ||
+      !tryBuild(false, &fresh, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+  CHECK(incremental == fresh);
+  CHECK(incrementalInodes.size() > warmInodes.size());
+  size_t numReused = 0;
+  for (const auto &[name, inode] : incrementalInodes) {
+    auto ip = warmInodes.find(name);
+    numReused += ip != warmInodes.end() && ip->second == inode;
+  }
+  CHECK(numReused != 0);
+
+  // Damaged entries are misses: garble the first entry's manifest and change the contents of one
+  // of the last entry's files.
+  std::string garbledManifest;
+  std::string changedFile;
+  for (const auto &[name, inode] : incrementalInodes) {
+    (void)inode;
+    if (name.size() > 9 && name.substr(name.size() - 9) == ".manifest") {
+      if (garbledManifest.empty()) {
+        garbledManifest = name;
+      }
+    } else {
+      changedFile = name;
+    }
+  }
+  std::string repaired;
+  if (!nsunix::tryWriteAll(garbledManifest, "this is not a manifest", fr.nest(HERE)) ||
+      !nsunix::tryWriteAll(changedFile, "this is not what was stored", fr.nest(HERE)) ||
+      !tryBuild(true, &repaired, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+  CHECK(repaired == fresh);
+}
+
+// A build that finds the scratch directory as an earlier build left it picks up that build's split
+// and digested chunks, unless they were damaged or their inputs changed, and makes the same index
+// either way.
+TEST_CASE("index_construction: resume from stage manifest", "[index_construction]") {
+  FailRoot fr;
+  std::shared_ptr<PathMaster> pm;
+  if (!tryGetPathMaster(&pm, fr.nest(HERE)) ||
+      !TestUtil::tryPopulateFile(*pm, simpleKey0, simpleText0, fr.nest(HERE)) ||
+      !TestUtil::tryPopulateFile(*pm, simpleKey1, simpleText1, fr.nest(HERE)) ||
+      !TestUtil::tryPopulateFile(*pm, simpleUnloggedKey1, simpleUnloggedText1, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+  auto tryBuild = [&pm](bool clearScratch, std::string *result, const FailFrame &ff) {
+    IndexBuilder::Options options;
+    options.chunkSize_ = 1;
+    // So that everything that is reused comes from the manifest.
+    options.useDigestCache_ = false;
+    MappedFile<char> mf;
+    if ((clearScratch && !IndexBuilder::tryClearScratchDirectory(*pm, ff.nest(HERE))) ||
+        !IndexBuilder::tryBuild(*pm,
+            InterFileRange<FileKeyKind::Logged>::everything,
+            InterFileRange<FileKeyKind::Unlogged>::everything, options, ff.nest(HERE)) ||
+        !mf.tryMap(pm->getScratchIndexPath(), false, ff.nest(HERE))) {
+      return false;
+    }
+    result->assign(mf.get(), mf.byteSize());
+    return true;
+  };
+  // One output of each stage. A stage that is resumed leaves its files alone.
+  auto splitterOutput = pm->getScratchPathFor(filenames::zgramRevisions);
+  auto digestorOutput = pm->getScratchPathFor(filenames::plusPlusKeys);
+  auto tryGetInodes = [&](std::pair<ino_t, ino_t> *result, const FailFrame &ff) {
+    struct stat st0 = {};
+    struct stat st1 = {};
+    if (stat(splitterOutput.c_str(), &st0) != 0 || stat(digestorOutput.c_str(), &st1) != 0) {
+      return ff.failf(HERE, "Can't stat %o or %o", splitterOutput, digestorOutput);
+    }
+    *result = std::make_pair(st0.st_ino, st1.st_ino);
+    return true;
+  };
+
+  std::string fresh;
+  std::string resumed;
+  std::pair<ino_t, ino_t> freshInodes;
+  std::pair<ino_t, ino_t> resumedInodes;
+  StageManifest manifest;
+  if (!tryBuild(true, &fresh, fr.nest(HERE)) ||
+      !tryGetInodes(&freshInodes, fr.nest(HERE)) ||
+      !StageManifest::tryLoad(*pm, &manifest, fr.nest(HERE)) ||
+      !tryBuild(false, &resumed, fr.nest(HERE)) ||
+      !tryGetInodes(&resumedInodes, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+  CHECK(manifest.numStages() == 2);
+  CHECK(!fresh.empty());
+  CHECK(fresh == resumed);
+  CHECK(freshInodes == resumedInodes);
+
+  // Touching a log without changing the bytes in its range (as happens to today's log, which keeps
+  // growing during a build) doesn't stop the build from resuming.
+  std::string touched;
+  std::pair<ino_t, ino_t> touchedInodes;
+  auto logName = pm->getPlaintextPath(simpleKey0);
+  if (utimensat(AT_FDCWD, logName.c_str(), nullptr, 0) != 0) {
+    FAIL("Can't touch " << logName);
+  }
+  if (!tryBuild(false, &touched, fr.nest(HERE)) ||
+      !tryGetInodes(&touchedInodes, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+  CHECK(fresh == touched);
+  CHECK(freshInodes == touchedInodes);
+
+  // A damaged output makes its stage run again, but not the stage before it.
+  std::string repaired;
+  std::pair<ino_t, ino_t> repairedInodes;
+  if (!nsunix::tryWriteAll(digestorOutput, "garbage", fr.nest(HERE)) ||
+      !tryBuild(false, &repaired, fr.nest(HERE)) ||
+      !tryGetInodes(&repairedInodes, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+  CHECK(fresh == repaired);
+  CHECK(freshInodes.first == repairedInodes.first);
+
+  // New input makes every stage run again.
+  std::string incremental;
+  std::string incrementalFresh;
+  if (!TestUtil::tryPopulateFile(*pm, simpleKey2, simpleText2, fr.nest(HERE)) ||
+      !tryBuild(false, &incremental, fr.nest(HERE)) ||
+      !tryBuild(true, &incrementalFresh, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+  CHECK(incremental != fresh);
+  CHECK(incremental == incrementalFresh);
+}
+
+// The file grows a step at a time behind the allocator (never sparse, never much bigger than what
+// has been allocated), and what comes out is exactly what was written, including the parts written
+// long after they were allocated, or written back and dropped from the cache.
+TEST_CASE("index_construction: IndexFileWriter", "[index_construction]") {
+  FailRoot fr;
+  std::shared_ptr<PathMaster> pm;
+  if (!tryGetPathMaster(&pm, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+  IndexFileWriter::Options options;
+  options.growStep_ = 64 * 1024;
+  options.writeBehind_ = 16 * 1024;
+  options.dropWrittenPages_ = true;
+  IndexFileWriter writer(options);
+  auto fileName = pm->getScratchPathFor("index_file_writer_test");
+  if (!writer.tryOpen(fileName, 1024 * 1024 * 1024, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+  SimpleAllocator alloc(&writer, 8);
+  uint64_t *header = nullptr;
+  std::string expected(sizeof(uint64_t), 0);
+  if (!alloc.tryAllocate(1, &header, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+  bool fileKeptUp = true;
+  for (size_t i = 0; i != 5000; ++i) {
+    char *block;
+    auto size = 1 + i % 97;
+    if (!alloc.tryAllocate(size, 1, &block, fr.nest(HERE))) {
+      FAIL(fr);
+    }
+    memset(block, 'a' + i % 26, size);
+    expected.append(block, size);
+    fileKeptUp &= writer.fileSize() >= alloc.allocatedSize() &&
+        writer.fileSize() < alloc.allocatedSize() + options.growStep_;
+  }
+  CHECK(fileKeptUp);
+  *header = 0x0123456789abcdefULL;
+  memcpy(expected.data(), header, sizeof(*header));
+
+  std::string actual;
+  if (!writer.tryFinish(alloc.allocatedSize(), fr.nest(HERE)) ||
+      !nsunix::tryReadAll(fileName, &actual, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+  CHECK(expected.size() == alloc.allocatedSize());
+  CHECK(actual == expected);
+}
+
+TEST_CASE("index_construction: BuildMemoryTracker", "[index_construction]") {
+  FailRoot fr;
+  BuildMemoryTracker memory(1000);
+  {
+    MemoryReservation reservation(&memory);
+    CHECK(reservation.tryResizeIfAvailable(600));
+    CHECK(!reservation.tryResizeIfAvailable(1001));
+    CHECK(reservation.size() == 600);
+    CHECK(memory.threadsFor(8, 100) == 4);
+    CHECK(memory.tryReserve(400, fr.nest(HERE)));
+    memory.release(400);
+
+    // Forced reservations can go over, and then nothing else fits.
+    reservation.forceResize(1500);
+    CHECK(memory.resourcesExceeded());
+    CHECK(!memory.reserveIfAvailable(1));
+    CHECK(memory.threadsFor(8, 100) == 1);
+    reservation.forceResize(100);
+    CHECK(!memory.resourcesExceeded());
+  }
+  CHECK(memory.estimateMemoryUsed() == 0);
+  CHECK(memory.endStage("test") == 1500);
+  CHECK(memory.endStage("test") == 0);
+
+  BuildMemoryTracker unlimited(0);
+  CHECK(unlimited.reserveIfAvailable(1'000'000'000'000));
+  CHECK(unlimited.sortBufferSize(3) == 0);
+  unlimited.release(1'000'000'000'000);
+}
+
+TEST_CASE("index_construction: BuildGovernor", "[index_construction]") {
+  using std::chrono::milliseconds;
+  BuildGovernor::Options options;
+  options.writeBytesPerSecond_ = 1'000'000;
+  options.latencyThreshold_ = milliseconds(50);
+  options.queueDepthThreshold_ = 10;
+  options.pressureHold_ = milliseconds(100);
+  options.maxPause_ = milliseconds(500);
+  BuildGovernor governor(options);
+
+  // The first second's worth is free; the next 200K cost about 200 ms.
+  auto start = std::chrono::steady_clock::now();
+  governor.beforeWrite(1'000'000);
+  governor.beforeWrite(200'000);
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  CHECK(elapsed >= milliseconds(150));
+  CHECK(governor.metrics().rateLimited_ >= milliseconds(150));
+  CHECK(governor.metrics().bytesWritten_ == 1'200'000);
+
+  // A fast, shallow batch doesn't pause us; a slow one or a deep queue does.
+  governor.reportServerLoad(milliseconds(10), 3);
+  governor.beforeWrite(0);
+  CHECK(governor.metrics().numPauses_ == 0);
+  governor.reportServerLoad(milliseconds(10), 11);
+  governor.beforeWrite(0);
+  governor.reportServerLoad(milliseconds(60), 0);
+  governor.beforeWrite(0);
+  CHECK(governor.metrics().numPauses_ == 2);
+  CHECK(governor.metrics().paused_ >= milliseconds(150));
+
+  // BufferedWriter consults the thread's throttle.
+  FailRoot fr;
+  std::shared_ptr<PathMaster> pm;
+  FileCloser fc;
+  if (!tryGetPathMaster(&pm, fr.nest(HERE)) ||
+      !nsunix::tryOpen(pm->getScratchPathFor("governor_test"), O_CREAT | O_WRONLY | O_TRUNC, 0644,
+          &fc, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+  {
+    WriteThrottle::Scope scope(&governor);
+    BufferedWriter writer(std::move(fc));
+    if (!writer.tryWriteBytes("hello", 5, fr.nest(HERE)) || !writer.tryClose(fr.nest(HERE))) {
+      FAIL(fr);
+    }
+  }
+  CHECK(governor.metrics().bytesWritten_ == 1'200'005);
+
+  // On a thread of its own, so as not to slow down the rest of the tests.
+  BuildGovernor lowered(BuildGovernor::defaultOptions());
+  FailRoot fr2;
+  bool success = false;
+  std::thread([&]() {
+    success = lowered.tryLowerCurrentThreadPriority(fr2.nest(HERE));
+  }).join();
+  if (!success) {
+    FAIL(fr2);
+  }
+}
+
+// Runs come out sorted bytewise (which for UTF-8 is code point order), with every posting intact.
+TEST_CASE("index_construction: TrieEntriesWriter runs", "[index_construction]") {
+  FailRoot fr;
+  std::shared_ptr<PathMaster> pm;
+  if (!tryGetPathMaster(&pm, fr.nest(HERE)) ||
+      !IndexBuilder::tryClearScratchDirectory(*pm, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+  // Plenty of shared prefixes, different lengths, and some multibyte characters.
+  std::vector<std::string> words;
+  for (size_t i = 0; i != 500; ++i) {
+    auto word = std::to_string(i * 7919 % 1000);
+    words.push_back(i % 3 == 0 ? "kosh" + word : i % 3 == 1 ? "ü" + word : word);
+  }
+  BuildMemoryTracker memory(0);
+  TrieEntriesWriter writer(pm->getScratchPathFor("trie_entries_test"), 1'000'000, &memory);
+  for (size_t i = 0; i != words.size() * 2; ++i) {
+    if (!writer.tryAdd(words[i % words.size()], i, fr.nest(HERE))) {
+      FAIL(fr);
+    }
+  }
+  if (!writer.tryClose(fr.nest(HERE))) {
+    FAIL(fr);
+  }
+  REQUIRE(writer.runNames().size() == 1);
+
+  std::map<std::string, std::vector<uint32_t>> expected;
+  for (size_t i = 0; i != words.size() * 2; ++i) {
+    expected[words[i % words.size()]].push_back(i);
+  }
+  TrieEntriesReader reader;
+  if (!TrieEntriesReader::tryCreate(writer.runNames().front(), &reader, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+  auto ip = expected.begin();
+  TrieEntry entry;
+  while (reader.tryGetNext(&entry)) {
+    REQUIRE(ip != expected.end());
+    CHECK(entry.key_ == ip->first);
+    CHECK(std::vector<uint32_t>(entry.wordOffs_, entry.wordOffs_ + entry.numWordOffs_) ==
+        ip->second);
+    ++ip;
+  }
+  CHECK(ip == expected.end());
+}
+
 TEST_CASE("index_construction: Probe Frozen Index", "[index_construction]") {
   FailRoot fr;
   std::shared_ptr<PathMaster> pm;
@@ -17,15 +17,15 @@
 #include "catch/catch.hpp"
 #include "kosak/coding/coding.h"
 #include "kosak/coding/failures.h"
-#include "kosak/coding/map_utils.h"
 #include "z2kplus/backend/files/path_master.h"
 #include "z2kplus/backend/reverse_index/index/consolidated_index.h"
+#include "z2kplus/backend/reverse_index/metadata/string_interner.h"
+#include "z2kplus/backend/shared/magic_constants.h"
 #include "z2kplus/backend/util/frozen/frozen_string_pool.h"
 #include "z2kplus/backend/test/util/test_util.h"
 
 using kosak::coding::FailFrame;
 using kosak::coding::FailRoot;
-using kosak::coding::maputils::tryFind;
 using kosak::coding::toString;
 using z2kplus::backend::files::PathMaster;
 using z2kplus::backend::shared::LogRecord;
@@ -33,16 +33,18 @@ using z2kplus::backend::shared::MetadataRecord;
 using z2kplus::backend::shared::ZgramId;
 using z2kplus::backend::shared::Zephyrgram;
 using z2kplus::backend::reverse_index::index::ConsolidatedIndex;
+using z2kplus::backend::reverse_index::index::MetadataBatch;
 using z2kplus::backend::reverse_index::FieldMask;
 using z2kplus::backend::reverse_index::WordInfo;
 using z2kplus::backend::reverse_index::iterators::WordIterator;
 using z2kplus::backend::reverse_index::iterators::ZgramIterator;
-using z2kplus::backend::reverse_index::metadata::DynamicMetadata;
 using z2kplus::backend::reverse_index::metadata::FrozenMetadata;
+using z2kplus::backend::reverse_index::metadata::StringInterner;
 using z2kplus::backend::test::util::TestUtil;
 using z2kplus::backend::util::automaton::FiniteAutomaton;
 using z2kplus::backend::util::frozen::frozenStringRef_t;
 
+namespace magicConstants = z2kplus::backend::shared::magicConstants;
 namespace zgMetadata = z2kplus::backend::shared::zgMetadata;
 
 #define HERE KOSAK_CODING_HERE
@@ -164,13 +166,16 @@ void testReactionsIndex(const ConsolidatedIndex &ci, const char *reaction,
 
   if (ci.frozenIndex().stringPool().tryFind(reaction, &fsr) &&
       ci.frozenIndex().metadata().reactionCounts().tryFind(fsr, &fInner)) {
-    for (const auto &[zgId, count] : *fInner) {
-      netCounts[zgId] += count;
+    const auto &bitmap = fInner->zgramOffs();
+    uint32_t off = 0;
+    for (size_t rank = 0; bitmap.tryFindNext(off, &off); ++rank, ++off) {
+      auto zgId = ci.frozenIndex().zgramInfos()[off].zgramId();
+      netCounts[zgId] += fInner->countAt(rank);
     }
   }
 
-  const DynamicMetadata::reactionCounts_t::mapped_type *dInner;
-  if (tryFind(ci.dynamicIndex().metadata().reactionCounts(), reaction, &dInner)) {
+  const auto *dInner = ci.dynamicIndex().metadata().findReactionCounts(reaction);
+  if (dInner != nullptr) {
     for (const auto &[zgId, count] : *dInner) {
       netCounts[zgId] += count;
     }
@@ -234,6 +239,133 @@ TEST_CASE("metadata: refersTo","[metadata]") {
   CHECK(a0.refersTo().raw() == 41);
 }
 
+TEST_CASE("metadata: thread","[metadata]") {
+  FailRoot fr;
+  std::shared_ptr<PathMaster> pm;
+  ConsolidatedIndex ci;
+  if (!getPathMaster(&pm, fr.nest(HERE)) ||
+      !TestUtil::trySetupConsolidatedIndex(pm, &ci, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+
+  auto toIds = [](std::initializer_list<uint64_t> raws) {
+    std::vector<ZgramId> result;
+    for (auto raw : raws) {
+      result.emplace_back(raw);
+    }
+    return result;
+  };
+
+  // On the frozen side, 42 refers to 41.
+  std::vector<ZgramId> actual;
+  ci.getReferredBy(ZgramId(41), &actual);
+  CHECK(actual == toIds({42}));
+  ci.getThread(ZgramId(41), 10, &actual);
+  CHECK(actual == toIds({41, 42}));
+  ci.getThread(ZgramId(41), 1, &actual);
+  CHECK(actual == toIds({41}));
+
+  // On the dynamic side, 30 starts referring to 42, and 42 stops referring to 41.
+  std::vector<MetadataRecord> records;
+  records.emplace_back(zgMetadata::ZgramRefersTo(ZgramId(30), ZgramId(42), true));
+  records.emplace_back(zgMetadata::ZgramRefersTo(ZgramId(42), ZgramId(41), false));
+  ConsolidatedIndex::ppDeltaMap_t deltaMap;
+  std::vector<MetadataRecord> movedRecords;
+  if (!ci.tryAddMetadata(std::move(records), &deltaMap, &movedRecords, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+  ci.getReferredBy(ZgramId(41), &actual);
+  CHECK(actual.empty());
+  ci.getReferredBy(ZgramId(42), &actual);
+  CHECK(actual == toIds({30}));
+  ci.getThread(ZgramId(42), 10, &actual);
+  CHECK(actual == toIds({30, 42}));
+  ci.getThread(ZgramId(41), 10, &actual);
+  CHECK(actual == toIds({41}));
+}
+
+// Resolving a whole range at once (which gallops through the frozen maps) should give the same
+// answers as resolving each zgram on its own.
+TEST_CASE("metadata: resolveMetadata","[metadata]") {
+  FailRoot fr;
+  std::shared_ptr<PathMaster> pm;
+  ConsolidatedIndex ci;
+  if (!getPathMaster(&pm, fr.nest(HERE)) ||
+      !TestUtil::trySetupConsolidatedIndex(pm, &ci, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+  std::vector<ZgramId> ids;
+  for (uint64_t raw = 0; raw != ci.zgramEnd().raw() + 5; ++raw) {
+    ids.emplace_back(raw);
+  }
+  MetadataBatch batch;
+  ci.resolveMetadata(ids.data(), ids.size(), &batch);
+  REQUIRE(batch.size() == ids.size());
+
+  size_t numRecords = 0;
+  for (size_t i = 0; i != ids.size(); ++i) {
+    INFO("zgramId=" << ids[i]);
+    CHECK(batch.zgramId(i) == ids[i]);
+    std::vector<MetadataRecord> fromBatch;
+    batch.appendMetadataRecords(i, &fromBatch);
+    std::vector<MetadataRecord> single;
+    ci.getMetadataFor(ids[i], &single);
+    CHECK(toString(fromBatch) == toString(single));
+    numRecords += single.size();
+
+    std::vector<ConsolidatedIndex::plusPlusKeyId_t> keys;
+    ci.getPlusPlusKeys(ids[i], &keys);
+    auto batchKeys = batch.plusPlusKeys(i);
+    CHECK(keys == std::vector<ConsolidatedIndex::plusPlusKeyId_t>(batchKeys.begin(),
+        batchKeys.end()));
+  }
+  // Make sure the test data actually has something in it.
+  CHECK(numRecords != 0);
+}
+
+// Strings in the frozen pool keep their frozenStringRef_t; new strings are numbered after them and
+// survive spilling into multiple arena chunks.
+TEST_CASE("metadata: stringInterner","[metadata]") {
+  FailRoot fr;
+  std::shared_ptr<PathMaster> pm;
+  ConsolidatedIndex ci;
+  if (!getPathMaster(&pm, fr.nest(HERE)) ||
+      !TestUtil::trySetupConsolidatedIndex(pm, &ci, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+  const auto &fsp = ci.frozenIndex().stringPool();
+  REQUIRE(fsp.size() != 0);
+  StringInterner interner(&fsp);
+
+  frozenStringRef_t fsr(0);
+  auto frozenText = std::string(fsp.toStringView(fsr));
+  CHECK(interner.intern(frozenText) == fsr.raw());
+  CHECK(interner.numDynamicStrings() == 0);
+
+  std::vector<std::string> texts;
+  std::vector<StringInterner::stringId_t> ids;
+  for (size_t i = 0; i != 5000; ++i) {
+    texts.push_back("not-in-the-frozen-pool-" + std::to_string(i) + std::string(i % 50, 'x'));
+    ids.push_back(interner.intern(texts.back()));
+  }
+  // A string bigger than a whole chunk.
+  texts.emplace_back(magicConstants::stringArenaChunkSize + 1, 'y');
+  ids.push_back(interner.intern(texts.back()));
+
+  CHECK(interner.numDynamicStrings() == texts.size());
+  for (size_t i = 0; i != texts.size(); ++i) {
+    INFO("i=" << i);
+    CHECK(ids[i] == fsp.size() + i);
+    CHECK(interner.toStringView(ids[i]) == texts[i]);
+    StringInterner::stringId_t found;
+    CHECK(interner.tryFind(texts[i], &found));
+    CHECK(found == ids[i]);
+    CHECK(interner.intern(texts[i]) == ids[i]);
+  }
+  StringInterner::stringId_t dummy;
+  CHECK(!interner.tryFind("never-interned", &dummy));
+}
+
 namespace {
 bool getPathMaster(std::shared_ptr<PathMaster> *result, const FailFrame &ff) {
   return TestUtil::tryGetPathMaster("metadata", result, ff.nest(HERE));
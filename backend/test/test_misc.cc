@@ -12,21 +12,51 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
 #include <string>
+#include <vector>
 #include "catch/catch.hpp"
+#include "kosak/coding/myjson.h"
 #include "kosak/coding/failures.h"
 #include "kosak/coding/memory/mapped_file.h"
+#include "kosak/coding/text/misc.h"
 #include "kosak/coding/unix.h"
+#include "z2kplus/backend/factories/log_record_scanner.h"
+#include "z2kplus/backend/reverse_index/builder/bitmap_builder.h"
+#include "z2kplus/backend/reverse_index/index/consolidated_index.h"
+#include "z2kplus/backend/shared/zephyrgram.h"
+#include "z2kplus/backend/shared/zgram_view.h"
 #include "z2kplus/backend/test/util/test_util.h"
+#include "z2kplus/backend/util/frozen/frozen_bitmap.h"
+#include "z2kplus/backend/util/json_scanner.h"
 #include "z2kplus/backend/util/misc.h"
 
 namespace z2kplus::backend::test {
 
 using kosak::coding::FailFrame;
 using kosak::coding::FailRoot;
+using kosak::coding::ParseContext;
 using kosak::coding::memory::MappedFile;
+using kosak::coding::text::Splitter;
+using kosak::coding::toString;
+using z2kplus::backend::factories::LogRecordBatch;
+using z2kplus::backend::factories::LogRecordScanner;
+using z2kplus::backend::files::FileKey;
+using z2kplus::backend::files::FileKeyKind;
 using z2kplus::backend::files::PathMaster;
+using z2kplus::backend::reverse_index::builder::BitmapBuilder;
+using z2kplus::backend::reverse_index::builder::SimpleAllocator;
+using z2kplus::backend::reverse_index::index::ConsolidatedIndex;
+using z2kplus::backend::shared::LogRecord;
+using z2kplus::backend::shared::MetadataRecord;
+using z2kplus::backend::shared::RenderStyle;
+using z2kplus::backend::shared::Zephyrgram;
+using z2kplus::backend::shared::ZgramCore;
+using z2kplus::backend::shared::ZgramId;
+using z2kplus::backend::shared::ZgramView;
 using z2kplus::backend::test::util::TestUtil;
+using z2kplus::backend::util::JsonScanner;
+using z2kplus::backend::util::frozen::FrozenBitmap;
 
 #define HERE KOSAK_CODING_HERE
 
@@ -34,6 +64,12 @@ namespace nsunix = kosak::coding::nsunix;
 
 namespace {
 bool tryGetPathMaster(std::shared_ptr<PathMaster> *result, const FailFrame &ff);
+// Parses 'record' with both LogRecordScanner and the generic parser, and checks that they agree.
+void checkScannerAgrees(const std::string &record);
+// Checks that entry 'i' of 'batch' is what the generic parser makes of 'record', which starts at
+// 'offset'.
+void checkBatchEntry(const LogRecordBatch &batch, size_t i, const std::string &record,
+    size_t offset);
 }  // namespace
 
 TEST_CASE("misc: Test MappedFile", "[misc]") {
@@ -62,9 +98,312 @@ TEST_CASE("misc: Test MappedFile", "[misc]") {
   }
 }
 
+TEST_CASE("misc: FrozenBitmap", "[misc]") {
+  // A sparse container, a container dense enough to become a bitset, and a lone value far away.
+  std::vector<uint32_t> values = {3, 17, 60000};
+  for (uint32_t i = 0; i != 10000; ++i) {
+    values.push_back(0x50000 + i * 3);
+  }
+  values.push_back(0xfffffff0);
+
+  std::vector<uint64_t> buffer(64 * 1024);
+  SimpleAllocator alloc((char*)buffer.data(), buffer.size() * sizeof(uint64_t), 8);
+  FailRoot fr;
+  FrozenBitmap bitmap;
+  if (!BitmapBuilder::tryMake(values.data(), values.size(), &alloc, &bitmap, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+  CHECK(bitmap.size() == values.size());
+
+  // Walk forward and backward through the whole thing.
+  std::vector<uint32_t> forward;
+  uint32_t v = 0;
+  for (size_t rank = 0; bitmap.tryFindNext(v, &v); ++rank, ++v) {
+    CHECK(bitmap.rank(v) == rank);
+    forward.push_back(v);
+    if (v == UINT32_MAX) {
+      break;
+    }
+  }
+  CHECK(forward == values);
+
+  std::vector<uint32_t> backward;
+  v = UINT32_MAX;
+  while (bitmap.tryFindPrev(v, &v)) {
+    backward.push_back(v);
+    if (v == 0) {
+      break;
+    }
+    --v;
+  }
+  CHECK(std::equal(backward.rbegin(), backward.rend(), values.begin(), values.end()));
+
+  CHECK(bitmap.contains(17));
+  CHECK(!bitmap.contains(18));
+  CHECK(bitmap.contains(0x50000 + 3));
+  CHECK(!bitmap.contains(0x50000 + 4));
+  CHECK(bitmap.tryFindNext(18, &v));
+  CHECK(v == 60000);
+  CHECK(bitmap.tryFindPrev(0x50000 - 1, &v));
+  CHECK(v == 60000);
+  CHECK(!bitmap.tryFindPrev(2, &v));
+  CHECK(!bitmap.tryFindNext(0xfffffff1, &v));
+  CHECK(bitmap.rank(0xfffffff1) == values.size());
+
+  // Input that isn't strictly increasing is rejected.
+  std::vector<uint32_t> bad = {5, 5};
+  FailRoot fr2(true);
+  FrozenBitmap badBitmap;
+  CHECK(!BitmapBuilder::tryMake(bad.data(), bad.size(), &alloc, &badBitmap, fr2.nest(HERE)));
+}
+
+// A ZgramView must reproduce, byte for byte, the JSON that the Zephyrgram itself would emit.
+TEST_CASE("misc: ZgramView", "[misc]") {
+  FailRoot fr;
+  auto makeZgram = []() {
+    ZgramCore core("help.\"quoted\"", "line one\nline two\t\\ done",
+        RenderStyle::MarkDeepMathJax);
+    return Zephyrgram(ZgramId(12345), 946703313, "kosak", "Corey \"K\" Kosak", false,
+        std::move(core));
+  };
+  auto zg = makeZgram();
+  std::string zgJson;
+  std::string logRecordJson;
+  std::string bodyJson;
+  if (!tryAppendJson(zg, &zgJson, fr.nest(HERE)) ||
+      !tryAppendJson(LogRecord(makeZgram()), &logRecordJson, fr.nest(HERE)) ||
+      !tryAppendJson(zg.zgramCore().body(), &bodyJson, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+
+  std::shared_ptr<const ZgramView> view;
+  if (!ZgramView::tryCreateFromLogRecord(logRecordJson, &view, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+  CHECK(view->zgramId() == zg.zgramId());
+  CHECK(view->timesecs() == zg.timesecs());
+  CHECK(view->isLogged() == zg.isLogged());
+  CHECK(view->renderStyle() == zg.zgramCore().renderStyle());
+  CHECK(view->json() == zgJson);
+  CHECK(view->bodyJson() == bodyJson);
+
+  std::string spliced;
+  if (!tryAppendJson(*view, &spliced, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+  CHECK(spliced == zgJson);
+
+  Zephyrgram decoded;
+  if (!view->tryDecode(&decoded, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+  CHECK(decoded.sender() == zg.sender());
+  CHECK(decoded.signature() == zg.signature());
+  CHECK(decoded.zgramCore().instance() == zg.zgramCore().instance());
+  CHECK(decoded.zgramCore().body() == zg.zgramCore().body());
+
+  // Metadata records are not zgrams.
+  FailRoot fr2(true);
+  CHECK(!ZgramView::tryCreateFromLogRecord(R"([["m",[["r",[[3],"x","kosak",true]]]]])", &view,
+      fr2.nest(HERE)));
+}
+
+// The scanner has to agree with the generic parser on everything, including the records it doesn't
+// handle itself.
+TEST_CASE("misc: LogRecordScanner agrees with the generic parser", "[misc]") {
+  std::string longBody(100, 'x');
+  longBody[40] = '\\';
+  longBody.insert(41, "\"");
+  std::string longRecord;
+  {
+    FailRoot fr;
+    ZgramCore core("long", longBody, RenderStyle::Default);
+    if (!tryAppendJson(LogRecord(Zephyrgram(ZgramId(7), 8, "a", "b", true, std::move(core))),
+        &longRecord, fr.nest(HERE))) {
+      FAIL(fr);
+    }
+  }
+  std::string rawTab = R"([["z",[[8],946703319,"kosak","Corey Kosak",true,["help","raw tab","d"]]]])";
+  rawTab[rawTab.find("raw tab") + 3] = '\t';
+  std::string rawNul = R"([["z",[[9],946703320,"kosak","Corey Kosak",true,["help","nul","d"]]]])";
+  rawNul[rawNul.find("Corey Kosak") + 5] = '\0';
+  const std::vector<std::string> records = {
+      R"([["z",[[1],946703313,"kosak","Corey Kosak",true,["help","hello","d"]]]])",
+      R"([["z",[[2],946703314,"simon","",false,["help.cheese","Kosak: I ❤ \"cheese\"\n","x"]]]])",
+      R"([["z",[[3],946703315,"kosak","Corey 😀 Kosak",true,["","","d"]]]])",
+      R"([["m",[["rx",[[30],"👍","kosak",true]]]]])",
+      R"([["m",[["zgrev",[[30],["help","new \"body\"","x"]]]]]])",
+      R"([["m",[["ref",[[30],[12],false]]]]])",
+      R"([["m",[["zmojis",["kosak","👍,💕"]]]]])",
+      // Not the shape we write, so these go the slow way.
+      R"([ ["z", [[4], 946703316, "kosak", "Corey Kosak", true, ["help", "spaced", "d"]]]])",
+      R"([["z",[[5],946703317,"kosak","Corey Kosak",true,["help","escaped tag","\u0064"]]]])",
+      R"([["z",[[6],18446744073709551615,"kosak","Corey Kosak",true,["help","twenty digits","d"]]]])",
+      // JSON doesn't allow leading zeros or raw control characters, so the scanner leaves these to
+      // the generic parser too.
+      R"([["z",[[007],946703318,"kosak","Corey Kosak",true,["help","leading zeros","d"]]]])",
+      R"([["m",[["ref",[[30],[012],false]]]]])",
+      rawTab,
+      rawNul,
+      longRecord
+  };
+  for (const auto &record : records) {
+    checkScannerAgrees(record);
+  }
+
+  // Malformed records fail.
+  for (const char *bad : {R"([["z",[[1],946703313,"kosak","Corey Kosak",true,["help","hello","d"]]])",
+      R"([["z",[[1],946703313,"kosak","Corey Kosak",true,["help","hello","q"]]]])",
+      R"([["z",[[1],946703313,"kosak","unterminated]]]])"}) {
+    INFO(bad);
+    FailRoot fr(true);
+    LogRecord lr;
+    CHECK(!LogRecordScanner::tryParse(bad, &lr, fr.nest(HERE)));
+  }
+
+  // A region keeps file order and log locations.
+  std::string region;
+  for (const auto &record : records) {
+    region.append(record);
+    region.push_back('\n');
+  }
+  FailRoot fr;
+  FileKey<FileKeyKind::Either> fileKey;
+  if (!FileKey<FileKeyKind::Either>::tryCreate(2000, 1, 1, true, &fileKey, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+  LogRecordBatch batch;
+  if (!LogRecordScanner::tryScanRegion(region, fileKey, 1000, &batch, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+  REQUIRE(batch.order().size() == records.size());
+  size_t offset = 1000;
+  for (size_t i = 0; i != records.size(); ++i) {
+    checkBatchEntry(batch, i, records[i], offset);
+    offset += records[i].size() + 1;
+  }
+}
+
+// Every record of every test log, one at a time and as a whole file.
+TEST_CASE("misc: LogRecordScanner agrees with the generic parser on the test logs", "[misc]") {
+  FailRoot fr;
+  std::shared_ptr<PathMaster> pm;
+  ConsolidatedIndex ci;
+  std::vector<FileKey<FileKeyKind::Either>> fileKeys;
+  auto cb = [&fileKeys](FileKey<FileKeyKind::Either> fileKey, const FailFrame &) {
+    fileKeys.push_back(fileKey);
+    return true;
+  };
+  if (!tryGetPathMaster(&pm, fr.nest(HERE)) ||
+      !TestUtil::trySetupConsolidatedIndex(pm, &ci, fr.nest(HERE)) ||
+      !pm->tryGetPlaintexts(&cb, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+  REQUIRE(!fileKeys.empty());
+
+  size_t numRecords = 0;
+  for (const auto &fileKey : fileKeys) {
+    INFO(fileKey);
+    std::string text;
+    LogRecordBatch batch;
+    if (!nsunix::tryReadAll(pm->getPlaintextPath(fileKey), &text, fr.nest(HERE)) ||
+        !LogRecordScanner::tryScanRegion(text, fileKey, 0, &batch, fr.nest(HERE))) {
+      FAIL(fr);
+    }
+    auto splitter = Splitter::ofRecords(text, '\n');
+    std::string_view line;
+    size_t i = 0;
+    size_t offset = 0;
+    while (splitter.moveNext(&line)) {
+      std::string record(line);
+      checkScannerAgrees(record);
+      REQUIRE(i < batch.order().size());
+      checkBatchEntry(batch, i, record, offset);
+      offset += record.size() + 1;
+      ++i;
+    }
+    CHECK(i == batch.order().size());
+    numRecords += i;
+  }
+  CHECK(numRecords != 0);
+}
+
+// Quotes and backslashes are found wherever they fall relative to the vector width.
+TEST_CASE("misc: JsonScanner", "[misc]") {
+  for (size_t size = 0; size != 80; ++size) {
+    // Bytes of multibyte UTF-8 characters (0x80 and up) aren't special.
+    std::string text(size, 'a');
+    for (size_t pos = 1; pos < size; pos += 3) {
+      text[pos] = (char)0xe2;
+    }
+    CHECK(JsonScanner::findSpecial(text.data(), text.data() + size) == text.data() + size);
+    for (size_t pos = 0; pos != size; ++pos) {
+      for (char ch : {'"', '\\', '\0', '\n', '\x1f'}) {
+        auto copy = text;
+        copy[pos] = ch;
+        CHECK(JsonScanner::findSpecial(copy.data(), copy.data() + size) == copy.data() + pos);
+      }
+    }
+  }
+
+  std::string text = R"(abc\"def\\"tail)";
+  std::string_view contents;
+  bool hasEscapes;
+  const auto *next = JsonScanner::scanString(text.data(), text.data() + text.size(), &contents,
+      &hasEscapes);
+  REQUIRE(next != nullptr);
+  CHECK(contents == R"(abc\"def\\)");
+  CHECK(hasEscapes);
+  CHECK(std::string_view(next) == "tail");
+  CHECK(JsonScanner::scanString(text.data(), text.data() + 5, &contents, &hasEscapes) == nullptr);
+  std::string withTab = "abc\tdef\"";
+  CHECK(JsonScanner::scanString(withTab.data(), withTab.data() + withTab.size(), &contents,
+      &hasEscapes) == nullptr);
+}
+
 namespace {
 bool tryGetPathMaster(std::shared_ptr<PathMaster> *result, const FailFrame &ff) {
   return TestUtil::tryGetPathMaster("misc", result, ff.nest(HERE));
 }
+
+void checkScannerAgrees(const std::string &record) {
+  INFO(record);
+  FailRoot expectedFr(true);
+  FailRoot actualFr(true);
+  LogRecord expected;
+  LogRecord actual;
+  ParseContext ctx(record);
+  auto expectedOk = tryParseJson(&ctx, &expected, expectedFr.nest(HERE));
+  auto actualOk = LogRecordScanner::tryParse(record, &actual, actualFr.nest(HERE));
+  CHECK(expectedOk == actualOk);
+  if (expectedOk && actualOk) {
+    CHECK(toString(expected) == toString(actual));
+  }
+}
+
+void checkBatchEntry(const LogRecordBatch &batch, size_t i, const std::string &record,
+    size_t offset) {
+  INFO(record);
+  FailRoot fr;
+  auto [isZgram, index] = batch.order()[i];
+  LogRecord expected;
+  ParseContext ctx(record);
+  if (!tryParseJson(&ctx, &expected, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+  if (isZgram) {
+    Zephyrgram zg;
+    if (!batch.tryDecodeZgram(index, &zg, fr.nest(HERE))) {
+      FAIL(fr);
+    }
+    CHECK(toString(expected) == toString(LogRecord(std::move(zg))));
+    CHECK(batch.zgrams().locations_[index].offset() == offset);
+    CHECK(batch.zgrams().locations_[index].size() == record.size());
+  } else {
+    const auto &[mdr, location] = batch.metadata()[index];
+    CHECK(toString(std::get<MetadataRecord>(expected.payload())) == toString(mdr));
+    CHECK(location.offset() == offset);
+  }
+}
 }  // namespace
 }  // namespace z2kplus::backend::test
@@ -0,0 +1,167 @@
+// Copyright 2023 The Z2K Plus+ Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+#include "catch/catch.hpp"
+#include "kosak/coding/coding.h"
+#include "kosak/coding/failures.h"
+#include "z2kplus/backend/files/path_master.h"
+#include "z2kplus/backend/queryparsing/planner.h"
+#include "z2kplus/backend/reverse_index/fields.h"
+#include "z2kplus/backend/reverse_index/index/consolidated_index.h"
+#include "z2kplus/backend/reverse_index/iterators/boundary/word_adaptor.h"
+#include "z2kplus/backend/reverse_index/iterators/iterator_common.h"
+#include "z2kplus/backend/reverse_index/iterators/word/pattern.h"
+#include "z2kplus/backend/reverse_index/iterators/zgram/and.h"
+#include "z2kplus/backend/reverse_index/iterators/zgram/metadata/having_reaction.h"
+#include "z2kplus/backend/reverse_index/iterators/zgram/not.h"
+#include "z2kplus/backend/shared/magic_constants.h"
+#include "z2kplus/backend/test/util/test_util.h"
+#include "z2kplus/backend/util/automaton/automaton.h"
+
+using kosak::coding::FailFrame;
+using kosak::coding::FailRoot;
+using kosak::coding::toString;
+using z2kplus::backend::files::PathMaster;
+using z2kplus::backend::queryparsing::QueryPlanner;
+using z2kplus::backend::reverse_index::FieldMask;
+using z2kplus::backend::reverse_index::index::ConsolidatedIndex;
+using z2kplus::backend::reverse_index::iterators::And;
+using z2kplus::backend::reverse_index::iterators::Not;
+using z2kplus::backend::reverse_index::iterators::ZgramIterator;
+using z2kplus::backend::reverse_index::iterators::boundary::WordAdaptor;
+using z2kplus::backend::reverse_index::iterators::word::Pattern;
+using z2kplus::backend::reverse_index::iterators::zgram::metadata::HavingReaction;
+using z2kplus::backend::test::util::TestUtil;
+using z2kplus::backend::util::automaton::FiniteAutomaton;
+
+namespace magicConstants = z2kplus::backend::shared::magicConstants;
+
+#define HERE KOSAK_CODING_HERE
+
+namespace z2kplus::backend::test {
+
+namespace {
+bool trySetup(ConsolidatedIndex *ci, const FailFrame &ff);
+bool tryMakeKosak(std::unique_ptr<ZgramIterator> *result, const FailFrame &ff);
+}  // namespace
+
+TEST_CASE("planner: rarest child goes first","[planner]") {
+  FailRoot fr;
+  ConsolidatedIndex ci;
+  std::unique_ptr<ZgramIterator> kosak;
+  if (!trySetup(&ci, fr.nest(HERE)) ||
+      !tryMakeKosak(&kosak, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+
+  std::vector<std::unique_ptr<ZgramIterator>> children;
+  children.push_back(std::move(kosak));
+  children.push_back(HavingReaction::create("no such reaction"));
+  std::string explanation;
+  auto planned = QueryPlanner(ci).plan(And::create(std::move(children)), &explanation);
+  auto text = toString(*planned);
+  INFO(text);
+  INFO(explanation);
+  CHECK(text.find("And([HavingReaction(") == 0);
+  CHECK(explanation.find("And [size=0, ") == 0);
+  CHECK(explanation.find("  HavingReaction(no such reaction) [size=0, cost=0]") != std::string::npos);
+}
+
+TEST_CASE("planner: duplicates are removed","[planner]") {
+  FailRoot fr;
+  ConsolidatedIndex ci;
+  std::unique_ptr<ZgramIterator> kosak1;
+  std::unique_ptr<ZgramIterator> kosak2;
+  if (!trySetup(&ci, fr.nest(HERE)) ||
+      !tryMakeKosak(&kosak1, fr.nest(HERE)) ||
+      !tryMakeKosak(&kosak2, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+  auto expected = toString(*kosak1);
+
+  std::vector<std::unique_ptr<ZgramIterator>> children;
+  children.push_back(std::move(kosak1));
+  children.push_back(std::move(kosak2));
+  auto planned = QueryPlanner(ci).plan(And::create(std::move(children)), nullptr);
+  CHECK(toString(*planned) == expected);
+  if (!TestUtil::fourWaySearchTest("kosak", ci, planned.get(), 5, {4, 50, 63, 70, 71}, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+}
+
+TEST_CASE("planner: x and not x matches nothing","[planner]") {
+  FailRoot fr;
+  ConsolidatedIndex ci;
+  std::unique_ptr<ZgramIterator> kosak1;
+  std::unique_ptr<ZgramIterator> kosak2;
+  if (!trySetup(&ci, fr.nest(HERE)) ||
+      !tryMakeKosak(&kosak1, fr.nest(HERE)) ||
+      !tryMakeKosak(&kosak2, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+
+  std::vector<std::unique_ptr<ZgramIterator>> children;
+  children.push_back(std::move(kosak1));
+  children.push_back(Not::create(std::move(kosak2)));
+  auto planned = QueryPlanner(ci).plan(And::create(std::move(children)), nullptr);
+  CHECK(planned->matchesNothing());
+}
+
+TEST_CASE("planner: size estimates give up on long trie walks","[planner]") {
+  FailRoot fr;
+  ConsolidatedIndex ci;
+  FiniteAutomaton kosak;
+  FiniteAutomaton anything;
+  if (!trySetup(&ci, fr.nest(HERE)) ||
+      !TestUtil::tryMakeDfa("kosak", &kosak, fr.nest(HERE)) ||
+      !TestUtil::tryMakeDfa("*", &anything, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+  size_t numKosaks;
+  size_t numWords;
+  size_t unused;
+  CHECK(ci.tryCountMatching(kosak, magicConstants::maxEstimateTrieNodes, &numKosaks));
+  CHECK(numKosaks > 0);
+  CHECK(ci.tryCountMatching(anything, std::numeric_limits<size_t>::max(), &numWords));
+  CHECK(numWords > numKosaks);
+  CHECK(!ci.tryCountMatching(anything, 2, &unused));
+
+  // A pattern whose walk is cut short gets the trivial estimate.
+  auto cheap = Pattern::create(std::move(kosak), FieldMask::body);
+  auto expensive = Pattern::create(std::move(anything), FieldMask::body);
+  CHECK(cheap->estimateSize(ci) == numKosaks);
+  CHECK(expensive->estimateSize(ci) <= ci.wordInfoSize());
+}
+
+namespace {
+bool trySetup(ConsolidatedIndex *ci, const FailFrame &ff) {
+  std::shared_ptr<PathMaster> pm;
+  return TestUtil::tryGetPathMaster("planner", &pm, ff.nest(HERE)) &&
+      TestUtil::trySetupConsolidatedIndex(std::move(pm), ci, ff.nest(HERE));
+}
+
+bool tryMakeKosak(std::unique_ptr<ZgramIterator> *result, const FailFrame &ff) {
+  FiniteAutomaton dfa;
+  if (!TestUtil::tryMakeDfa("kosak", &dfa, ff.nest(HERE))) {
+    return false;
+  }
+  *result = WordAdaptor::create(Pattern::create(std::move(dfa), FieldMask::body));
+  return true;
+}
+}  // namespace
+}  // namespace z2kplus::backend::test
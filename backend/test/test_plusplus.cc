@@ -12,18 +12,23 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
+#include <vector>
 #include "catch/catch.hpp"
 #include "kosak/coding/coding.h"
 #include "kosak/coding/failures.h"
 #include "z2kplus/backend/files/path_master.h"
 #include "z2kplus/backend/reverse_index/index/consolidated_index.h"
+#include "z2kplus/backend/reverse_index/metadata/plusplus_counter.h"
 #include "z2kplus/backend/test/util/test_util.h"
 
 using kosak::coding::FailFrame;
 using kosak::coding::FailRoot;
 using z2kplus::backend::files::PathMaster;
 using z2kplus::backend::reverse_index::index::ConsolidatedIndex;
+using z2kplus::backend::reverse_index::metadata::PlusPlusCounter;
 using z2kplus::backend::test::util::TestUtil;
+using z2kplus::backend::util::frozen::frozenStringRef_t;
 
 namespace zgMetadata = z2kplus::backend::shared::zgMetadata;
 
@@ -54,6 +59,103 @@ TEST_CASE("plusplus: check counts","[plusplus]") {
   CHECK(0 == ci.getPlusPlusCountAfter(zgramId, "C"));
 }
 
+TEST_CASE("plusplus: batch counts agree with single counts","[plusplus]") {
+  FailRoot fr;
+  std::shared_ptr<PathMaster> pm;
+  ConsolidatedIndex ci;
+  if (!getPathMaster(&pm, fr.nest(HERE)) ||
+      !TestUtil::trySetupConsolidatedIndex(pm, &ci, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+
+  std::vector<ZgramId> zgramIds;
+  for (uint64_t i = 40; i != 80; ++i) {
+    zgramIds.emplace_back(i);
+  }
+  std::vector<int64_t> counts(zgramIds.size());
+  ci.getPlusPlusCountsAfter("kosak", zgramIds.data(), zgramIds.size(), counts.data());
+  for (size_t i = 0; i != zgramIds.size(); ++i) {
+    INFO("zgramId " << zgramIds[i]);
+    CHECK(counts[i] == ci.getPlusPlusCountAfter(zgramIds[i], "kosak"));
+  }
+}
+
+// A delta for an older zgram (e.g. from an edit) lands in the middle of the series.
+TEST_CASE("plusplus: counter handles out-of-order deltas","[plusplus]") {
+  PlusPlusCounter counter;
+  const ConsolidatedIndex::plusPlusKeyId_t kosak = 3;
+  const ConsolidatedIndex::plusPlusKeyId_t nobody = 7;
+  counter.add(kosak, ZgramId(10), 1);
+  counter.add(kosak, ZgramId(30), 1);
+  counter.add(kosak, ZgramId(20), -1);
+  counter.add(kosak, ZgramId(30), 1);
+  counter.add(kosak, ZgramId(5), 0);
+
+  CHECK(0 == counter.countAfter(kosak, ZgramId(9)));
+  CHECK(1 == counter.countAfter(kosak, ZgramId(10)));
+  CHECK(0 == counter.countAfter(kosak, ZgramId(20)));
+  CHECK(2 == counter.countAfter(kosak, ZgramId(30)));
+  CHECK(2 == counter.countAfter(kosak, ZgramId(1000)));
+  CHECK(0 == counter.countAfter(nobody, ZgramId(1000)));
+}
+
+// The running totals laid out by the builder agree with the ++ and -- zgrams they came from.
+TEST_CASE("plusplus: frozen counts agree with the frozen ++ and --","[plusplus]") {
+  FailRoot fr;
+  std::shared_ptr<PathMaster> pm;
+  ConsolidatedIndex ci;
+  if (!getPathMaster(&pm, fr.nest(HERE)) ||
+      !TestUtil::trySetupConsolidatedIndex(pm, &ci, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+  const auto &metadata = ci.frozenIndex().metadata();
+  const auto &counts = metadata.plusPlusCounts();
+  REQUIRE(counts.size() != 0);
+  auto countUpTo = [](const auto &map, frozenStringRef_t key, ZgramId zgramId) -> int64_t {
+    auto ip = map.find(key);
+    if (ip == map.end()) {
+      return 0;
+    }
+    return std::upper_bound(ip->second.begin(), ip->second.end(), zgramId) - ip->second.begin();
+  };
+  for (const auto &[key, frozen] : counts) {
+    const auto &ids = frozen.zgramIds();
+    REQUIRE(ids.size() == frozen.cumulative().size());
+    for (size_t i = 0; i != ids.size(); ++i) {
+      INFO("zgramId " << ids[i]);
+      CHECK((i == 0 || ids[i - 1] < ids[i]));
+      auto expected = countUpTo(metadata.plusPluses(), key, ids[i]) -
+          countUpTo(metadata.minusMinuses(), key, ids[i]);
+      CHECK(frozen.cumulative()[i] == expected);
+    }
+  }
+}
+
+// Every key round-trips through its id, and the id-keyed queries agree with the string-keyed ones.
+TEST_CASE("plusplus: key dictionary","[plusplus]") {
+  FailRoot fr;
+  std::shared_ptr<PathMaster> pm;
+  ConsolidatedIndex ci;
+  if (!getPathMaster(&pm, fr.nest(HERE)) ||
+      !TestUtil::trySetupConsolidatedIndex(pm, &ci, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+  const auto &keys = ci.plusPlusKeys();
+  ConsolidatedIndex::plusPlusKeyId_t kosak;
+  REQUIRE(keys.tryFind("kosak", &kosak));
+  CHECK(keys.toStringView(kosak) == "kosak");
+  CHECK(3 == ci.getPlusPlusCountAfter(ZgramId(70), kosak));
+
+  for (ConsolidatedIndex::plusPlusKeyId_t id = 0; id != keys.size(); ++id) {
+    ConsolidatedIndex::plusPlusKeyId_t found;
+    CHECK(keys.tryFind(keys.toStringView(id), &found));
+    CHECK(found == id);
+  }
+
+  ConsolidatedIndex::plusPlusKeyId_t unknown;
+  CHECK(!keys.tryFind("no-such-key-anywhere", &unknown));
+}
+
 namespace {
 bool getPathMaster(std::shared_ptr<PathMaster> *result, const FailFrame &ff) {
   return TestUtil::tryGetPathMaster("plusplus", result, ff.nest(HERE));
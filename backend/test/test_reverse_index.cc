@@ -12,6 +12,8 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <chrono>
+#include <limits>
 #include <list>
 #include <memory>
 #include <string>
@@ -28,8 +30,11 @@
 #include "z2kplus/backend/reverse_index/iterators/zgram/metadata/having_reaction.h"
 #include "z2kplus/backend/reverse_index/iterators/boundary/near.h"
 #include "z2kplus/backend/reverse_index/iterators/zgram/not.h"
+#include "z2kplus/backend/reverse_index/iterators/zgram/or.h"
 #include "z2kplus/backend/reverse_index/iterators/word/pattern.h"
 #include "z2kplus/backend/reverse_index/iterators/boundary/word_adaptor.h"
+#include "z2kplus/backend/shared/magic_constants.h"
+#include "z2kplus/backend/shared/profile.h"
 #include "z2kplus/backend/shared/zephyrgram.h"
 #include "z2kplus/backend/test/util/test_util.h"
 #include "z2kplus/backend/util/automaton/automaton.h"
@@ -38,24 +43,35 @@ using kosak::coding::FailFrame;
 using kosak::coding::FailRoot;
 using kosak::coding::memory::MappedFile;
 using kosak::coding::stringf;
+using z2kplus::backend::shared::Profile;
+using z2kplus::backend::shared::RenderStyle;
 using z2kplus::backend::shared::Zephyrgram;
+using z2kplus::backend::shared::ZgramCore;
 using z2kplus::backend::reverse_index::index::ConsolidatedIndex;
+using z2kplus::backend::reverse_index::index::TrieWalkPosition;
 using z2kplus::backend::reverse_index::FieldMask;
 using z2kplus::backend::files::PathMaster;
 using z2kplus::backend::reverse_index::WordInfo;
+using z2kplus::backend::reverse_index::wordOff_t;
 using z2kplus::backend::reverse_index::zgramOff_t;
 using z2kplus::backend::reverse_index::iterators::boundary::Near;
 using z2kplus::backend::reverse_index::iterators::boundary::WordAdaptor;
 using z2kplus::backend::reverse_index::iterators::Anchored;
 using z2kplus::backend::reverse_index::iterators::And;
+using z2kplus::backend::reverse_index::iterators::IteratorContext;
 using z2kplus::backend::reverse_index::iterators::Not;
+using z2kplus::backend::reverse_index::iterators::Or;
+using z2kplus::backend::reverse_index::iterators::QueryBudget;
 using z2kplus::backend::reverse_index::iterators::WordIterator;
 using z2kplus::backend::reverse_index::iterators::ZgramIterator;
+using z2kplus::backend::reverse_index::iterators::ZgramIteratorState;
+using z2kplus::backend::reverse_index::iterators::zgramRel_t;
 using z2kplus::backend::reverse_index::iterators::zgram::metadata::HavingReaction;
 using z2kplus::backend::reverse_index::iterators::word::Pattern;
 using z2kplus::backend::shared::ZgramId;
 using z2kplus::backend::test::util::TestUtil;
 using z2kplus::backend::util::automaton::FiniteAutomaton;
+namespace magicConstants = z2kplus::backend::shared::magicConstants;
 
 #define HERE KOSAK_CODING_HERE
 
@@ -288,6 +304,120 @@ bool makeThisManyAdjacentThes(size_t numThes, FieldMask fieldMask,
 }
 }  // namespace
 
+// Evaluate "sender:kosak or not all:kosak" under a tiny postings budget. Every time the budget trips
+// we throw away the iterator state and resume just past the last item we received, like Subscription
+// does. The end result should be the same as an unbudgeted evaluation.
+TEST_CASE("reverse_index: budgeted evaluation resumes correctly", "[reverse_index]") {
+  FailRoot fr;
+  std::shared_ptr<PathMaster> pm;
+  ConsolidatedIndex ci;
+  FiniteAutomaton kosak1Dfa;
+  FiniteAutomaton kosak2Dfa;
+  if (!getPathMaster(&pm, fr.nest(HERE)) ||
+    !TestUtil::trySetupConsolidatedIndex(std::move(pm), &ci, fr.nest(HERE)) ||
+    !TestUtil::tryMakeDfa("kosak", &kosak1Dfa, fr.nest(HERE)) ||
+    !TestUtil::tryMakeDfa("kosak", &kosak2Dfa, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+
+  auto adapted1 = WordAdaptor::create(Pattern::create(std::move(kosak1Dfa), FieldMask::sender));
+  auto adapted2 = WordAdaptor::create(Pattern::create(std::move(kosak2Dfa), FieldMask::all));
+  std::vector<std::unique_ptr<ZgramIterator>> children;
+  children.push_back(std::move(adapted1));
+  children.push_back(Not::create(std::move(adapted2)));
+  auto iterator = Or::create(std::move(children));
+
+  auto evaluate = [&ci, &iterator](bool useBudget, size_t *numTrips) {
+    std::vector<zgramRel_t> result;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::hours(1);
+    std::unique_ptr<ZgramIteratorState> state;
+    zgramRel_t resumeFrom;
+    size_t maxPostings = 1;
+    *numTrips = 0;
+    while (true) {
+      QueryBudget budget(deadline, maxPostings);
+      IteratorContext ctx(ci, true, useBudget ? &budget : nullptr);
+      if (state == nullptr) {
+        state = iterator->createState(ctx);
+      }
+      zgramRel_t buffer[3];
+      auto size = iterator->getMore(ctx, state.get(), resumeFrom, buffer, STATIC_ARRAYSIZE(buffer));
+      result.insert(result.end(), buffer, buffer + size);
+      if (size != 0) {
+        resumeFrom = buffer[size - 1].addRaw(1);
+      }
+      if (budget.tripped()) {
+        ++*numTrips;
+        state.reset();
+        // Like Subscription, double the budget if we made no progress.
+        maxPostings = size != 0 ? 1 : maxPostings * 2;
+        continue;
+      }
+      if (size == 0) {
+        return result;
+      }
+    }
+  };
+
+  size_t unbudgetedTrips;
+  size_t budgetedTrips;
+  auto expected = evaluate(false, &unbudgetedTrips);
+  auto actual = evaluate(true, &budgetedTrips);
+  CHECK(unbudgetedTrips == 0);
+  CHECK(budgetedTrips != 0);
+  CHECK(expected == actual);
+}
+
+// A trie walk that is stopped every few nodes and resumed each time should report exactly what an
+// uninterrupted walk does.
+TEST_CASE("reverse_index: trie walk resumes where it stopped", "[reverse_index]") {
+  FailRoot fr;
+  std::shared_ptr<PathMaster> pm;
+  ConsolidatedIndex ci;
+  if (!getPathMaster(&pm, fr.nest(HERE)) ||
+      !TestUtil::trySetupConsolidatedIndex(std::move(pm), &ci, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+
+  for (const char *pattern : {"*a*", "k*", "kosak", "*"}) {
+    INFO(pattern);
+    FiniteAutomaton dfa;
+    if (!TestUtil::tryMakeDfa(pattern, &dfa, fr.nest(HERE))) {
+      FAIL(fr);
+    }
+    typedef std::vector<std::pair<const wordOff_t *, const wordOff_t *>> spans_t;
+    auto walk = [&ci, &dfa](size_t nodesPerStep, size_t *numStops) {
+      spans_t result;
+      auto cb = [&result](const wordOff_t *begin, const wordOff_t *end) {
+        result.emplace_back(begin, end);
+      };
+      TrieWalkPosition position;
+      *numStops = 0;
+      while (true) {
+        size_t nodesLeft = nodesPerStep;
+        auto outOfBudget = [&nodesLeft]() {
+          if (nodesLeft == 0) {
+            return true;
+          }
+          --nodesLeft;
+          return false;
+        };
+        if (ci.tryFindMatching(dfa, &outOfBudget, &position, &cb)) {
+          return result;
+        }
+        ++*numStops;
+      }
+    };
+    size_t unbudgetedStops;
+    size_t budgetedStops;
+    auto expected = walk(std::numeric_limits<size_t>::max(), &unbudgetedStops);
+    auto actual = walk(3, &budgetedStops);
+    CHECK(unbudgetedStops == 0);
+    CHECK(budgetedStops != 0);
+    CHECK(expected == actual);
+  }
+}
+
 // Searching for "the", "the the", etc, up to six "thes"
 TEST_CASE("reverse_index: various 'the's", "[reverse_index]") {
   FailRoot fr;
@@ -320,6 +450,138 @@ TEST_CASE("reverse_index: various 'the's", "[reverse_index]") {
   }
 }
 
+namespace {
+bool makeNear(const std::vector<std::string> &words, size_t margin, Near::Strategy strategy,
+    std::unique_ptr<ZgramIterator> *result, const FailFrame &ff) {
+  std::vector<std::unique_ptr<WordIterator>> children;
+  for (const auto &word : words) {
+    FiniteAutomaton dfa;
+    if (!TestUtil::tryMakeDfa(word, &dfa, ff.nest(HERE))) {
+      return false;
+    }
+    children.push_back(Pattern::create(std::move(dfa), FieldMask::all));
+  }
+  *result = Near::create(margin, std::move(children), strategy);
+  return true;
+}
+
+std::vector<zgramRel_t> evaluateAll(const ConsolidatedIndex &ci, const ZgramIterator &iterator,
+    bool forward) {
+  std::vector<zgramRel_t> result;
+  IteratorContext ctx(ci, forward);
+  auto state = iterator.createState(ctx);
+  zgramRel_t buffer[3];
+  while (true) {
+    auto size = iterator.getMore(ctx, state.get(), zgramRel_t(0), buffer, STATIC_ARRAYSIZE(buffer));
+    if (size == 0) {
+      return result;
+    }
+    result.insert(result.end(), buffer, buffer + size);
+  }
+}
+
+const std::vector<std::vector<std::string>> &nearQueries() {
+  static const std::vector<std::vector<std::string>> queries = {
+      {"the", "the"},
+      {"the", "the", "the"},
+      {"you", "jealous"},
+      {"jealous", "you"},
+      {"the", "zamboni"},
+      {"kosak", "the"},
+      {"the", "*", "the"},
+      {"^this", "is"},
+  };
+  return queries;
+}
+}  // namespace
+
+// The rarest-first strategy should find exactly what the lockstep strategy finds, for exact phrases
+// and for wider margins, in both directions.
+TEST_CASE("reverse_index: near strategies agree", "[reverse_index]") {
+  FailRoot fr;
+  std::shared_ptr<PathMaster> pm;
+  ConsolidatedIndex ci;
+  if (!getPathMaster(&pm, fr.nest(HERE)) ||
+      !TestUtil::trySetupConsolidatedIndex(pm, &ci, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+  for (const auto &words : nearQueries()) {
+    for (size_t margin = 1; margin <= 4; ++margin) {
+      std::unique_ptr<ZgramIterator> lockstep;
+      std::unique_ptr<ZgramIterator> rarestFirst;
+      if (!makeNear(words, margin, Near::Strategy::Lockstep, &lockstep, fr.nest(HERE)) ||
+          !makeNear(words, margin, Near::Strategy::RarestFirst, &rarestFirst, fr.nest(HERE))) {
+        FAIL(fr);
+      }
+      for (bool forward : {true, false}) {
+        INFO(stringf("%o margin=%o forward=%o", *lockstep, margin, forward));
+        CHECK(evaluateAll(ci, *lockstep, forward) == evaluateAll(ci, *rarestFirst, forward));
+      }
+    }
+  }
+}
+
+// Not run by default. Use the "[benchmark]" tag to run it. The test corpus is tiny, so we pad it out
+// with a few thousand zgrams made mostly of common words, in which "house" is comparatively rare.
+TEST_CASE("reverse_index: near strategies benchmark", "[.][benchmark]") {
+  FailRoot fr;
+  std::shared_ptr<PathMaster> pm;
+  ConsolidatedIndex ci;
+  if (!getPathMaster(&pm, fr.nest(HERE)) ||
+      !TestUtil::trySetupConsolidatedIndex(pm, &ci, fr.nest(HERE))) {
+    FAIL(fr);
+  }
+  const char *commonWords[] = {"in", "the", "of", "and", "a", "to", "is", "it"};
+  std::vector<ZgramCore> zgcs;
+  uint32_t seed = 12345;
+  for (size_t i = 0; i < 5000; ++i) {
+    std::string body;
+    for (size_t j = 0; j < 40; ++j) {
+      seed = seed * 1103515245 + 12345;
+      auto which = (seed >> 16) % (STATIC_ARRAYSIZE(commonWords) * 25);
+      body += which < STATIC_ARRAYSIZE(commonWords) * 24 ? commonWords[which % STATIC_ARRAYSIZE(commonWords)] : "house";
+      body += ' ';
+    }
+    zgcs.emplace_back("benchmark", std::move(body), RenderStyle::Default);
+  }
+  Profile profile("kosak", "Corey Kosak");
+  ConsolidatedIndex::ppDeltaMap_t deltaMap;
+  std::vector<Zephyrgram> zgrams;
+  if (!ci.tryAddZgrams(std::chrono::system_clock::now(), profile, std::move(zgcs), &deltaMap, &zgrams,
+      fr.nest(HERE))) {
+    FAIL(fr);
+  }
+
+  const std::vector<std::vector<std::string>> queries = {
+      {"in", "the", "house"},
+      {"the", "house", "of"},
+      {"of", "the"},
+      {"the", "*", "the"},
+  };
+  const size_t numIterations = 50;
+  const char *strategyNames[] = {"auto", "lockstep", "rarest-first"};
+  for (const auto &words : queries) {
+    for (size_t margin : {(size_t)1, magicConstants::nearMargin}) {
+      for (auto strategy : {Near::Strategy::Lockstep, Near::Strategy::RarestFirst, Near::Strategy::Auto}) {
+        std::unique_ptr<ZgramIterator> iterator;
+        if (!makeNear(words, margin, strategy, &iterator, fr.nest(HERE))) {
+          FAIL(fr);
+        }
+        size_t numResults = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < numIterations; ++i) {
+          numResults = evaluateAll(ci, *iterator, true).size();
+        }
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        auto usPerQuery = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count() /
+            (double)numIterations;
+        warn("%o %o: %o results, %o us/query", *iterator,
+            strategyNames[(size_t)strategy], numResults, usPerQuery);
+      }
+    }
+  }
+}
+
 // Searching for havingreaction("👎")
 TEST_CASE("reverse_index: havingreaction('👎')", "[reverse_index]") {
   FailRoot fr;
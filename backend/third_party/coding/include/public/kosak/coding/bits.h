@@ -49,6 +49,21 @@ inline size_t findFirstSet(unsigned long long bitset) {
   return __builtin_ctzll(bitset);
 }
 
+inline size_t findLastSet(unsigned int bitset) {
+  myassert(bitset != 0);
+  return 8 * sizeof(bitset) - 1 - __builtin_clz(bitset);
+}
+
+inline size_t findLastSet(unsigned long bitset) {
+  myassert(bitset != 0);
+  return 8 * sizeof(bitset) - 1 - __builtin_clzl(bitset);
+}
+
+inline size_t findLastSet(unsigned long long bitset) {
+  myassert(bitset != 0);
+  return 8 * sizeof(bitset) - 1 - __builtin_clzll(bitset);
+}
+
 // Removes the lowest bit from 'bitSet' and returns its index. If *bitSet is all-zero, the results
 // are undefined.
 inline size_t removeLowestBit(unsigned int *bitSet) {
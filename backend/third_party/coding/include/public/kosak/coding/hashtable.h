@@ -105,6 +105,10 @@ public:
   template<typename Key>
   slot_t findSlot(const Key &key);
 
+  // Lookup only. Returns nullptr if 'key' is not present (or if the table was never created).
+  template<typename Key>
+  const Entry *tryFind(const Key &key) const;
+
   bool tryFinishInsert(internal::Slot<Entry> *slot, const FailFrame &ff);
 
   iterator_t iterator() { return iterator_t(this, -1, false); }
@@ -120,7 +124,7 @@ private:
   bool tryRehash(const FailFrame &ff);
 
   template<typename Key>
-  std::pair<size_t, size_t> calculateIndexAndDelta(const Key &key);
+  std::pair<size_t, size_t> calculateIndexAndDelta(const Key &key) const;
 
   std::unique_ptr<Entry[]> entries_;
 
@@ -211,6 +215,28 @@ internal::Slot<Entry> Hashtable<Entry, Utils>::findSlot(const Key &key) {
   }
 }
 
+template<typename Entry, typename Utils>
+template<typename Key>
+const Entry *Hashtable<Entry, Utils>::tryFind(const Key &key) const {
+  if (capacity() == 0) {
+    return nullptr;
+  }
+  auto id = calculateIndexAndDelta(key);
+  auto index = id.first;
+  auto delta = id.second;
+
+  while (true) {
+    const Entry *entry = &entries_[index];
+    if (!Utils::isValid(*entry)) {
+      return nullptr;
+    }
+    if (Utils::equal(*entry, key)) {
+      return entry;
+    }
+    index = (index + delta) % capacity();
+  }
+}
+
 template<typename Entry, typename Utils>
 bool Hashtable<Entry, Utils>::tryFinishInsert(internal::Slot<Entry> *slot,
     const FailFrame &ff) {
@@ -242,7 +268,7 @@ bool Hashtable<Entry, Utils>::tryRehash(const FailFrame &ff) {
 
 template<typename Entry, typename Utils>
 template<typename Key>
-inline std::pair<size_t, size_t> Hashtable<Entry, Utils>::calculateIndexAndDelta(const Key &key) {
+inline std::pair<size_t, size_t> Hashtable<Entry, Utils>::calculateIndexAndDelta(const Key &key) const {
   auto id = Utils::hash(key);
   id.first %= capacity();  // index
   id.second %= capacity();  // delta
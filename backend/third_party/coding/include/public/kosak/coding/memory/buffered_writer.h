@@ -17,6 +17,35 @@
 #include "kosak/coding/unix.h"
 
 namespace kosak::coding::memory {
+// An optional per-thread hook that is told about writes before they happen, so that it can pace
+// them. BufferedWriter consults the calling thread's current throttle before each flush.
+class WriteThrottle {
+public:
+  WriteThrottle() = default;
+  DISALLOW_MOVE_COPY_AND_ASSIGN(WriteThrottle);
+  virtual ~WriteThrottle() = default;
+
+  // May block.
+  virtual void beforeWrite(size_t bytes) = 0;
+
+  // The calling thread's throttle, or nullptr.
+  static WriteThrottle *current() { return current_; }
+
+  // Installs a throttle (possibly nullptr) on the calling thread for the lifetime of the Scope.
+  class Scope {
+  public:
+    explicit Scope(WriteThrottle *throttle) : saved_(current_) { current_ = throttle; }
+    DISALLOW_MOVE_COPY_AND_ASSIGN(Scope);
+    ~Scope() { current_ = saved_; }
+
+  private:
+    WriteThrottle *saved_ = nullptr;
+  };
+
+private:
+  static thread_local WriteThrottle *current_;
+};
+
 class BufferedWriter {
   typedef kosak::coding::FailFrame FailFrame;
   static constexpr size_t highWaterMark = 16384;
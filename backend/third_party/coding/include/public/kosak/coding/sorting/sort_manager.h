@@ -30,6 +30,8 @@ struct SortOptions {
   bool unique_ = false;
   char fieldSeparator_ = 0;
   bool lineSeparatorIsNul_ = false;
+  // Passed as --buffer-size, if nonzero. Otherwise sort picks its own.
+  size_t bufferSize_ = 0;
 };
 
 struct KeyOptions {
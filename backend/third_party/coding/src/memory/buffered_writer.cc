@@ -17,6 +17,8 @@
 #define HERE KOSAK_CODING_HERE
 
 namespace kosak::coding::memory {
+thread_local WriteThrottle *WriteThrottle::current_ = nullptr;
+
 BufferedWriter::BufferedWriter() = default;
 BufferedWriter::BufferedWriter(BufferedWriter &&) noexcept = default;
 BufferedWriter &BufferedWriter::operator=(BufferedWriter &&) noexcept = default;
@@ -49,6 +51,9 @@ bool BufferedWriter::tryMaybeFlush(bool force, const FailFrame &ff) {
   if (!force && buffer_.size() < highWaterMark) {
     return true;
   }
+  if (auto *throttle = WriteThrottle::current(); throttle != nullptr && !buffer_.empty()) {
+    throttle->beforeWrite(buffer_.size());
+  }
   if (!nsunix::tryWriteAll(fc_.get(), buffer_.data(), buffer_.size(), ff.nest(HERE))) {
     return false;
   }
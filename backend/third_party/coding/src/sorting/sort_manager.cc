@@ -71,6 +71,9 @@ bool SortManager::tryCreate(const SortOptions &sortOptions, const std::vector<Ke
   if (sortOptions.lineSeparatorIsNul_) {
     args.emplace_back("--zero-terminated");
   }
+  if (sortOptions.bufferSize_ != 0) {
+    args.push_back(stringf("--buffer-size=%ob", sortOptions.bufferSize_));
+  }
 
   for (const auto &ko : keyOptions) {
     args.emplace_back("--key");
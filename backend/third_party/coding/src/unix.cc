@@ -279,7 +279,7 @@ bool tryWritevAll(int fd, struct iovec *iovecs, size_t numIovecs, const FailFram
         break;
       }
       auto &iov = iovecs[i];
-      auto amountToAdvance = std::min(uresult, iov.iov_len);
+      auto amountToAdvance = std::min(static_cast<size_t>(result), iov.iov_len);
       iov.iov_base = static_cast<void*>(static_cast<char*>(iov.iov_base) + amountToAdvance);
       iov.iov_len -= amountToAdvance;
       result -= amountToAdvance;